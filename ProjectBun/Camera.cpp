@@ -21,10 +21,18 @@ namespace gps {
 
 	}
 
+	CullingView Camera::getFrustum(const glm::mat4& projection) {
+		return makeCullingView(projection * getViewMatrix(), cameraPosition, glm::mat4(1.0f));
+	}
+
 	glm::vec3 Camera::getCameraTarget() {
 		return cameraTarget;
 	}
 
+	glm::vec3 Camera::getCameraPosition() {
+		return cameraPosition;
+	}
+
 	//update the camera internal parameters following a camera move event
 	void Camera::move(MOVE_DIRECTION direction, float speed) {
 		//TODO
@@ -4,6 +4,8 @@
 #include <glm/glm.hpp>
 #include <glm/gtx/transform.hpp>
 
+#include "Meshlets.hpp"
+
 
 #include <string>
 
@@ -18,6 +20,8 @@ namespace gps {
         Camera(glm::vec3 cameraPosition, glm::vec3 cameraTarget, glm::vec3 cameraUp);
         //return the view matrix, using the glm::lookAt() function
         glm::mat4 getViewMatrix();
+        //return the planes of the view frustum in world space, for culling
+        CullingView getFrustum(const glm::mat4& projection);
         //update the camera internal parameters following a camera move event
         void move(MOVE_DIRECTION direction, float speed);
         //update the camera internal parameters following a camera rotate event
@@ -25,6 +29,7 @@ namespace gps {
         //pitch - camera rotation around the x axis
         void rotate(float pitch, float yaw);
         glm::vec3 getCameraTarget();
+        glm::vec3 getCameraPosition();
         
     private:
         glm::vec3 cameraPosition;
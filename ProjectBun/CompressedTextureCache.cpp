@@ -0,0 +1,166 @@
+#include "CompressedTextureCache.hpp"
+#include "FileUtils.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+namespace gps {
+
+	namespace {
+
+		// Bump whenever the layout or the encoders' output changes
+		const uint32_t CACHE_VERSION = 1;
+		const char CACHE_MAGIC[8] = { 'G', 'P', 'S', 'T', 'E', 'X', 0, 0 };
+		const size_t LEVEL_ALIGNMENT = 16;
+		const uint32_t MAX_LEVELS = 32;
+
+		struct TextureFileHeader {
+			char magic[8];
+			uint32_t version;
+			uint32_t compression;
+			uint32_t format;
+			uint32_t width;
+			uint32_t height;
+			uint32_t levelCount;
+			uint64_t sourceSize;
+			int64_t sourceModificationTime;
+			uint64_t sourceHash;
+			uint64_t dataChecksum;
+		};
+
+		struct LevelIndex {
+			uint64_t byteOffset;
+			uint64_t byteLength;
+		};
+
+		size_t alignUp(size_t value, size_t alignment)
+		{
+			return (value + alignment - 1) & ~(alignment - 1);
+		}
+
+		size_t levelSize(BlockFormat format, uint32_t width, uint32_t height)
+		{
+			return (size_t)((width + 3) / 4) * ((height + 3) / 4) * blockSize(format);
+		}
+	}
+
+	std::string CompressedTextureCache::pathFor(const std::string& imageFileName)
+	{
+		return imageFileName + ".texcache";
+	}
+
+	bool CompressedTextureCache::write(const std::string& cacheFileName, const std::string& sourceFileName,
+		TextureCompression compression, const CompressedImage& image)
+	{
+		if (image.levels.empty() || image.levels.size() > MAX_LEVELS)
+			return false;
+
+		TextureFileHeader header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+		header.version = CACHE_VERSION;
+		header.compression = (uint32_t)compression;
+		header.format = (uint32_t)image.format;
+		header.width = (uint32_t)image.levels[0].width;
+		header.height = (uint32_t)image.levels[0].height;
+		header.levelCount = (uint32_t)image.levels.size();
+
+		FileStamp stamp;
+		if (!getFileStamp(sourceFileName, &stamp) || !hashFile(sourceFileName, &header.sourceHash))
+			return false;
+		header.sourceSize = stamp.size;
+		header.sourceModificationTime = stamp.modificationTime;
+
+		// like KTX2 the small levels come first, so a partial read still has a usable tail
+		std::vector<LevelIndex> index(image.levels.size());
+		size_t dataStart = alignUp(sizeof(header) + index.size() * sizeof(LevelIndex), LEVEL_ALIGNMENT);
+		std::vector<unsigned char> data;
+		for (size_t i = image.levels.size(); i-- > 0;) {
+			const CompressedLevel& level = image.levels[i];
+			data.resize(alignUp(data.size(), LEVEL_ALIGNMENT), 0);
+			index[i].byteOffset = dataStart + data.size();
+			index[i].byteLength = level.data.size();
+			data.insert(data.end(), level.data.begin(), level.data.end());
+		}
+		header.dataChecksum = hashBytes(data.data(), data.size());
+
+		// write next to the final name and swap it in, so a crash never leaves a torn cache
+		std::string tempFileName = cacheFileName + ".tmp";
+		{
+			std::ofstream out(tempFileName.c_str(), std::ios::binary | std::ios::trunc);
+			if (!out)
+				return false;
+			std::vector<unsigned char> padding(dataStart - sizeof(header) - index.size() * sizeof(LevelIndex), 0);
+			out.write((const char*)&header, sizeof(header));
+			out.write((const char*)index.data(), index.size() * sizeof(LevelIndex));
+			out.write((const char*)padding.data(), padding.size());
+			out.write((const char*)data.data(), data.size());
+			if (!out) {
+				out.close();
+				std::remove(tempFileName.c_str());
+				return false;
+			}
+		}
+
+		std::remove(cacheFileName.c_str());
+		if (std::rename(tempFileName.c_str(), cacheFileName.c_str()) != 0) {
+			std::remove(tempFileName.c_str());
+			return false;
+		}
+		return true;
+	}
+
+	bool CompressedTextureCache::read(const std::string& cacheFileName, const std::string& sourceFileName,
+		TextureCompression compression, CompressedImage* image)
+	{
+		MappedFile file;
+		if (!file.open(cacheFileName))
+			return false;
+
+		TextureFileHeader header;
+		if (file.size() < sizeof(header))
+			return false;
+		memcpy(&header, file.data(), sizeof(header));
+
+		if (memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 ||
+			header.version != CACHE_VERSION ||
+			header.compression != (uint32_t)compression ||
+			(header.format != BLOCK_FORMAT_BC1 && header.format != BLOCK_FORMAT_BC3 && header.format != BLOCK_FORMAT_BC7) ||
+			header.levelCount == 0 || header.levelCount > MAX_LEVELS ||
+			file.size() < sizeof(header) + header.levelCount * sizeof(LevelIndex))
+			return false;
+
+		if (!isFileUnchanged(sourceFileName, header.sourceSize, header.sourceModificationTime, header.sourceHash))
+			return false;
+
+		std::vector<LevelIndex> index(header.levelCount);
+		memcpy(index.data(), file.data() + sizeof(header), index.size() * sizeof(LevelIndex));
+
+		size_t dataStart = alignUp(sizeof(header) + index.size() * sizeof(LevelIndex), LEVEL_ALIGNMENT);
+		if (dataStart > file.size() ||
+			hashBytes(file.data() + dataStart, file.size() - dataStart) != header.dataChecksum)
+			return false;
+
+		BlockFormat format = (BlockFormat)header.format;
+		image->format = format;
+		image->levels.resize(header.levelCount);
+		uint32_t width = header.width;
+		uint32_t height = header.height;
+		for (uint32_t i = 0; i < header.levelCount; i++) {
+			if (index[i].byteLength != levelSize(format, width, height) ||
+				index[i].byteOffset + index[i].byteLength > file.size())
+				return false;
+
+			CompressedLevel& level = image->levels[i];
+			level.width = (int)width;
+			level.height = (int)height;
+			const unsigned char* levelData = file.data() + index[i].byteOffset;
+			level.data.assign(levelData, levelData + index[i].byteLength);
+
+			width = width > 1 ? width / 2 : 1;
+			height = height > 1 ? height / 2 : 1;
+		}
+		return true;
+	}
+}
@@ -0,0 +1,29 @@
+#ifndef CompressedTextureCache_hpp
+#define CompressedTextureCache_hpp
+
+#include "TextureCompressor.hpp"
+
+#include <string>
+
+namespace gps {
+
+    // KTX2-style container for a block compressed image, stored next to its
+    // source: a header, a level index (base level first) and the level data,
+    // smallest level first. Rejected when the source image changed or it was
+    // encoded with another compression setting.
+    class CompressedTextureCache
+    {
+    public:
+        // Cache file used for a given image
+        static std::string pathFor(const std::string& imageFileName);
+
+        static bool write(const std::string& cacheFileName, const std::string& sourceFileName,
+            TextureCompression compression, const CompressedImage& image);
+
+        // Reads and validates a cache file, false when it is missing, stale or corrupt
+        static bool read(const std::string& cacheFileName, const std::string& sourceFileName,
+            TextureCompression compression, CompressedImage* image);
+    };
+}
+
+#endif /* CompressedTextureCache_hpp */
@@ -0,0 +1,184 @@
+#include "FileUtils.hpp"
+
+#include <cstring>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace gps {
+
+	MappedFile::MappedFile() : mappedData(NULL), mappedSize(0)
+	{
+#ifdef _WIN32
+		fileHandle = INVALID_HANDLE_VALUE;
+		mappingHandle = NULL;
+#endif
+	}
+
+	MappedFile::~MappedFile()
+	{
+		close();
+	}
+
+	bool MappedFile::open(const std::string& fileName)
+	{
+		close();
+
+#ifdef _WIN32
+		fileHandle = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (fileHandle == INVALID_HANDLE_VALUE)
+			return false;
+
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0) {
+			close();
+			return false;
+		}
+
+		mappingHandle = CreateFileMappingA(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mappingHandle == NULL) {
+			close();
+			return false;
+		}
+
+		mappedData = (const unsigned char*)MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+		if (mappedData == NULL) {
+			close();
+			return false;
+		}
+		mappedSize = (size_t)fileSize.QuadPart;
+#else
+		int fd = ::open(fileName.c_str(), O_RDONLY);
+		if (fd < 0)
+			return false;
+
+		struct stat info;
+		if (fstat(fd, &info) != 0 || info.st_size == 0) {
+			::close(fd);
+			return false;
+		}
+
+		void* address = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd);
+		if (address == MAP_FAILED)
+			return false;
+
+		mappedData = (const unsigned char*)address;
+		mappedSize = (size_t)info.st_size;
+#endif
+		return true;
+	}
+
+	void MappedFile::close()
+	{
+#ifdef _WIN32
+		if (mappedData)
+			UnmapViewOfFile(mappedData);
+		if (mappingHandle)
+			CloseHandle(mappingHandle);
+		if (fileHandle != INVALID_HANDLE_VALUE)
+			CloseHandle(fileHandle);
+		mappingHandle = NULL;
+		fileHandle = INVALID_HANDLE_VALUE;
+#else
+		if (mappedData)
+			munmap((void*)mappedData, mappedSize);
+#endif
+		mappedData = NULL;
+		mappedSize = 0;
+	}
+
+	bool MappedFile::isOpen() const
+	{
+		return mappedData != NULL;
+	}
+
+	const unsigned char* MappedFile::data() const
+	{
+		return mappedData;
+	}
+
+	size_t MappedFile::size() const
+	{
+		return mappedSize;
+	}
+
+	bool getFileStamp(const std::string& fileName, FileStamp* stamp)
+	{
+#ifdef _WIN32
+		WIN32_FILE_ATTRIBUTE_DATA info;
+		if (!GetFileAttributesExA(fileName.c_str(), GetFileExInfoStandard, &info))
+			return false;
+		stamp->size = ((uint64_t)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+		stamp->modificationTime = (int64_t)(((uint64_t)info.ftLastWriteTime.dwHighDateTime << 32) | info.ftLastWriteTime.dwLowDateTime);
+#else
+		struct stat info;
+		if (stat(fileName.c_str(), &info) != 0)
+			return false;
+		stamp->size = (uint64_t)info.st_size;
+#if defined(__APPLE__)
+		stamp->modificationTime = (int64_t)info.st_mtimespec.tv_sec * 1000000000 + info.st_mtimespec.tv_nsec;
+#else
+		stamp->modificationTime = (int64_t)info.st_mtim.tv_sec * 1000000000 + info.st_mtim.tv_nsec;
+#endif
+#endif
+		return true;
+	}
+
+	// FNV-1a consuming 8 bytes per step, then the tail byte by byte
+	uint64_t hashBytes(const void* data, size_t size, uint64_t seed)
+	{
+		const uint64_t prime = 1099511628211ull;
+		const unsigned char* bytes = (const unsigned char*)data;
+		uint64_t hash = seed;
+
+		size_t words = size / 8;
+		for (size_t i = 0; i < words; i++) {
+			uint64_t word;
+			memcpy(&word, bytes + i * 8, sizeof(word));
+			hash = (hash ^ word) * prime;
+		}
+		for (size_t i = words * 8; i < size; i++)
+			hash = (hash ^ bytes[i]) * prime;
+
+		hash ^= hash >> 33;
+		return hash;
+	}
+
+	bool hashFile(const std::string& fileName, uint64_t* hash)
+	{
+		FileStamp stamp;
+		if (!getFileStamp(fileName, &stamp))
+			return false;
+		if (stamp.size == 0) {
+			*hash = hashBytes(NULL, 0);
+			return true;
+		}
+
+		MappedFile file;
+		if (!file.open(fileName))
+			return false;
+		*hash = hashBytes(file.data(), file.size());
+		return true;
+	}
+
+	bool isFileUnchanged(const std::string& fileName, uint64_t size, int64_t modificationTime, uint64_t hash)
+	{
+		FileStamp stamp;
+		if (!getFileStamp(fileName, &stamp) || stamp.size != size)
+			return false;
+		if (stamp.modificationTime == modificationTime)
+			return true;
+
+		uint64_t currentHash;
+		return hashFile(fileName, &currentHash) && currentHash == hash;
+	}
+}
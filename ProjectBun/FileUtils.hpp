@@ -0,0 +1,56 @@
+#ifndef FileUtils_hpp
+#define FileUtils_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace gps {
+
+    // Read-only memory mapping of a whole file
+    class MappedFile
+    {
+    public:
+        MappedFile();
+        ~MappedFile();
+
+        bool open(const std::string& fileName);
+        void close();
+
+        bool isOpen() const;
+        const unsigned char* data() const;
+        size_t size() const;
+
+    private:
+        const unsigned char* mappedData;
+        size_t mappedSize;
+#ifdef _WIN32
+        void* fileHandle;
+        void* mappingHandle;
+#endif
+
+        MappedFile(const MappedFile&);
+        MappedFile& operator=(const MappedFile&);
+    };
+
+    struct FileStamp {
+        uint64_t size;
+        // platform file time at the highest resolution available
+        int64_t modificationTime;
+    };
+
+    // Size and last modification time of a file, false if it does not exist
+    bool getFileStamp(const std::string& fileName, FileStamp* stamp);
+
+    // 64-bit FNV-1a over a block of memory
+    uint64_t hashBytes(const void* data, size_t size, uint64_t seed = 14695981039346656037ull);
+
+    // Content hash of a whole file, false if it can not be read
+    bool hashFile(const std::string& fileName, uint64_t* hash);
+
+    // True when a file still matches a recorded size, mtime and content hash.
+    // A different mtime alone (touch, checkout) falls back to the hash.
+    bool isFileUnchanged(const std::string& fileName, uint64_t size, int64_t modificationTime, uint64_t hash);
+}
+
+#endif /* FileUtils_hpp */
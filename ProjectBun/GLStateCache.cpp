@@ -0,0 +1,190 @@
+#include "GLStateCache.hpp"
+
+namespace gps {
+
+	namespace {
+
+		const GLuint UNKNOWN = (GLuint)-1;
+
+		// slot of a tracked texture target, -1 for the others
+		int targetSlot(GLenum target)
+		{
+			switch (target) {
+			case GL_TEXTURE_2D:
+				return 0;
+			case GL_TEXTURE_CUBE_MAP:
+				return 1;
+			case GL_TEXTURE_BUFFER:
+				return 2;
+			default:
+				return -1;
+			}
+		}
+	}
+
+	GLStateCache::GLStateCache()
+	{
+		invalidate();
+		resetStats();
+	}
+
+	GLStateCache& GLStateCache::shared()
+	{
+		static GLStateCache cache;
+		return cache;
+	}
+
+	template <typename T>
+	bool GLStateCache::change(T& current, T value)
+	{
+		if (current == value) {
+			stats.elided++;
+			return false;
+		}
+		current = value;
+		stats.issued++;
+		return true;
+	}
+
+	void GLStateCache::useProgram(GLuint program)
+	{
+		if (change(this->program, program))
+			glUseProgram(program);
+	}
+
+	GLuint GLStateCache::getProgram() const
+	{
+		return program == UNKNOWN ? 0 : program;
+	}
+
+	void GLStateCache::bindVertexArray(GLuint vertexArray)
+	{
+		if (change(this->vertexArray, vertexArray))
+			glBindVertexArray(vertexArray);
+	}
+
+	void GLStateCache::bindFramebuffer(GLuint framebuffer)
+	{
+		if (change(this->framebuffer, framebuffer))
+			glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	}
+
+	void GLStateCache::viewport(GLint x, GLint y, GLsizei width, GLsizei height)
+	{
+		if (viewportRect[0] == x && viewportRect[1] == y && viewportRect[2] == width && viewportRect[3] == height) {
+			stats.elided++;
+			return;
+		}
+		viewportRect[0] = x;
+		viewportRect[1] = y;
+		viewportRect[2] = width;
+		viewportRect[3] = height;
+		stats.issued++;
+		glViewport(x, y, width, height);
+	}
+
+	void GLStateCache::activeTexture(GLuint unit)
+	{
+		if (change(activeUnit, unit))
+			glActiveTexture(GL_TEXTURE0 + unit);
+	}
+
+	void GLStateCache::bindTexture(GLuint unit, GLenum target, GLuint texture)
+	{
+		int slot = targetSlot(target);
+		if (slot < 0 || unit >= MAX_TEXTURE_UNITS) {
+			activeTexture(unit);
+			stats.issued++;
+			glBindTexture(target, texture);
+			return;
+		}
+		if (textures[unit][slot] == texture) {
+			stats.elided++;
+			return;
+		}
+		activeTexture(unit);
+		change(textures[unit][slot], texture);
+		glBindTexture(target, texture);
+	}
+
+	void GLStateCache::bindTexture(GLenum target, GLuint texture)
+	{
+		// an unknown unit is made known first, so the binding can be recorded
+		bindTexture(activeUnit == UNKNOWN ? 0 : activeUnit, target, texture);
+	}
+
+	void GLStateCache::bindUniformBuffer(GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+	{
+		if (index < MAX_UNIFORM_BUFFER_BINDINGS) {
+			BufferRange& range = uniformBuffers[index];
+			if (range.buffer == buffer && range.offset == offset && range.size == size) {
+				stats.elided++;
+				return;
+			}
+			range.buffer = buffer;
+			range.offset = offset;
+			range.size = size;
+		}
+		stats.issued++;
+		glBindBufferRange(GL_UNIFORM_BUFFER, index, buffer, offset, size);
+	}
+
+	void GLStateCache::depthFunc(GLenum func)
+	{
+		if (change(depthFunction, func))
+			glDepthFunc(func);
+	}
+
+	void GLStateCache::polygonMode(GLenum mode)
+	{
+		if (change(polygonFillMode, mode))
+			glPolygonMode(GL_FRONT_AND_BACK, mode);
+	}
+
+	void GLStateCache::textureDeleted(GLuint texture)
+	{
+		for (GLuint unit = 0; unit < MAX_TEXTURE_UNITS; unit++) {
+			for (int slot = 0; slot < TRACKED_TARGETS; slot++) {
+				if (textures[unit][slot] == texture)
+					textures[unit][slot] = 0;
+			}
+		}
+	}
+
+	void GLStateCache::bufferDeleted(GLuint buffer)
+	{
+		for (GLuint index = 0; index < MAX_UNIFORM_BUFFER_BINDINGS; index++) {
+			if (uniformBuffers[index].buffer == buffer)
+				uniformBuffers[index].buffer = 0;
+		}
+	}
+
+	void GLStateCache::invalidate()
+	{
+		program = UNKNOWN;
+		vertexArray = UNKNOWN;
+		framebuffer = UNKNOWN;
+		for (int i = 0; i < 4; i++)
+			viewportRect[i] = -1;
+		activeUnit = UNKNOWN;
+		for (GLuint unit = 0; unit < MAX_TEXTURE_UNITS; unit++) {
+			for (int slot = 0; slot < TRACKED_TARGETS; slot++)
+				textures[unit][slot] = UNKNOWN;
+		}
+		for (GLuint index = 0; index < MAX_UNIFORM_BUFFER_BINDINGS; index++)
+			uniformBuffers[index].buffer = UNKNOWN;
+		depthFunction = UNKNOWN;
+		polygonFillMode = UNKNOWN;
+	}
+
+	GLStateStats GLStateCache::getStats() const
+	{
+		return stats;
+	}
+
+	void GLStateCache::resetStats()
+	{
+		stats.issued = 0;
+		stats.elided = 0;
+	}
+}
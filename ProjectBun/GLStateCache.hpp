@@ -0,0 +1,98 @@
+#ifndef GLStateCache_hpp
+#define GLStateCache_hpp
+
+#include <GL/glew.h>
+
+#include <cstddef>
+
+namespace gps {
+
+    struct GLStateStats
+    {
+        // state changes sent to GL
+        size_t issued;
+        // state changes dropped as already in effect
+        size_t elided;
+    };
+
+    // Shadow copy of the GL state the renderer changes most - program, vertex
+    // array, framebuffer, viewport, active texture unit and the textures bound
+    // to each unit, uniform buffer ranges, depth function and polygon mode -
+    // so that changes to what is already in effect are never sent. Only holds
+    // while every change goes through here; state starts out unknown, so the
+    // first change of each kind is always sent. GL thread only.
+    class GLStateCache
+    {
+    public:
+        static const GLuint MAX_TEXTURE_UNITS = 32;
+        static const GLuint MAX_UNIFORM_BUFFER_BINDINGS = 16;
+
+        static GLStateCache& shared();
+
+        void useProgram(GLuint program);
+        // 0 until a program was used
+        GLuint getProgram() const;
+
+        void bindVertexArray(GLuint vertexArray);
+        // Draw and read framebuffer both
+        void bindFramebuffer(GLuint framebuffer);
+        void viewport(GLint x, GLint y, GLsizei width, GLsizei height);
+
+        // Unit index, not GL_TEXTUREi
+        void activeTexture(GLuint unit);
+        // Binds to `unit`, switching the active unit only when the binding changes.
+        // GL_TEXTURE_2D, GL_TEXTURE_CUBE_MAP and GL_TEXTURE_BUFFER are tracked,
+        // other targets are always sent.
+        void bindTexture(GLuint unit, GLenum target, GLuint texture);
+        // Binds to the active unit, e.g. to upload to the texture
+        void bindTexture(GLenum target, GLuint texture);
+
+        // Range of `buffer` for uniform block binding point `index`; binding
+        // points past the tracked ones are always sent
+        void bindUniformBuffer(GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size);
+
+        void depthFunc(GLenum func);
+        // For GL_FRONT_AND_BACK
+        void polygonMode(GLenum mode);
+
+        // A deleted texture is unbound wherever it was bound
+        void textureDeleted(GLuint texture);
+        void bufferDeleted(GLuint buffer);
+
+        // Forgets everything, after GL state was changed behind the cache's back
+        void invalidate();
+
+        GLStateStats getStats() const;
+        void resetStats();
+
+    private:
+        static const int TRACKED_TARGETS = 3;
+
+        // GLuint(-1) / -1 for unknown
+        GLuint program;
+        GLuint vertexArray;
+        GLuint framebuffer;
+        GLint viewportRect[4];
+        GLuint activeUnit;
+        GLuint textures[MAX_TEXTURE_UNITS][TRACKED_TARGETS];
+        struct BufferRange {
+            GLuint buffer;
+            GLintptr offset;
+            GLsizeiptr size;
+        };
+        BufferRange uniformBuffers[MAX_UNIFORM_BUFFER_BINDINGS];
+        GLenum depthFunction;
+        GLenum polygonFillMode;
+        GLStateStats stats;
+
+        GLStateCache();
+        GLStateCache(const GLStateCache&);
+        GLStateCache& operator=(const GLStateCache&);
+
+        // True when `value` differs from `current`, which takes it; counts either way
+        template <typename T>
+        bool change(T& current, T value);
+    };
+}
+
+#endif /* GLStateCache_hpp */
@@ -0,0 +1,266 @@
+#include "GpuBufferArena.hpp"
+#include "GLStateCache.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+namespace gps {
+
+	namespace {
+		// Default block size; larger meshes get a block of their own
+		const size_t BLOCK_VERTICES = 1 << 18;
+		const size_t BLOCK_INDEX_BYTES = 4 * 1024 * 1024;
+		// 16- and 32-bit indices share the index buffers
+		const size_t INDEX_ALIGNMENT = sizeof(GLuint);
+
+		// Largest single glBufferSubData call, bounds the driver's staging copy
+		const size_t UPLOAD_CHUNK_SIZE = 4 * 1024 * 1024;
+
+		void uploadRange(GLenum target, size_t offset, size_t size, const void* data)
+		{
+			const unsigned char* bytes = (const unsigned char*)data;
+			for (size_t done = 0; done < size; done += UPLOAD_CHUNK_SIZE) {
+				size_t chunkSize = std::min(size - done, UPLOAD_CHUNK_SIZE);
+				glBufferSubData(target, offset + done, chunkSize, bytes + done);
+			}
+		}
+
+		template <typename V> void setAttributePointers()
+		{
+			const VertexAttribute* attributes = VertexLayout<V>::getAttributes();
+			for (size_t i = 0; i < VertexLayout<V>::attributeCount; i++) {
+				glEnableVertexAttribArray(attributes[i].location);
+				glVertexAttribPointer(attributes[i].location, attributes[i].size, attributes[i].type,
+					attributes[i].normalized, sizeof(V), (GLvoid*)attributes[i].offset);
+			}
+		}
+
+		const char* formatName(VertexFormat format)
+		{
+			switch (format) {
+			case VERTEX_FORMAT_COMPACT:
+				return "compact";
+			case VERTEX_FORMAT_QUANTIZED:
+				return "quantized";
+			default:
+				return "full";
+			}
+		}
+
+		// 1 - largest free range / all free space: 0 while the free space is in one piece
+		float fragmentation(size_t capacity, size_t used, size_t largestFree)
+		{
+			size_t freeSpace = capacity - used;
+			return freeSpace == 0 ? 0.0f : 1.0f - (float)largestFree / freeSpace;
+		}
+	}
+
+	RangeAllocator::RangeAllocator(size_t capacity) : capacity(capacity), used(0)
+	{
+		if (capacity > 0)
+			freeRanges[0] = capacity;
+	}
+
+	size_t RangeAllocator::allocate(size_t size, size_t alignment)
+	{
+		for (std::map<size_t, size_t>::iterator it = freeRanges.begin(); it != freeRanges.end(); ++it) {
+			size_t start = (it->first + alignment - 1) / alignment * alignment;
+			size_t end = it->first + it->second;
+			if (start + size > end)
+				continue;
+
+			// split off what is left on either side
+			size_t rangeStart = it->first;
+			freeRanges.erase(it);
+			if (start > rangeStart)
+				freeRanges[rangeStart] = start - rangeStart;
+			if (start + size < end)
+				freeRanges[start + size] = end - (start + size);
+			used += size;
+			return start;
+		}
+		return NO_SPACE;
+	}
+
+	void RangeAllocator::free(size_t offset, size_t size)
+	{
+		used -= size;
+		std::map<size_t, size_t>::iterator next = freeRanges.lower_bound(offset);
+		if (next != freeRanges.end() && offset + size == next->first) {
+			size += next->second;
+			next = freeRanges.erase(next);
+		}
+		if (next != freeRanges.begin()) {
+			std::map<size_t, size_t>::iterator previous = next;
+			--previous;
+			if (previous->first + previous->second == offset) {
+				previous->second += size;
+				return;
+			}
+		}
+		freeRanges[offset] = size;
+	}
+
+	size_t RangeAllocator::getCapacity() const
+	{
+		return capacity;
+	}
+
+	size_t RangeAllocator::getUsed() const
+	{
+		return used;
+	}
+
+	size_t RangeAllocator::getFreeRangeCount() const
+	{
+		return freeRanges.size();
+	}
+
+	size_t RangeAllocator::getLargestFreeRange() const
+	{
+		size_t largest = 0;
+		for (std::map<size_t, size_t>::const_iterator it = freeRanges.begin(); it != freeRanges.end(); ++it)
+			largest = std::max(largest, it->second);
+		return largest;
+	}
+
+	GpuBufferArena::GpuBufferArena()
+	{
+	}
+
+	GpuBufferArena& GpuBufferArena::shared()
+	{
+		// never destroyed: meshes in globals give their ranges back at exit
+		static GpuBufferArena* arena = new GpuBufferArena();
+		return *arena;
+	}
+
+	std::shared_ptr<const ArenaAllocation> GpuBufferArena::allocate(VertexFormat format, const void* vertices, size_t vertexCount,
+		const void* indices, size_t indexBytes)
+	{
+		std::vector<Block>& formatBlocks = blocks[format];
+		size_t block = 0;
+		size_t firstVertex = RangeAllocator::NO_SPACE;
+		size_t indexOffset = RangeAllocator::NO_SPACE;
+		for (; block < formatBlocks.size(); block++) {
+			Block& candidate = formatBlocks[block];
+			if (candidate.vertices.getCapacity() - candidate.vertices.getUsed() < vertexCount ||
+				candidate.indices.getCapacity() - candidate.indices.getUsed() < indexBytes)
+				continue;
+			firstVertex = candidate.vertices.allocate(vertexCount, 1);
+			if (firstVertex == RangeAllocator::NO_SPACE)
+				continue;
+			indexOffset = candidate.indices.allocate(indexBytes, INDEX_ALIGNMENT);
+			if (indexOffset != RangeAllocator::NO_SPACE)
+				break;
+			candidate.vertices.free(firstVertex, vertexCount);
+		}
+		if (block == formatBlocks.size()) {
+			block = createBlock(format, std::max(vertexCount, BLOCK_VERTICES), std::max(indexBytes, BLOCK_INDEX_BYTES));
+			firstVertex = formatBlocks[block].vertices.allocate(vertexCount, 1);
+			indexOffset = formatBlocks[block].indices.allocate(indexBytes, INDEX_ALIGNMENT);
+		}
+
+		Block& target = formatBlocks[block];
+		target.allocations++;
+		size_t stride = vertexStride(format);
+		glBindBuffer(GL_ARRAY_BUFFER, target.vertexBuffer);
+		uploadRange(GL_ARRAY_BUFFER, firstVertex * stride, vertexCount * stride, vertices);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		// the element binding is VAO state, upload through the copy target instead
+		glBindBuffer(GL_COPY_WRITE_BUFFER, target.indexBuffer);
+		uploadRange(GL_COPY_WRITE_BUFFER, indexOffset, indexBytes, indices);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+		ArenaAllocation* allocation = new ArenaAllocation();
+		allocation->format = format;
+		allocation->block = block;
+		allocation->vertexArray = target.vertexArray;
+		allocation->baseVertex = (GLint)firstVertex;
+		allocation->vertexCount = vertexCount;
+		allocation->indexOffset = indexOffset;
+		allocation->indexBytes = indexBytes;
+		return std::shared_ptr<const ArenaAllocation>(allocation, [](const ArenaAllocation* released) {
+			GpuBufferArena::shared().release(*released);
+			delete released;
+		});
+	}
+
+	void GpuBufferArena::release(const ArenaAllocation& allocation)
+	{
+		Block& block = blocks[allocation.format][allocation.block];
+		block.vertices.free(allocation.baseVertex, allocation.vertexCount);
+		block.indices.free(allocation.indexOffset, allocation.indexBytes);
+		block.allocations--;
+	}
+
+	size_t GpuBufferArena::createBlock(VertexFormat format, size_t vertexCapacity, size_t indexCapacity)
+	{
+		Block block = { 0, 0, 0, RangeAllocator(vertexCapacity), RangeAllocator(indexCapacity), 0 };
+		glGenVertexArrays(1, &block.vertexArray);
+		glGenBuffers(1, &block.vertexBuffer);
+		glGenBuffers(1, &block.indexBuffer);
+
+		GLStateCache& state = GLStateCache::shared();
+		state.bindVertexArray(block.vertexArray);
+		glBindBuffer(GL_ARRAY_BUFFER, block.vertexBuffer);
+		glBufferData(GL_ARRAY_BUFFER, vertexCapacity * vertexStride(format), NULL, GL_STATIC_DRAW);
+		switch (format) {
+		case VERTEX_FORMAT_COMPACT:
+			setAttributePointers<CompactVertex>();
+			break;
+		case VERTEX_FORMAT_QUANTIZED:
+			setAttributePointers<QuantizedVertex>();
+			break;
+		default:
+			setAttributePointers<Vertex>();
+			break;
+		}
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, block.indexBuffer);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCapacity, NULL, GL_STATIC_DRAW);
+		state.bindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		blocks[format].push_back(block);
+		return blocks[format].size() - 1;
+	}
+
+	ArenaStats GpuBufferArena::getStats(VertexFormat format) const
+	{
+		ArenaStats stats = ArenaStats();
+		size_t stride = vertexStride(format);
+		const std::vector<Block>& formatBlocks = blocks[format];
+		stats.blocks = formatBlocks.size();
+		for (size_t i = 0; i < formatBlocks.size(); i++) {
+			const Block& block = formatBlocks[i];
+			stats.allocations += block.allocations;
+			stats.vertexCapacity += block.vertices.getCapacity() * stride;
+			stats.vertexUsed += block.vertices.getUsed() * stride;
+			stats.vertexLargestFree = std::max(stats.vertexLargestFree, block.vertices.getLargestFreeRange() * stride);
+			stats.vertexFreeRanges += block.vertices.getFreeRangeCount();
+			stats.indexCapacity += block.indices.getCapacity();
+			stats.indexUsed += block.indices.getUsed();
+			stats.indexLargestFree = std::max(stats.indexLargestFree, block.indices.getLargestFreeRange());
+			stats.indexFreeRanges += block.indices.getFreeRangeCount();
+		}
+		return stats;
+	}
+
+	void GpuBufferArena::printStats() const
+	{
+		for (size_t f = 0; f < FORMAT_COUNT; f++) {
+			ArenaStats stats = getStats((VertexFormat)f);
+			if (stats.blocks == 0)
+				continue;
+
+			std::cout << "Buffer arena   : " << formatName((VertexFormat)f) << ", " << stats.allocations << " meshes in "
+				<< stats.blocks << " block(s)" << std::endl;
+			std::cout << "  vertices     : " << stats.vertexUsed / 1024 << " of " << stats.vertexCapacity / 1024 << " KB used, "
+				<< stats.vertexFreeRanges << " free range(s), fragmentation "
+				<< fragmentation(stats.vertexCapacity, stats.vertexUsed, stats.vertexLargestFree) * 100.0f << "%" << std::endl;
+			std::cout << "  indices      : " << stats.indexUsed / 1024 << " of " << stats.indexCapacity / 1024 << " KB used, "
+				<< stats.indexFreeRanges << " free range(s), fragmentation "
+				<< fragmentation(stats.indexCapacity, stats.indexUsed, stats.indexLargestFree) * 100.0f << "%" << std::endl;
+		}
+	}
+}
@@ -0,0 +1,111 @@
+#ifndef GpuBufferArena_hpp
+#define GpuBufferArena_hpp
+
+#include <GL/glew.h>
+
+#include "VertexFormat.hpp"
+
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <vector>
+
+namespace gps {
+
+    // Where a mesh's geometry lives in the arena; the ranges go back to the
+    // free lists when the last reference to it is dropped
+    struct ArenaAllocation
+    {
+        VertexFormat format;
+        size_t block;
+        // VAO of the block, shared by every mesh in it
+        GLuint vertexArray;
+        // first vertex of the mesh, added to each of its indices when drawing
+        GLint baseVertex;
+        size_t vertexCount;
+        // where the mesh's indices start in the block's index buffer, in bytes
+        size_t indexOffset;
+        size_t indexBytes;
+    };
+
+    // First-fit free list over [0, capacity); freed ranges merge with their neighbours
+    class RangeAllocator
+    {
+    public:
+        static const size_t NO_SPACE = ~(size_t)0;
+
+        explicit RangeAllocator(size_t capacity);
+
+        // Start of a free range of `size` aligned to `alignment`, NO_SPACE if none is large enough
+        size_t allocate(size_t size, size_t alignment);
+        void free(size_t offset, size_t size);
+
+        size_t getCapacity() const;
+        size_t getUsed() const;
+        size_t getFreeRangeCount() const;
+        size_t getLargestFreeRange() const;
+
+    private:
+        size_t capacity;
+        size_t used;
+        // offset -> size
+        std::map<size_t, size_t> freeRanges;
+    };
+
+    // Usage of the blocks of one vertex format, in bytes
+    struct ArenaStats
+    {
+        size_t blocks;
+        size_t allocations;
+        size_t vertexCapacity;
+        size_t vertexUsed;
+        size_t vertexLargestFree;
+        size_t vertexFreeRanges;
+        size_t indexCapacity;
+        size_t indexUsed;
+        size_t indexLargestFree;
+        size_t indexFreeRanges;
+    };
+
+    // Sub-allocates mesh geometry from a few large vertex/index buffer pairs per
+    // vertex format. Each block has one VAO with the format's attributes, so
+    // meshes draw with a base vertex instead of owning buffers. GL thread only.
+    class GpuBufferArena
+    {
+    public:
+        static GpuBufferArena& shared();
+
+        // Copies the packed vertices of `format` and the indices into a block with
+        // room for both, adding a block when none has
+        std::shared_ptr<const ArenaAllocation> allocate(VertexFormat format, const void* vertices, size_t vertexCount,
+            const void* indices, size_t indexBytes);
+
+        ArenaStats getStats(VertexFormat format) const;
+
+        // Utilization and fragmentation of every format in use
+        void printStats() const;
+
+    private:
+        struct Block
+        {
+            GLuint vertexArray;
+            GLuint vertexBuffer;
+            GLuint indexBuffer;
+            // in vertices
+            RangeAllocator vertices;
+            // in bytes
+            RangeAllocator indices;
+            size_t allocations;
+        };
+
+        static const size_t FORMAT_COUNT = 3;
+        std::vector<Block> blocks[FORMAT_COUNT];
+
+        GpuBufferArena();
+
+        size_t createBlock(VertexFormat format, size_t vertexCapacity, size_t indexCapacity);
+        void release(const ArenaAllocation& allocation);
+    };
+}
+
+#endif /* GpuBufferArena_hpp */
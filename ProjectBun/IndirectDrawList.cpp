@@ -0,0 +1,249 @@
+#include "IndirectDrawList.hpp"
+#include "GLStateCache.hpp"
+
+#include <algorithm>
+
+namespace gps {
+
+	namespace {
+		// model matrix columns, position scale + octahedral flag, position offset, texcoord scale + offset
+		const size_t RECORD_TEXELS = 7;
+
+		bool sameTextures(const std::vector<Texture>& a, const std::vector<Texture>& b)
+		{
+			if (a.size() != b.size())
+				return false;
+			for (size_t i = 0; i < a.size(); i++) {
+				if (a[i].id != b[i].id || a[i].type != b[i].type)
+					return false;
+			}
+			return true;
+		}
+
+		// Replaces the contents of `buffer`, orphaning the previous storage
+		void uploadStream(GLenum target, GLuint buffer, size_t size, const void* data)
+		{
+			glBindBuffer(target, buffer);
+			glBufferData(target, size, NULL, GL_STREAM_DRAW);
+			glBufferSubData(target, 0, size, data);
+			glBindBuffer(target, 0);
+		}
+	}
+
+	IndirectDrawList::IndirectDrawList() : commandCount(0), submitCount(0), commandBuffer(0), recordBuffer(0),
+		recordTexture(0), drawIdBuffer(0), drawIdCount(0)
+	{
+	}
+
+	IndirectDrawList::~IndirectDrawList()
+	{
+		if (commandBuffer == 0)
+			return;
+		glDeleteBuffers(1, &commandBuffer);
+		glDeleteBuffers(1, &recordBuffer);
+		glDeleteBuffers(1, &drawIdBuffer);
+		glDeleteTextures(1, &recordTexture);
+		GLStateCache::shared().textureDeleted(recordTexture);
+	}
+
+	bool IndirectDrawList::isMultiDrawIndirectSupported()
+	{
+		// the draw ID comes from an instanced attribute offset by baseInstance
+		return GLEW_ARB_multi_draw_indirect && GLEW_ARB_base_instance;
+	}
+
+	void IndirectDrawList::clear()
+	{
+		batches.clear();
+		records.clear();
+		commandCount = 0;
+	}
+
+	void IndirectDrawList::add(const Model3D& model, const glm::mat4& modelMatrix, const LodView& lodView, ClusterCullStats* stats)
+	{
+		add(model, modelMatrix, lodView, (const char*)NULL, stats);
+	}
+
+	void IndirectDrawList::add(const Model3D& model, const glm::mat4& modelMatrix, const CullingView& view, const LodView& lodView,
+		ClusterCullStats* stats)
+	{
+		add(model, modelMatrix, view, lodView, (const char*)NULL, stats);
+	}
+
+	void IndirectDrawList::add(const Model3D& model, const glm::mat4& modelMatrix, const LodView& lodView, const char* visibleMeshes,
+		ClusterCullStats* stats)
+	{
+		const std::vector<Mesh>& meshes = model.GetMeshes();
+		for (size_t i = 0; i < meshes.size(); i++) {
+			if (visibleMeshes && !visibleMeshes[i])
+				continue;
+			const Mesh& mesh = meshes[i];
+			const MeshLod& lod = mesh.getLods()[mesh.getLodLevel(lodView)];
+			if (stats) {
+				stats->triangles += mesh.getLods()[0].indexCount / 3;
+				stats->visibleTriangles += lod.indexCount / 3;
+			}
+			addRange(findBatch(mesh), mesh, addRecord(mesh, modelMatrix), lod.firstIndex, lod.indexCount);
+		}
+	}
+
+	void IndirectDrawList::add(const Model3D& model, const glm::mat4& modelMatrix, const CullingView& view, const LodView& lodView,
+		const char* visibleMeshes, ClusterCullStats* stats)
+	{
+		const std::vector<Mesh>& meshes = model.GetMeshes();
+		for (size_t i = 0; i < meshes.size(); i++) {
+			if (visibleMeshes && !visibleMeshes[i])
+				continue;
+			const Mesh& mesh = meshes[i];
+			counts.clear();
+			firstIndices.clear();
+			mesh.selectRanges(view, lodView, counts, firstIndices, stats);
+			if (counts.empty())
+				continue;
+
+			// the meshlets of a mesh share its record
+			Batch& batch = findBatch(mesh);
+			GLuint record = addRecord(mesh, modelMatrix);
+			for (size_t r = 0; r < counts.size(); r++)
+				addRange(batch, mesh, record, firstIndices[r], counts[r]);
+		}
+	}
+
+	GLuint IndirectDrawList::addRecord(const Mesh& mesh, const glm::mat4& modelMatrix)
+	{
+		GLuint record = (GLuint)(records.size() / RECORD_TEXELS);
+		const VertexQuantization& quantization = mesh.getQuantization();
+		for (int column = 0; column < 4; column++)
+			records.push_back(modelMatrix[column]);
+		records.push_back(glm::vec4(quantization.positionScale, hasOctahedralNormals(mesh.getVertexFormat()) ? 1.0f : 0.0f));
+		records.push_back(glm::vec4(quantization.positionOffset, 0.0f));
+		records.push_back(glm::vec4(quantization.texCoordScale, quantization.texCoordOffset));
+		return record;
+	}
+
+	IndirectDrawList::Batch& IndirectDrawList::findBatch(const Mesh& mesh)
+	{
+		GLuint vertexArray = mesh.getAllocation().vertexArray;
+		for (size_t i = 0; i < batches.size(); i++) {
+			if (batches[i].vertexArray == vertexArray && batches[i].indexType == mesh.getIndexType() &&
+				sameTextures(batches[i].textures, mesh.textures))
+				return batches[i];
+		}
+
+		Batch batch;
+		batch.vertexArray = vertexArray;
+		batch.indexType = mesh.getIndexType();
+		batch.textures = mesh.textures;
+		batches.push_back(batch);
+		return batches.back();
+	}
+
+	void IndirectDrawList::addRange(Batch& batch, const Mesh& mesh, GLuint record, size_t firstIndex, size_t indexCount)
+	{
+		// command offsets count indices from the start of the block's index buffer
+		const ArenaAllocation& allocation = mesh.getAllocation();
+		size_t indexSize = mesh.getIndexType() == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+		DrawElementsIndirectCommand command = { (GLuint)indexCount, 1, (GLuint)(allocation.indexOffset / indexSize + firstIndex),
+			allocation.baseVertex, record };
+		batch.commands.push_back(command);
+		commandCount++;
+	}
+
+	void IndirectDrawList::upload()
+	{
+		if (commandBuffer == 0) {
+			glGenBuffers(1, &commandBuffer);
+			glGenBuffers(1, &recordBuffer);
+			glGenBuffers(1, &drawIdBuffer);
+			glGenTextures(1, &recordTexture);
+		}
+
+		commands.clear();
+		for (size_t i = 0; i < batches.size(); i++)
+			commands.insert(commands.end(), batches[i].commands.begin(), batches[i].commands.end());
+		uploadStream(GL_DRAW_INDIRECT_BUFFER, commandBuffer, commands.size() * sizeof(DrawElementsIndirectCommand), commands.data());
+
+		uploadStream(GL_TEXTURE_BUFFER, recordBuffer, records.size() * sizeof(glm::vec4), records.data());
+		GLStateCache::shared().bindTexture(GL_TEXTURE_BUFFER, recordTexture);
+		glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, recordBuffer);
+
+		// the IDs never change, the buffer only grows
+		size_t recordCount = records.size() / RECORD_TEXELS;
+		if (recordCount > drawIdCount) {
+			drawIdCount = std::max(recordCount, drawIdCount * 2);
+			std::vector<GLuint> ids(drawIdCount);
+			for (size_t i = 0; i < ids.size(); i++)
+				ids[i] = (GLuint)i;
+			glBindBuffer(GL_ARRAY_BUFFER, drawIdBuffer);
+			glBufferData(GL_ARRAY_BUFFER, ids.size() * sizeof(GLuint), ids.data(), GL_STATIC_DRAW);
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+		}
+	}
+
+	void IndirectDrawList::submit(gps::Shader shader)
+	{
+		submitCount = 0;
+		if (commandCount == 0)
+			return;
+		upload();
+
+		static const UniformId INDIRECT = Shader::getUniformId("indirect");
+		static const UniformId DRAW_RECORDS = Shader::getUniformId("drawRecords");
+
+		shader.useShaderProgram();
+		shader.setInt(INDIRECT, 1);
+		// the record buffer goes to the unit the shader gave its sampler
+		GLStateCache& state = GLStateCache::shared();
+		state.bindTexture((GLuint)shader.getSamplerUnit(DRAW_RECORDS), GL_TEXTURE_BUFFER, recordTexture);
+
+		bool multiDraw = isMultiDrawIndirectSupported();
+		if (multiDraw)
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+
+		size_t firstCommand = 0;
+		for (size_t b = 0; b < batches.size(); b++) {
+			const Batch& batch = batches[b];
+			Mesh::bindTextures(shader, batch.textures);
+			state.bindVertexArray(batch.vertexArray);
+
+			if (multiDraw) {
+				glBindBuffer(GL_ARRAY_BUFFER, drawIdBuffer);
+				glEnableVertexAttribArray(DRAW_ID_LOCATION);
+				glVertexAttribIPointer(DRAW_ID_LOCATION, 1, GL_UNSIGNED_INT, sizeof(GLuint), 0);
+				glVertexAttribDivisor(DRAW_ID_LOCATION, 1);
+				glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+				glMultiDrawElementsIndirect(GL_TRIANGLES, batch.indexType,
+					(const GLvoid*)(firstCommand * sizeof(DrawElementsIndirectCommand)), (GLsizei)batch.commands.size(), 0);
+				glDisableVertexAttribArray(DRAW_ID_LOCATION);
+				submitCount++;
+			}
+			else {
+				// the disabled attribute reads its current value instead
+				size_t indexSize = batch.indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+				for (size_t c = 0; c < batch.commands.size(); c++) {
+					const DrawElementsIndirectCommand& command = batch.commands[c];
+					glVertexAttribI1ui(DRAW_ID_LOCATION, command.baseInstance);
+					glDrawElementsBaseVertex(GL_TRIANGLES, (GLsizei)command.count, batch.indexType,
+						(const GLvoid*)(command.firstIndex * indexSize), command.baseVertex);
+				}
+				submitCount += batch.commands.size();
+			}
+			firstCommand += batch.commands.size();
+		}
+
+		if (multiDraw)
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+		shader.setInt(INDIRECT, 0);
+	}
+
+	size_t IndirectDrawList::getCommandCount() const
+	{
+		return commandCount;
+	}
+
+	size_t IndirectDrawList::getSubmitCount() const
+	{
+		return submitCount;
+	}
+}
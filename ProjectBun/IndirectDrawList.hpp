@@ -0,0 +1,101 @@
+#ifndef IndirectDrawList_hpp
+#define IndirectDrawList_hpp
+
+#include <GL/glew.h>
+#include "glm/glm.hpp"
+
+#include "Model3D.hpp"
+
+#include <vector>
+
+namespace gps {
+
+    // Layout glMultiDrawElementsIndirect reads from the indirect buffer
+    struct DrawElementsIndirectCommand
+    {
+        GLuint count;
+        GLuint instanceCount;
+        GLuint firstIndex;
+        GLint baseVertex;
+        // index of the per-draw record, fetched through the draw ID attribute
+        GLuint baseInstance;
+    };
+
+    // Vertex attribute carrying the per-draw record index in the vertex shaders
+    const GLuint DRAW_ID_LOCATION = 8;
+
+    // Collects the visible meshes of a pass as indirect draw commands and submits
+    // them with one glMultiDrawElementsIndirect per vertex array and texture set.
+    // The model matrix and vertex decoding of each mesh go into a buffer texture
+    // read by the shader (its `indirect` path), so meshes need no uniforms of
+    // their own. Without ARB_multi_draw_indirect the commands are drawn in a loop.
+    // GL thread only.
+    class IndirectDrawList
+    {
+    public:
+        IndirectDrawList();
+        ~IndirectDrawList();
+
+        static bool isMultiDrawIndirectSupported();
+
+        void clear();
+
+        // Every mesh of `model` at the level of detail picked from `lodView`
+        void add(const Model3D& model, const glm::mat4& modelMatrix, const LodView& lodView, ClusterCullStats* stats = NULL);
+
+        // Only what is inside `view`, down to single meshlets at full detail
+        void add(const Model3D& model, const glm::mat4& modelMatrix, const CullingView& view, const LodView& lodView,
+            ClusterCullStats* stats = NULL);
+
+        // As above, only for the meshes i with visibleMeshes[i] set
+        void add(const Model3D& model, const glm::mat4& modelMatrix, const LodView& lodView, const char* visibleMeshes,
+            ClusterCullStats* stats = NULL);
+        void add(const Model3D& model, const glm::mat4& modelMatrix, const CullingView& view, const LodView& lodView,
+            const char* visibleMeshes, ClusterCullStats* stats = NULL);
+
+        // Draws everything added since clear(). The shader needs normalMatrix
+        // to cover only the view, the normals come out in world space.
+        void submit(gps::Shader shader);
+
+        size_t getCommandCount() const;
+        // Draw calls the last submit took
+        size_t getSubmitCount() const;
+
+    private:
+        // Commands sharing the state a multi-draw can not change
+        struct Batch {
+            GLuint vertexArray;
+            GLenum indexType;
+            std::vector<Texture> textures;
+            std::vector<DrawElementsIndirectCommand> commands;
+        };
+
+        std::vector<Batch> batches;
+        // model matrix and decoding of every mesh added, RECORD_TEXELS apiece
+        std::vector<glm::vec4> records;
+        std::vector<DrawElementsIndirectCommand> commands;
+        size_t commandCount;
+        size_t submitCount;
+
+        GLuint commandBuffer;
+        GLuint recordBuffer;
+        GLuint recordTexture;
+        // 0, 1, 2, ... read once per draw, starting at its baseInstance
+        GLuint drawIdBuffer;
+        size_t drawIdCount;
+
+        // Reused between frames
+        std::vector<GLsizei> counts;
+        std::vector<size_t> firstIndices;
+
+        GLuint addRecord(const Mesh& mesh, const glm::mat4& modelMatrix);
+        Batch& findBatch(const Mesh& mesh);
+        void addRange(Batch& batch, const Mesh& mesh, GLuint record, size_t firstIndex, size_t indexCount);
+        void upload();
+
+        IndirectDrawList(const IndirectDrawList&);
+        IndirectDrawList& operator=(const IndirectDrawList&);
+    };
+}
+
+#endif /* IndirectDrawList_hpp */
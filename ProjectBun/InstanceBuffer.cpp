@@ -0,0 +1,60 @@
+#include "InstanceBuffer.hpp"
+
+#include <algorithm>
+
+namespace gps {
+
+	InstanceBuffer::InstanceBuffer() : buffer(0), capacity(0), count(0)
+	{
+	}
+
+	InstanceBuffer::~InstanceBuffer()
+	{
+		if (buffer != 0)
+			glDeleteBuffers(1, &buffer);
+	}
+
+	void InstanceBuffer::upload(const ModelInstance* instances, size_t count)
+	{
+		if (buffer == 0)
+			glGenBuffers(1, &buffer);
+
+		this->count = count;
+		capacity = std::max(capacity, count);
+		glBindBuffer(GL_ARRAY_BUFFER, buffer);
+		glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(ModelInstance), NULL, GL_STREAM_DRAW);
+		if (count > 0)
+			glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(ModelInstance), instances);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	size_t InstanceBuffer::getInstanceCount() const
+	{
+		return count;
+	}
+
+	void InstanceBuffer::bind(size_t firstInstance) const
+	{
+		size_t base = firstInstance * sizeof(ModelInstance);
+		glBindBuffer(GL_ARRAY_BUFFER, buffer);
+		for (GLuint column = 0; column < 4; column++) {
+			GLuint location = INSTANCE_TRANSFORM_LOCATION + column;
+			glEnableVertexAttribArray(location);
+			glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, sizeof(ModelInstance),
+				(GLvoid*)(base + offsetof(ModelInstance, transform) + column * sizeof(glm::vec4)));
+			glVertexAttribDivisor(location, 1);
+		}
+		glEnableVertexAttribArray(INSTANCE_TINT_LOCATION);
+		glVertexAttribPointer(INSTANCE_TINT_LOCATION, 4, GL_FLOAT, GL_FALSE, sizeof(ModelInstance),
+			(GLvoid*)(base + offsetof(ModelInstance, tint)));
+		glVertexAttribDivisor(INSTANCE_TINT_LOCATION, 1);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	void InstanceBuffer::unbind()
+	{
+		for (GLuint column = 0; column < 4; column++)
+			glDisableVertexAttribArray(INSTANCE_TRANSFORM_LOCATION + column);
+		glDisableVertexAttribArray(INSTANCE_TINT_LOCATION);
+	}
+}
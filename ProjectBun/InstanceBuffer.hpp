@@ -0,0 +1,55 @@
+#ifndef InstanceBuffer_hpp
+#define InstanceBuffer_hpp
+
+#include <GL/glew.h>
+#include "glm/glm.hpp"
+
+#include <cstddef>
+
+namespace gps {
+
+    // Per-instance vertex data of an instanced draw
+    struct ModelInstance
+    {
+        // applied after the `model` uniform; rotation and uniform scale only,
+        // the normals are not renormalized against shearing
+        glm::mat4 transform;
+        // multiplies the lit diffuse and ambient colour
+        glm::vec4 tint;
+    };
+
+    // Attribute locations of ModelInstance in the vertex shaders; a mat4 takes four
+    const GLuint INSTANCE_TRANSFORM_LOCATION = 3;
+    const GLuint INSTANCE_TINT_LOCATION = 7;
+
+    // GL buffer of ModelInstance records, rewritten whenever the instances change.
+    // Created on the first upload, GL thread only.
+    class InstanceBuffer
+    {
+    public:
+        InstanceBuffer();
+        ~InstanceBuffer();
+
+        // Replaces the contents, orphaning the previous storage so draws still using it do not stall
+        void upload(const ModelInstance* instances, size_t count);
+
+        size_t getInstanceCount() const;
+
+        // Points the instance attributes of the bound VAO at the records from
+        // `firstInstance` on, advancing once per instance
+        void bind(size_t firstInstance) const;
+
+        // Turns the instance attributes of the bound VAO off again
+        static void unbind();
+
+    private:
+        GLuint buffer;
+        size_t capacity;
+        size_t count;
+
+        InstanceBuffer(const InstanceBuffer&);
+        InstanceBuffer& operator=(const InstanceBuffer&);
+    };
+}
+
+#endif /* InstanceBuffer_hpp */
@@ -0,0 +1,36 @@
+#include "MemoryStats.hpp"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#ifdef _MSC_VER
+#pragma comment(lib, "psapi.lib")
+#endif
+#else
+#include <sys/resource.h>
+#endif
+
+namespace gps {
+
+	size_t getPeakResidentMemory()
+	{
+#ifdef _WIN32
+		PROCESS_MEMORY_COUNTERS counters;
+		if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+			return 0;
+		return (size_t)counters.PeakWorkingSetSize;
+#else
+		struct rusage usage;
+		if (getrusage(RUSAGE_SELF, &usage) != 0)
+			return 0;
+#if defined(__APPLE__)
+		return (size_t)usage.ru_maxrss;
+#else
+		// kilobytes on Linux and the BSDs
+		return (size_t)usage.ru_maxrss * 1024;
+#endif
+#endif
+	}
+}
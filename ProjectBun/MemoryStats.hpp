@@ -0,0 +1,12 @@
+#ifndef MemoryStats_hpp
+#define MemoryStats_hpp
+
+#include <cstddef>
+
+namespace gps {
+
+    // Highest resident set size / working set of the process so far, in bytes (0 if unknown)
+    size_t getPeakResidentMemory();
+}
+
+#endif /* MemoryStats_hpp */
@@ -1,71 +1,327 @@
 #include "Mesh.hpp"
+#include "GLStateCache.hpp"
+
+#include <algorithm>
+
 namespace gps {
 
+	namespace {
+		struct OwnedGeometry {
+			std::vector<Vertex> vertices;
+			std::vector<GLuint> indices;
+		};
+	}
+
 	/* Mesh Constructor */
-	Mesh::Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures)
+	Mesh::Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures,
+		VertexFormat format, std::vector<MeshLod> lods)
+	{
+		std::shared_ptr<OwnedGeometry> geometry = std::make_shared<OwnedGeometry>();
+		geometry->vertices.swap(vertices);
+		geometry->indices.swap(indices);
+
+		this->storage = geometry;
+		this->vertexData = geometry->vertices.data();
+		this->vertexCount = geometry->vertices.size();
+		this->indexData = geometry->indices.data();
+		this->indexCount = geometry->indices.size();
+		this->textures = textures;
+		this->vertexFormat = format;
+		this->lods.swap(lods);
+
+		this->setupMesh();
+	}
+
+	Mesh::Mesh(std::shared_ptr<const void> storage, const Vertex* vertices, size_t vertexCount,
+		const GLuint* indices, size_t indexCount, std::vector<Texture> textures,
+		VertexFormat format, std::vector<MeshLod> lods)
 	{
-		this->vertices = vertices;
-		this->indices = indices;
+		this->storage = storage;
+		this->vertexData = vertices;
+		this->vertexCount = vertexCount;
+		this->indexData = indices;
+		this->indexCount = indexCount;
 		this->textures = textures;
+		this->vertexFormat = format;
+		this->lods.swap(lods);
 
 		this->setupMesh();
 	}
 
-	Buffers Mesh::getBuffers() {
-	    return this->buffers;
+	const ArenaAllocation& Mesh::getAllocation() const {
+		return *this->allocation;
+	}
+
+	const Vertex* Mesh::getVertices() const {
+		return this->vertexData;
+	}
+
+	size_t Mesh::getVertexCount() const {
+		return this->vertexCount;
+	}
+
+	const GLuint* Mesh::getIndices() const {
+		return this->indexData;
+	}
+
+	size_t Mesh::getIndexCount() const {
+		return this->indexCount;
+	}
+
+	const std::vector<MeshLod>& Mesh::getLods() const {
+		return this->lods;
+	}
+
+	VertexFormat Mesh::getVertexFormat() const {
+		return this->vertexFormat;
+	}
+
+	GLenum Mesh::getIndexType() const {
+		return this->indexType;
+	}
+
+	size_t Mesh::getGpuMemory() const {
+		size_t indexSize = this->indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+		return this->vertexCount * vertexStride(this->vertexFormat) + this->indexCount * indexSize;
+	}
+
+	void Mesh::releaseGeometry() {
+		this->storage.reset();
+		this->vertexData = NULL;
+		this->indexData = NULL;
 	}
 
 	/* Mesh drawing function - also applies associated textures */
-	void Mesh::Draw(gps::Shader shader)
+	void Mesh::Draw(gps::Shader shader) const
+	{
+		beginDraw(shader);
+		glDrawElementsBaseVertex(GL_TRIANGLES, (GLsizei)this->lods[0].indexCount, this->indexType,
+			(const GLvoid*)indexOffset(0), this->allocation->baseVertex);
+	}
+
+	void Mesh::Draw(gps::Shader shader, const LodView& lodView, ClusterCullStats* stats) const
+	{
+		drawLod(shader, getLodLevel(lodView), stats);
+	}
+
+	size_t Mesh::getLodLevel(const LodView& lodView) const
 	{
+		return selectLod(this->lods, this->boundsCenter, this->boundsRadius, lodView);
+	}
+
+	// Draws only the meshlets inside the view, and not facing away from it when
+	// the view culls back faces, or a whole coarser level when the camera is far enough
+	void Mesh::Draw(gps::Shader shader, const CullingView& view, const LodView& lodView, ClusterCullStats* stats) const
+	{
+		// GL thread only, reused to avoid allocating every frame
+		static std::vector<GLsizei> counts;
+		static std::vector<size_t> firstIndices;
+		static std::vector<const GLvoid*> offsets;
+		static std::vector<GLint> baseVertices;
+		counts.clear();
+		firstIndices.clear();
+		selectRanges(view, lodView, counts, firstIndices, stats);
+		if (counts.empty())
+			return;
+
+		offsets.resize(firstIndices.size());
+		for (size_t i = 0; i < firstIndices.size(); i++)
+			offsets[i] = (const GLvoid*)indexOffset(firstIndices[i]);
+		baseVertices.assign(counts.size(), this->allocation->baseVertex);
+
+		beginDraw(shader);
+		glMultiDrawElementsBaseVertex(GL_TRIANGLES, counts.data(), this->indexType, offsets.data(), (GLsizei)counts.size(),
+			baseVertices.data());
+	}
+
+	void Mesh::selectRanges(const CullingView& view, const LodView& lodView, std::vector<GLsizei>& counts,
+		std::vector<size_t>& firstIndices, ClusterCullStats* stats) const
+	{
+		size_t level = getLodLevel(lodView);
+		if (level == 0) {
+			this->meshlets->cull(view, counts, firstIndices, stats);
+			return;
+		}
+
+		// coarser levels are drawn whole, unless the mesh is entirely outside the view
+		const MeshLod& lod = this->lods[level];
+		bool visible = true;
+		for (int i = 0; i < 6 && visible; i++)
+			visible = glm::dot(glm::vec3(view.planes[i]), this->boundsCenter) + view.planes[i].w >= -this->boundsRadius;
+		if (stats) {
+			stats->triangles += this->lods[0].indexCount / 3;
+			if (visible)
+				stats->visibleTriangles += lod.indexCount / 3;
+		}
+		if (visible) {
+			counts.push_back((GLsizei)lod.indexCount);
+			firstIndices.push_back(lod.firstIndex);
+		}
+	}
+
+	void Mesh::drawLod(gps::Shader shader, size_t level, ClusterCullStats* stats) const
+	{
+		const MeshLod& lod = this->lods[level];
+		if (stats) {
+			stats->triangles += this->lods[0].indexCount / 3;
+			stats->visibleTriangles += lod.indexCount / 3;
+		}
+
+		beginDraw(shader);
+		glDrawElementsBaseVertex(GL_TRIANGLES, (GLsizei)lod.indexCount, this->indexType, (const GLvoid*)indexOffset(lod.firstIndex),
+			this->allocation->baseVertex);
+	}
+
+	const BoundingBox& Mesh::getBoundingBox() const {
+		return this->boundingBox;
+	}
+
+	GLuint Mesh::getVertexArray() const {
+		return this->allocation->vertexArray;
+	}
+
+	const VertexQuantization& Mesh::getQuantization() const {
+		return this->quantization;
+	}
+
+	const MeshletSet& Mesh::getMeshlets() const {
+		return *this->meshlets;
+	}
+
+	void Mesh::Draw(gps::Shader shader, const std::vector<MeshPart>& parts) const
+	{
+		beginDraw(shader);
+		for (size_t i = 0; i < parts.size(); i++) {
+			bindTextures(shader, parts[i].textures);
+			glDrawElementsBaseVertex(GL_TRIANGLES, (GLsizei)parts[i].indexCount, this->indexType,
+				(const GLvoid*)indexOffset(parts[i].firstIndex), this->allocation->baseVertex);
+		}
+	}
+
+	void Mesh::DrawInstanced(gps::Shader shader, const InstanceBuffer& instances, size_t firstInstance, size_t instanceCount,
+		size_t level) const
+	{
+		const MeshLod& lod = this->lods[level];
+		beginDraw(shader);
+		instances.bind(firstInstance);
+		glDrawElementsInstancedBaseVertex(GL_TRIANGLES, (GLsizei)lod.indexCount, this->indexType,
+			(const GLvoid*)indexOffset(lod.firstIndex), (GLsizei)instanceCount, this->allocation->baseVertex);
+		InstanceBuffer::unbind();
+	}
+
+	// Leaves the program, textures and VAO bound, the next draw only changes what differs
+	void Mesh::beginDraw(gps::Shader shader) const
+	{
+		static const UniformId POSITION_SCALE = Shader::getUniformId("positionScale");
+		static const UniformId POSITION_OFFSET = Shader::getUniformId("positionOffset");
+		static const UniformId TEX_COORD_SCALE = Shader::getUniformId("texCoordScale");
+		static const UniformId TEX_COORD_OFFSET = Shader::getUniformId("texCoordOffset");
+		static const UniformId OCTAHEDRAL_NORMALS = Shader::getUniformId("octahedralNormals");
+
 		shader.useShaderProgram();
 
 		//set textures
-		for (GLuint i = 0; i < textures.size(); i++)
+		bindTextures(shader, this->textures);
+
+		// undo the vertex packing, the uniforms are ignored by shaders without them
+		shader.setVec3(POSITION_SCALE, this->quantization.positionScale);
+		shader.setVec3(POSITION_OFFSET, this->quantization.positionOffset);
+		shader.setVec2(TEX_COORD_SCALE, this->quantization.texCoordScale);
+		shader.setVec2(TEX_COORD_OFFSET, this->quantization.texCoordOffset);
+		shader.setInt(OCTAHEDRAL_NORMALS, hasOctahedralNormals(this->vertexFormat));
+
+		GLStateCache::shared().bindVertexArray(this->allocation->vertexArray);
+	}
+
+	void Mesh::bindTextures(gps::Shader shader, const std::vector<Texture>& textures)
+	{
+		// units holding the textures of the last material, GL thread only
+		static GLuint materialUnits = 0;
+
+		// every sampler has its own unit in the program, textures it does not sample are skipped
+		GLStateCache& state = GLStateCache::shared();
+		GLuint textureUnits = 0;
+		for (size_t i = 0; i < textures.size(); i++)
 		{
-			glActiveTexture(GL_TEXTURE0 + i);
-			glUniform1i(glGetUniformLocation(shader.shaderProgram, this->textures[i].type.c_str()), i);
-			glBindTexture(GL_TEXTURE_2D, this->textures[i].id);
+			GLint unit = shader.getSamplerUnit(textures[i].sampler);
+			if (unit < 0)
+				continue;
+			state.bindTexture((GLuint)unit, GL_TEXTURE_2D, textures[i].id);
+			textureUnits |= 1u << unit;
 		}
 
-		glBindVertexArray(this->buffers.VAO);
-		glDrawElements(GL_TRIANGLES, this->indices.size(), GL_UNSIGNED_INT, 0);
-		glBindVertexArray(0);
-
-        for(GLuint i = 0; i < this->textures.size(); i++)
-        {
-            glActiveTexture(GL_TEXTURE0 + i);
-            glBindTexture(GL_TEXTURE_2D, 0);
-        }
+		// what the last material had and this one lacks reads as unbound
+		GLuint staleUnits = materialUnits & ~textureUnits;
+		for (GLuint unit = 0; staleUnits != 0; unit++, staleUnits >>= 1)
+		{
+			if (staleUnits & 1)
+				state.bindTexture(unit, GL_TEXTURE_2D, 0);
+		}
+		materialUnits = textureUnits;
+	}
 
-    }
+	size_t Mesh::indexOffset(size_t firstIndex) const {
+		size_t indexSize = this->indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+		return this->allocation->indexOffset + firstIndex * indexSize;
+	}
 
-	// Initializes all the buffer objects/arrays
+	// Copies the geometry into the shared GPU buffers
 	void Mesh::setupMesh(){
-		// Create buffers/arrays
-		glGenVertexArrays(1, &this->buffers.VAO);
-		glGenBuffers(1, &this->buffers.VBO);
-		glGenBuffers(1, &this->buffers.EBO);
+		if (this->lods.empty()) {
+			MeshLod full = { 0, (GLuint)this->indexCount, 0.0f };
+			this->lods.push_back(full);
+		}
+
+		glm::vec3 lower(0.0f);
+		glm::vec3 upper(0.0f);
+		for (size_t i = 0; i < this->vertexCount; i++) {
+			lower = i == 0 ? this->vertexData[i].Position : glm::min(lower, this->vertexData[i].Position);
+			upper = i == 0 ? this->vertexData[i].Position : glm::max(upper, this->vertexData[i].Position);
+		}
+		this->boundsCenter = (lower + upper) * 0.5f;
+		this->boundsRadius = glm::length(upper - lower) * 0.5f;
+		this->boundingBox.min = lower;
+		this->boundingBox.max = upper;
+
+		// meshlets follow the (cache optimized) triangle order of the full detail level
+		std::shared_ptr<MeshletSet> meshletSet = std::make_shared<MeshletSet>();
+		meshletSet->build(this->vertexData, this->vertexCount, this->indexData, this->lods[0].indexCount);
+		this->meshlets = meshletSet;
 
-		glBindVertexArray(this->buffers.VAO);
 		// Load data into vertex buffers
-		glBindBuffer(GL_ARRAY_BUFFER, this->buffers.VBO);
-		glBufferData(GL_ARRAY_BUFFER, this->vertices.size() * sizeof(Vertex), &this->vertices[0], GL_STATIC_DRAW);
-
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->buffers.EBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, this->indices.size() * sizeof(GLuint), &this->indices[0], GL_STATIC_DRAW);
-
-		// Set the vertex attribute pointers
-		// Vertex Positions
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)0);
-		// Vertex Normals
-		glEnableVertexAttribArray(1);
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, Normal));
-		// Vertex Texture Coords
-		glEnableVertexAttribArray(2);
-		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, TexCoords));
-
-		glBindVertexArray(0);
+		this->quantization = computeQuantization(this->vertexData, this->vertexCount, this->vertexFormat);
+		// indices are relative to the base vertex, so those of small meshes fit in half the space
+		this->indexType = this->vertexCount <= 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+		switch (this->vertexFormat) {
+		case VERTEX_FORMAT_COMPACT:
+			uploadVertices<CompactVertex>();
+			break;
+		case VERTEX_FORMAT_QUANTIZED:
+			uploadVertices<QuantizedVertex>();
+			break;
+		default:
+			uploadGeometry(this->vertexData);
+			break;
+		}
+	}
+
+	template <typename V> void Mesh::uploadVertices() {
+		std::vector<V> packed(this->vertexCount);
+		for (size_t i = 0; i < this->vertexCount; i++)
+			encodeVertex(this->vertexData[i], this->quantization, &packed[i]);
+		uploadGeometry(packed.data());
+	}
+
+	void Mesh::uploadGeometry(const void* vertices) {
+		GpuBufferArena& arena = GpuBufferArena::shared();
+		if (this->indexType == GL_UNSIGNED_SHORT) {
+			std::vector<GLushort> shortIndices(this->indexData, this->indexData + this->indexCount);
+			this->allocation = arena.allocate(this->vertexFormat, vertices, this->vertexCount,
+				shortIndices.data(), shortIndices.size() * sizeof(GLushort));
+		}
+		else {
+			this->allocation = arena.allocate(this->vertexFormat, vertices, this->vertexCount,
+				this->indexData, this->indexCount * sizeof(GLuint));
+		}
 	}
 }
@@ -5,25 +5,26 @@
 #include "glm/glm.hpp"
 
 #include "Shader.hpp"
+#include "VertexFormat.hpp"
+#include "Meshlets.hpp"
+#include "MeshLod.hpp"
+#include "GpuBufferArena.hpp"
+#include "InstanceBuffer.hpp"
 
+#include <memory>
 #include <string>
 #include <vector>
 
 
 namespace gps {
 
-struct Vertex
-{
-    glm::vec3 Position;
-    glm::vec3 Normal;
-    glm::vec2 TexCoords;
-};
-
 struct Texture
 {
     GLuint id;
     //ambientTexture, diffuseTexture, specularTexture
     std::string type;
+    // id of the sampler uniform named by type
+    UniformId sampler;
     std::string path;
 };
 
@@ -34,32 +35,128 @@ struct Material
         glm::vec3 specular;
     };
 
-struct Buffers {
-    GLuint VAO;
-    GLuint VBO;
-    GLuint EBO;
+// Index range of a mesh drawn with its own textures
+struct MeshPart {
+    GLuint firstIndex;
+    GLuint indexCount;
+    std::vector<Texture> textures;
 };
 
 class Mesh
 {
 public:
-    std::vector<Vertex> vertices;
-    std::vector<GLuint> indices;
     std::vector<Texture> textures;
 
-	Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures);
+	// `lods` are index ranges of coarser versions stored after the full mesh;
+	// without them all of `indices` is the only level
+	Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures,
+		VertexFormat format = VERTEX_FORMAT_FULL, std::vector<MeshLod> lods = std::vector<MeshLod>());
+
+	// Uses geometry owned by `storage` (e.g. a mapped cache file) without copying it
+	Mesh(std::shared_ptr<const void> storage, const Vertex* vertices, size_t vertexCount,
+		const GLuint* indices, size_t indexCount, std::vector<Texture> textures,
+		VertexFormat format = VERTEX_FORMAT_FULL, std::vector<MeshLod> lods = std::vector<MeshLod>());
+
+	// Where the geometry lives in the shared GPU buffers
+	const ArenaAllocation& getAllocation() const;
+
+	const Vertex* getVertices() const;
+	size_t getVertexCount() const;
+	const GLuint* getIndices() const;
+	// All levels of detail together
+	size_t getIndexCount() const;
+
+	// Full detail first, then coarser and coarser
+	const std::vector<MeshLod>& getLods() const;
+
+	VertexFormat getVertexFormat() const;
+	// GL_UNSIGNED_SHORT when every index fits in 16 bits, GL_UNSIGNED_INT otherwise
+	GLenum getIndexType() const;
+	// Bytes taken on the GPU by the vertex and index buffers
+	size_t getGpuMemory() const;
+
+	// Drops the CPU copy of the geometry once it lives on the GPU; the
+	// vertex/index pointers become null, the counts stay valid
+	void releaseGeometry();
+
+	// Draws the full detail level
+	void Draw(gps::Shader shader) const;
+
+	// Draws the coarsest level that looks the same from `lodView`
+	void Draw(gps::Shader shader, const LodView& lodView, ClusterCullStats* stats = NULL) const;
+
+	// As above, skipping what is outside `view` (in model space); at full detail
+	// the meshlets are culled and only the visible ones drawn
+	void Draw(gps::Shader shader, const CullingView& view, const LodView& lodView, ClusterCullStats* stats = NULL) const;
 
-	Buffers getBuffers();
+	// One draw call per part, binding the VAO and decode uniforms only once
+	void Draw(gps::Shader shader, const std::vector<MeshPart>& parts) const;
 
-	void Draw(gps::Shader shader);
+	// Draws `level` once for each of `instanceCount` records of `instances` from `firstInstance` on
+	void DrawInstanced(gps::Shader shader, const InstanceBuffer& instances, size_t firstInstance, size_t instanceCount,
+		size_t level = 0) const;
+
+	// Coarsest level that looks the same from `lodView`
+	size_t getLodLevel(const LodView& lodView) const;
+
+	// Appends the index ranges Draw(shader, view, lodView) draws, in indices
+	// from the start of the mesh
+	void selectRanges(const CullingView& view, const LodView& lodView, std::vector<GLsizei>& counts,
+		std::vector<size_t>& firstIndices, ClusterCullStats* stats = NULL) const;
+
+	// Bounds of the vertices in model space
+	const BoundingBox& getBoundingBox() const;
+
+	// VAO of the arena block holding the mesh, shared with the other meshes in it
+	GLuint getVertexArray() const;
+
+	// What the vertex shader needs to undo the packing of the vertex format
+	const VertexQuantization& getQuantization() const;
+
+	const MeshletSet& getMeshlets() const;
+
+	// Binds each texture to the unit of its sampler in the shader, skipping the
+	// ones it does not sample; units the previous textures used are unbound
+	static void bindTextures(gps::Shader shader, const std::vector<Texture>& textures);
 
 private:
-    /*  Render data  */
-    Buffers buffers;
+    /*  Geometry - stays valid for as long as `storage` is alive  */
+    std::shared_ptr<const void> storage;
+    const Vertex* vertexData;
+    size_t vertexCount;
+    const GLuint* indexData;
+    size_t indexCount;
 
-	// Initializes all the buffer objects/arrays
+    /*  Render data  */
+    // released back to the arena with the last copy of the mesh
+    std::shared_ptr<const ArenaAllocation> allocation;
+    VertexFormat vertexFormat;
+    VertexQuantization quantization;
+    GLenum indexType;
+    std::vector<MeshLod> lods;
+    // bounding sphere, for the level of detail and culling, and the box around the vertices
+    glm::vec3 boundsCenter;
+    float boundsRadius;
+    BoundingBox boundingBox;
+    // meshlets of the full detail level
+    std::shared_ptr<const MeshletSet> meshlets;
+
+	// Copies the geometry into the shared GPU buffers
 	void setupMesh();
 
+	// Binds textures, decode uniforms and the VAO
+	void beginDraw(gps::Shader shader) const;
+
+	// Draws one level of detail whole
+	void drawLod(gps::Shader shader, size_t level, ClusterCullStats* stats) const;
+
+	// Byte offset in the block's index buffer of the mesh's index `firstIndex`
+	size_t indexOffset(size_t firstIndex) const;
+
+	// Packs the vertices as V and hands them to the arena
+	template <typename V> void uploadVertices();
+	void uploadGeometry(const void* vertices);
+
 };
 
 }
@@ -0,0 +1,284 @@
+#include "MeshCache.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+namespace gps {
+
+	namespace {
+
+		// Bump whenever the layout or the import pipeline output changes
+		const uint32_t CACHE_VERSION = 5;
+		const char CACHE_MAGIC[8] = { 'G', 'P', 'S', 'M', 'E', 'S', 'H', 0 };
+		const size_t BLOB_ALIGNMENT = 16;
+
+		struct CacheHeader {
+			char magic[8];
+			uint32_t version;
+			uint32_t meshCount;
+			uint32_t sourceCount;
+			uint32_t reserved;
+			uint64_t buildKey;
+			uint64_t payloadSize;
+			uint64_t payloadChecksum;
+		};
+
+		size_t alignUp(size_t value, size_t alignment)
+		{
+			return (value + alignment - 1) & ~(alignment - 1);
+		}
+
+		class Writer {
+		public:
+			std::vector<unsigned char> bytes;
+
+			void put(const void* data, size_t size)
+			{
+				const unsigned char* p = (const unsigned char*)data;
+				bytes.insert(bytes.end(), p, p + size);
+			}
+			void putU32(uint32_t value) { put(&value, sizeof(value)); }
+			void putU64(uint64_t value) { put(&value, sizeof(value)); }
+			void putString(const std::string& value)
+			{
+				putU32((uint32_t)value.size());
+				put(value.data(), value.size());
+			}
+			void pad(size_t alignment)
+			{
+				bytes.resize(alignUp(bytes.size(), alignment), 0);
+			}
+		};
+
+		class Reader {
+		public:
+			Reader(const unsigned char* begin, const unsigned char* end) : cursor(begin), end(end), failed(false) {}
+
+			const unsigned char* cursor;
+			const unsigned char* end;
+			bool failed;
+
+			bool get(void* out, size_t size)
+			{
+				if (failed || (size_t)(end - cursor) < size) {
+					failed = true;
+					return false;
+				}
+				memcpy(out, cursor, size);
+				cursor += size;
+				return true;
+			}
+			uint32_t getU32() { uint32_t value = 0; get(&value, sizeof(value)); return value; }
+			uint64_t getU64() { uint64_t value = 0; get(&value, sizeof(value)); return value; }
+			std::string getString()
+			{
+				uint32_t length = getU32();
+				if (failed || (size_t)(end - cursor) < length) {
+					failed = true;
+					return std::string();
+				}
+				std::string value((const char*)cursor, length);
+				cursor += length;
+				return value;
+			}
+		};
+	}
+
+	std::string MeshCache::pathFor(const std::string& objFileName)
+	{
+		return objFileName + ".meshcache";
+	}
+
+	bool MeshCache::write(const std::string& cacheFileName, const std::vector<std::string>& sources,
+		const std::vector<std::string>& materialLibraries, uint64_t buildKey,
+		const std::vector<CachedMesh>& meshes)
+	{
+		Writer payload;
+
+		for (size_t i = 0; i < sources.size(); i++) {
+			FileStamp stamp;
+			uint64_t hash;
+			if (!getFileStamp(sources[i], &stamp) || !hashFile(sources[i], &hash))
+				return false;
+			payload.putString(sources[i]);
+			payload.putU64(stamp.size);
+			payload.putU64((uint64_t)stamp.modificationTime);
+			payload.putU64(hash);
+		}
+
+		payload.putU32((uint32_t)materialLibraries.size());
+		for (size_t i = 0; i < materialLibraries.size(); i++)
+			payload.putString(materialLibraries[i]);
+
+		// blob offsets are relative to the aligned end of the table
+		size_t blobSize = 0;
+		for (size_t i = 0; i < meshes.size(); i++) {
+			const CachedMesh& mesh = meshes[i];
+			payload.putU32((uint32_t)mesh.vertexCount);
+			payload.putU32((uint32_t)mesh.indexCount);
+			payload.putU64(blobSize);
+			blobSize = alignUp(blobSize + mesh.vertexCount * sizeof(Vertex), BLOB_ALIGNMENT);
+			payload.putU64(blobSize);
+			blobSize = alignUp(blobSize + mesh.indexCount * sizeof(GLuint), BLOB_ALIGNMENT);
+			payload.putString(mesh.material);
+
+			payload.putU32((uint32_t)mesh.textures.size());
+			for (size_t t = 0; t < mesh.textures.size(); t++) {
+				payload.putString(mesh.textures[t].type);
+				payload.putString(mesh.textures[t].path);
+			}
+
+			payload.putU32((uint32_t)mesh.lods.size());
+			for (size_t l = 0; l < mesh.lods.size(); l++) {
+				payload.putU32(mesh.lods[l].firstIndex);
+				payload.putU32(mesh.lods[l].indexCount);
+				payload.put(&mesh.lods[l].error, sizeof(float));
+			}
+		}
+		payload.pad(BLOB_ALIGNMENT);
+
+		payload.bytes.reserve(payload.bytes.size() + blobSize);
+		for (size_t i = 0; i < meshes.size(); i++) {
+			payload.put(meshes[i].vertices, meshes[i].vertexCount * sizeof(Vertex));
+			payload.pad(BLOB_ALIGNMENT);
+			payload.put(meshes[i].indices, meshes[i].indexCount * sizeof(GLuint));
+			payload.pad(BLOB_ALIGNMENT);
+		}
+
+		CacheHeader header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+		header.version = CACHE_VERSION;
+		header.meshCount = (uint32_t)meshes.size();
+		header.sourceCount = (uint32_t)sources.size();
+		header.buildKey = buildKey;
+		header.payloadSize = payload.bytes.size();
+		header.payloadChecksum = hashBytes(payload.bytes.data(), payload.bytes.size());
+
+		// write next to the final name and swap it in, so a crash never leaves a torn cache
+		std::string tempFileName = cacheFileName + ".tmp";
+		{
+			std::ofstream out(tempFileName.c_str(), std::ios::binary | std::ios::trunc);
+			if (!out)
+				return false;
+			out.write((const char*)&header, sizeof(header));
+			out.write((const char*)payload.bytes.data(), payload.bytes.size());
+			if (!out) {
+				out.close();
+				std::remove(tempFileName.c_str());
+				return false;
+			}
+		}
+
+		std::remove(cacheFileName.c_str());
+		if (std::rename(tempFileName.c_str(), cacheFileName.c_str()) != 0) {
+			std::remove(tempFileName.c_str());
+			return false;
+		}
+		return true;
+	}
+
+	std::shared_ptr<MeshCache> MeshCache::open(const std::string& cacheFileName, uint64_t buildKey)
+	{
+		std::shared_ptr<MeshCache> cache = std::make_shared<MeshCache>();
+		if (!cache->file.open(cacheFileName))
+			return std::shared_ptr<MeshCache>();
+
+		if (!cache->parse(buildKey)) {
+			std::cout << "Mesh cache " << cacheFileName << " is out of date" << std::endl;
+			return std::shared_ptr<MeshCache>();
+		}
+		return cache;
+	}
+
+	const std::vector<CachedMesh>& MeshCache::getMeshes() const
+	{
+		return meshes;
+	}
+
+	const std::vector<std::string>& MeshCache::getMaterialLibraries() const
+	{
+		return materialLibraries;
+	}
+
+	bool MeshCache::parse(uint64_t buildKey)
+	{
+		const unsigned char* base = file.data();
+
+		CacheHeader header;
+		if (file.size() < sizeof(header))
+			return false;
+		memcpy(&header, base, sizeof(header));
+
+		if (memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 ||
+			header.version != CACHE_VERSION ||
+			header.buildKey != buildKey ||
+			header.payloadSize != file.size() - sizeof(header))
+			return false;
+
+		const unsigned char* payload = base + sizeof(header);
+		if (hashBytes(payload, (size_t)header.payloadSize) != header.payloadChecksum)
+			return false;
+
+		Reader reader(payload, base + file.size());
+
+		for (uint32_t i = 0; i < header.sourceCount; i++) {
+			std::string fileName = reader.getString();
+			uint64_t size = reader.getU64();
+			int64_t modificationTime = (int64_t)reader.getU64();
+			uint64_t hash = reader.getU64();
+			if (reader.failed || !isFileUnchanged(fileName, size, modificationTime, hash))
+				return false;
+		}
+
+		uint32_t libraryCount = reader.getU32();
+		for (uint32_t i = 0; i < libraryCount && !reader.failed; i++)
+			materialLibraries.push_back(reader.getString());
+
+		std::vector<uint64_t> vertexOffsets(header.meshCount);
+		std::vector<uint64_t> indexOffsets(header.meshCount);
+		meshes.resize(header.meshCount);
+		for (uint32_t i = 0; i < header.meshCount; i++) {
+			CachedMesh& mesh = meshes[i];
+			mesh.vertexCount = reader.getU32();
+			mesh.indexCount = reader.getU32();
+			vertexOffsets[i] = reader.getU64();
+			indexOffsets[i] = reader.getU64();
+			mesh.material = reader.getString();
+
+			uint32_t textureCount = reader.getU32();
+			for (uint32_t t = 0; t < textureCount && !reader.failed; t++) {
+				TextureReference texture;
+				texture.type = reader.getString();
+				texture.path = reader.getString();
+				mesh.textures.push_back(texture);
+			}
+
+			uint32_t lodCount = reader.getU32();
+			for (uint32_t l = 0; l < lodCount && !reader.failed; l++) {
+				MeshLod lod;
+				lod.firstIndex = reader.getU32();
+				lod.indexCount = reader.getU32();
+				reader.get(&lod.error, sizeof(float));
+				if (lod.firstIndex > mesh.indexCount || lod.indexCount > mesh.indexCount - lod.firstIndex)
+					return false;
+				mesh.lods.push_back(lod);
+			}
+		}
+		if (reader.failed)
+			return false;
+
+		size_t blobStart = alignUp((size_t)(reader.cursor - base), BLOB_ALIGNMENT);
+		for (uint32_t i = 0; i < header.meshCount; i++) {
+			CachedMesh& mesh = meshes[i];
+			if (blobStart + vertexOffsets[i] + mesh.vertexCount * sizeof(Vertex) > file.size() ||
+				blobStart + indexOffsets[i] + mesh.indexCount * sizeof(GLuint) > file.size())
+				return false;
+			mesh.vertices = (const Vertex*)(base + blobStart + vertexOffsets[i]);
+			mesh.indices = (const GLuint*)(base + blobStart + indexOffsets[i]);
+		}
+		return true;
+	}
+}
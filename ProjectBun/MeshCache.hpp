@@ -0,0 +1,67 @@
+#ifndef MeshCache_hpp
+#define MeshCache_hpp
+
+#include "Mesh.hpp"
+#include "FileUtils.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    // A texture a mesh refers to - resolved by the model when the cache is read
+    struct TextureReference
+    {
+        std::string type;
+        std::string path;
+    };
+
+    // One assembled mesh; points either into caller memory (when writing)
+    // or straight into the mapped cache file (when reading)
+    struct CachedMesh
+    {
+        const Vertex* vertices;
+        size_t vertexCount;
+        const GLuint* indices;
+        size_t indexCount;
+        // name of the material the textures come from ("" = none)
+        std::string material;
+        std::vector<TextureReference> textures;
+        // levels of detail, as index ranges of `indices`
+        std::vector<MeshLod> lods;
+    };
+
+    // Versioned, checksummed binary image of a loaded model, stored next to the
+    // source .obj. It is rejected when any of its source files changed or when
+    // it was built with different import options.
+    class MeshCache
+    {
+    public:
+        // Cache file used for a given .obj
+        static std::string pathFor(const std::string& objFileName);
+
+        // Writes `meshes` to `cacheFileName`; `sources` are the files the data was built from
+        // and `materialLibraries` the .mtl names the model refers to
+        static bool write(const std::string& cacheFileName, const std::vector<std::string>& sources,
+            const std::vector<std::string>& materialLibraries, uint64_t buildKey,
+            const std::vector<CachedMesh>& meshes);
+
+        // Maps and validates a cache file, null when it is missing, stale or corrupt.
+        // The returned object owns the mapping the mesh pointers refer to.
+        static std::shared_ptr<MeshCache> open(const std::string& cacheFileName, uint64_t buildKey);
+
+        const std::vector<CachedMesh>& getMeshes() const;
+        const std::vector<std::string>& getMaterialLibraries() const;
+
+    private:
+        MappedFile file;
+        std::vector<CachedMesh> meshes;
+        std::vector<std::string> materialLibraries;
+
+        bool parse(uint64_t buildKey);
+    };
+}
+
+#endif /* MeshCache_hpp */
@@ -0,0 +1,419 @@
+#include "MeshLod.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+
+namespace gps {
+
+	namespace {
+
+		const GLuint NO_POSITION = ~0u;
+		// constraint planes keeping borders and seams in place, relative to the faces
+		const double BORDER_WEIGHT = 10.0;
+		const double SEAM_WEIGHT = 1.0;
+
+		struct Quadric {
+			double a00, a11, a22, a01, a02, a12;
+			double b0, b1, b2;
+			double c;
+			double weight;
+		};
+
+		void addPlane(Quadric& q, const glm::vec3& normal, double distance, double weight)
+		{
+			double x = normal.x, y = normal.y, z = normal.z;
+			q.a00 += weight * x * x;
+			q.a11 += weight * y * y;
+			q.a22 += weight * z * z;
+			q.a01 += weight * x * y;
+			q.a02 += weight * x * z;
+			q.a12 += weight * y * z;
+			q.b0 += weight * x * distance;
+			q.b1 += weight * y * distance;
+			q.b2 += weight * z * distance;
+			q.c += weight * distance * distance;
+			q.weight += weight;
+		}
+
+		void addQuadric(Quadric& q, const Quadric& other)
+		{
+			q.a00 += other.a00; q.a11 += other.a11; q.a22 += other.a22;
+			q.a01 += other.a01; q.a02 += other.a02; q.a12 += other.a12;
+			q.b0 += other.b0; q.b1 += other.b1; q.b2 += other.b2;
+			q.c += other.c;
+			q.weight += other.weight;
+		}
+
+		// Weighted mean squared distance of p to the planes of the quadric
+		double quadricError(const Quadric& q, const glm::vec3& p)
+		{
+			double x = p.x, y = p.y, z = p.z;
+			double r = q.a00 * x * x + q.a11 * y * y + q.a22 * z * z
+				+ 2.0 * (q.a01 * x * y + q.a02 * x * z + q.a12 * y * z)
+				+ 2.0 * (q.b0 * x + q.b1 * y + q.b2 * z) + q.c;
+			return q.weight > 0.0 ? std::fabs(r) / q.weight : 0.0;
+		}
+
+		uint64_t edgeKey(GLuint from, GLuint to)
+		{
+			return ((uint64_t)from << 32) | to;
+		}
+
+		struct Collapse {
+			GLuint from;
+			GLuint to;
+			double error;
+		};
+
+		class Simplifier {
+		public:
+			Simplifier(const std::vector<Vertex>& vertices, const GLuint* indices, size_t indexCount)
+				: vertices(vertices), indices(indices, indices + indexCount - indexCount % 3)
+			{
+				buildPositions();
+				buildQuadrics();
+			}
+
+			float run(size_t targetIndexCount, float maxError)
+			{
+				double maxSquaredError = (double)maxError * maxError;
+				double reachedError = 0.0;
+
+				while (indices.size() > targetIndexCount) {
+					size_t trianglesToRemove = (indices.size() - targetIndexCount) / 3;
+					size_t removed = runPass(trianglesToRemove, maxSquaredError, reachedError);
+					if (removed == 0)
+						break;
+				}
+				return (float)std::sqrt(reachedError);
+			}
+
+			void getIndices(std::vector<GLuint>& destination) const
+			{
+				destination = indices;
+			}
+
+		private:
+			const std::vector<Vertex>& vertices;
+			std::vector<GLuint> indices;
+			// vertices with the same position share one id
+			std::vector<GLuint> positionOf;
+			std::vector<GLuint> positionVertex;
+			std::vector<Quadric> quadrics;
+			std::vector<char> onBorder;
+			std::unordered_map<uint64_t, char> borderEdges;
+
+			void buildPositions()
+			{
+				std::vector<GLuint> order(vertices.size());
+				for (size_t i = 0; i < order.size(); i++)
+					order[i] = (GLuint)i;
+				std::sort(order.begin(), order.end(), [this](GLuint a, GLuint b) {
+					const glm::vec3& pa = vertices[a].Position;
+					const glm::vec3& pb = vertices[b].Position;
+					if (pa.x != pb.x) return pa.x < pb.x;
+					if (pa.y != pb.y) return pa.y < pb.y;
+					return pa.z < pb.z;
+				});
+
+				positionOf.assign(vertices.size(), NO_POSITION);
+				for (size_t i = 0; i < order.size(); i++) {
+					if (i == 0 || !(vertices[order[i]].Position == vertices[order[i - 1]].Position))
+						positionVertex.push_back(order[i]);
+					positionOf[order[i]] = (GLuint)positionVertex.size() - 1;
+				}
+			}
+
+			const glm::vec3& positionAt(GLuint position) const
+			{
+				return vertices[positionVertex[position]].Position;
+			}
+
+			void buildQuadrics()
+			{
+				Quadric empty = Quadric();
+				quadrics.assign(positionVertex.size(), empty);
+				onBorder.assign(positionVertex.size(), 0);
+
+				// directed position edge -> the vertices used at its ends
+				std::unordered_map<uint64_t, std::pair<GLuint, GLuint> > edges;
+				edges.reserve(indices.size());
+				for (size_t i = 0; i < indices.size(); i += 3) {
+					for (int k = 0; k < 3; k++) {
+						GLuint a = indices[i + k];
+						GLuint b = indices[i + (k + 1) % 3];
+						edges[edgeKey(positionOf[a], positionOf[b])] = std::make_pair(a, b);
+					}
+				}
+
+				for (size_t i = 0; i < indices.size(); i += 3) {
+					const glm::vec3& p0 = vertices[indices[i + 0]].Position;
+					const glm::vec3& p1 = vertices[indices[i + 1]].Position;
+					const glm::vec3& p2 = vertices[indices[i + 2]].Position;
+					glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+					float area = glm::length(normal);
+					if (area == 0.0f)
+						continue;
+					normal /= area;
+
+					for (int k = 0; k < 3; k++)
+						addPlane(quadrics[positionOf[indices[i + k]]], normal, -glm::dot(normal, p0), area);
+
+					for (int k = 0; k < 3; k++) {
+						GLuint a = indices[i + k];
+						GLuint b = indices[i + (k + 1) % 3];
+						GLuint pa = positionOf[a];
+						GLuint pb = positionOf[b];
+						if (pa == pb)
+							continue;
+
+						// open border: no triangle walks the edge the other way;
+						// seam: the triangle that does uses other vertices
+						std::unordered_map<uint64_t, std::pair<GLuint, GLuint> >::const_iterator opposite = edges.find(edgeKey(pb, pa));
+						double weight;
+						if (opposite == edges.end()) {
+							weight = BORDER_WEIGHT;
+							onBorder[pa] = 1;
+							onBorder[pb] = 1;
+							borderEdges[edgeKey(pa, pb)] = 1;
+							borderEdges[edgeKey(pb, pa)] = 1;
+						}
+						else if (opposite->second.first != b || opposite->second.second != a)
+							weight = SEAM_WEIGHT;
+						else
+							continue;
+
+						const glm::vec3& ea = vertices[a].Position;
+						const glm::vec3& eb = vertices[b].Position;
+						glm::vec3 edge = eb - ea;
+						float length = glm::length(edge);
+						glm::vec3 planeNormal = glm::cross(edge, normal);
+						float planeLength = glm::length(planeNormal);
+						if (planeLength == 0.0f)
+							continue;
+						planeNormal /= planeLength;
+
+						double constraintWeight = weight * length * length;
+						addPlane(quadrics[pa], planeNormal, -glm::dot(planeNormal, ea), constraintWeight);
+						addPlane(quadrics[pb], planeNormal, -glm::dot(planeNormal, ea), constraintWeight);
+					}
+				}
+			}
+
+			// Triangles around every position of the current index buffer
+			void buildAdjacency(std::vector<GLuint>& offsets, std::vector<GLuint>& triangles) const
+			{
+				offsets.assign(positionVertex.size() + 1, 0);
+				for (size_t i = 0; i < indices.size(); i++)
+					offsets[positionOf[indices[i]] + 1]++;
+				for (size_t p = 0; p < positionVertex.size(); p++)
+					offsets[p + 1] += offsets[p];
+
+				triangles.resize(indices.size());
+				std::vector<GLuint> cursor(offsets.begin(), offsets.end() - 1);
+				for (size_t i = 0; i < indices.size(); i++)
+					triangles[cursor[positionOf[indices[i]]]++] = (GLuint)(i / 3);
+			}
+
+			// Every vertex used at `from` must have exactly one counterpart at `to`,
+			// taken from the triangles that disappear with the collapse
+			bool mapVertices(GLuint from, GLuint to, const GLuint* triangles, size_t triangleCount,
+				std::vector<std::pair<GLuint, GLuint> >& mapping) const
+			{
+				mapping.clear();
+				for (size_t t = 0; t < triangleCount; t++) {
+					const GLuint* triangle = &indices[triangles[t] * 3];
+					GLuint fromVertex = NO_POSITION;
+					GLuint toVertex = NO_POSITION;
+					for (int k = 0; k < 3; k++) {
+						if (positionOf[triangle[k]] == from)
+							fromVertex = triangle[k];
+						else if (positionOf[triangle[k]] == to)
+							toVertex = triangle[k];
+					}
+					if (toVertex == NO_POSITION)
+						continue;
+
+					bool known = false;
+					for (size_t m = 0; m < mapping.size(); m++) {
+						if (mapping[m].first == fromVertex) {
+							if (mapping[m].second != toVertex)
+								return false;
+							known = true;
+						}
+					}
+					if (!known)
+						mapping.push_back(std::make_pair(fromVertex, toVertex));
+				}
+				if (mapping.empty())
+					return false;
+
+				for (size_t t = 0; t < triangleCount; t++) {
+					const GLuint* triangle = &indices[triangles[t] * 3];
+					for (int k = 0; k < 3; k++) {
+						if (positionOf[triangle[k]] != from)
+							continue;
+						bool mapped = false;
+						for (size_t m = 0; m < mapping.size() && !mapped; m++)
+							mapped = mapping[m].first == triangle[k];
+						if (!mapped)
+							return false;
+					}
+				}
+				return true;
+			}
+
+			// Moving `from` onto `to` must not turn any remaining triangle over
+			bool flipsTriangle(GLuint from, GLuint to, const GLuint* triangles, size_t triangleCount) const
+			{
+				const glm::vec3& target = positionAt(to);
+				for (size_t t = 0; t < triangleCount; t++) {
+					const GLuint* triangle = &indices[triangles[t] * 3];
+					glm::vec3 before[3];
+					glm::vec3 after[3];
+					bool collapses = false;
+					for (int k = 0; k < 3; k++) {
+						GLuint position = positionOf[triangle[k]];
+						collapses = collapses || position == to;
+						before[k] = positionAt(position);
+						after[k] = position == from ? target : before[k];
+					}
+					if (collapses)
+						continue;
+
+					glm::vec3 n0 = glm::cross(before[1] - before[0], before[2] - before[0]);
+					glm::vec3 n1 = glm::cross(after[1] - after[0], after[2] - after[0]);
+					if (glm::dot(n0, n1) <= 0.0f)
+						return true;
+				}
+				return false;
+			}
+
+			size_t runPass(size_t trianglesToRemove, double maxSquaredError, double& reachedError)
+			{
+				std::vector<GLuint> offsets;
+				std::vector<GLuint> triangles;
+				buildAdjacency(offsets, triangles);
+
+				// candidate collapses: every half-edge once covers both directions of an
+				// inner edge, borders only run one way and get the reverse added
+				std::vector<Collapse> collapses;
+				std::vector<std::pair<GLuint, GLuint> > mapping;
+				collapses.reserve(indices.size());
+				for (size_t i = 0; i < indices.size(); i += 3) {
+					for (int k = 0; k < 3; k++) {
+						GLuint a = positionOf[indices[i + k]];
+						GLuint b = positionOf[indices[i + (k + 1) % 3]];
+						if (a == b)
+							continue;
+						bool borderEdge = onBorder[a] && onBorder[b] && borderEdges.find(edgeKey(a, b)) != borderEdges.end();
+						for (int d = 0; d < (borderEdge ? 2 : 1); d++) {
+							GLuint from = d == 0 ? a : b;
+							GLuint to = d == 0 ? b : a;
+							// border vertices only slide along the border
+							if (onBorder[from] && !borderEdge)
+								continue;
+							Collapse collapse = { from, to, quadricError(quadrics[from], positionAt(to)) };
+							if (collapse.error > maxSquaredError)
+								continue;
+							if (!mapVertices(from, to, &triangles[offsets[from]], offsets[from + 1] - offsets[from], mapping))
+								continue;
+							collapses.push_back(collapse);
+						}
+					}
+				}
+				std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) {
+					return a.error < b.error;
+				});
+
+				// cheapest first; a collapse locks its neighbourhood for the rest of the pass
+				std::vector<char> locked(positionVertex.size(), 0);
+				std::vector<GLuint> vertexRemap(vertices.size());
+				for (size_t v = 0; v < vertexRemap.size(); v++)
+					vertexRemap[v] = (GLuint)v;
+				size_t removed = 0;
+
+				for (size_t c = 0; c < collapses.size() && removed < trianglesToRemove; c++) {
+					GLuint from = collapses[c].from;
+					GLuint to = collapses[c].to;
+					if (locked[from] || locked[to])
+						continue;
+
+					const GLuint* around = &triangles[offsets[from]];
+					size_t aroundCount = offsets[from + 1] - offsets[from];
+					bool neighbourLocked = false;
+					for (size_t t = 0; t < aroundCount && !neighbourLocked; t++) {
+						for (int k = 0; k < 3; k++)
+							neighbourLocked = neighbourLocked || locked[positionOf[indices[around[t] * 3 + k]]];
+					}
+					if (neighbourLocked)
+						continue;
+					if (!mapVertices(from, to, around, aroundCount, mapping))
+						continue;
+					if (flipsTriangle(from, to, around, aroundCount))
+						continue;
+
+					for (size_t m = 0; m < mapping.size(); m++)
+						vertexRemap[mapping[m].first] = mapping[m].second;
+					for (size_t t = 0; t < aroundCount; t++) {
+						bool collapsing = false;
+						for (int k = 0; k < 3; k++) {
+							GLuint position = positionOf[indices[around[t] * 3 + k]];
+							locked[position] = 1;
+							collapsing = collapsing || position == to;
+						}
+						removed += collapsing;
+					}
+					addQuadric(quadrics[to], quadrics[from]);
+					reachedError = std::max(reachedError, collapses[c].error);
+				}
+
+				// rewrite the triangles, dropping the ones that collapsed
+				size_t write = 0;
+				for (size_t i = 0; i < indices.size(); i += 3) {
+					GLuint a = vertexRemap[indices[i + 0]];
+					GLuint b = vertexRemap[indices[i + 1]];
+					GLuint c = vertexRemap[indices[i + 2]];
+					if (positionOf[a] == positionOf[b] || positionOf[b] == positionOf[c] || positionOf[a] == positionOf[c])
+						continue;
+					indices[write++] = a;
+					indices[write++] = b;
+					indices[write++] = c;
+				}
+				indices.resize(write);
+				return removed;
+			}
+		};
+	}
+
+	LodView makeLodView(const glm::mat4& projection, float viewportHeight, const glm::vec3& cameraPosition,
+		const glm::mat4& model, float maxScreenError)
+	{
+		// errors and distances are both in model units, so the model scale cancels out
+		LodView view;
+		view.cameraPosition = glm::vec3(glm::inverse(model) * glm::vec4(cameraPosition, 1.0f));
+		view.errorScale = 0.5f * viewportHeight * projection[1][1] / maxScreenError;
+		return view;
+	}
+
+	size_t selectLod(const std::vector<MeshLod>& lods, const glm::vec3& center, float radius, const LodView& view)
+	{
+		// the closest point of the bounds decides, so no part of the mesh gets too coarse
+		float distance = std::max(glm::length(center - view.cameraPosition) - radius, 1e-6f);
+		size_t level = 0;
+		while (level + 1 < lods.size() && lods[level + 1].error * view.errorScale <= distance)
+			level++;
+		return level;
+	}
+
+	float simplifyMesh(std::vector<GLuint>& destination, const std::vector<Vertex>& vertices,
+		const GLuint* indices, size_t indexCount, size_t targetIndexCount, float maxError)
+	{
+		Simplifier simplifier(vertices, indices, indexCount);
+		float error = simplifier.run(targetIndexCount, maxError);
+		simplifier.getIndices(destination);
+		return error;
+	}
+}
@@ -0,0 +1,48 @@
+#ifndef MeshLod_hpp
+#define MeshLod_hpp
+
+#include <GL/glew.h>
+#include "glm/glm.hpp"
+
+#include "VertexFormat.hpp"
+
+#include <cstddef>
+#include <vector>
+
+namespace gps {
+
+    // One level of detail: a range of the mesh's index buffer and how far
+    // (in model units) its surface strays from the full detail one
+    struct MeshLod
+    {
+        GLuint firstIndex;
+        GLuint indexCount;
+        float error;
+    };
+
+    // What levels of detail are picked against, in the model space of the mesh
+    struct LodView
+    {
+        glm::vec3 cameraPosition;
+        // pixels covered by one unit of error at distance 1, over the allowed pixels
+        float errorScale;
+    };
+
+    // A level is used while its error projects to at most `maxScreenError` pixels
+    LodView makeLodView(const glm::mat4& projection, float viewportHeight, const glm::vec3& cameraPosition,
+        const glm::mat4& model, float maxScreenError);
+
+    // Coarsest level whose error is invisible from `view` for a mesh with the given bounding sphere
+    size_t selectLod(const std::vector<MeshLod>& lods, const glm::vec3& center, float radius, const LodView& view);
+
+    // Quadric error metric simplification by edge collapse (Garland & Heckbert).
+    // Only the index buffer changes, the LOD reuses the vertex buffer. Vertices
+    // sharing a position but not normals/texcoords (seams) only move along the
+    // seam and take their attributes with them; open borders stay in place.
+    // Stops at `targetIndexCount` or when the next collapse would move the
+    // surface by more than `maxError` (model units). Returns the error reached.
+    float simplifyMesh(std::vector<GLuint>& destination, const std::vector<Vertex>& vertices,
+        const GLuint* indices, size_t indexCount, size_t targetIndexCount, float maxError);
+}
+
+#endif /* MeshLod_hpp */
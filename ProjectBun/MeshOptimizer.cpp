@@ -0,0 +1,519 @@
+#include "MeshOptimizer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+namespace gps {
+
+	namespace {
+
+		const size_t VERTEX_KEY_SIZE = 8;
+
+		struct VertexKey {
+			uint32_t v[VERTEX_KEY_SIZE];
+		};
+
+		uint32_t quantize(float value, float epsilon)
+		{
+			if (epsilon > 0.0f)
+				return (uint32_t)(int32_t)std::floor(value / epsilon + 0.5f);
+
+			// -0.0 and 0.0 must land in the same bucket
+			if (value == 0.0f)
+				value = 0.0f;
+			uint32_t bits;
+			memcpy(&bits, &value, sizeof(bits));
+			return bits;
+		}
+
+		VertexKey makeKey(const Vertex& vertex, float epsilon)
+		{
+			VertexKey key;
+			key.v[0] = quantize(vertex.Position.x, epsilon);
+			key.v[1] = quantize(vertex.Position.y, epsilon);
+			key.v[2] = quantize(vertex.Position.z, epsilon);
+			key.v[3] = quantize(vertex.Normal.x, epsilon);
+			key.v[4] = quantize(vertex.Normal.y, epsilon);
+			key.v[5] = quantize(vertex.Normal.z, epsilon);
+			key.v[6] = quantize(vertex.TexCoords.x, epsilon);
+			key.v[7] = quantize(vertex.TexCoords.y, epsilon);
+			return key;
+		}
+
+		uint32_t hashKey(const VertexKey& key)
+		{
+			// murmur-style mixing of each attribute word
+			uint32_t h = 2166136261u;
+			for (size_t i = 0; i < VERTEX_KEY_SIZE; i++) {
+				uint32_t k = key.v[i] * 0xcc9e2d51u;
+				k = (k << 15) | (k >> 17);
+				h ^= k * 0x1b873593u;
+				h = ((h << 13) | (h >> 19)) * 5 + 0xe6546b64u;
+			}
+			h ^= h >> 16;
+			h *= 0x85ebca6bu;
+			h ^= h >> 13;
+			return h;
+		}
+
+		const GLuint EMPTY_SLOT = ~0u;
+		const GLuint NO_VERTEX = ~0u;
+
+		// Triangles using each vertex, as offsets into one shared array
+		struct TriangleAdjacency {
+			std::vector<GLuint> counts;
+			std::vector<GLuint> offsets;
+			std::vector<GLuint> triangles;
+		};
+
+		void buildAdjacency(const std::vector<GLuint>& indices, size_t vertexCount, TriangleAdjacency& adjacency)
+		{
+			adjacency.counts.assign(vertexCount, 0);
+			adjacency.offsets.assign(vertexCount, 0);
+			adjacency.triangles.resize(indices.size());
+
+			for (size_t i = 0; i < indices.size(); i++)
+				adjacency.counts[indices[i]]++;
+
+			GLuint offset = 0;
+			for (size_t v = 0; v < vertexCount; v++) {
+				adjacency.offsets[v] = offset;
+				offset += adjacency.counts[v];
+			}
+
+			// fill using the offsets as cursors, then move them back
+			for (size_t i = 0; i < indices.size(); i++)
+				adjacency.triangles[adjacency.offsets[indices[i]]++] = (GLuint)(i / 3);
+			for (size_t v = 0; v < vertexCount; v++)
+				adjacency.offsets[v] -= adjacency.counts[v];
+		}
+
+		// Next vertex with live triangles: recent dead ends first, then in input order
+		GLuint skipDeadEnd(std::vector<GLuint>& deadEnd, const std::vector<GLuint>& liveCount, size_t& cursor)
+		{
+			while (!deadEnd.empty()) {
+				GLuint vertex = deadEnd.back();
+				deadEnd.pop_back();
+				if (liveCount[vertex] > 0)
+					return vertex;
+			}
+			while (cursor < liveCount.size()) {
+				if (liveCount[cursor] > 0)
+					return (GLuint)cursor;
+				cursor++;
+			}
+			return NO_VERTEX;
+		}
+
+		// FIFO cache with timestamps; returns how many of the triangle's vertices missed
+		unsigned updateCache(const GLuint* triangle, std::vector<unsigned>& timestamps, unsigned& time, unsigned cacheSize)
+		{
+			unsigned misses = 0;
+			for (int k = 0; k < 3; k++) {
+				if (time - timestamps[triangle[k]] > cacheSize) {
+					timestamps[triangle[k]] = time++;
+					misses++;
+				}
+			}
+			return misses;
+		}
+
+		struct Cluster {
+			size_t begin;
+			size_t end;
+			float sortKey;
+		};
+	}
+
+	size_t weldVertices(std::vector<Vertex>& vertices, std::vector<GLuint>& indices, float epsilon)
+	{
+		if (vertices.empty())
+			return 0;
+
+		// open addressing table, kept at most half full
+		size_t tableSize = 1;
+		while (tableSize < vertices.size() * 2)
+			tableSize <<= 1;
+		std::vector<GLuint> table(tableSize, EMPTY_SLOT);
+
+		std::vector<VertexKey> keys;
+		keys.reserve(vertices.size());
+		std::vector<GLuint> remap(vertices.size());
+		size_t unique = 0;
+
+		for (size_t i = 0; i < vertices.size(); i++) {
+			VertexKey key = makeKey(vertices[i], epsilon);
+			size_t slot = hashKey(key) & (tableSize - 1);
+
+			for (;;) {
+				GLuint candidate = table[slot];
+				if (candidate == EMPTY_SLOT) {
+					table[slot] = (GLuint)unique;
+					remap[i] = (GLuint)unique;
+					vertices[unique] = vertices[i];
+					keys.push_back(key);
+					unique++;
+					break;
+				}
+				if (memcmp(&keys[candidate], &key, sizeof(key)) == 0) {
+					remap[i] = candidate;
+					break;
+				}
+				slot = (slot + 1) & (tableSize - 1);
+			}
+		}
+
+		vertices.resize(unique);
+		for (size_t i = 0; i < indices.size(); i++)
+			indices[i] = remap[indices[i]];
+
+		return unique;
+	}
+
+	VertexWelder::VertexWelder(float epsilon) : epsilon(epsilon)
+	{
+	}
+
+	void VertexWelder::addCorner(const Vertex& vertex)
+	{
+		// same half-full bound as weldVertices
+		if ((vertices.size() + 1) * 2 > table.size())
+			grow();
+
+		VertexKey key = makeKey(vertex, epsilon);
+		size_t slot = hashKey(key) & (table.size() - 1);
+
+		for (;;) {
+			GLuint candidate = table[slot];
+			if (candidate == EMPTY_SLOT) {
+				table[slot] = (GLuint)vertices.size();
+				indices.push_back((GLuint)vertices.size());
+				vertices.push_back(vertex);
+				return;
+			}
+			// keys are recomputed rather than stored to keep the footprint down
+			VertexKey candidateKey = makeKey(vertices[candidate], epsilon);
+			if (memcmp(&candidateKey, &key, sizeof(key)) == 0) {
+				indices.push_back(candidate);
+				return;
+			}
+			slot = (slot + 1) & (table.size() - 1);
+		}
+	}
+
+	size_t VertexWelder::getCornerCount() const
+	{
+		return indices.size();
+	}
+
+	void VertexWelder::release(std::vector<Vertex>& vertices, std::vector<GLuint>& indices)
+	{
+		vertices.clear();
+		indices.clear();
+		vertices.swap(this->vertices);
+		indices.swap(this->indices);
+		std::vector<GLuint>().swap(table);
+	}
+
+	void VertexWelder::grow()
+	{
+		size_t tableSize = table.empty() ? 1024 : table.size() * 2;
+		table.assign(tableSize, EMPTY_SLOT);
+
+		for (size_t i = 0; i < vertices.size(); i++) {
+			size_t slot = hashKey(makeKey(vertices[i], epsilon)) & (tableSize - 1);
+			while (table[slot] != EMPTY_SLOT)
+				slot = (slot + 1) & (tableSize - 1);
+			table[slot] = (GLuint)i;
+		}
+	}
+
+	void optimizeVertexCache(std::vector<GLuint>& indices, size_t vertexCount, unsigned cacheSize)
+	{
+		if (indices.size() < 3 || vertexCount == 0)
+			return;
+
+		TriangleAdjacency adjacency;
+		buildAdjacency(indices, vertexCount, adjacency);
+
+		std::vector<GLuint> liveCount(adjacency.counts);
+		// a vertex is in the cache while time - timestamp <= cacheSize
+		std::vector<unsigned> timestamps(vertexCount, 0);
+		std::vector<char> emitted(indices.size() / 3, 0);
+		std::vector<GLuint> deadEnd;
+		deadEnd.reserve(indices.size());
+		std::vector<GLuint> candidates;
+		std::vector<GLuint> result;
+		result.reserve(indices.size());
+
+		unsigned time = cacheSize + 1;
+		size_t cursor = 0;
+		GLuint fan = skipDeadEnd(deadEnd, liveCount, cursor);
+
+		while (fan != NO_VERTEX) {
+			// emit every live triangle around the fanning vertex
+			candidates.clear();
+			const GLuint* triangles = &adjacency.triangles[adjacency.offsets[fan]];
+			for (GLuint t = 0; t < adjacency.counts[fan]; t++) {
+				GLuint triangle = triangles[t];
+				if (emitted[triangle])
+					continue;
+				emitted[triangle] = 1;
+
+				for (int k = 0; k < 3; k++) {
+					GLuint vertex = indices[triangle * 3 + k];
+					result.push_back(vertex);
+					deadEnd.push_back(vertex);
+					candidates.push_back(vertex);
+					liveCount[vertex]--;
+					if (time - timestamps[vertex] > cacheSize)
+						timestamps[vertex] = time++;
+				}
+			}
+
+			// prefer the oldest candidate that stays in the cache while its fan is emitted
+			GLuint next = NO_VERTEX;
+			int bestPriority = -1;
+			for (size_t i = 0; i < candidates.size(); i++) {
+				GLuint vertex = candidates[i];
+				if (liveCount[vertex] == 0)
+					continue;
+				int priority = 0;
+				if (time - timestamps[vertex] + 2 * liveCount[vertex] <= cacheSize)
+					priority = (int)(time - timestamps[vertex]);
+				if (priority > bestPriority) {
+					bestPriority = priority;
+					next = vertex;
+				}
+			}
+			if (next == NO_VERTEX)
+				next = skipDeadEnd(deadEnd, liveCount, cursor);
+			fan = next;
+		}
+
+		indices.swap(result);
+	}
+
+	void optimizeOverdraw(std::vector<GLuint>& indices, const std::vector<Vertex>& vertices,
+		float threshold, unsigned cacheSize)
+	{
+		size_t triangleCount = indices.size() / 3;
+		if (triangleCount == 0 || vertices.empty())
+			return;
+
+		std::vector<unsigned> timestamps(vertices.size(), 0);
+		unsigned time = cacheSize + 1;
+
+		// hard boundaries: triangles missing all three vertices, where the cache starts over
+		std::vector<size_t> hardBoundaries;
+		for (size_t t = 0; t < triangleCount; t++) {
+			if (updateCache(&indices[t * 3], timestamps, time, cacheSize) == 3)
+				hardBoundaries.push_back(t);
+		}
+		if (hardBoundaries.empty() || hardBoundaries[0] != 0)
+			hardBoundaries.insert(hardBoundaries.begin(), 0);
+		hardBoundaries.push_back(triangleCount);
+
+		// soft boundaries: split a cluster as soon as its prefix is about as
+		// cache efficient as the whole cluster, within the threshold
+		std::vector<Cluster> clusters;
+		for (size_t h = 0; h + 1 < hardBoundaries.size(); h++) {
+			size_t begin = hardBoundaries[h];
+			size_t end = hardBoundaries[h + 1];
+
+			time += cacheSize + 1;
+			size_t clusterMisses = 0;
+			for (size_t t = begin; t < end; t++)
+				clusterMisses += updateCache(&indices[t * 3], timestamps, time, cacheSize);
+			float clusterThreshold = threshold * (float)clusterMisses / (float)(end - begin);
+
+			time += cacheSize + 1;
+			size_t runningMisses = 0;
+			size_t runningTriangles = 0;
+			size_t clusterBegin = begin;
+			for (size_t t = begin; t < end; t++) {
+				runningMisses += updateCache(&indices[t * 3], timestamps, time, cacheSize);
+				runningTriangles++;
+				if ((float)runningMisses / (float)runningTriangles <= clusterThreshold && t + 1 < end) {
+					Cluster cluster = { clusterBegin, t + 1, 0.0f };
+					clusters.push_back(cluster);
+					clusterBegin = t + 1;
+					time += cacheSize + 1;
+					runningMisses = 0;
+					runningTriangles = 0;
+				}
+			}
+			Cluster cluster = { clusterBegin, end, 0.0f };
+			clusters.push_back(cluster);
+		}
+
+		// area weighted centroids and normals
+		glm::vec3 meshCentroid(0.0f);
+		for (size_t i = 0; i < indices.size(); i++)
+			meshCentroid += vertices[indices[i]].Position;
+		meshCentroid /= (float)indices.size();
+
+		for (size_t c = 0; c < clusters.size(); c++) {
+			glm::vec3 centroid(0.0f);
+			glm::vec3 normal(0.0f);
+			float area = 0.0f;
+			for (size_t t = clusters[c].begin; t < clusters[c].end; t++) {
+				const glm::vec3& a = vertices[indices[t * 3 + 0]].Position;
+				const glm::vec3& b = vertices[indices[t * 3 + 1]].Position;
+				const glm::vec3& d = vertices[indices[t * 3 + 2]].Position;
+				glm::vec3 faceNormal = glm::cross(b - a, d - a);
+				float faceArea = glm::length(faceNormal);
+				centroid += (a + b + d) * (faceArea / 3.0f);
+				normal += faceNormal;
+				area += faceArea;
+			}
+			if (area > 0.0f)
+				centroid /= area;
+			float normalLength = glm::length(normal);
+			if (normalLength > 0.0f)
+				normal /= normalLength;
+
+			clusters[c].sortKey = glm::dot(centroid - meshCentroid, normal);
+		}
+
+		// outward facing clusters first, they occlude the rest of the mesh
+		std::stable_sort(clusters.begin(), clusters.end(), [](const Cluster& a, const Cluster& b) {
+			return a.sortKey > b.sortKey;
+		});
+
+		std::vector<GLuint> result;
+		result.reserve(indices.size());
+		for (size_t c = 0; c < clusters.size(); c++)
+			result.insert(result.end(), indices.begin() + clusters[c].begin * 3, indices.begin() + clusters[c].end * 3);
+		// a trailing partial triangle is kept as is
+		result.insert(result.end(), indices.begin() + triangleCount * 3, indices.end());
+		indices.swap(result);
+	}
+
+	void optimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<GLuint>& indices)
+	{
+		std::vector<GLuint> remap(vertices.size(), NO_VERTEX);
+		std::vector<Vertex> result;
+		result.reserve(vertices.size());
+
+		for (size_t i = 0; i < indices.size(); i++) {
+			GLuint& slot = remap[indices[i]];
+			if (slot == NO_VERTEX) {
+				slot = (GLuint)result.size();
+				result.push_back(vertices[indices[i]]);
+			}
+			indices[i] = slot;
+		}
+		vertices.swap(result);
+	}
+
+	VertexCacheStats analyzeVertexCache(const std::vector<GLuint>& indices, size_t vertexCount, unsigned cacheSize)
+	{
+		VertexCacheStats stats;
+		stats.transformedVertices = 0;
+		stats.triangles = indices.size() / 3;
+		stats.vertices = vertexCount;
+
+		std::vector<unsigned> timestamps(vertexCount, 0);
+		unsigned time = cacheSize + 1;
+		for (size_t t = 0; t < stats.triangles; t++)
+			stats.transformedVertices += updateCache(&indices[t * 3], timestamps, time, cacheSize);
+
+		stats.acmr = stats.triangles ? (float)stats.transformedVertices / stats.triangles : 0.0f;
+		stats.atvr = stats.vertices ? (float)stats.transformedVertices / stats.vertices : 0.0f;
+		return stats;
+	}
+
+	OverdrawStats analyzeOverdraw(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices)
+	{
+		const int GRID_SIZE = 256;
+
+		OverdrawStats stats;
+		stats.pixelsCovered = 0;
+		stats.pixelsShaded = 0;
+		stats.overdraw = 0.0f;
+		if (vertices.empty() || indices.size() < 3)
+			return stats;
+
+		glm::vec3 minPosition = vertices[0].Position;
+		glm::vec3 maxPosition = vertices[0].Position;
+		for (size_t i = 1; i < vertices.size(); i++) {
+			for (int c = 0; c < 3; c++) {
+				minPosition[c] = std::min(minPosition[c], vertices[i].Position[c]);
+				maxPosition[c] = std::max(maxPosition[c], vertices[i].Position[c]);
+			}
+		}
+		glm::vec3 extent = maxPosition - minPosition;
+		float scale = std::max(extent.x, std::max(extent.y, extent.z));
+		if (scale <= 0.0f)
+			return stats;
+		scale = (GRID_SIZE - 1) / scale;
+
+		std::vector<float> depth(GRID_SIZE * GRID_SIZE);
+		for (int view = 0; view < 6; view++) {
+			int axis = view / 2;
+			float direction = view % 2 ? -1.0f : 1.0f;
+			int uAxis = (axis + 1) % 3;
+			int vAxis = (axis + 2) % 3;
+			std::fill(depth.begin(), depth.end(), 2.0f);
+
+			for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+				const glm::vec3& a = vertices[indices[t + 0]].Position;
+				const glm::vec3& b = vertices[indices[t + 1]].Position;
+				const glm::vec3& c = vertices[indices[t + 2]].Position;
+
+				// looking along +/- axis, faces pointing the same way are culled
+				glm::vec3 faceNormal = glm::cross(b - a, c - a);
+				if (faceNormal[axis] * direction >= 0.0f)
+					continue;
+
+				float x[3], y[3], z[3];
+				const glm::vec3* corners[3] = { &a, &b, &c };
+				for (int k = 0; k < 3; k++) {
+					x[k] = ((*corners[k])[uAxis] - minPosition[uAxis]) * scale;
+					y[k] = ((*corners[k])[vAxis] - minPosition[vAxis]) * scale;
+					// 0 is nearest to the viewer
+					float d = ((*corners[k])[axis] - minPosition[axis]) / (extent[axis] > 0.0f ? extent[axis] : 1.0f);
+					z[k] = direction > 0.0f ? d : 1.0f - d;
+				}
+
+				float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+				if (area == 0.0f)
+					continue;
+				float invArea = 1.0f / area;
+
+				int minX = std::max(0, (int)std::floor(std::min(x[0], std::min(x[1], x[2]))));
+				int maxX = std::min(GRID_SIZE - 1, (int)std::ceil(std::max(x[0], std::max(x[1], x[2]))));
+				int minY = std::max(0, (int)std::floor(std::min(y[0], std::min(y[1], y[2]))));
+				int maxY = std::min(GRID_SIZE - 1, (int)std::ceil(std::max(y[0], std::max(y[1], y[2]))));
+
+				for (int py = minY; py <= maxY; py++) {
+					for (int px = minX; px <= maxX; px++) {
+						float sx = px + 0.5f;
+						float sy = py + 0.5f;
+						// barycentrics, the sign of the area makes both windings work
+						float w0 = ((x[1] - sx) * (y[2] - sy) - (x[2] - sx) * (y[1] - sy)) * invArea;
+						float w1 = ((x[2] - sx) * (y[0] - sy) - (x[0] - sx) * (y[2] - sy)) * invArea;
+						float w2 = 1.0f - w0 - w1;
+						if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f)
+							continue;
+
+						float fragmentDepth = w0 * z[0] + w1 * z[1] + w2 * z[2];
+						float& stored = depth[py * GRID_SIZE + px];
+						if (fragmentDepth < stored) {
+							if (stored > 1.0f)
+								stats.pixelsCovered++;
+							stored = fragmentDepth;
+							stats.pixelsShaded++;
+						}
+					}
+				}
+			}
+		}
+
+		stats.overdraw = stats.pixelsCovered ? (float)stats.pixelsShaded / stats.pixelsCovered : 0.0f;
+		return stats;
+	}
+}
@@ -0,0 +1,81 @@
+#ifndef MeshOptimizer_hpp
+#define MeshOptimizer_hpp
+
+#include "Mesh.hpp"
+
+#include <vector>
+
+namespace gps {
+
+    // Merges vertices with identical position/normal/texcoord and rewrites the
+    // index buffer to reference the survivors. With epsilon > 0 attributes are
+    // snapped to a grid of that size before comparison.
+    // Returns the number of unique vertices left.
+    size_t weldVertices(std::vector<Vertex>& vertices, std::vector<GLuint>& indices, float epsilon = 0.0f);
+
+    // Incremental counterpart of weldVertices for geometry that arrives one
+    // corner at a time, so the unwelded corner list never has to be built.
+    // Produces the same vertices and indices as weldVertices would.
+    class VertexWelder
+    {
+    public:
+        explicit VertexWelder(float epsilon = 0.0f);
+
+        void addCorner(const Vertex& vertex);
+
+        size_t getCornerCount() const;
+
+        // Hands over the welded geometry and starts a new, empty mesh
+        void release(std::vector<Vertex>& vertices, std::vector<GLuint>& indices);
+
+    private:
+        float epsilon;
+        std::vector<Vertex> vertices;
+        std::vector<GLuint> indices;
+        std::vector<GLuint> table;
+
+        void grow();
+    };
+
+    // Reorders triangles for the post-transform vertex cache with Tipsify
+    // (Sander et al. 2007), assuming a FIFO cache of `cacheSize` entries
+    void optimizeVertexCache(std::vector<GLuint>& indices, size_t vertexCount, unsigned cacheSize = 16);
+
+    // Splits cache-ordered triangles into clusters and sorts them so outward
+    // facing clusters come first, cutting overdraw. `threshold` bounds how
+    // much the ACMR may get worse (1.05 = 5%).
+    void optimizeOverdraw(std::vector<GLuint>& indices, const std::vector<Vertex>& vertices,
+        float threshold = 1.05f, unsigned cacheSize = 16);
+
+    // Renumbers vertices in the order the indices first use them, so fetches
+    // walk the vertex buffer forward. Unreferenced vertices are dropped.
+    void optimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<GLuint>& indices);
+
+    struct VertexCacheStats
+    {
+        size_t transformedVertices;
+        size_t triangles;
+        size_t vertices;
+        // average cache miss ratio - transformed vertices per triangle
+        float acmr;
+        // average transform to vertex ratio, 1 is optimal
+        float atvr;
+    };
+
+    // Simulates a FIFO post-transform cache over the index buffer
+    VertexCacheStats analyzeVertexCache(const std::vector<GLuint>& indices, size_t vertexCount, unsigned cacheSize = 16);
+
+    struct OverdrawStats
+    {
+        size_t pixelsCovered;
+        size_t pixelsShaded;
+        // shaded / covered, 1 means no overdraw
+        float overdraw;
+    };
+
+    // Rasterizes the mesh in submission order from the six axis directions
+    // with depth testing and backface culling, and counts shaded fragments
+    OverdrawStats analyzeOverdraw(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices);
+}
+
+#endif /* MeshOptimizer_hpp */
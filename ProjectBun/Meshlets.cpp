@@ -0,0 +1,317 @@
+#include "Meshlets.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define GPS_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace gps {
+
+	namespace {
+
+		// cone culling is skipped for meshlets whose normals spread wider than this
+		const float MIN_CONE_DOT = 0.1f;
+		const float NO_CONE_CUTOFF = 2.0f;
+
+		glm::vec4 getRow(const glm::mat4& m, int row)
+		{
+			return glm::vec4(m[0][row], m[1][row], m[2][row], m[3][row]);
+		}
+
+		glm::vec4 normalizePlane(const glm::vec4& plane)
+		{
+			float length = std::sqrt(plane.x * plane.x + plane.y * plane.y + plane.z * plane.z);
+			return length > 0.0f ? plane / length : plane;
+		}
+
+#ifndef GPS_USE_SSE2
+		// Visibility of one meshlet, same tests as the SIMD path
+		bool isVisible(const CullingView& view, float cx, float cy, float cz, float r,
+			float ax, float ay, float az, float cutoff)
+		{
+			for (int p = 0; p < 6; p++) {
+				const glm::vec4& plane = view.planes[p];
+				if (plane.x * cx + plane.y * cy + plane.z * cz + plane.w < -r)
+					return false;
+			}
+
+			if (!view.backFacesCulled)
+				return true;
+
+			float dx = cx - view.cameraPosition.x;
+			float dy = cy - view.cameraPosition.y;
+			float dz = cz - view.cameraPosition.z;
+			float distance = std::sqrt(dx * dx + dy * dy + dz * dz);
+			return dx * ax + dy * ay + dz * az < cutoff * distance + r * (1.0f + cutoff);
+		}
+#endif
+
+		void appendRange(const Meshlet& meshlet, std::vector<GLsizei>& counts, std::vector<size_t>& firstIndices)
+		{
+			size_t first = (size_t)meshlet.triangleOffset * 3;
+			GLsizei count = (GLsizei)meshlet.triangleCount * 3;
+			if (!counts.empty() && firstIndices.back() + counts.back() == first)
+				counts.back() += count;
+			else {
+				firstIndices.push_back(first);
+				counts.push_back(count);
+			}
+		}
+	}
+
+	CullingView makeCullingView(const glm::mat4& viewProjection, const glm::vec3& cameraPosition, const glm::mat4& model)
+	{
+		// Gribb/Hartmann: planes of the clip volume of the combined matrix are in model space
+		glm::mat4 matrix = viewProjection * model;
+		glm::vec4 x = getRow(matrix, 0);
+		glm::vec4 y = getRow(matrix, 1);
+		glm::vec4 z = getRow(matrix, 2);
+		glm::vec4 w = getRow(matrix, 3);
+
+		CullingView view;
+		view.planes[0] = normalizePlane(w + x);
+		view.planes[1] = normalizePlane(w - x);
+		view.planes[2] = normalizePlane(w + y);
+		view.planes[3] = normalizePlane(w - y);
+		view.planes[4] = normalizePlane(w + z);
+		view.planes[5] = normalizePlane(w - z);
+		view.cameraPosition = glm::vec3(glm::inverse(model) * glm::vec4(cameraPosition, 1.0f));
+		view.backFacesCulled = false;
+		return view;
+	}
+
+	BoundingBox transformBox(const BoundingBox& box, const glm::mat4& transform)
+	{
+		// Arvo: the extent along each world axis sums the absolute contributions of the box axes
+		glm::vec3 center = glm::vec3(transform * glm::vec4((box.min + box.max) * 0.5f, 1.0f));
+		glm::vec3 extent = (box.max - box.min) * 0.5f;
+		glm::vec3 worldExtent(0.0f);
+		for (int row = 0; row < 3; row++) {
+			for (int column = 0; column < 3; column++)
+				worldExtent[row] += std::fabs(transform[column][row]) * extent[column];
+		}
+		BoundingBox result = { center - worldExtent, center + worldExtent };
+		return result;
+	}
+
+	BoundingBox mergeBoxes(const BoundingBox& a, const BoundingBox& b)
+	{
+		BoundingBox result = { glm::min(a.min, b.min), glm::max(a.max, b.max) };
+		return result;
+	}
+
+	MeshletSet::MeshletSet() : triangleCount(0)
+	{
+	}
+
+	void MeshletSet::build(const Vertex* vertices, size_t vertexCount, const GLuint* indices, size_t indexCount)
+	{
+		meshlets.clear();
+		triangleCount = indexCount / 3;
+
+		// meshlet that last used each vertex, + 1
+		std::vector<GLuint> usedBy(vertexCount, 0);
+		Meshlet current = { 0, 0, 0 };
+		GLuint stamp = 1;
+
+		for (size_t t = 0; t < triangleCount; t++) {
+			const GLuint* triangle = indices + t * 3;
+			GLuint newVertices = 0;
+			for (int k = 0; k < 3; k++) {
+				if (usedBy[triangle[k]] != stamp) {
+					usedBy[triangle[k]] = stamp;
+					newVertices++;
+				}
+			}
+
+			if (current.vertexCount + newVertices > MAX_VERTICES || current.triangleCount == MAX_TRIANGLES) {
+				meshlets.push_back(current);
+				current.triangleOffset = (GLuint)t;
+				current.triangleCount = 0;
+				current.vertexCount = 0;
+
+				// this triangle opens the next meshlet
+				stamp++;
+				newVertices = 0;
+				for (int k = 0; k < 3; k++) {
+					if (usedBy[triangle[k]] != stamp) {
+						usedBy[triangle[k]] = stamp;
+						newVertices++;
+					}
+				}
+			}
+
+			current.vertexCount += newVertices;
+			current.triangleCount++;
+		}
+		if (current.triangleCount > 0)
+			meshlets.push_back(current);
+
+		size_t paddedCount = (meshlets.size() + 3) & ~(size_t)3;
+		centerX.assign(paddedCount, 0.0f);
+		centerY.assign(paddedCount, 0.0f);
+		centerZ.assign(paddedCount, 0.0f);
+		radius.assign(paddedCount, -1e30f);
+		axisX.assign(paddedCount, 0.0f);
+		axisY.assign(paddedCount, 0.0f);
+		axisZ.assign(paddedCount, 0.0f);
+		cutoff.assign(paddedCount, NO_CONE_CUTOFF);
+
+		for (size_t i = 0; i < meshlets.size(); i++)
+			computeBounds(vertices, indices, i);
+	}
+
+	const std::vector<Meshlet>& MeshletSet::getMeshlets() const
+	{
+		return meshlets;
+	}
+
+	void MeshletSet::computeBounds(const Vertex* vertices, const GLuint* indices, size_t i)
+	{
+		const Meshlet& meshlet = meshlets[i];
+		const GLuint* begin = indices + (size_t)meshlet.triangleOffset * 3;
+		const GLuint* end = begin + (size_t)meshlet.triangleCount * 3;
+
+		// Ritter's sphere: start from two far apart corners, then grow to fit the rest
+		glm::vec3 first = vertices[begin[0]].Position;
+		glm::vec3 a = first;
+		float best = -1.0f;
+		for (const GLuint* p = begin; p != end; p++) {
+			glm::vec3 d = vertices[*p].Position - first;
+			if (glm::dot(d, d) > best) {
+				best = glm::dot(d, d);
+				a = vertices[*p].Position;
+			}
+		}
+		glm::vec3 b = a;
+		best = -1.0f;
+		for (const GLuint* p = begin; p != end; p++) {
+			glm::vec3 d = vertices[*p].Position - a;
+			if (glm::dot(d, d) > best) {
+				best = glm::dot(d, d);
+				b = vertices[*p].Position;
+			}
+		}
+
+		glm::vec3 center = (a + b) * 0.5f;
+		float r = glm::length(b - a) * 0.5f;
+		for (const GLuint* p = begin; p != end; p++) {
+			glm::vec3 d = vertices[*p].Position - center;
+			float distance = glm::length(d);
+			if (distance > r) {
+				float grownRadius = (r + distance) * 0.5f;
+				center += d * ((grownRadius - r) / distance);
+				r = grownRadius;
+			}
+		}
+
+		// normal cone from the face normals
+		glm::vec3 axis(0.0f);
+		for (const GLuint* p = begin; p != end; p += 3) {
+			glm::vec3 normal = glm::cross(vertices[p[1]].Position - vertices[p[0]].Position,
+				vertices[p[2]].Position - vertices[p[0]].Position);
+			float length = glm::length(normal);
+			if (length > 0.0f)
+				axis += normal / length;
+		}
+
+		float axisLength = glm::length(axis);
+		float coneCutoff = NO_CONE_CUTOFF;
+		if (axisLength > 0.0f) {
+			axis /= axisLength;
+			float minDot = 1.0f;
+			for (const GLuint* p = begin; p != end; p += 3) {
+				glm::vec3 normal = glm::cross(vertices[p[1]].Position - vertices[p[0]].Position,
+					vertices[p[2]].Position - vertices[p[0]].Position);
+				float length = glm::length(normal);
+				if (length > 0.0f)
+					minDot = std::min(minDot, glm::dot(normal / length, axis));
+			}
+			// all normals within acos(minDot) of the axis: cull when the whole
+			// sphere is seen at more than 90 degrees minus that from the axis
+			if (minDot > MIN_CONE_DOT)
+				coneCutoff = std::sqrt(1.0f - minDot * minDot);
+		}
+
+		centerX[i] = center.x;
+		centerY[i] = center.y;
+		centerZ[i] = center.z;
+		radius[i] = r;
+		axisX[i] = axis.x;
+		axisY[i] = axis.y;
+		axisZ[i] = axis.z;
+		cutoff[i] = coneCutoff;
+	}
+
+	void MeshletSet::cull(const CullingView& view, std::vector<GLsizei>& counts, std::vector<size_t>& firstIndices,
+		ClusterCullStats* stats) const
+	{
+		size_t visibleClusters = 0;
+		size_t visibleTriangles = 0;
+
+#ifdef GPS_USE_SSE2
+		__m128 cameraX = _mm_set1_ps(view.cameraPosition.x);
+		__m128 cameraY = _mm_set1_ps(view.cameraPosition.y);
+		__m128 cameraZ = _mm_set1_ps(view.cameraPosition.z);
+		__m128 one = _mm_set1_ps(1.0f);
+
+		for (size_t i = 0; i < meshlets.size(); i += 4) {
+			__m128 cx = _mm_loadu_ps(&centerX[i]);
+			__m128 cy = _mm_loadu_ps(&centerY[i]);
+			__m128 cz = _mm_loadu_ps(&centerZ[i]);
+			__m128 r = _mm_loadu_ps(&radius[i]);
+			__m128 negativeRadius = _mm_sub_ps(_mm_setzero_ps(), r);
+
+			__m128 visible = _mm_castsi128_ps(_mm_set1_epi32(-1));
+			for (int p = 0; p < 6; p++) {
+				const glm::vec4& plane = view.planes[p];
+				__m128 distance = _mm_add_ps(
+					_mm_add_ps(_mm_mul_ps(cx, _mm_set1_ps(plane.x)), _mm_mul_ps(cy, _mm_set1_ps(plane.y))),
+					_mm_add_ps(_mm_mul_ps(cz, _mm_set1_ps(plane.z)), _mm_set1_ps(plane.w)));
+				visible = _mm_and_ps(visible, _mm_cmpge_ps(distance, negativeRadius));
+			}
+
+			if (view.backFacesCulled) {
+				__m128 dx = _mm_sub_ps(cx, cameraX);
+				__m128 dy = _mm_sub_ps(cy, cameraY);
+				__m128 dz = _mm_sub_ps(cz, cameraZ);
+				__m128 distance = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+				__m128 axisDot = _mm_add_ps(
+					_mm_add_ps(_mm_mul_ps(dx, _mm_loadu_ps(&axisX[i])), _mm_mul_ps(dy, _mm_loadu_ps(&axisY[i]))),
+					_mm_mul_ps(dz, _mm_loadu_ps(&axisZ[i])));
+				__m128 c = _mm_loadu_ps(&cutoff[i]);
+				__m128 limit = _mm_add_ps(_mm_mul_ps(c, distance), _mm_mul_ps(r, _mm_add_ps(one, c)));
+				visible = _mm_and_ps(visible, _mm_cmplt_ps(axisDot, limit));
+			}
+
+			int mask = _mm_movemask_ps(visible);
+			for (int lane = 0; lane < 4 && mask; lane++, mask >>= 1) {
+				if (mask & 1) {
+					const Meshlet& meshlet = meshlets[i + lane];
+					appendRange(meshlet, counts, firstIndices);
+					visibleClusters++;
+					visibleTriangles += meshlet.triangleCount;
+				}
+			}
+		}
+#else
+		for (size_t i = 0; i < meshlets.size(); i++) {
+			if (isVisible(view, centerX[i], centerY[i], centerZ[i], radius[i], axisX[i], axisY[i], axisZ[i], cutoff[i])) {
+				appendRange(meshlets[i], counts, firstIndices);
+				visibleClusters++;
+				visibleTriangles += meshlets[i].triangleCount;
+			}
+		}
+#endif
+
+		if (stats) {
+			stats->clusters += meshlets.size();
+			stats->visibleClusters += visibleClusters;
+			stats->triangles += triangleCount;
+			stats->visibleTriangles += visibleTriangles;
+		}
+	}
+}
@@ -0,0 +1,97 @@
+#ifndef Meshlets_hpp
+#define Meshlets_hpp
+
+#include <GL/glew.h>
+#include "glm/glm.hpp"
+
+#include "VertexFormat.hpp"
+
+#include <cstddef>
+#include <vector>
+
+namespace gps {
+
+    // Contiguous run of triangles in a mesh's index buffer
+    struct Meshlet
+    {
+        GLuint triangleOffset;
+        GLuint triangleCount;
+        GLuint vertexCount;
+    };
+
+    // What a draw is culled against, in the model space of the mesh
+    struct CullingView
+    {
+        // frustum planes (xyz = normal pointing inside, w = distance), normalized
+        glm::vec4 planes[6];
+        glm::vec3 cameraPosition;
+        // set by the caller when the draw culls back faces; only then are
+        // meshlets facing away from the camera skipped
+        bool backFacesCulled;
+    };
+
+    // Moves the camera frustum and position into the space `model` maps from,
+    // for a draw that shows both sides of its triangles
+    CullingView makeCullingView(const glm::mat4& viewProjection, const glm::vec3& cameraPosition, const glm::mat4& model);
+
+    // Axis aligned bounding box
+    struct BoundingBox
+    {
+        glm::vec3 min;
+        glm::vec3 max;
+    };
+
+    // Smallest box holding `box` after it is moved by `transform`
+    BoundingBox transformBox(const BoundingBox& box, const glm::mat4& transform);
+
+    BoundingBox mergeBoxes(const BoundingBox& a, const BoundingBox& b);
+
+    struct ClusterCullStats
+    {
+        size_t clusters;
+        size_t visibleClusters;
+        size_t triangles;
+        size_t visibleTriangles;
+    };
+
+    // Splits a mesh into meshlets along its index order, so the vertex cache
+    // order is kept and every meshlet is an index range, with a bounding sphere
+    // and a normal cone for each
+    class MeshletSet
+    {
+    public:
+        static const size_t MAX_VERTICES = 64;
+        static const size_t MAX_TRIANGLES = 124;
+
+        MeshletSet();
+
+        void build(const Vertex* vertices, size_t vertexCount, const GLuint* indices, size_t indexCount);
+
+        const std::vector<Meshlet>& getMeshlets() const;
+
+        // Appends the index ranges (first index, index count) of the meshlets
+        // inside the frustum, and not facing away from the camera when the view
+        // culls back faces, merging neighbours. Four meshlets are tested at a time.
+        void cull(const CullingView& view, std::vector<GLsizei>& counts, std::vector<size_t>& firstIndices,
+            ClusterCullStats* stats) const;
+
+    private:
+        std::vector<Meshlet> meshlets;
+        size_t triangleCount;
+        // bounds as structure of arrays, padded to a multiple of 4 with meshlets that never pass
+        std::vector<float> centerX;
+        std::vector<float> centerY;
+        std::vector<float> centerZ;
+        std::vector<float> radius;
+        std::vector<float> axisX;
+        std::vector<float> axisY;
+        std::vector<float> axisZ;
+        // sine of the cone spread, > 1 when the cone test can not cull
+        std::vector<float> cutoff;
+
+        // Bounding sphere and normal cone of meshlet i
+        void computeBounds(const Vertex* vertices, const GLuint* indices, size_t i);
+    };
+}
+
+#endif /* Meshlets_hpp */
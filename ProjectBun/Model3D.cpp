@@ -1,16 +1,381 @@
 #include "Model3D.hpp"
+#include "MemoryStats.hpp"
+#include "MeshCache.hpp"
+#include "MeshLod.hpp"
+#include "MeshOptimizer.hpp"
+#include "ModelRegistry.hpp"
+#include "TextureCache.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <functional>
 
 namespace gps {
 
+	namespace {
+		// Remembers which .mtl files an .obj pulled in, so the mesh cache can watch them too
+		class SourceTrackingMaterialReader : public tinyobj::MaterialReader {
+		public:
+			explicit SourceTrackingMaterialReader(const std::string& basePath)
+				: basePath(basePath), fileReader(basePath) {}
+
+			virtual bool operator()(const std::string& matId,
+				std::vector<tinyobj::material_t>* materials,
+				std::map<std::string, int>* matMap, std::string* err) {
+				libraries.push_back(matId);
+				sourceFiles.push_back(basePath + matId);
+				return fileReader(matId, materials, matMap, err);
+			}
+
+			// .mtl names as written in the .obj
+			const std::vector<std::string>& getLibraries() const {
+				return libraries;
+			}
+
+			const std::vector<std::string>& getSourceFiles() const {
+				return sourceFiles;
+			}
+
+		private:
+			std::string basePath;
+			tinyobj::MaterialFileReader fileReader;
+			std::vector<std::string> libraries;
+			std::vector<std::string> sourceFiles;
+		};
+
+		void AppendTextureReferences(const tinyobj::material_t& material, const std::string& basePath,
+			std::vector<TextureReference>& textures) {
+			//ambient texture
+			if (!material.ambient_texname.empty()) {
+				TextureReference currentTexture = { "ambientTexture", basePath + material.ambient_texname };
+				textures.push_back(currentTexture);
+			}
+
+			//diffuse texture
+			if (!material.diffuse_texname.empty()) {
+				TextureReference currentTexture = { "diffuseTexture", basePath + material.diffuse_texname };
+				textures.push_back(currentTexture);
+			}
+
+			//specular texture
+			if (!material.specular_texname.empty()) {
+				TextureReference currentTexture = { "specularTexture", basePath + material.specular_texname };
+				textures.push_back(currentTexture);
+			}
+		}
+
+		void PrintPeakMemory() {
+			std::cout << "Peak resident memory : " << getPeakResidentMemory() / (1024 * 1024) << " MB" << std::endl;
+		}
+
+		// Vertex cache and overdraw figures of a model before and after optimization
+		struct OptimizationStats {
+			VertexCacheStats cacheBefore;
+			VertexCacheStats cacheAfter;
+			OverdrawStats overdrawBefore;
+			OverdrawStats overdrawAfter;
+		};
+
+		void AddStats(VertexCacheStats& total, const VertexCacheStats& stats) {
+			total.transformedVertices += stats.transformedVertices;
+			total.triangles += stats.triangles;
+			total.vertices += stats.vertices;
+		}
+
+		void AddStats(OverdrawStats& total, const OverdrawStats& stats) {
+			total.pixelsCovered += stats.pixelsCovered;
+			total.pixelsShaded += stats.pixelsShaded;
+		}
+
+		void AddStats(OptimizationStats& total, const OptimizationStats& stats) {
+			AddStats(total.cacheBefore, stats.cacheBefore);
+			AddStats(total.cacheAfter, stats.cacheAfter);
+			AddStats(total.overdrawBefore, stats.overdrawBefore);
+			AddStats(total.overdrawAfter, stats.overdrawAfter);
+		}
+
+		// Triangle order for the post-transform cache, then cluster order for
+		// early-Z, then vertex order for fetch locality
+		void OptimizeMesh(std::vector<gps::Vertex>& vertices, std::vector<GLuint>& indices, OptimizationStats& stats) {
+			stats.cacheBefore = analyzeVertexCache(indices, vertices.size());
+			stats.overdrawBefore = analyzeOverdraw(vertices, indices);
+
+			optimizeVertexCache(indices, vertices.size());
+			optimizeOverdraw(indices, vertices);
+			optimizeVertexFetch(vertices, indices);
+
+			stats.cacheAfter = analyzeVertexCache(indices, vertices.size());
+			stats.overdrawAfter = analyzeOverdraw(vertices, indices);
+		}
+
+		void PrintOptimizationStats(const OptimizationStats& stats) {
+			const VertexCacheStats& before = stats.cacheBefore;
+			const VertexCacheStats& after = stats.cacheAfter;
+			std::cout << "ACMR / ATVR    : "
+				<< (float)before.transformedVertices / std::max<size_t>(before.triangles, 1) << " / "
+				<< (float)before.transformedVertices / std::max<size_t>(before.vertices, 1) << " -> "
+				<< (float)after.transformedVertices / std::max<size_t>(after.triangles, 1) << " / "
+				<< (float)after.transformedVertices / std::max<size_t>(after.vertices, 1) << std::endl;
+			std::cout << "Overdraw       : "
+				<< (float)stats.overdrawBefore.pixelsShaded / std::max<size_t>(stats.overdrawBefore.pixelsCovered, 1) << " -> "
+				<< (float)stats.overdrawAfter.pixelsShaded / std::max<size_t>(stats.overdrawAfter.pixelsCovered, 1) << std::endl;
+		}
+
+		// Largest error of the coarsest level, relative to the mesh size
+		const float LOD_MAX_ERROR = 0.05f;
+		// Each level may stray at most this much less than the next coarser one,
+		// so meshes that do not simplify cleanly still get gradual levels
+		const float LOD_ERROR_STEP = 0.25f;
+		// A level that keeps more of the previous one's triangles is not worth drawing
+		const float LOD_MIN_REDUCTION = 0.85f;
+
+		// Appends coarser and coarser copies of the triangles to `indices`, each
+		// simplified from the previous one down to about `triangleRatio` of it
+		void GenerateLods(const std::vector<gps::Vertex>& vertices, std::vector<GLuint>& indices,
+			size_t levelCount, float triangleRatio, std::vector<MeshLod>& lods) {
+			lods.clear();
+			MeshLod full = { 0, (GLuint)indices.size(), 0.0f };
+			lods.push_back(full);
+			if (vertices.empty())
+				return;
+
+			glm::vec3 lower = vertices[0].Position;
+			glm::vec3 upper = vertices[0].Position;
+			for (size_t i = 1; i < vertices.size(); i++) {
+				lower = glm::min(lower, vertices[i].Position);
+				upper = glm::max(upper, vertices[i].Position);
+			}
+			float maxError = glm::length(upper - lower) * 0.5f * LOD_MAX_ERROR;
+
+			// errors add up along the chain, each level is measured against the previous one
+			std::vector<GLuint> level(indices);
+			float error = 0.0f;
+			for (size_t l = 1; l < levelCount; l++) {
+				std::vector<GLuint> coarser;
+				size_t target = (size_t)(level.size() / 3 * triangleRatio) * 3;
+				float errorLimit = maxError * std::pow(LOD_ERROR_STEP, (float)(levelCount - 1 - l));
+				float levelError = simplifyMesh(coarser, vertices, level.data(), level.size(), target, errorLimit - error);
+				if (coarser.empty() || coarser.size() > level.size() * LOD_MIN_REDUCTION)
+					break;
+
+				error += levelError;
+				optimizeVertexCache(coarser, vertices.size());
+				MeshLod lod = { (GLuint)indices.size(), (GLuint)coarser.size(), error };
+				indices.insert(indices.end(), coarser.begin(), coarser.end());
+				lods.push_back(lod);
+				level.swap(coarser);
+			}
+		}
+
+		// Triangles per level of detail; meshes with a shorter chain count their coarsest level
+		void AddLodTriangles(std::vector<size_t>& total, const std::vector<MeshLod>& lods) {
+			for (size_t l = 0; l < total.size(); l++)
+				total[l] += lods[std::min(l, lods.size() - 1)].indexCount / 3;
+		}
+
+		void PrintLodTriangles(const std::vector<size_t>& total) {
+			std::cout << "LOD triangles  : ";
+			for (size_t l = 0; l < total.size(); l++)
+				std::cout << (l > 0 ? " / " : "") << total[l];
+			std::cout << std::endl;
+		}
+
+		// Consecutive faces of one shape [faceBegin, faceEnd) sharing a material;
+		// firstIndex is where the first one starts in the shape's index list
+		struct FaceRun {
+			size_t shape;
+			size_t faceBegin;
+			size_t faceEnd;
+			size_t firstIndex;
+		};
+
+		// Assembles meshes while LoadObjWithCallback walks the file. Only the
+		// attribute pools (indices into them are global) and the shape being
+		// built are kept; each finished shape, or single-material part of a
+		// shape, is handed to `onShape`.
+		class StreamingImporter {
+		public:
+			typedef std::function<void(std::vector<gps::Vertex>& vertices, std::vector<GLuint>& indices,
+				const tinyobj::material_t* material)> ShapeHandler;
+
+			StreamingImporter(float weldEpsilon, const ShapeHandler& onShape)
+				: welder(weldEpsilon), onShape(onShape), materialId(-1), shapeMaterialId(-1),
+				meshCount(0), cornerCount(0), vertexCount(0) {}
+
+			tinyobj::callback_t getCallbacks() const {
+				tinyobj::callback_t callbacks;
+				callbacks.vertex_cb = OnVertex;
+				callbacks.normal_cb = OnNormal;
+				callbacks.texcoord_cb = OnTexCoord;
+				callbacks.index_cb = OnFace;
+				callbacks.usemtl_cb = OnUseMaterial;
+				callbacks.mtllib_cb = OnMaterialLibrary;
+				callbacks.group_cb = OnGroup;
+				callbacks.object_cb = OnObject;
+				return callbacks;
+			}
+
+			// Emits the last shape once the file has been read
+			void finish() {
+				FlushShape();
+			}
+
+			size_t getMeshCount() const { return meshCount; }
+			size_t getMaterialCount() const { return materials.size(); }
+			size_t getCornerCount() const { return cornerCount; }
+			size_t getVertexCount() const { return vertexCount; }
+
+		private:
+			std::vector<float> positions;
+			std::vector<float> normals;
+			std::vector<float> texCoords;
+			std::vector<tinyobj::material_t> materials;
+			VertexWelder welder;
+			ShapeHandler onShape;
+			int materialId;
+			int shapeMaterialId;
+			size_t meshCount;
+			size_t cornerCount;
+			size_t vertexCount;
+
+			// Raw OBJ index: 1-based, negative = relative to the end, 0 = absent
+			static int ResolveIndex(int index, size_t count) {
+				if (index > 0)
+					return index - 1;
+				if (index < 0)
+					return (int)count + index;
+				return -1;
+			}
+
+			void AddCorner(const tinyobj::index_t& idx) {
+				gps::Vertex vertex;
+				vertex.Position = glm::vec3(0.0f);
+				vertex.Normal = glm::vec3(0.0f);
+				vertex.TexCoords = glm::vec2(0.0f);
+
+				int v = ResolveIndex(idx.vertex_index, positions.size() / 3);
+				if (v >= 0 && (size_t)v < positions.size() / 3)
+					vertex.Position = glm::vec3(positions[3 * v + 0], positions[3 * v + 1], positions[3 * v + 2]);
+				int n = ResolveIndex(idx.normal_index, normals.size() / 3);
+				if (n >= 0 && (size_t)n < normals.size() / 3)
+					vertex.Normal = glm::vec3(normals[3 * n + 0], normals[3 * n + 1], normals[3 * n + 2]);
+				int t = ResolveIndex(idx.texcoord_index, texCoords.size() / 2);
+				if (t >= 0 && (size_t)t < texCoords.size() / 2)
+					vertex.TexCoords = glm::vec2(texCoords[2 * t + 0], texCoords[2 * t + 1]);
+
+				welder.addCorner(vertex);
+			}
+
+			void FlushShape() {
+				if (welder.getCornerCount() == 0)
+					return;
+
+				std::vector<gps::Vertex> vertices;
+				std::vector<GLuint> indices;
+				welder.release(vertices, indices);
+				cornerCount += indices.size();
+				vertexCount += vertices.size();
+				meshCount++;
+
+				const tinyobj::material_t* material = NULL;
+				if (shapeMaterialId >= 0 && (size_t)shapeMaterialId < materials.size())
+					material = &materials[shapeMaterialId];
+				onShape(vertices, indices, material);
+			}
+
+			static void OnVertex(void* userData, float x, float y, float z, float w) {
+				std::vector<float>& positions = ((StreamingImporter*)userData)->positions;
+				positions.push_back(x);
+				positions.push_back(y);
+				positions.push_back(z);
+			}
+
+			static void OnNormal(void* userData, float x, float y, float z) {
+				std::vector<float>& normals = ((StreamingImporter*)userData)->normals;
+				normals.push_back(x);
+				normals.push_back(y);
+				normals.push_back(z);
+			}
+
+			static void OnTexCoord(void* userData, float x, float y, float z) {
+				std::vector<float>& texCoords = ((StreamingImporter*)userData)->texCoords;
+				texCoords.push_back(x);
+				texCoords.push_back(y);
+			}
+
+			static void OnFace(void* userData, tinyobj::index_t* indices, int count) {
+				StreamingImporter* importer = (StreamingImporter*)userData;
+				// a mesh never mixes materials, the shape is split where its material changes
+				if (importer->welder.getCornerCount() > 0 && importer->materialId != importer->shapeMaterialId)
+					importer->FlushShape();
+				if (importer->welder.getCornerCount() == 0)
+					importer->shapeMaterialId = importer->materialId;
+
+				// Polygon -> triangle fan conversion
+				for (int k = 2; k < count; k++) {
+					importer->AddCorner(indices[0]);
+					importer->AddCorner(indices[k - 1]);
+					importer->AddCorner(indices[k]);
+				}
+			}
+
+			static void OnUseMaterial(void* userData, const char* name, int materialId) {
+				((StreamingImporter*)userData)->materialId = materialId;
+			}
+
+			static void OnMaterialLibrary(void* userData, const tinyobj::material_t* materials, int count) {
+				((StreamingImporter*)userData)->materials.assign(materials, materials + count);
+			}
+
+			static void OnGroup(void* userData, const char** names, int count) {
+				((StreamingImporter*)userData)->FlushShape();
+			}
+
+			static void OnObject(void* userData, const char* name) {
+				((StreamingImporter*)userData)->FlushShape();
+			}
+		};
+	}
+
 	void Model3D::LoadModel(std::string fileName)
 	{
         std::string basePath = fileName.substr(0, fileName.find_last_of('/')) + "/";
 		ReadOBJ(fileName, basePath);
+		PrintVertexMemory();
 	}
 
     void Model3D::LoadModel(std::string fileName, std::string basePath)
 	{
 		ReadOBJ(fileName, basePath);
+		PrintVertexMemory();
+	}
+
+	const std::vector<gps::Mesh>& Model3D::GetMeshes() const
+	{
+		return meshes;
+	}
+
+	void Model3D::SetWeldEpsilon(float epsilon)
+	{
+		weldEpsilon = epsilon;
+	}
+
+	void Model3D::SetStreamingImport(bool streaming)
+	{
+		streamingImport = streaming;
+	}
+
+	void Model3D::SetVertexFormat(VertexFormat format)
+	{
+		vertexFormat = format;
+	}
+
+	void Model3D::SetLodChain(size_t levelCount, float triangleRatio)
+	{
+		lodLevelCount = std::max<size_t>(levelCount, 1);
+		lodTriangleRatio = triangleRatio;
 	}
 
 	// Draw each mesh from the model
@@ -20,17 +385,82 @@ namespace gps {
 			meshes[i].Draw(shaderProgram);
 	}
 
+	void Model3D::Draw(gps::Shader shaderProgram, const LodView& lodView, ClusterCullStats* stats)
+	{
+		Draw(shaderProgram, lodView, (const char*)NULL, stats);
+	}
+
+	void Model3D::Draw(gps::Shader shaderProgram, const CullingView& view, const LodView& lodView, ClusterCullStats* stats)
+	{
+		Draw(shaderProgram, view, lodView, (const char*)NULL, stats);
+	}
+
+	void Model3D::Draw(gps::Shader shaderProgram, const LodView& lodView, const char* visibleMeshes, ClusterCullStats* stats)
+	{
+		for (size_t i = 0; i < meshes.size(); i++) {
+			if (!visibleMeshes || visibleMeshes[i])
+				meshes[i].Draw(shaderProgram, lodView, stats);
+		}
+	}
+
+	void Model3D::Draw(gps::Shader shaderProgram, const CullingView& view, const LodView& lodView, const char* visibleMeshes,
+		ClusterCullStats* stats)
+	{
+		for (size_t i = 0; i < meshes.size(); i++) {
+			if (!visibleMeshes || visibleMeshes[i])
+				meshes[i].Draw(shaderProgram, view, lodView, stats);
+		}
+	}
+
 	// Does the parsing of the .obj file and fills in the data structure
 	void Model3D::ReadOBJ(std::string fileName, std::string basePath){
 
         std::cout << "Loading : " << fileName << std::endl;
+
+		// Identical files share one copy of the geometry and its GPU buffers
+		uint64_t registryKey = 0;
+		// the packed GPU buffers depend on the vertex format too
+		uint64_t geometryKey = hashBytes(&vertexFormat, sizeof(vertexFormat), GetCacheKey());
+		bool shareable = ModelRegistry::makeKey(fileName, geometryKey, &registryKey);
+		if (shareable) {
+			std::shared_ptr<ModelGeometry> existing = ModelRegistry::shared().find(registryKey);
+			if (existing) {
+				std::cout << "Sharing geometry of an identical model" << std::endl;
+				UseGeometry(existing, basePath);
+				return;
+			}
+		}
+		geometry = std::make_shared<ModelGeometry>();
+		if (shareable) {
+			ModelRegistry::shared().add(registryKey, geometry);
+		}
+
+		std::string cacheFileName = MeshCache::pathFor(fileName);
+		if (ReadMeshCache(cacheFileName)) {
+			std::cout << "Loaded from cache : " << cacheFileName << std::endl;
+			return;
+		}
+
+		if (streamingImport) {
+			ReadOBJStreaming(fileName, basePath);
+			PrintPeakMemory();
+			return;
+		}
+
 		tinyobj::attrib_t attrib;
 		std::vector<tinyobj::shape_t> shapes;
 		std::vector<tinyobj::material_t> materials;
-		int materialId;
 
 		std::string err;
-		bool ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &err, fileName.c_str(), basePath.c_str(), GL_TRUE);
+		MappedFile objFile;
+		if (!objFile.open(fileName)) {
+			std::cerr << "Cannot open file [" << fileName << "]" << std::endl;
+			exit(1);
+		}
+		SourceTrackingMaterialReader materialReader(basePath);
+		bool ret = tinyobj::LoadObjParallel(&attrib, &shapes, &materials, &err,
+			(const char*)objFile.data(), objFile.size(), &materialReader, GL_TRUE);
+		objFile.close();
 
 		if (!err.empty()) { // `err` may contain warning message.
 			std::cerr << err << std::endl;
@@ -43,191 +473,315 @@ namespace gps {
 		std::cout << "# of shapes    : " << shapes.size() << std::endl;
 		std::cout << "# of materials : " << materials.size() << std::endl;
 
-		// Loop over shapes
+		// One mesh per material: faces are grouped by their own material (not the
+		// shape's first one) and the groups of every shape are merged, so each
+		// material is a single draw. Runs of consecutive faces keep it cheap.
+		std::vector<int> materialGroups(materials.size() + 1, -1);
+		std::vector<int> groupMaterialIds;
+		std::vector<std::vector<FaceRun> > groupRuns;
 		for (size_t s = 0; s < shapes.size(); s++) {
-			std::vector<gps::Vertex> vertices;
-			std::vector<GLuint> indices;
-			std::vector<gps::Texture> textures;
-
-			// Loop over faces(polygon)
+			const tinyobj::mesh_t& shapeMesh = shapes[s].mesh;
 			size_t index_offset = 0;
-			for (size_t f = 0; f < shapes[s].mesh.num_face_vertices.size(); f++) {
-				int fv = shapes[s].mesh.num_face_vertices[f];
-
-				//gps::Texture currentTexture = LoadTexture("index1.png", "ambientTexture");
-				//textures.push_back(currentTexture);
-
-				// Loop over vertices in the face.
-				for (size_t v = 0; v < fv; v++) {
-					// access to vertex
-					tinyobj::index_t idx = shapes[s].mesh.indices[index_offset + v];
-
-					float vx = attrib.vertices[3 * idx.vertex_index + 0];
-					float vy = attrib.vertices[3 * idx.vertex_index + 1];
-					float vz = attrib.vertices[3 * idx.vertex_index + 2];
-					float nx = attrib.normals[3 * idx.normal_index + 0];
-					float ny = attrib.normals[3 * idx.normal_index + 1];
-					float nz = attrib.normals[3 * idx.normal_index + 2];
-					float tx = 0.0f;
-					float ty = 0.0f;
-					if (idx.texcoord_index != -1) {
-						tx = attrib.texcoords[2 * idx.texcoord_index + 0];
-						ty = attrib.texcoords[2 * idx.texcoord_index + 1];
+			for (size_t f = 0; f < shapeMesh.num_face_vertices.size(); f++) {
+				int materialId = f < shapeMesh.material_ids.size() ? shapeMesh.material_ids[f] : -1;
+				if (materialId < 0 || (size_t)materialId >= materials.size())
+					materialId = -1;
+
+				int& group = materialGroups[materialId + 1];
+				if (group < 0) {
+					group = (int)groupRuns.size();
+					groupRuns.push_back(std::vector<FaceRun>());
+					groupMaterialIds.push_back(materialId);
+				}
+
+				std::vector<FaceRun>& runs = groupRuns[group];
+				if (!runs.empty() && runs.back().shape == s && runs.back().faceEnd == f) {
+					runs.back().faceEnd++;
+				}
+				else {
+					FaceRun run = { s, f, f + 1, index_offset };
+					runs.push_back(run);
+				}
+				index_offset += shapeMesh.num_face_vertices[f];
+			}
+		}
+		std::cout << "# of meshes    : " << groupRuns.size() << " after grouping by material" << std::endl;
+
+		// Assemble and weld the vertex data of every material in parallel
+		size_t meshCount = groupRuns.size();
+		std::vector<std::vector<gps::Vertex> > meshVertices(meshCount);
+		std::vector<std::vector<GLuint> > meshIndices(meshCount);
+		std::vector<size_t> cornerCounts(meshCount);
+		std::vector<OptimizationStats> meshStats(meshCount);
+		std::vector<std::vector<MeshLod> > meshLods(meshCount);
+
+		ThreadPool::shared().parallelFor(meshCount, [&](size_t m) {
+			std::vector<gps::Vertex>& vertices = meshVertices[m];
+			std::vector<GLuint>& indices = meshIndices[m];
+
+			for (size_t r = 0; r < groupRuns[m].size(); r++) {
+				const FaceRun& run = groupRuns[m][r];
+				const tinyobj::mesh_t& shapeMesh = shapes[run.shape].mesh;
+
+				// Loop over faces(polygon)
+				size_t index_offset = run.firstIndex;
+				for (size_t f = run.faceBegin; f < run.faceEnd; f++) {
+					int fv = shapeMesh.num_face_vertices[f];
+
+					// Loop over vertices in the face.
+					for (size_t v = 0; v < fv; v++) {
+						// access to vertex
+						tinyobj::index_t idx = shapeMesh.indices[index_offset + v];
+
+						float vx = attrib.vertices[3 * idx.vertex_index + 0];
+						float vy = attrib.vertices[3 * idx.vertex_index + 1];
+						float vz = attrib.vertices[3 * idx.vertex_index + 2];
+						float nx = 0.0f;
+						float ny = 0.0f;
+						float nz = 0.0f;
+						if (idx.normal_index != -1) {
+							nx = attrib.normals[3 * idx.normal_index + 0];
+							ny = attrib.normals[3 * idx.normal_index + 1];
+							nz = attrib.normals[3 * idx.normal_index + 2];
+						}
+						float tx = 0.0f;
+						float ty = 0.0f;
+						if (idx.texcoord_index != -1) {
+							tx = attrib.texcoords[2 * idx.texcoord_index + 0];
+							ty = attrib.texcoords[2 * idx.texcoord_index + 1];
+						}
+
+						gps::Vertex currentVertex;
+						currentVertex.Position = glm::vec3(vx, vy, vz);
+						currentVertex.Normal = glm::vec3(nx, ny, nz);
+						currentVertex.TexCoords = glm::vec2(tx, ty);
+
+						indices.push_back((GLuint)vertices.size());
+						vertices.push_back(currentVertex);
 					}
 
-					glm::vec3 vertexPosition(vx, vy, vz);
-					glm::vec3 vertexNormal(nx, ny, nz);
-					glm::vec2 vertexTexCoords(tx, ty);
+					index_offset += fv;
+				}
+			}
 
-					gps::Vertex currentVertex;
-					currentVertex.Position = vertexPosition;
-					currentVertex.Normal = vertexNormal;
-					currentVertex.TexCoords = vertexTexCoords;
+			cornerCounts[m] = vertices.size();
+			weldVertices(vertices, indices, weldEpsilon);
+			OptimizeMesh(vertices, indices, meshStats[m]);
+			GenerateLods(vertices, indices, lodLevelCount, lodTriangleRatio, meshLods[m]);
+		});
+
+		size_t totalCorners = 0;
+		size_t totalWelded = 0;
+		OptimizationStats totalStats = OptimizationStats();
+		std::vector<size_t> lodTriangles(lodLevelCount, 0);
+		for (size_t m = 0; m < meshCount; m++) {
+			totalCorners += cornerCounts[m];
+			totalWelded += meshVertices[m].size();
+			AddStats(totalStats, meshStats[m]);
+			AddLodTriangles(lodTriangles, meshLods[m]);
+		}
+		std::cout << "# of vertices  : " << totalCorners << " -> " << totalWelded << " after welding" << std::endl;
+		PrintOptimizationStats(totalStats);
+		PrintLodTriangles(lodTriangles);
+
+		std::vector<CachedMesh> cachedMeshes(meshCount);
+		for (size_t m = 0; m < meshCount; m++) {
+			int materialId = groupMaterialIds[m];
+			if (materialId != -1) {
+				cachedMeshes[m].material = materials[materialId].name;
+				AppendTextureReferences(materials[materialId], basePath, cachedMeshes[m].textures);
+			}
 
-					vertices.push_back(currentVertex);
+			cachedMeshes[m].vertices = meshVertices[m].data();
+			cachedMeshes[m].vertexCount = meshVertices[m].size();
+			cachedMeshes[m].indices = meshIndices[m].data();
+			cachedMeshes[m].indexCount = meshIndices[m].size();
+			cachedMeshes[m].lods = meshLods[m];
+		}
 
-					indices.push_back(index_offset + v);
-				}
+		// Later runs map the assembled meshes instead of parsing the .obj again
+		std::vector<std::string> sources = materialReader.getSourceFiles();
+		sources.insert(sources.begin(), fileName);
+		geometry->materialLibraries = materialReader.getLibraries();
+		if (!MeshCache::write(cacheFileName, sources, geometry->materialLibraries, GetCacheKey(), cachedMeshes)) {
+			std::cerr << "WARNING: could not write mesh cache " << cacheFileName << std::endl;
+		}
 
-				index_offset += fv;
-			}
-
-			// get material id
-			// Only try to read materials if the .mtl file is present
-			int a = shapes[s].mesh.material_ids.size();
-			if (a > 0 && materials.size()>0) {
-				materialId = shapes[s].mesh.material_ids[0];
-				if (materialId != -1) {
-					gps::Material currentMaterial;
-					currentMaterial.ambient = glm::vec3(materials[materialId].ambient[0], materials[materialId].ambient[1], materials[materialId].ambient[2]);
-					currentMaterial.diffuse = glm::vec3(materials[materialId].diffuse[0], materials[materialId].diffuse[1], materials[materialId].diffuse[2]);
-					currentMaterial.specular = glm::vec3(materials[materialId].specular[0], materials[materialId].specular[1], materials[materialId].specular[2]);
-
-					//ambient texture
-					std::string ambientTexturePath = materials[materialId].ambient_texname;
-					if (!ambientTexturePath.empty())
-					{
-						gps::Texture currentTexture;
-						currentTexture = LoadTexture(basePath + ambientTexturePath, "ambientTexture");
-						textures.push_back(currentTexture);
-					}
+		for (size_t m = 0; m < meshCount; m++) {
+			gps::Mesh mesh(std::move(meshVertices[m]), std::move(meshIndices[m]), std::vector<gps::Texture>(), vertexFormat,
+				std::move(meshLods[m]));
+			AddMesh(mesh, cachedMeshes[m].material, cachedMeshes[m].textures);
+		}
+		PrintPeakMemory();
+	}
 
-					//diffuse texture
-					std::string diffuseTexturePath = materials[materialId].diffuse_texname;
-					if (!diffuseTexturePath.empty())
-					{
-						gps::Texture currentTexture;
-						currentTexture = LoadTexture(basePath + diffuseTexturePath, "diffuseTexture");
-						textures.push_back(currentTexture);
-					}
+	// Parses the .obj line by line and uploads every shape as soon as it is
+	// complete, releasing its CPU copy before the next one is read. Peak memory
+	// stays near the attribute pools plus the largest shape. No mesh cache is
+	// written since the meshes are never all in memory at once, and for the
+	// same reason meshes of one material are only merged within a shape.
+	void Model3D::ReadOBJStreaming(std::string fileName, std::string basePath) {
+		std::ifstream objStream(fileName.c_str(), std::ios::binary);
+		if (!objStream) {
+			std::cerr << "Cannot open file [" << fileName << "]" << std::endl;
+			exit(1);
+		}
 
-					//specular texture
-					std::string specularTexturePath = materials[materialId].specular_texname;
-					if (!specularTexturePath.empty())
-					{
-						gps::Texture currentTexture;
-						currentTexture = LoadTexture(basePath + specularTexturePath, "specularTexture");
-						textures.push_back(currentTexture);
-					}
-				}
+		OptimizationStats totalStats = OptimizationStats();
+		std::vector<size_t> lodTriangles(lodLevelCount, 0);
+		StreamingImporter importer(weldEpsilon, [&](std::vector<gps::Vertex>& vertices, std::vector<GLuint>& indices,
+			const tinyobj::material_t* material) {
+			OptimizationStats shapeStats;
+			OptimizeMesh(vertices, indices, shapeStats);
+			AddStats(totalStats, shapeStats);
+			std::vector<MeshLod> lods;
+			GenerateLods(vertices, indices, lodLevelCount, lodTriangleRatio, lods);
+			AddLodTriangles(lodTriangles, lods);
+
+			std::vector<TextureReference> references;
+			std::string materialName;
+			if (material) {
+				materialName = material->name;
+				AppendTextureReferences(*material, basePath, references);
+			}
+			gps::Mesh mesh(std::move(vertices), std::move(indices), std::vector<gps::Texture>(), vertexFormat, std::move(lods));
+			mesh.releaseGeometry();
+			AddMesh(mesh, materialName, references);
+		});
+
+		std::string err;
+		SourceTrackingMaterialReader materialReader(basePath);
+		bool ret = tinyobj::LoadObjWithCallback(objStream, importer.getCallbacks(), &importer, &materialReader, &err);
+		importer.finish();
+		geometry->materialLibraries = materialReader.getLibraries();
+
+		if (!err.empty()) { // `err` may contain warning message.
+			std::cerr << err << std::endl;
+		}
+
+		if (!ret) {
+			exit(1);
+		}
+
+		std::cout << "# of meshes    : " << importer.getMeshCount() << std::endl;
+		std::cout << "# of materials : " << importer.getMaterialCount() << std::endl;
+		std::cout << "# of vertices  : " << importer.getCornerCount() << " -> " << importer.getVertexCount() << " after welding" << std::endl;
+		PrintOptimizationStats(totalStats);
+		PrintLodTriangles(lodTriangles);
+	}
+
+	// Maps a previously written mesh cache and uploads it without an intermediate copy
+	bool Model3D::ReadMeshCache(const std::string& cacheFileName) {
+		std::shared_ptr<MeshCache> cache = MeshCache::open(cacheFileName, GetCacheKey());
+		if (!cache) {
+			return false;
+		}
+
+		const std::vector<CachedMesh>& cachedMeshes = cache->getMeshes();
+		for (size_t i = 0; i < cachedMeshes.size(); i++) {
+			const CachedMesh& mesh = cachedMeshes[i];
+			AddMesh(gps::Mesh(cache, mesh.vertices, mesh.vertexCount, mesh.indices, mesh.indexCount, std::vector<gps::Texture>(), vertexFormat, mesh.lods),
+				mesh.material, mesh.textures);
+		}
+		geometry->materialLibraries = cache->getMaterialLibraries();
+		return true;
+	}
+
+	// Adds a newly built mesh to the shared geometry and to this model, with its textures
+	void Model3D::AddMesh(const gps::Mesh& mesh, const std::string& material, const std::vector<TextureReference>& textures) {
+		geometry->meshes.push_back(mesh);
+		geometry->materialNames.push_back(material);
+
+		meshes.push_back(mesh);
+		meshes.back().textures = LoadTextures(textures);
+	}
+
+	// Reuses the meshes of an identical model; materials come from the .mtl
+	// files next to this one, so each copy can look different
+	void Model3D::UseGeometry(const std::shared_ptr<ModelGeometry>& sharedGeometry, const std::string& basePath) {
+		geometry = sharedGeometry;
+
+		std::vector<tinyobj::material_t> materials;
+		std::map<std::string, int> materialMap;
+		tinyobj::MaterialFileReader materialReader(basePath);
+		for (size_t i = 0; i < geometry->materialLibraries.size(); i++) {
+			std::string err;
+			if (!materialReader(geometry->materialLibraries[i], &materials, &materialMap, &err)) {
+				std::cerr << err << std::endl;
 			}
+		}
 
-			meshes.push_back(gps::Mesh(vertices, indices, textures));
+		for (size_t i = 0; i < geometry->meshes.size(); i++) {
+			std::vector<TextureReference> textures;
+			const std::string& materialName = geometry->materialNames[i];
+			std::map<std::string, int>::const_iterator it = materialMap.find(materialName);
+			if (!materialName.empty() && it != materialMap.end()) {
+				AppendTextureReferences(materials[it->second], basePath, textures);
+			}
+
+			meshes.push_back(geometry->meshes[i]);
+			meshes.back().textures = LoadTextures(textures);
 		}
 	}
 
+	// Import options baked into the cached data
+	uint64_t Model3D::GetCacheKey() {
+		uint64_t key = hashBytes(&weldEpsilon, sizeof(weldEpsilon));
+		key = hashBytes(&lodLevelCount, sizeof(lodLevelCount), key);
+		return hashBytes(&lodTriangleRatio, sizeof(lodTriangleRatio), key);
+	}
+
+	void Model3D::PrintVertexMemory() {
+		size_t fullBytes = 0;
+		size_t packedBytes = 0;
+		size_t shortIndexMeshes = 0;
+		for (size_t i = 0; i < meshes.size(); i++) {
+			fullBytes += meshes[i].getVertexCount() * sizeof(Vertex) + meshes[i].getIndexCount() * sizeof(GLuint);
+			packedBytes += meshes[i].getGpuMemory();
+			if (meshes[i].getIndexType() == GL_UNSIGNED_SHORT)
+				shortIndexMeshes++;
+		}
+
+		std::cout << "Vertex memory  : " << packedBytes / 1024 << " KB (" << (fullBytes - packedBytes) / 1024
+			<< " KB saved, 16-bit indices on " << shortIndexMeshes << " of " << meshes.size() << " meshes)" << std::endl;
+	}
+
+	std::vector<gps::Texture> Model3D::LoadTextures(const std::vector<TextureReference>& references) {
+		std::vector<gps::Texture> textures;
+		for (size_t i = 0; i < references.size(); i++) {
+			textures.push_back(LoadTexture(references[i].path, references[i].type));
+		}
+		return textures;
+	}
+
 	// Retrieves a texture associated with the object - by its name and type
 	gps::Texture Model3D::LoadTexture(std::string path, std::string type) {
 
-			for (int i = 0; i < loadedTextures.size(); i++) {
-				if (loadedTextures[i].path == path)
-				{
-					//already loaded texture
-					return loadedTextures[i];
-				}
-			}
-
 			gps::Texture currentTexture;
-			currentTexture.id = ReadTextureFromFile(path.c_str());
 			currentTexture.type = std::string(type);
+			currentTexture.sampler = Shader::getUniformId(type);
 			currentTexture.path = path;
 
+			std::unordered_map<std::string, GLuint>::iterator it = loadedTextureIds.find(path);
+			if (it != loadedTextureIds.end()) {
+				//already loaded texture
+				currentTexture.id = it->second;
+				return currentTexture;
+			}
+
+			// shared with every other model using the same image; decoded on a
+			// worker, the pixels follow once TextureLoader uploads them
+			currentTexture.id = TextureCache::shared().acquire(path);
+			loadedTextureIds[path] = currentTexture.id;
 			loadedTextures.push_back(currentTexture);
 
 			return currentTexture;
 		}
 
-	// Reads the pixel data from an image file and loads it into the video memory
-	GLuint Model3D::ReadTextureFromFile(const char* file_name) {
-		int x, y, n;
-		int force_channels = 4;
-		unsigned char* image_data = stbi_load(file_name, &x, &y, &n, force_channels);
-		if (!image_data) {
-			fprintf(stderr, "ERROR: could not load %s\n", file_name);
-			return false;
-		}
-		// NPOT check
-		if ((x & (x - 1)) != 0 || (y & (y - 1)) != 0) {
-			fprintf(
-				stderr, "WARNING: texture %s is not power-of-2 dimensions\n", file_name
-			);
-		}
-
-		int width_in_bytes = x * 4;
-		unsigned char *top = NULL;
-		unsigned char *bottom = NULL;
-		unsigned char temp = 0;
-		int half_height = y / 2;
-
-		for (int row = 0; row < half_height; row++) {
-			top = image_data + row * width_in_bytes;
-			bottom = image_data + (y - row - 1) * width_in_bytes;
-			for (int col = 0; col < width_in_bytes; col++) {
-				temp = *top;
-				*top = *bottom;
-				*bottom = temp;
-				top++;
-				bottom++;
-			}
-		}
-
-		GLuint textureID;
-		glGenTextures(1, &textureID);
-		glBindTexture(GL_TEXTURE_2D, textureID);
-		glTexImage2D(
-			GL_TEXTURE_2D,
-			0,
-			GL_SRGB, //GL_SRGB,//GL_RGBA,
-			x,
-			y,
-			0,
-			GL_RGBA,
-			GL_UNSIGNED_BYTE,
-			image_data
-		);
-		glGenerateMipmap(GL_TEXTURE_2D);
-
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glBindTexture(GL_TEXTURE_2D, 0);
-
-		return textureID;
-	}
-
 	Model3D::~Model3D() {
         for (size_t i = 0; i < loadedTextures.size(); i++) {
-            glDeleteTextures(1, &loadedTextures.at(i).id);
-        }
-
-        for (size_t i = 0; i < meshes.size(); i++) {
-            GLuint VBO = meshes.at(i).getBuffers().VBO;
-            GLuint EBO = meshes.at(i).getBuffers().EBO;
-            GLuint VAO = meshes.at(i).getBuffers().VAO;
-            glDeleteBuffers(1, &VBO);
-            glDeleteBuffers(1, &EBO);
-            glDeleteVertexArrays(1, &VAO);
+            TextureCache::shared().release(loadedTextures.at(i).id);
         }
+        // the GPU buffers go with the last model sharing `geometry`
 	}
 }
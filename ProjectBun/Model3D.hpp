@@ -2,12 +2,15 @@
 #define Model3D_hpp
 
 #include "Mesh.hpp"
+#include "MeshCache.hpp"
+#include "ModelRegistry.hpp"
 
 #include "tiny_obj_loader.h"
 #include "stb_image.h"
 
 #include <iostream>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 namespace gps {
@@ -18,26 +21,86 @@ namespace gps {
     public:
         ~Model3D();
 
+		// Texture images are decoded in the background; call
+		// TextureLoader::shared().finish() before the first frame
 		void LoadModel(std::string fileName);
 
 		void LoadModel(std::string fileName, std::string basePath);
 
 		void Draw(gps::Shader shaderProgram);
 
+		// Draws every mesh at the coarsest level of detail that looks the same from `lodView`
+		void Draw(gps::Shader shaderProgram, const LodView& lodView, ClusterCullStats* stats = NULL);
+
+		// Also skips what is outside `view`, down to single meshlets at full detail
+		void Draw(gps::Shader shaderProgram, const CullingView& view, const LodView& lodView, ClusterCullStats* stats = NULL);
+
+		// As above, only for the meshes i with visibleMeshes[i] set (e.g. by a SceneBvh)
+		void Draw(gps::Shader shaderProgram, const LodView& lodView, const char* visibleMeshes, ClusterCullStats* stats = NULL);
+		void Draw(gps::Shader shaderProgram, const CullingView& view, const LodView& lodView, const char* visibleMeshes,
+			ClusterCullStats* stats = NULL);
+
+		// Meshes with their resolved textures
+		const std::vector<gps::Mesh>& GetMeshes() const;
+
+		// Vertices closer than epsilon in every attribute are merged on load (0 = exact match)
+		void SetWeldEpsilon(float epsilon);
+
+		// Builds and uploads meshes shape by shape while parsing, keeping peak memory low.
+		// Meshes loaded this way keep no CPU copy of their geometry, and shapes
+		// sharing a material stay separate draws.
+		void SetStreamingImport(bool streaming);
+
+		// Layout the vertices are packed into on upload (full floats by default)
+		void SetVertexFormat(VertexFormat format);
+
+		// Levels of detail built per mesh on import, the full mesh included; each
+		// keeps about `triangleRatio` of the triangles of the one before
+		void SetLodChain(size_t levelCount, float triangleRatio);
+
     private:
 		// Component meshes - group of objects
         std::vector<gps::Mesh> meshes;
-		// Associated textures
+		// Geometry and GPU buffers, shared with identical models
+		std::shared_ptr<ModelGeometry> geometry;
+		// Texture references taken from the TextureCache, released with the model
         std::vector<gps::Texture> loadedTextures;
+		// path -> texture for the lookups while loading
+		std::unordered_map<std::string, GLuint> loadedTextureIds;
+		// Tolerance used when welding duplicate vertices
+		float weldEpsilon = 0.0f;
+		// Parse with LoadObjWithCallback instead of the in-memory parser
+		bool streamingImport = false;
+		// GPU vertex layout of the meshes
+		VertexFormat vertexFormat = VERTEX_FORMAT_FULL;
+		// Level of detail chain generated on import
+		size_t lodLevelCount = 4;
+		float lodTriangleRatio = 0.5f;
 
 		// Does the parsing of the .obj file and fills in the data structure
 		void ReadOBJ(std::string fileName, std::string basePath);
 
+		// Low-memory variant of ReadOBJ, used when streaming import is on
+		void ReadOBJStreaming(std::string fileName, std::string basePath);
+
+		// Builds the meshes from a valid binary cache, false if there is none
+		bool ReadMeshCache(const std::string& cacheFileName);
+
+		void AddMesh(const gps::Mesh& mesh, const std::string& material, const std::vector<TextureReference>& textures);
+
+		// Takes over the geometry of an identical model, with materials resolved from basePath
+		void UseGeometry(const std::shared_ptr<ModelGeometry>& sharedGeometry, const std::string& basePath);
+
+		// Identifies the import options a cache was built with
+		uint64_t GetCacheKey();
+
+		// Reports the GPU memory of the meshes against full vertices and 32-bit indices
+		void PrintVertexMemory();
+
+		std::vector<gps::Texture> LoadTextures(const std::vector<TextureReference>& references);
+
 		// Retrieves a texture associated with the object - by its name and type
 		gps::Texture LoadTexture(std::string path, std::string type);
-
-		// Reads the pixel data from an image file and loads it into the video memory
-		GLuint ReadTextureFromFile(const char* file_name);
     };
 }
 
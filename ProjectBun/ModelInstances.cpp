@@ -0,0 +1,95 @@
+#include "ModelInstances.hpp"
+
+namespace gps {
+
+	void ModelInstances::add(const glm::mat4& transform, const glm::vec4& tint)
+	{
+		ModelInstance instance = { transform, tint };
+		instances.push_back(instance);
+		inverseTransforms.push_back(glm::inverse(transform));
+	}
+
+	void ModelInstances::clear()
+	{
+		instances.clear();
+		inverseTransforms.clear();
+	}
+
+	size_t ModelInstances::size() const
+	{
+		return instances.size();
+	}
+
+	const std::vector<ModelInstance>& ModelInstances::getInstances() const
+	{
+		return instances;
+	}
+
+	void ModelInstances::Draw(const Model3D& model, gps::Shader shader, const LodView& lodView, ClusterCullStats* stats)
+	{
+		Draw(model, shader, lodView, (const char*)NULL, stats);
+	}
+
+	void ModelInstances::Draw(const Model3D& model, gps::Shader shader, const LodView& lodView, const char* visibleInstances,
+		ClusterCullStats* stats)
+	{
+		const std::vector<Mesh>& meshes = model.GetMeshes();
+		drawn.clear();
+		for (size_t i = 0; i < instances.size(); i++) {
+			if (!visibleInstances || visibleInstances[i])
+				drawn.push_back(i);
+		}
+		if (drawn.empty() || meshes.empty())
+			return;
+
+		// group the instances by the level each mesh is drawn at, counting sort per mesh
+		sorted.clear();
+		ranges.clear();
+		levels.resize(drawn.size());
+		// errors and distances scale alike, only the camera has to move into each instance
+		instanceViews.resize(drawn.size());
+		for (size_t i = 0; i < drawn.size(); i++) {
+			instanceViews[i] = lodView;
+			instanceViews[i].cameraPosition = glm::vec3(inverseTransforms[drawn[i]] * glm::vec4(lodView.cameraPosition, 1.0f));
+		}
+
+		std::vector<size_t> levelCounts;
+		for (size_t m = 0; m < meshes.size(); m++) {
+			const Mesh& mesh = meshes[m];
+			levelCounts.assign(mesh.getLods().size(), 0);
+			for (size_t i = 0; i < drawn.size(); i++) {
+				levels[i] = mesh.getLodLevel(instanceViews[i]);
+				levelCounts[levels[i]]++;
+			}
+
+			size_t first = sorted.size();
+			for (size_t level = 0; level < levelCounts.size(); level++) {
+				if (levelCounts[level] == 0)
+					continue;
+				Range range = { m, level, first, levelCounts[level] };
+				ranges.push_back(range);
+				levelCounts[level] = first;
+				first += range.instanceCount;
+			}
+			sorted.resize(first);
+			for (size_t i = 0; i < drawn.size(); i++)
+				sorted[levelCounts[levels[i]]++] = instances[drawn[i]];
+		}
+		buffer.upload(sorted.data(), sorted.size());
+
+		static const UniformId INSTANCED = Shader::getUniformId("instanced");
+
+		shader.useShaderProgram();
+		shader.setInt(INSTANCED, 1);
+		for (size_t r = 0; r < ranges.size(); r++) {
+			const Range& range = ranges[r];
+			const Mesh& mesh = meshes[range.mesh];
+			if (stats) {
+				stats->triangles += mesh.getLods()[0].indexCount / 3 * range.instanceCount;
+				stats->visibleTriangles += mesh.getLods()[range.level].indexCount / 3 * range.instanceCount;
+			}
+			mesh.DrawInstanced(shader, buffer, range.firstInstance, range.instanceCount, range.level);
+		}
+		shader.setInt(INSTANCED, 0);
+	}
+}
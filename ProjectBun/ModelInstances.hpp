@@ -0,0 +1,54 @@
+#ifndef ModelInstances_hpp
+#define ModelInstances_hpp
+
+#include "Model3D.hpp"
+#include "InstanceBuffer.hpp"
+
+#include <vector>
+
+namespace gps {
+
+    // Many copies of one model drawn with hardware instancing. Every frame the
+    // instances are sorted by the level of detail each mesh needs from the
+    // camera, so a model takes one draw call per mesh and level in use.
+    class ModelInstances
+    {
+    public:
+        // `transform` places the copy relative to the `model` uniform of the draw
+        void add(const glm::mat4& transform, const glm::vec4& tint = glm::vec4(1.0f));
+        void clear();
+        size_t size() const;
+
+        // `lodView` is the one the model would be drawn with on its own; the
+        // shader's `instanced` uniform is on only for the duration of the call
+        void Draw(const Model3D& model, gps::Shader shader, const LodView& lodView, ClusterCullStats* stats = NULL);
+
+        // Only the instances i with visibleInstances[i] set
+        void Draw(const Model3D& model, gps::Shader shader, const LodView& lodView, const char* visibleInstances,
+            ClusterCullStats* stats = NULL);
+
+        const std::vector<ModelInstance>& getInstances() const;
+
+    private:
+        struct Range {
+            size_t mesh;
+            size_t level;
+            size_t firstInstance;
+            size_t instanceCount;
+        };
+
+        std::vector<ModelInstance> instances;
+        // to bring the camera into the space of each instance
+        std::vector<glm::mat4> inverseTransforms;
+
+        // Rebuilt by every draw, kept to avoid allocating
+        std::vector<LodView> instanceViews;
+        std::vector<size_t> levels;
+        std::vector<size_t> drawn;
+        std::vector<ModelInstance> sorted;
+        std::vector<Range> ranges;
+        InstanceBuffer buffer;
+    };
+}
+
+#endif /* ModelInstances_hpp */
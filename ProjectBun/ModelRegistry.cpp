@@ -0,0 +1,38 @@
+#include "ModelRegistry.hpp"
+#include "FileUtils.hpp"
+
+namespace gps {
+
+	ModelRegistry& ModelRegistry::shared()
+	{
+		// never destroyed: models living in globals drop their geometry at exit
+		static ModelRegistry* registry = new ModelRegistry();
+		return *registry;
+	}
+
+	bool ModelRegistry::makeKey(const std::string& fileName, uint64_t importKey, uint64_t* key)
+	{
+		uint64_t contentHash;
+		if (!hashFile(fileName, &contentHash))
+			return false;
+		*key = hashBytes(&importKey, sizeof(importKey), contentHash);
+		return true;
+	}
+
+	std::shared_ptr<ModelGeometry> ModelRegistry::find(uint64_t key)
+	{
+		std::unordered_map<uint64_t, std::weak_ptr<ModelGeometry> >::iterator it = entries.find(key);
+		if (it == entries.end())
+			return std::shared_ptr<ModelGeometry>();
+
+		std::shared_ptr<ModelGeometry> geometry = it->second.lock();
+		if (!geometry)
+			entries.erase(it);
+		return geometry;
+	}
+
+	void ModelRegistry::add(uint64_t key, const std::shared_ptr<ModelGeometry>& geometry)
+	{
+		entries[key] = geometry;
+	}
+}
@@ -0,0 +1,47 @@
+#ifndef ModelRegistry_hpp
+#define ModelRegistry_hpp
+
+#include "Mesh.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace gps {
+
+    // Geometry of one loaded model file, shared by every Model3D created from
+    // identical file contents. The meshes give their GPU buffer ranges back
+    // to the arena when the last model using them goes away.
+    struct ModelGeometry
+    {
+        // Meshes without textures - each model resolves its own materials
+        std::vector<Mesh> meshes;
+        // Material used by each mesh, by name ("" = none)
+        std::vector<std::string> materialNames;
+        // .mtl files the source refers to, relative to its directory
+        std::vector<std::string> materialLibraries;
+    };
+
+    // Finds the geometry of an already loaded model with the same contents.
+    // Entries go away with the last model using them. GL thread only.
+    class ModelRegistry
+    {
+    public:
+        static ModelRegistry& shared();
+
+        // Key for a model file imported with the given options, false if it can not be read
+        static bool makeKey(const std::string& fileName, uint64_t importKey, uint64_t* key);
+
+        // Live geometry for a key, null if there is none
+        std::shared_ptr<ModelGeometry> find(uint64_t key);
+
+        void add(uint64_t key, const std::shared_ptr<ModelGeometry>& geometry);
+
+    private:
+        std::unordered_map<uint64_t, std::weak_ptr<ModelGeometry> > entries;
+    };
+}
+
+#endif /* ModelRegistry_hpp */
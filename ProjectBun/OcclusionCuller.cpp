@@ -0,0 +1,716 @@
+#include "OcclusionCuller.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define GPS_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace gps {
+
+	namespace {
+
+		// Boxes covering more pixels than this are taken as visible once the tiles fail to hide them
+		const int MAX_PIXEL_TEST = 32 * 32;
+
+		const GLuint NO_VERTEX = 0xffffffffu;
+
+		bool intersectsFrustum(const CullingView& frustum, const BoundingBox& box)
+		{
+			glm::vec3 center = (box.min + box.max) * 0.5f;
+			glm::vec3 extent = (box.max - box.min) * 0.5f;
+			for (int p = 0; p < 6; p++) {
+				glm::vec3 normal = glm::vec3(frustum.planes[p]);
+				float radius = glm::dot(glm::abs(normal), extent);
+				if (glm::dot(normal, center) + frustum.planes[p].w < -radius)
+					return false;
+			}
+			return true;
+		}
+
+		// Whether the triangles abc and abd of a shared edge ab lie on the same side
+		// of it on screen, which makes the edge a silhouette. The side is the sign of
+		// det(x, y, w), which holds whichever side of the camera a and b are on.
+		bool foldsOver(const glm::vec4& a, const glm::vec4& b, const glm::vec4& c, const glm::vec4& d)
+		{
+			if (c.w <= 0.0f || d.w <= 0.0f)
+				return true;
+			glm::vec3 line = glm::cross(glm::vec3(a.x, a.y, a.w), glm::vec3(b.x, b.y, b.w));
+			return glm::dot(line, glm::vec3(c.x, c.y, c.w)) * glm::dot(line, glm::vec3(d.x, d.y, d.w)) >= 0.0f;
+		}
+
+		// Splits the part of a clip space triangle in front of the near plane (z >= -w)
+		// into at most two triangles. silhouette[e] flags the edge from corner e to the
+		// next one; the cut along the near plane is a silhouette, the diagonal is not.
+		int clipNear(const glm::vec4* triangle, const bool* silhouette, glm::vec4* clipped, bool* clippedSilhouette)
+		{
+			glm::vec4 polygon[4];
+			bool polygonSilhouette[4];
+			int count = 0;
+			for (int i = 0; i < 3; i++) {
+				const glm::vec4& a = triangle[i];
+				const glm::vec4& b = triangle[(i + 1) % 3];
+				float distanceA = a.z + a.w;
+				float distanceB = b.z + b.w;
+				if (distanceA >= 0.0f) {
+					polygonSilhouette[count] = silhouette[i];
+					polygon[count++] = a;
+				}
+				if ((distanceA >= 0.0f) != (distanceB >= 0.0f)) {
+					polygonSilhouette[count] = distanceA >= 0.0f || silhouette[i];
+					polygon[count++] = a + (b - a) * (distanceA / (distanceA - distanceB));
+				}
+			}
+			if (count < 3)
+				return 0;
+
+			for (int i = 0; i + 2 < count; i++) {
+				clipped[i * 3] = polygon[0];
+				clipped[i * 3 + 1] = polygon[i + 1];
+				clipped[i * 3 + 2] = polygon[i + 2];
+				clippedSilhouette[i * 3] = i == 0 && polygonSilhouette[0];
+				clippedSilhouette[i * 3 + 1] = polygonSilhouette[i + 1];
+				clippedSilhouette[i * 3 + 2] = i + 3 == count && polygonSilhouette[count - 1];
+			}
+			return count - 2;
+		}
+
+		// Bits of the clip planes a vertex is outside of, the near plane excluded
+		int outcode(const glm::vec4& v)
+		{
+			return (v.x < -v.w ? 1 : 0) | (v.x > v.w ? 2 : 0) | (v.y < -v.w ? 4 : 0) | (v.y > v.w ? 8 : 0) | (v.z > v.w ? 16 : 0);
+		}
+	}
+
+	// Inside where all three edge equations are >= 0, depth a plane over the screen
+	struct OcclusionCuller::ScreenTriangle
+	{
+		float edgeX[3];
+		float edgeY[3];
+		float edgeConstant[3];
+		float depthX;
+		float depthY;
+		float depthConstant;
+		// pixels whose centers the triangle can cover
+		int minX;
+		int maxX;
+		int minY;
+		int maxY;
+	};
+
+	// The triangles of one occluder and the silhouette edges of their union, in pixels
+	struct OcclusionCuller::ScreenOccluder
+	{
+		std::vector<ScreenTriangle> triangles;
+		std::vector<glm::vec4> silhouettes;
+		// pixels whose centers the triangles can cover
+		int minX;
+		int maxX;
+		int minY;
+		int maxY;
+	};
+
+	OcclusionCuller::OcclusionCuller(int width, int height)
+		: width(width), height(height), triangleBudget(16384), viewProjection(1.0f), reprojection(false),
+		previousViewProjection(1.0f), hasPrevious(false), occludersMoved(false)
+	{
+		tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+		tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+		stride = tilesX * TILE_SIZE;
+		// padding stays at depth 0 so it never raises a tile's farthest depth
+		depth.assign((size_t)stride * tilesY * TILE_SIZE, 0.0f);
+		for (int y = 0; y < height; y++)
+			std::fill(depth.begin() + (size_t)y * stride, depth.begin() + (size_t)y * stride + width, 1.0f);
+		tileDepth.assign((size_t)tilesX * tilesY, 1.0f);
+		occluderDepth.assign(depth.size(), 1.0f);
+	}
+
+	size_t OcclusionCuller::addOccluders(const Model3D& model, float minSize, float maxProxyError)
+	{
+		size_t id = transforms.size();
+		transforms.push_back(glm::mat4(1.0f));
+
+		const std::vector<Mesh>& meshes = model.GetMeshes();
+		for (size_t m = 0; m < meshes.size(); m++) {
+			const Mesh& mesh = meshes[m];
+			if (!mesh.getVertices() || !mesh.getIndices())
+				continue;
+
+			// thin things (poles, railings) hide little for their triangles
+			glm::vec3 size = mesh.getBoundingBox().max - mesh.getBoundingBox().min;
+			float extents[3] = { size.x, size.y, size.z };
+			std::sort(extents, extents + 3);
+			if (extents[1] < minSize)
+				continue;
+
+			const std::vector<MeshLod>& lods = mesh.getLods();
+			size_t level = 0;
+			while (level + 1 < lods.size() && lods[level + 1].error <= maxProxyError)
+				level++;
+
+			// only the positions the level uses, so coarse proxies transform fewer vertices
+			std::vector<glm::vec3> positions;
+			std::vector<GLuint> levelIndices;
+			std::vector<GLuint> remap(mesh.getVertexCount(), NO_VERTEX);
+			const GLuint* indices = mesh.getIndices() + lods[level].firstIndex;
+			for (size_t i = 0; i < lods[level].indexCount; i++) {
+				GLuint& vertex = remap[indices[i]];
+				if (vertex == NO_VERTEX) {
+					vertex = (GLuint)positions.size();
+					positions.push_back(mesh.getVertices()[indices[i]].Position);
+				}
+				levelIndices.push_back(vertex);
+			}
+			addPieces(id, positions, levelIndices);
+		}
+		occludersMoved = true;
+		return id;
+	}
+
+	size_t OcclusionCuller::addOccluder(const std::vector<glm::vec3>& positions, const std::vector<GLuint>& indices)
+	{
+		size_t id = transforms.size();
+		transforms.push_back(glm::mat4(1.0f));
+
+		addPieces(id, positions, indices);
+		occludersMoved = true;
+		return id;
+	}
+
+	void OcclusionCuller::addPieces(size_t model, const std::vector<glm::vec3>& positions, const std::vector<GLuint>& indices)
+	{
+		// split vertices (normals, texture seams) would make every seam an open edge
+		std::map<std::tuple<float, float, float>, GLuint> welded;
+		std::vector<GLuint> remap(positions.size());
+		std::vector<glm::vec3> weldedPositions;
+		for (size_t i = 0; i < positions.size(); i++) {
+			const glm::vec3& p = positions[i];
+			std::pair<std::map<std::tuple<float, float, float>, GLuint>::iterator, bool> inserted =
+				welded.insert(std::make_pair(std::make_tuple(p.x, p.y, p.z), (GLuint)weldedPositions.size()));
+			if (inserted.second)
+				weldedPositions.push_back(p);
+			remap[i] = inserted.first->second;
+		}
+		size_t indexCount = indices.size() / 3 * 3;
+		std::vector<GLuint> weldedIndices(indexCount);
+		for (size_t i = 0; i < indexCount; i++)
+			weldedIndices[i] = remap[indices[i]];
+
+		// the first corner using each edge and how many do
+		std::unordered_map<uint64_t, std::pair<size_t, int> > edges;
+		for (size_t i = 0; i < indexCount; i++) {
+			GLuint a = weldedIndices[i];
+			GLuint b = weldedIndices[i % 3 == 2 ? i - 2 : i + 1];
+			uint64_t key = ((uint64_t)std::min(a, b) << 32) | std::max(a, b);
+			std::pair<size_t, int>& edge = edges.insert(std::make_pair(key, std::make_pair(i, 0))).first->second;
+			edge.second++;
+		}
+
+		// the far corner across every edge of exactly two triangles, and the
+		// pieces the shared edges join the triangles into
+		std::vector<GLuint> opposite(indexCount, NO_VERTEX);
+		std::vector<size_t> piece(indexCount / 3);
+		for (size_t t = 0; t < piece.size(); t++)
+			piece[t] = t;
+		std::function<size_t(size_t)> findPiece = [&](size_t t) {
+			while (piece[t] != t)
+				t = piece[t] = piece[piece[t]];
+			return t;
+		};
+		for (size_t i = 0; i < indexCount; i++) {
+			GLuint a = weldedIndices[i];
+			GLuint b = weldedIndices[i % 3 == 2 ? i - 2 : i + 1];
+			const std::pair<size_t, int>& edge = edges[((uint64_t)std::min(a, b) << 32) | std::max(a, b)];
+			size_t first = edge.first;
+			if (first == i)
+				continue;
+			piece[findPiece(i / 3)] = findPiece(first / 3);
+			// both corners are filled in from the later one
+			if (edge.second == 2) {
+				opposite[first] = weldedIndices[i - i % 3 + (i + 2) % 3];
+				opposite[i] = weldedIndices[first - first % 3 + (first + 2) % 3];
+			}
+		}
+
+		std::unordered_map<size_t, size_t> pieceNumbers;
+		std::vector<std::vector<size_t> > pieceTriangles;
+		for (size_t t = 0; t < piece.size(); t++) {
+			std::pair<std::unordered_map<size_t, size_t>::iterator, bool> inserted =
+				pieceNumbers.insert(std::make_pair(findPiece(t), pieceTriangles.size()));
+			if (inserted.second)
+				pieceTriangles.push_back(std::vector<size_t>());
+			pieceTriangles[inserted.first->second].push_back(t);
+		}
+
+		// one occluder per piece, with the positions it uses
+		std::vector<GLuint> local(weldedPositions.size());
+		std::vector<size_t> localPiece(weldedPositions.size(), pieceTriangles.size());
+		for (size_t p = 0; p < pieceTriangles.size(); p++) {
+			const std::vector<size_t>& triangles = pieceTriangles[p];
+			Occluder occluder;
+			occluder.model = model;
+			occluder.bounds.min = glm::vec3(1e30f);
+			occluder.bounds.max = glm::vec3(-1e30f);
+			for (size_t t = 0; t < triangles.size(); t++) {
+				for (int k = 0; k < 3; k++) {
+					GLuint vertex = weldedIndices[triangles[t] * 3 + k];
+					if (localPiece[vertex] != p) {
+						localPiece[vertex] = p;
+						local[vertex] = (GLuint)occluder.positions.size();
+						occluder.positions.push_back(weldedPositions[vertex]);
+						occluder.bounds.min = glm::min(occluder.bounds.min, weldedPositions[vertex]);
+						occluder.bounds.max = glm::max(occluder.bounds.max, weldedPositions[vertex]);
+					}
+					occluder.indices.push_back(local[vertex]);
+				}
+			}
+			// the far corners of shared edges are in the same piece
+			for (size_t t = 0; t < triangles.size(); t++) {
+				for (int k = 0; k < 3; k++) {
+					GLuint far = opposite[triangles[t] * 3 + k];
+					occluder.opposite.push_back(far == NO_VERTEX ? NO_VERTEX : local[far]);
+				}
+			}
+			occluders.push_back(occluder);
+		}
+	}
+
+	void OcclusionCuller::setTransform(size_t model, const glm::mat4& transform)
+	{
+		if (transforms[model] != transform) {
+			transforms[model] = transform;
+			occludersMoved = true;
+		}
+	}
+
+	size_t OcclusionCuller::getOccluderCount() const
+	{
+		return occluders.size();
+	}
+
+	void OcclusionCuller::setTriangleBudget(size_t triangles)
+	{
+		triangleBudget = triangles;
+	}
+
+	void OcclusionCuller::setReprojection(bool enabled)
+	{
+		reprojection = enabled;
+		if (!enabled)
+			hasPrevious = false;
+	}
+
+	void OcclusionCuller::render(const glm::mat4& viewProjection, const glm::vec3& cameraPosition, OcclusionStats* stats)
+	{
+		this->viewProjection = viewProjection;
+		CullingView frustum = makeCullingView(viewProjection, cameraPosition, glm::mat4(1.0f));
+
+		// occluders in view, the ones covering most of the screen first
+		std::vector<std::pair<float, size_t> > candidates;
+		for (size_t i = 0; i < occluders.size(); i++) {
+			BoundingBox box = transformBox(occluders[i].bounds, transforms[occluders[i].model]);
+			if (!intersectsFrustum(frustum, box))
+				continue;
+			float radius = glm::length(box.max - box.min) * 0.5f;
+			float distance = std::max(glm::length((box.min + box.max) * 0.5f - cameraPosition) - radius, 1e-3f);
+			candidates.push_back(std::make_pair(radius / distance, i));
+		}
+		std::sort(candidates.begin(), candidates.end(), std::greater<std::pair<float, size_t> >());
+
+		std::vector<size_t> selected;
+		size_t triangles = 0;
+		for (size_t c = 0; c < candidates.size(); c++) {
+			size_t count = occluders[candidates[c].second].indices.size() / 3;
+			if (!selected.empty() && triangles + count > triangleBudget)
+				continue;
+			selected.push_back(candidates[c].second);
+			triangles += count;
+		}
+
+		ThreadPool& pool = ThreadPool::shared();
+		std::vector<ScreenOccluder> screenOccluders(selected.size());
+		pool.parallelFor(selected.size(), [&](size_t i) {
+			const Occluder& occluder = occluders[selected[i]];
+			setupTriangles(occluder, viewProjection * transforms[occluder.model], screenOccluders[i]);
+		});
+
+		// bands of tile rows, about two per thread; each clears and fills its own rows
+		int bandTiles = std::max(1, tilesY / (int)(2 * (pool.size() + 1)));
+		int bandCount = (tilesY + bandTiles - 1) / bandTiles;
+		pool.parallelFor(bandCount, [&](size_t band) {
+			int firstRow = (int)band * bandTiles * TILE_SIZE;
+			int endRow = std::min(firstRow + bandTiles * TILE_SIZE, height);
+			for (int y = firstRow; y < endRow; y++)
+				std::fill(depth.begin() + (size_t)y * stride, depth.begin() + (size_t)y * stride + width, 1.0f);
+
+			// one occluder at a time in the scratch rows, opened where its silhouettes
+			// cross, so only the pixels it covers whole reach the depth buffer
+			for (size_t i = 0; i < screenOccluders.size(); i++) {
+				const ScreenOccluder& screen = screenOccluders[i];
+				int firstY = std::max(screen.minY, firstRow);
+				int endY = std::min(screen.maxY + 1, endRow);
+				if (firstY >= endY)
+					continue;
+				for (int y = firstY; y < endY; y++)
+					std::fill(occluderDepth.begin() + (size_t)y * stride + screen.minX,
+						occluderDepth.begin() + (size_t)y * stride + screen.maxX + 1, 1.0f);
+				for (size_t t = 0; t < screen.triangles.size(); t++)
+					if (screen.triangles[t].minY < endY && screen.triangles[t].maxY >= firstY)
+						rasterize(screen.triangles[t], firstY, endY);
+				for (size_t e = 0; e < screen.silhouettes.size(); e++)
+					clearCrossedPixels(screen.silhouettes[e], screen, firstY, endY);
+				for (int y = firstY; y < endY; y++) {
+					float* row = depth.data() + (size_t)y * stride;
+					const float* occluderRow = occluderDepth.data() + (size_t)y * stride;
+					for (int x = screen.minX; x <= screen.maxX; x++)
+						row[x] = std::min(row[x], occluderRow[x]);
+				}
+			}
+		});
+
+		size_t reprojectedSamples = 0;
+		if (reprojection) {
+			std::vector<float> rasterized = depth;
+			if (hasPrevious && !occludersMoved)
+				reprojectedSamples = reproject();
+			previousDepth.swap(rasterized);
+			previousViewProjection = viewProjection;
+			hasPrevious = true;
+		}
+		occludersMoved = false;
+
+		pool.parallelFor(bandCount, [&](size_t band) {
+			updateTileDepth((int)band * bandTiles, std::min(((int)band + 1) * bandTiles, tilesY));
+		});
+
+		if (stats) {
+			stats->occluders += selected.size();
+			for (size_t i = 0; i < screenOccluders.size(); i++)
+				stats->occluderTriangles += screenOccluders[i].triangles.size();
+			stats->reprojectedSamples += reprojectedSamples;
+		}
+	}
+
+	void OcclusionCuller::setupTriangles(const Occluder& occluder, const glm::mat4& clipTransform,
+		ScreenOccluder& screenOccluder) const
+	{
+		std::vector<ScreenTriangle>& triangles = screenOccluder.triangles;
+		screenOccluder.minX = width;
+		screenOccluder.maxX = -1;
+		screenOccluder.minY = height;
+		screenOccluder.maxY = -1;
+
+		std::vector<glm::vec4> clip(occluder.positions.size());
+		std::vector<int> outcodes(clip.size());
+		for (size_t i = 0; i < clip.size(); i++) {
+			clip[i] = clipTransform * glm::vec4(occluder.positions[i], 1.0f);
+			outcodes[i] = outcode(clip[i]);
+		}
+
+		for (size_t i = 0; i + 2 < occluder.indices.size(); i += 3) {
+			const GLuint* index = &occluder.indices[i];
+			if (outcodes[index[0]] & outcodes[index[1]] & outcodes[index[2]])
+				continue;
+
+			glm::vec4 triangle[3] = { clip[index[0]], clip[index[1]], clip[index[2]] };
+			bool silhouette[3];
+			for (int e = 0; e < 3; e++) {
+				GLuint far = occluder.opposite[i + e];
+				silhouette[e] = far == NO_VERTEX || foldsOver(triangle[e], triangle[(e + 1) % 3], triangle[(e + 2) % 3], clip[far]);
+			}
+
+			glm::vec4 clipped[6];
+			bool clippedSilhouette[6];
+			int count = clipNear(triangle, silhouette, clipped, clippedSilhouette);
+			for (int c = 0; c < count; c++) {
+				glm::vec3 v[3];
+				for (int k = 0; k < 3; k++) {
+					const glm::vec4& p = clipped[c * 3 + k];
+					v[k] = glm::vec3((p.x / p.w * 0.5f + 0.5f) * width, (p.y / p.w * 0.5f + 0.5f) * height,
+						p.z / p.w * 0.5f + 0.5f);
+				}
+				// taken even from triangles too thin to cover a pixel center
+				for (int k = 0; k < 3; k++)
+					if (clippedSilhouette[c * 3 + k])
+						screenOccluder.silhouettes.push_back(glm::vec4(v[k].x, v[k].y, v[(k + 1) % 3].x, v[(k + 1) % 3].y));
+
+				// both sides are drawn, so turn every triangle counter-clockwise
+				float area = (v[1].x - v[0].x) * (v[2].y - v[0].y) - (v[2].x - v[0].x) * (v[1].y - v[0].y);
+				if (std::fabs(area) < 1e-6f)
+					continue;
+				if (area < 0.0f) {
+					std::swap(v[1], v[2]);
+					area = -area;
+				}
+
+				ScreenTriangle screen;
+				float minX = std::min(v[0].x, std::min(v[1].x, v[2].x));
+				float maxX = std::max(v[0].x, std::max(v[1].x, v[2].x));
+				float minY = std::min(v[0].y, std::min(v[1].y, v[2].y));
+				float maxY = std::max(v[0].y, std::max(v[1].y, v[2].y));
+				screen.minX = std::max(0, (int)std::ceil(std::max(minX - 0.5f, -1.0f)));
+				screen.maxX = std::min(width - 1, (int)std::floor(std::min(maxX - 0.5f, (float)width)));
+				screen.minY = std::max(0, (int)std::ceil(std::max(minY - 0.5f, -1.0f)));
+				screen.maxY = std::min(height - 1, (int)std::floor(std::min(maxY - 0.5f, (float)height)));
+				if (screen.minX > screen.maxX || screen.minY > screen.maxY)
+					continue;
+
+				// the two triangles of a shared edge get exactly opposite equations, no cracks between them
+				for (int e = 0; e < 3; e++) {
+					const glm::vec3* a = &v[e];
+					const glm::vec3* b = &v[(e + 1) % 3];
+					bool swapped = a->y > b->y || (a->y == b->y && a->x > b->x);
+					if (swapped)
+						std::swap(a, b);
+					float edgeX = a->y - b->y;
+					float edgeY = b->x - a->x;
+					float edgeConstant = -(edgeX * a->x + edgeY * a->y);
+					screen.edgeX[e] = swapped ? -edgeX : edgeX;
+					screen.edgeY[e] = swapped ? -edgeY : edgeY;
+					screen.edgeConstant[e] = swapped ? -edgeConstant : edgeConstant;
+				}
+				screen.depthX = ((v[1].z - v[0].z) * (v[2].y - v[0].y) - (v[2].z - v[0].z) * (v[1].y - v[0].y)) / area;
+				screen.depthY = ((v[1].x - v[0].x) * (v[2].z - v[0].z) - (v[2].x - v[0].x) * (v[1].z - v[0].z)) / area;
+				screen.depthConstant = v[0].z - screen.depthX * v[0].x - screen.depthY * v[0].y;
+				triangles.push_back(screen);
+				screenOccluder.minX = std::min(screenOccluder.minX, screen.minX);
+				screenOccluder.maxX = std::max(screenOccluder.maxX, screen.maxX);
+				screenOccluder.minY = std::min(screenOccluder.minY, screen.minY);
+				screenOccluder.maxY = std::max(screenOccluder.maxY, screen.maxY);
+			}
+		}
+	}
+
+	// Keeps the nearest depth of the pixel centers inside the triangle in the
+	// occluder's scratch rows [firstRow, endRow)
+	void OcclusionCuller::rasterize(const ScreenTriangle& triangle, int firstRow, int endRow)
+	{
+		int firstY = std::max(triangle.minY, firstRow);
+		int endY = std::min(triangle.maxY + 1, endRow);
+		int firstX = triangle.minX & ~3;
+
+		for (int y = firstY; y < endY; y++) {
+			float centerY = (float)y + 0.5f;
+			float* row = occluderDepth.data() + (size_t)y * stride;
+
+#ifdef GPS_USE_SSE2
+			const __m128 zero = _mm_setzero_ps();
+			const __m128 offsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+			__m128 edgeX0 = _mm_set1_ps(triangle.edgeX[0]);
+			__m128 edgeX1 = _mm_set1_ps(triangle.edgeX[1]);
+			__m128 edgeX2 = _mm_set1_ps(triangle.edgeX[2]);
+			__m128 rowEdge0 = _mm_set1_ps(triangle.edgeY[0] * centerY + triangle.edgeConstant[0]);
+			__m128 rowEdge1 = _mm_set1_ps(triangle.edgeY[1] * centerY + triangle.edgeConstant[1]);
+			__m128 rowEdge2 = _mm_set1_ps(triangle.edgeY[2] * centerY + triangle.edgeConstant[2]);
+			__m128 depthX = _mm_set1_ps(triangle.depthX);
+			__m128 rowDepth = _mm_set1_ps(triangle.depthY * centerY + triangle.depthConstant);
+			// the last group of four must not spill into the row padding
+			__m128 lastCenter = _mm_set1_ps((float)triangle.maxX + 0.5f);
+
+			for (int x = firstX; x <= triangle.maxX; x += 4) {
+				__m128 centerX = _mm_add_ps(_mm_set1_ps((float)x), offsets);
+				__m128 inside = _mm_and_ps(_mm_and_ps(
+					_mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(edgeX0, centerX), rowEdge0), zero),
+					_mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(edgeX1, centerX), rowEdge1), zero)),
+					_mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(edgeX2, centerX), rowEdge2), zero));
+				inside = _mm_and_ps(inside, _mm_cmple_ps(centerX, lastCenter));
+				if (!_mm_movemask_ps(inside))
+					continue;
+
+				__m128 z = _mm_max_ps(_mm_add_ps(_mm_mul_ps(depthX, centerX), rowDepth), zero);
+				__m128 old = _mm_loadu_ps(row + x);
+				__m128 nearest = _mm_min_ps(z, old);
+				_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, old)));
+			}
+#else
+			for (int x = triangle.minX; x <= triangle.maxX; x++) {
+				float centerX = (float)x + 0.5f;
+				bool inside = true;
+				for (int e = 0; e < 3; e++)
+					inside = inside && triangle.edgeX[e] * centerX + triangle.edgeY[e] * centerY + triangle.edgeConstant[e] >= 0.0f;
+				if (!inside)
+					continue;
+				float z = std::max(triangle.depthX * centerX + triangle.depthY * centerY + triangle.depthConstant, 0.0f);
+				row[x] = std::min(row[x], z);
+			}
+#endif
+		}
+	}
+
+	// Opens every pixel of the occluder's rows [firstY, endY) the segment passes through
+	void OcclusionCuller::clearCrossedPixels(const glm::vec4& segment, const ScreenOccluder& occluder, int firstY, int endY)
+	{
+		glm::vec2 a(segment.x, segment.y);
+		glm::vec2 b(segment.z, segment.w);
+		if (a.y > b.y)
+			std::swap(a, b);
+		int firstRow = std::max(firstY, (int)std::floor(std::max(a.y, -1.0f)));
+		int lastRow = std::min(endY - 1, (int)std::floor(std::min(b.y, (float)height)));
+		float slope = b.y > a.y ? (b.x - a.x) / (b.y - a.y) : 0.0f;
+
+		for (int y = firstRow; y <= lastRow; y++) {
+			// the part of the segment within the row
+			float top = std::max((float)y, a.y);
+			float bottom = std::min((float)y + 1.0f, b.y);
+			float x0 = b.y > a.y ? a.x + (top - a.y) * slope : a.x;
+			float x1 = b.y > a.y ? a.x + (bottom - a.y) * slope : b.x;
+			float left = std::max(std::min(x0, x1), -1.0f);
+			float right = std::min(std::max(x0, x1), (float)width);
+			int firstX = std::max(occluder.minX, (int)std::floor(left));
+			int lastX = std::min(occluder.maxX, (int)std::floor(right));
+			if (firstX <= lastX)
+				std::fill(occluderDepth.begin() + (size_t)y * stride + firstX,
+					occluderDepth.begin() + (size_t)y * stride + lastX + 1, 1.0f);
+		}
+	}
+
+	// Moves every covered pixel of the previous frame to where its point lands now;
+	// pixels nothing lands on keep what was rasterized. Returns the samples written.
+	size_t OcclusionCuller::reproject()
+	{
+		glm::mat4 previousToCurrent = viewProjection * glm::inverse(previousViewProjection);
+		size_t samples = 0;
+		for (int y = 0; y < height; y++) {
+			const float* row = previousDepth.data() + (size_t)y * stride;
+			for (int x = 0; x < width; x++) {
+				if (row[x] >= 1.0f)
+					continue;
+				glm::vec4 ndc(((float)x + 0.5f) / width * 2.0f - 1.0f, ((float)y + 0.5f) / height * 2.0f - 1.0f,
+					row[x] * 2.0f - 1.0f, 1.0f);
+				glm::vec4 clip = previousToCurrent * ndc;
+				if (clip.z < -clip.w)
+					continue;
+				float screenX = (clip.x / clip.w * 0.5f + 0.5f) * width;
+				float screenY = (clip.y / clip.w * 0.5f + 0.5f) * height;
+				if (!(screenX >= 0.0f && screenX < (float)width && screenY >= 0.0f && screenY < (float)height))
+					continue;
+				float& target = depth[(size_t)screenY * stride + (size_t)screenX];
+				target = std::min(target, std::max(clip.z / clip.w * 0.5f + 0.5f, 0.0f));
+				samples++;
+			}
+		}
+		return samples;
+	}
+
+	void OcclusionCuller::updateTileDepth(int firstTileRow, int endTileRow)
+	{
+		for (int ty = firstTileRow; ty < endTileRow; ty++) {
+			for (int tx = 0; tx < tilesX; tx++) {
+				const float* tile = depth.data() + (size_t)ty * TILE_SIZE * stride + tx * TILE_SIZE;
+#ifdef GPS_USE_SSE2
+				__m128 farthest = _mm_setzero_ps();
+				for (int y = 0; y < TILE_SIZE; y++)
+					farthest = _mm_max_ps(farthest, _mm_max_ps(_mm_loadu_ps(tile + y * stride), _mm_loadu_ps(tile + y * stride + 4)));
+				farthest = _mm_max_ps(farthest, _mm_shuffle_ps(farthest, farthest, _MM_SHUFFLE(1, 0, 3, 2)));
+				farthest = _mm_max_ps(farthest, _mm_shuffle_ps(farthest, farthest, _MM_SHUFFLE(2, 3, 0, 1)));
+				tileDepth[(size_t)ty * tilesX + tx] = _mm_cvtss_f32(farthest);
+#else
+				float farthest = 0.0f;
+				for (int y = 0; y < TILE_SIZE; y++)
+					for (int x = 0; x < TILE_SIZE; x++)
+						farthest = std::max(farthest, tile[y * stride + x]);
+				tileDepth[(size_t)ty * tilesX + tx] = farthest;
+#endif
+			}
+		}
+	}
+
+	bool OcclusionCuller::isVisible(const BoundingBox& box) const
+	{
+		float minX = 1e30f, maxX = -1e30f, minY = 1e30f, maxY = -1e30f;
+		float nearest = 1.0f;
+		for (int c = 0; c < 8; c++) {
+			glm::vec3 corner((c & 1) ? box.max.x : box.min.x, (c & 2) ? box.max.y : box.min.y, (c & 4) ? box.max.z : box.min.z);
+			glm::vec4 clip = viewProjection * glm::vec4(corner, 1.0f);
+			// reaches past the near plane: nothing can be in front of it
+			if (clip.w <= 0.0f || clip.z < -clip.w)
+				return true;
+			float screenX = (clip.x / clip.w * 0.5f + 0.5f) * width;
+			float screenY = (clip.y / clip.w * 0.5f + 0.5f) * height;
+			minX = std::min(minX, screenX);
+			maxX = std::max(maxX, screenX);
+			minY = std::min(minY, screenY);
+			maxY = std::max(maxY, screenY);
+			nearest = std::min(nearest, clip.z / clip.w * 0.5f + 0.5f);
+		}
+
+		// one pixel more all around: reprojected samples land on the pixel their
+		// point falls in, up to a pixel past where the occluder is now
+		int firstX = std::max(0, (int)std::floor(std::max(minX, -2.0f)) - 1);
+		int lastX = std::min(width - 1, (int)std::floor(std::min(maxX, (float)width)) + 1);
+		int firstY = std::max(0, (int)std::floor(std::max(minY, -2.0f)) - 1);
+		int lastY = std::min(height - 1, (int)std::floor(std::min(maxY, (float)height)) + 1);
+		if (firstX > lastX || firstY > lastY)
+			return false;
+
+		// the farthest depth of the tiles first, then single pixels for small boxes
+		bool hiddenByTiles = true;
+		for (int ty = firstY / TILE_SIZE; ty <= lastY / TILE_SIZE && hiddenByTiles; ty++)
+			for (int tx = firstX / TILE_SIZE; tx <= lastX / TILE_SIZE; tx++)
+				if (tileDepth[(size_t)ty * tilesX + tx] >= nearest) {
+					hiddenByTiles = false;
+					break;
+				}
+		if (hiddenByTiles)
+			return false;
+		if ((lastX - firstX + 1) * (lastY - firstY + 1) > MAX_PIXEL_TEST)
+			return true;
+
+		for (int y = firstY; y <= lastY; y++) {
+			const float* row = depth.data() + (size_t)y * stride;
+			for (int x = firstX; x <= lastX; x++)
+				if (row[x] >= nearest)
+					return true;
+		}
+		return false;
+	}
+
+	void OcclusionCuller::cull(const SceneBvh& bvh, std::vector<char>& visible, OcclusionStats* stats) const
+	{
+		size_t tested = 0;
+		size_t occluded = 0;
+		for (size_t object = 0; object < visible.size(); object++) {
+			if (!visible[object])
+				continue;
+			tested++;
+			if (!isVisible(bvh.getBounds(object))) {
+				visible[object] = 0;
+				occluded++;
+			}
+		}
+
+		if (stats) {
+			stats->testedObjects += tested;
+			stats->occludedObjects += occluded;
+		}
+	}
+
+	int OcclusionCuller::getWidth() const
+	{
+		return width;
+	}
+
+	int OcclusionCuller::getHeight() const
+	{
+		return height;
+	}
+
+	const float* OcclusionCuller::getDepth() const
+	{
+		return depth.data();
+	}
+
+	int OcclusionCuller::getStride() const
+	{
+		return stride;
+	}
+}
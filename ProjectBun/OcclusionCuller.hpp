@@ -0,0 +1,127 @@
+#ifndef OcclusionCuller_hpp
+#define OcclusionCuller_hpp
+
+#include "glm/glm.hpp"
+
+#include "Model3D.hpp"
+#include "Meshlets.hpp"
+#include "SceneBvh.hpp"
+
+#include <cstddef>
+#include <vector>
+
+namespace gps {
+
+    struct OcclusionStats
+    {
+        // occluder pieces and triangles rasterized this frame
+        size_t occluders;
+        size_t occluderTriangles;
+        // depth samples carried over from the previous frame
+        size_t reprojectedSamples;
+        size_t testedObjects;
+        size_t occludedObjects;
+    };
+
+    // Software occlusion culling, entirely on the CPU: a few large occluder
+    // meshes are rasterized depth-only into a small buffer, tile rows spread
+    // over the thread pool and four pixels at a time, and boxes are tested
+    // against the farthest depth of every 8x8 tile before single pixels. An
+    // occluder only covers the pixels it covers whole: the pixels its
+    // silhouette edges cross are left open, so nothing is culled through a gap
+    // narrower than a pixel. No GL calls, so it runs without a context.
+    class OcclusionCuller
+    {
+    public:
+        static const int TILE_SIZE = 8;
+
+        OcclusionCuller(int width = 320, int height = 180);
+
+        // Takes the meshes of `model` whose box is at least `minSize` across in
+        // two dimensions (walls, floors) as occluders, each at the coarsest
+        // level of detail within `maxProxyError`, split into the pieces their
+        // shared edges join. The meshes need their CPU geometry. Returns the id
+        // to move them with.
+        size_t addOccluders(const Model3D& model, float minSize, float maxProxyError = 0.0f);
+        // Takes the pieces of a triangle list, e.g. a hand-made proxy, as occluders as is
+        size_t addOccluder(const std::vector<glm::vec3>& positions, const std::vector<GLuint>& indices);
+        void setTransform(size_t model, const glm::mat4& transform);
+        size_t getOccluderCount() const;
+
+        // Occluders are taken nearest/largest first until the budget is used up
+        void setTriangleBudget(size_t triangles);
+
+        // Merges the previous frame's rasterized depth, moved to the new view,
+        // with this frame's; skipped on frames the occluders have moved
+        void setReprojection(bool enabled);
+
+        // Fills the depth buffer for the view
+        void render(const glm::mat4& viewProjection, const glm::vec3& cameraPosition, OcclusionStats* stats = NULL);
+
+        // False when `box` (world space) is behind the occluders everywhere it covers
+        bool isVisible(const BoundingBox& box) const;
+
+        // Clears visible[object] for the objects of `bvh` the occluders hide
+        void cull(const SceneBvh& bvh, std::vector<char>& visible, OcclusionStats* stats = NULL) const;
+
+        int getWidth() const;
+        int getHeight() const;
+        // [0, 1] window depth, bottom row first, getStride() floats per row
+        const float* getDepth() const;
+        int getStride() const;
+
+    private:
+        struct Occluder {
+            size_t model;
+            std::vector<glm::vec3> positions;
+            std::vector<GLuint> indices;
+            // for the edge from indices[i] to the next corner of its triangle,
+            // the far corner of the triangle across it, if exactly one is
+            std::vector<GLuint> opposite;
+            BoundingBox bounds;
+        };
+
+        struct ScreenTriangle;
+        struct ScreenOccluder;
+
+        // Merges the vertices by position and adds every piece of triangles
+        // joined by shared edges as an occluder of its own
+        void addPieces(size_t model, const std::vector<glm::vec3>& positions, const std::vector<GLuint>& indices);
+
+        int width;
+        int height;
+        // rows padded to whole tiles
+        int stride;
+        int tilesX;
+        int tilesY;
+        std::vector<float> depth;
+        // farthest depth of every tile
+        std::vector<float> tileDepth;
+        // one occluder at a time, before it is merged into `depth`
+        std::vector<float> occluderDepth;
+
+        std::vector<Occluder> occluders;
+        std::vector<glm::mat4> transforms;
+        size_t triangleBudget;
+
+        glm::mat4 viewProjection;
+
+        bool reprojection;
+        // rasterized depth of the last frame, before anything was reprojected into it
+        std::vector<float> previousDepth;
+        glm::mat4 previousViewProjection;
+        bool hasPrevious;
+        bool occludersMoved;
+
+        // Clip space triangles of `occluder` to screen space edge and depth
+        // equations, and the edges no other triangle of it continues past
+        void setupTriangles(const Occluder& occluder, const glm::mat4& clipTransform,
+            ScreenOccluder& screenOccluder) const;
+        void rasterize(const ScreenTriangle& triangle, int firstRow, int endRow);
+        void clearCrossedPixels(const glm::vec4& segment, const ScreenOccluder& occluder, int firstY, int endY);
+        size_t reproject();
+        void updateTileDepth(int firstTileRow, int endTileRow);
+    };
+}
+
+#endif /* OcclusionCuller_hpp */
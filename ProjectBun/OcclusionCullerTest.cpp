@@ -0,0 +1,282 @@
+// Checks the software occlusion culler without a GL context: triangle setup
+// and near clipping, the conservative box test, reprojection and gaps between
+// occluders narrower than a pixel. Not part of the application build; run
+// from this directory, linked with the rest of the application:
+//   g++ -std=c++14 -O2 -pthread OcclusionCullerTest.cpp $(ls *.cpp | grep -v -e main.cpp -e Test.cpp) -lglfw -lGLEW -lGL -o OcclusionCullerTest && ./OcclusionCullerTest
+#include "OcclusionCuller.hpp"
+
+#include "glm/glm.hpp"
+#include "glm/gtc/matrix_transform.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+namespace {
+
+	const int SIZE = 64;
+
+	struct Results {
+		size_t checks;
+		size_t failures;
+	};
+
+	Results results = { 0, 0 };
+
+	void expect(bool condition, const char* what)
+	{
+		results.checks++;
+		if (!condition) {
+			printf("  failed: %s\n", what);
+			results.failures++;
+		}
+	}
+
+	struct Geometry {
+		std::vector<glm::vec3> positions;
+		std::vector<GLuint> indices;
+	};
+
+	// A wall facing the camera at depth z
+	void addQuad(Geometry& geometry, float minX, float minY, float maxX, float maxY, float z)
+	{
+		GLuint first = (GLuint)geometry.positions.size();
+		geometry.positions.push_back(glm::vec3(minX, minY, z));
+		geometry.positions.push_back(glm::vec3(maxX, minY, z));
+		geometry.positions.push_back(glm::vec3(maxX, maxY, z));
+		geometry.positions.push_back(glm::vec3(minX, maxY, z));
+		GLuint quad[6] = { 0, 1, 2, 0, 2, 3 };
+		for (int i = 0; i < 6; i++)
+			geometry.indices.push_back(first + quad[i]);
+	}
+
+	// A closed box, four corners per face as a loader would split them
+	void addBox(Geometry& geometry, const glm::vec3& min, const glm::vec3& max)
+	{
+		for (int axis = 0; axis < 3; axis++) {
+			for (int side = 0; side < 2; side++) {
+				int u = (axis + 1) % 3;
+				int v = (axis + 2) % 3;
+				GLuint first = (GLuint)geometry.positions.size();
+				for (int corner = 0; corner < 4; corner++) {
+					glm::vec3 p;
+					p[axis] = side ? max[axis] : min[axis];
+					p[u] = (corner == 1 || corner == 2) ? max[u] : min[u];
+					p[v] = (corner >= 2) ? max[v] : min[v];
+					geometry.positions.push_back(p);
+				}
+				GLuint quad[6] = { 0, 1, 2, 0, 2, 3 };
+				for (int i = 0; i < 6; i++)
+					geometry.indices.push_back(first + quad[i]);
+			}
+		}
+	}
+
+	glm::mat4 viewProjection(const glm::vec3& camera)
+	{
+		glm::mat4 projection = glm::perspective(glm::radians(90.0f), 1.0f, 0.1f, 100.0f);
+		return projection * glm::lookAt(camera, camera + glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	}
+
+	float depthAt(const gps::OcclusionCuller& culler, int x, int y)
+	{
+		return culler.getDepth()[(size_t)y * culler.getStride() + x];
+	}
+
+	float windowDepth(const glm::mat4& viewProjection, const glm::vec3& point)
+	{
+		glm::vec4 clip = viewProjection * glm::vec4(point, 1.0f);
+		return clip.z / clip.w * 0.5f + 0.5f;
+	}
+
+	// The box from depth `nearZ` to `farZ` (negative, camera at the origin looking
+	// down -z) whose near face covers [minX, maxX] x [minY, maxY] in pixels
+	gps::BoundingBox screenBox(float minX, float minY, float maxX, float maxY, float nearZ, float farZ)
+	{
+		float scale = -nearZ / (SIZE * 0.5f);
+		gps::BoundingBox box;
+		box.min = glm::vec3((minX - SIZE * 0.5f) * scale, (minY - SIZE * 0.5f) * scale, farZ);
+		box.max = glm::vec3((maxX - SIZE * 0.5f) * scale, (maxY - SIZE * 0.5f) * scale, nearZ);
+		return box;
+	}
+
+	void testRasterization()
+	{
+		// spans pixels 25.4 to 38.6 both ways: the centers of 25 and 38 are inside
+		Geometry wall;
+		addQuad(wall, -1.03125f, -1.03125f, 1.03125f, 1.03125f, -5.0f);
+		gps::OcclusionCuller culler(SIZE, SIZE);
+		culler.addOccluder(wall.positions, wall.indices);
+		glm::mat4 view = viewProjection(glm::vec3(0.0f));
+		culler.render(view, glm::vec3(0.0f));
+
+		int covered = 0;
+		int minX = SIZE, maxX = -1;
+		for (int y = 0; y < SIZE; y++)
+			for (int x = 0; x < SIZE; x++)
+				if (depthAt(culler, x, y) < 1.0f) {
+					covered++;
+					minX = std::min(minX, x);
+					maxX = std::max(maxX, x);
+				}
+		expect(covered == 12 * 12, "a wall covers exactly the pixels it covers whole");
+		expect(minX == 26 && maxX == 37, "no pixel a silhouette passes through is covered");
+		expect(std::fabs(depthAt(culler, 32, 32) - windowDepth(view, glm::vec3(0.0f, 0.0f, -5.0f))) < 1e-5f,
+			"covered pixels hold the wall's window depth");
+
+		// the floor from behind the camera to far ahead, clipped at the near plane
+		Geometry floor;
+		addQuad(floor, -50.0f, -50.0f, 50.0f, 5.0f, 0.0f);
+		for (size_t i = 0; i < floor.positions.size(); i++)
+			floor.positions[i] = glm::vec3(floor.positions[i].x, -1.0f, floor.positions[i].y);
+		gps::OcclusionCuller clipped(SIZE, SIZE);
+		clipped.addOccluder(floor.positions, floor.indices);
+		gps::OcclusionStats stats = gps::OcclusionStats();
+		clipped.render(view, glm::vec3(0.0f), &stats);
+
+		bool inRange = true;
+		bool aboveHorizonEmpty = true;
+		for (int y = 0; y < SIZE; y++)
+			for (int x = 0; x < SIZE; x++) {
+				float z = depthAt(clipped, x, y);
+				inRange = inRange && z >= 0.0f && z <= 1.0f;
+				if (y >= SIZE / 2)
+					aboveHorizonEmpty = aboveHorizonEmpty && z == 1.0f;
+			}
+		expect(inRange, "near clipped triangles write depths in [0, 1]");
+		expect(aboveHorizonEmpty, "nothing of the floor lands above the horizon");
+		expect(depthAt(clipped, 32, 0) < windowDepth(view, glm::vec3(0.0f, -1.0f, -1.5f)),
+			"the floor reaches the bottom row from just past the near plane");
+		expect(depthAt(clipped, 0, 0) < 1.0f && depthAt(clipped, SIZE - 1, 0) < 1.0f, "the clipped floor fills the bottom corners");
+		expect(stats.occluderTriangles > 2, "the part in front of the near plane is split into more triangles");
+	}
+
+	void testBoxes()
+	{
+		Geometry wall;
+		addQuad(wall, -1.0f, -1.0f, 1.0f, 1.0f, -5.0f);
+		gps::OcclusionCuller culler(SIZE, SIZE);
+		culler.addOccluder(wall.positions, wall.indices);
+		culler.render(viewProjection(glm::vec3(0.0f)), glm::vec3(0.0f));
+
+		// spans pixels 25.6 to 38.4, covered pixels are 26 to 37
+		expect(!culler.isVisible(screenBox(28.0f, 28.0f, 36.0f, 36.0f, -7.0f, -8.0f)), "a box behind the wall is hidden");
+		expect(culler.isVisible(screenBox(28.0f, 28.0f, 36.0f, 36.0f, -3.0f, -4.0f)), "a box in front of the wall is visible");
+		expect(culler.isVisible(screenBox(28.0f, 28.0f, 36.0f, 36.0f, -4.5f, -8.0f)), "a box reaching in front of the wall is visible");
+		expect(culler.isVisible(screenBox(28.0f, 28.0f, 38.6f, 36.0f, -7.0f, -8.0f)), "a box past the wall's edge is visible");
+		expect(!culler.isVisible(screenBox(27.9f, 27.9f, 36.9f, 36.9f, -7.0f, -8.0f)),
+			"a box a pixel inside the covered pixels is hidden");
+		expect(culler.isVisible(screenBox(28.0f, 28.0f, 37.2f, 36.0f, -7.0f, -8.0f)),
+			"a box within a pixel of the last covered one is kept by the guard");
+		expect(culler.isVisible(screenBox(26.8f, 28.0f, 36.0f, 36.0f, -7.0f, -8.0f)),
+			"the guard holds on the low side too");
+		gps::BoundingBox straddling = screenBox(28.0f, 28.0f, 36.0f, 36.0f, -7.0f, -8.0f);
+		straddling.max.z = 1.0f;
+		expect(culler.isVisible(straddling), "a box reaching behind the camera is visible");
+	}
+
+	void testReprojection()
+	{
+		// only one wall fits the budget, the one nearer the camera
+		Geometry left, right;
+		addQuad(left, -3.0f, -1.0f, -1.0f, 1.0f, -5.0f);
+		addQuad(right, 1.0f, -1.0f, 3.0f, 1.0f, -5.0f);
+		gps::BoundingBox behindLeft;
+		behindLeft.min = glm::vec3(-2.7f, -0.3f, -7.0f);
+		behindLeft.max = glm::vec3(-2.2f, 0.3f, -6.8f);
+
+		for (int pass = 0; pass < 2; pass++) {
+			bool reprojection = pass == 1;
+			gps::OcclusionCuller culler(SIZE, SIZE);
+			culler.addOccluder(left.positions, left.indices);
+			culler.addOccluder(right.positions, right.indices);
+			culler.setTriangleBudget(2);
+			culler.setReprojection(reprojection);
+
+			glm::vec3 firstCamera(-0.5f, 0.0f, 0.0f);
+			culler.render(viewProjection(firstCamera), firstCamera);
+			expect(!culler.isVisible(behindLeft), "the nearer wall is rasterized");
+
+			glm::vec3 secondCamera(0.5f, 0.0f, 0.0f);
+			gps::OcclusionStats stats = gps::OcclusionStats();
+			culler.render(viewProjection(secondCamera), secondCamera, &stats);
+			expect(stats.occluders == 1, "the budget leaves out the wall that is now farther");
+
+			glm::vec4 clip = viewProjection(secondCamera) * glm::vec4(-2.0f, 0.0f, -5.0f, 1.0f);
+			int x = (int)((clip.x / clip.w * 0.5f + 0.5f) * SIZE);
+			int y = (int)((clip.y / clip.w * 0.5f + 0.5f) * SIZE);
+			if (reprojection) {
+				expect(stats.reprojectedSamples > 0, "the last frame's depth is carried over");
+				expect(std::fabs(depthAt(culler, x, y) - clip.z / clip.w * 0.5f - 0.5f) < 1e-4f,
+					"carried over depth is moved to the new view");
+				expect(!culler.isVisible(behindLeft), "the wall left out still hides through reprojection");
+			}
+			else {
+				expect(stats.reprojectedSamples == 0, "nothing is carried over when reprojection is off");
+				expect(depthAt(culler, x, y) == 1.0f && culler.isVisible(behindLeft),
+					"without reprojection the wall left out hides nothing");
+			}
+		}
+
+		// moving an occluder drops the last frame's depth
+		gps::OcclusionCuller culler(SIZE, SIZE);
+		size_t id = culler.addOccluder(left.positions, left.indices);
+		culler.setReprojection(true);
+		culler.render(viewProjection(glm::vec3(0.0f)), glm::vec3(0.0f));
+		culler.setTransform(id, glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 10.0f, 0.0f)));
+		gps::OcclusionStats stats = gps::OcclusionStats();
+		culler.render(viewProjection(glm::vec3(0.0f)), glm::vec3(0.0f), &stats);
+		expect(stats.reprojectedSamples == 0, "nothing is carried over on a frame the occluders moved");
+	}
+
+	void testThinGap()
+	{
+		// a fifth of a pixel either side of x = 32 at depth 5, between two pixel centers
+		const float halfGap = 0.2f / (SIZE * 0.5f) * 5.0f;
+		// a pole behind the gap, seen through it
+		gps::BoundingBox pole;
+		pole.min = glm::vec3(-0.01f, -0.5f, -10.01f);
+		pole.max = glm::vec3(0.01f, 0.5f, -10.0f);
+		gps::BoundingBox behindWall = screenBox(12.0f, 28.0f, 20.0f, 36.0f, -7.0f, -8.0f);
+
+		for (int thick = 0; thick < 2; thick++) {
+			Geometry walls;
+			if (thick) {
+				// closed boxes: the silhouettes are edges shared with the faces behind
+				addBox(walls, glm::vec3(-4.0f, -1.0f, -5.5f), glm::vec3(-halfGap, 1.0f, -5.0f));
+				addBox(walls, glm::vec3(halfGap, -1.0f, -5.5f), glm::vec3(4.0f, 1.0f, -5.0f));
+			}
+			else {
+				addQuad(walls, -4.0f, -1.0f, -halfGap, 1.0f, -5.0f);
+				addQuad(walls, halfGap, -1.0f, 4.0f, 1.0f, -5.0f);
+			}
+			gps::OcclusionCuller culler(SIZE, SIZE);
+			culler.addOccluder(walls.positions, walls.indices);
+			culler.render(viewProjection(glm::vec3(0.0f)), glm::vec3(0.0f));
+
+			expect(depthAt(culler, 31, 32) == 1.0f && depthAt(culler, 32, 32) == 1.0f,
+				thick ? "pixels a gap between box walls runs through stay open" : "pixels a gap between walls runs through stay open");
+			expect(culler.isVisible(pole), thick ? "a pole is not culled through a gap between box walls"
+				: "a pole is not culled through a gap narrower than a pixel");
+			expect(!culler.isVisible(behindWall), thick ? "box walls have no cracks along their inner edges"
+				: "walls have no cracks along their inner edges");
+		}
+	}
+}
+
+int main()
+{
+	testRasterization();
+	testBoxes();
+	testReprojection();
+	testThinGap();
+
+	printf("%zu checks, %zu failed\n", results.checks, results.failures);
+	if (results.failures != 0) {
+		printf("FAILED\n");
+		return 1;
+	}
+	printf("OK\n");
+	return 0;
+}
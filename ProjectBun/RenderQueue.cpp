@@ -0,0 +1,278 @@
+#include "RenderQueue.hpp"
+#include "FileUtils.hpp"
+
+#include "glm/gtc/matrix_inverse.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace gps {
+
+	namespace {
+
+		const int PASS_SHIFT = 60;
+		const int PROGRAM_SHIFT = 52;
+		const int TEXTURE_SET_SHIFT = 36;
+		const int VERTEX_ARRAY_SHIFT = 24;
+		const uint32_t PROGRAM_IDS = 1u << 8;
+		const uint32_t TEXTURE_SET_IDS = 1u << 16;
+		const uint32_t VERTEX_ARRAY_IDS = 1u << 12;
+		const uint64_t STATE_MASK = ((1ull << PASS_SHIFT) - 1) & ~((1ull << VERTEX_ARRAY_SHIFT) - 1);
+
+		// Ids in order of first use; the last one is shared once they run out
+		uint32_t compactId(std::unordered_map<GLuint, uint32_t>& ids, GLuint name, uint32_t limit)
+		{
+			std::unordered_map<GLuint, uint32_t>::iterator it = ids.find(name);
+			if (it != ids.end())
+				return it->second;
+			uint32_t id = std::min((uint32_t)ids.size(), limit - 1);
+			ids[name] = id;
+			return id;
+		}
+
+		// Top 24 bits of the float: positive floats order like their bit patterns
+		uint64_t depthBits(float depth)
+		{
+			depth = std::max(depth, 0.0f);
+			uint32_t bits;
+			memcpy(&bits, &depth, sizeof(bits));
+			return bits >> 8;
+		}
+
+		// Distance in front of the view to the center of `box`
+		float viewDepth(const glm::mat4& viewModel, const BoundingBox& box)
+		{
+			glm::vec3 center = (box.min + box.max) * 0.5f;
+			return -(viewModel * glm::vec4(center, 1.0f)).z;
+		}
+	}
+
+	RenderQueue::RenderQueue() : currentPass(RENDER_PASS_OPAQUE), objectStride(0), objectOffset(0)
+	{
+		for (int p = 0; p < RENDER_PASS_COUNT; p++)
+			passes[p].begun = false;
+	}
+
+	void RenderQueue::beginPass(RenderPass pass, const glm::mat4& view, const std::function<void()>& setup)
+	{
+		currentPass = pass;
+		passes[pass].view = view;
+		passes[pass].setup = setup;
+		passes[pass].begun = true;
+	}
+
+	size_t RenderQueue::addPlacement(const glm::mat4& modelMatrix, const LodView& lodView, const CullingView* cullingView)
+	{
+		Placement placement;
+		placement.model = modelMatrix;
+		placement.normal = glm::mat3(glm::inverseTranspose(passes[currentPass].view * modelMatrix));
+		placement.lodView = lodView;
+		placement.culled = cullingView != NULL;
+		if (cullingView)
+			placement.cullingView = *cullingView;
+		placements.push_back(placement);
+		return placements.size() - 1;
+	}
+
+	uint64_t RenderQueue::makeKey(GLuint program, const std::vector<Texture>& textures, GLuint vertexArray, float depth)
+	{
+		uint64_t textureHash = 0;
+		for (size_t i = 0; i < textures.size(); i++)
+			textureHash = hashBytes(&textures[i].id, sizeof(GLuint), textureHash + 1);
+		std::unordered_map<uint64_t, uint32_t>::iterator it = textureSetIds.find(textureHash);
+		uint32_t textureSet;
+		if (it != textureSetIds.end()) {
+			textureSet = it->second;
+		}
+		else {
+			textureSet = std::min((uint32_t)textureSetIds.size(), TEXTURE_SET_IDS - 1);
+			textureSetIds[textureHash] = textureSet;
+		}
+
+		return (uint64_t)currentPass << PASS_SHIFT
+			| (uint64_t)compactId(programIds, program, PROGRAM_IDS) << PROGRAM_SHIFT
+			| (uint64_t)textureSet << TEXTURE_SET_SHIFT
+			| (uint64_t)compactId(vertexArrayIds, vertexArray, VERTEX_ARRAY_IDS) << VERTEX_ARRAY_SHIFT
+			| depthBits(depth);
+	}
+
+	void RenderQueue::push(const Item& item, const std::vector<Texture>& textures, GLuint vertexArray, float depth)
+	{
+		SortEntry entry = { makeKey(item.shader->shaderProgram, textures, vertexArray, depth), (uint32_t)items.size() };
+		entries.push_back(entry);
+		items.push_back(item);
+	}
+
+	void RenderQueue::add(Shader& shader, const Model3D& model, const glm::mat4& modelMatrix, const LodView& lodView,
+		const char* visibleMeshes, const CullingView* cullingView)
+	{
+		const std::vector<Mesh>& meshes = model.GetMeshes();
+		size_t placement = addPlacement(modelMatrix, lodView, cullingView);
+		glm::mat4 viewModel = passes[currentPass].view * modelMatrix;
+
+		Item item = { ITEM_MESH, &shader, placement, &model, NULL, NULL, NULL, NULL, 0 };
+		for (size_t i = 0; i < meshes.size(); i++) {
+			if (visibleMeshes && !visibleMeshes[i])
+				continue;
+			item.mesh = &meshes[i];
+			push(item, meshes[i].textures, meshes[i].getVertexArray(), viewDepth(viewModel, meshes[i].getBoundingBox()));
+		}
+	}
+
+	void RenderQueue::addInstances(Shader& shader, ModelInstances& instances, const Model3D& model,
+		const glm::mat4& modelMatrix, const LodView& lodView, const char* visibleInstances)
+	{
+		const std::vector<Mesh>& meshes = model.GetMeshes();
+		if (meshes.empty())
+			return;
+
+		// the flags are likely overwritten by the next pass's culling before the queue runs
+		size_t first = visibility.size();
+		if (visibleInstances)
+			visibility.insert(visibility.end(), visibleInstances, visibleInstances + instances.size());
+		else
+			visibility.resize(first + instances.size(), 1);
+
+		Item item = { ITEM_INSTANCES, &shader, addPlacement(modelMatrix, lodView, NULL), &model, NULL, &instances,
+			NULL, NULL, first };
+		// the copies are all over the place, they go by the state of the first mesh
+		push(item, meshes[0].textures, meshes[0].getVertexArray(), 0.0f);
+	}
+
+	void RenderQueue::addBatch(Shader& shader, StaticBatch& batch, const glm::mat4& modelMatrix)
+	{
+		Item item = { ITEM_BATCH, &shader, addPlacement(modelMatrix, LodView(), NULL), NULL, NULL, NULL, &batch, NULL, 0 };
+		push(item, std::vector<Texture>(), 0, 0.0f);
+	}
+
+	void RenderQueue::addIndirect(Shader& shader, IndirectDrawList& draws)
+	{
+		Item item = { ITEM_INDIRECT, &shader, addPlacement(glm::mat4(1.0f), LodView(), NULL), NULL, NULL, NULL, NULL,
+			&draws, 0 };
+		push(item, std::vector<Texture>(), 0, 0.0f);
+	}
+
+	void RenderQueue::addCallback(const std::function<void()>& draw)
+	{
+		Item item = { ITEM_CALLBACK, NULL, 0, NULL, NULL, NULL, NULL, NULL, callbacks.size() };
+		callbacks.push_back(draw);
+		// after everything else in the pass; the stable sort keeps callbacks in order
+		SortEntry entry = { (uint64_t)currentPass << PASS_SHIFT | ((1ull << PASS_SHIFT) - 1), (uint32_t)items.size() };
+		entries.push_back(entry);
+		items.push_back(item);
+	}
+
+	void RenderQueue::execute(RenderQueueStats* stats)
+	{
+		if (!entries.empty())
+			radixSort(entries, scratch);
+		writeObjectBlocks();
+
+		size_t next = 0;
+		for (int pass = 0; pass < RENDER_PASS_COUNT; pass++) {
+			if (passes[pass].begun && passes[pass].setup)
+				passes[pass].setup();
+
+			size_t first = next;
+			while (next < entries.size() && (int)(entries[next].key >> PASS_SHIFT) == pass) {
+				run(items[entries[next].item]);
+				if (stats && next > first && ((entries[next].key ^ entries[next - 1].key) & STATE_MASK) != 0)
+					stats->stateChanges++;
+				next++;
+			}
+		}
+		if (stats)
+			stats->items += entries.size();
+	}
+
+	// One write for the frame instead of one per item
+	void RenderQueue::writeObjectBlocks()
+	{
+		UniformRing& ring = UniformRing::shared();
+		size_t alignment = ring.getAlignment();
+		objectStride = (sizeof(ObjectUniforms) + alignment - 1) / alignment * alignment;
+		if (placements.empty())
+			return;
+
+		objectBlocks.assign(placements.size() * objectStride, 0);
+		for (size_t i = 0; i < placements.size(); i++) {
+			ObjectUniforms block;
+			block.model = placements[i].model;
+			block.normalMatrix = glm::mat4(placements[i].normal);
+			memcpy(&objectBlocks[i * objectStride], &block, sizeof(block));
+		}
+		objectOffset = ring.write(objectBlocks.data(), objectBlocks.size());
+	}
+
+	void RenderQueue::run(const Item& item)
+	{
+		if (item.kind == ITEM_CALLBACK) {
+			callbacks[item.data]();
+			return;
+		}
+
+		Shader& shader = *item.shader;
+		const Placement& placement = placements[item.placement];
+		shader.useShaderProgram();
+		// the meshes of one model share the range, the state cache drops the repeats
+		UniformRing::shared().bind(OBJECT_UNIFORM_BINDING, objectOffset + (GLintptr)(item.placement * objectStride),
+			sizeof(ObjectUniforms));
+
+		switch (item.kind) {
+		case ITEM_MESH:
+			if (placement.culled)
+				item.mesh->Draw(shader, placement.cullingView, placement.lodView);
+			else
+				item.mesh->Draw(shader, placement.lodView);
+			break;
+		case ITEM_INSTANCES:
+			item.instances->Draw(*item.model, shader, placement.lodView, visibility.data() + item.data);
+			break;
+		case ITEM_BATCH:
+			item.batch->Draw(shader);
+			break;
+		case ITEM_INDIRECT:
+			item.draws->submit(shader);
+			break;
+		default:
+			break;
+		}
+	}
+
+	// Digits every key shares are skipped
+	void RenderQueue::radixSort(std::vector<SortEntry>& entries, std::vector<SortEntry>& scratch)
+	{
+		scratch.resize(entries.size());
+		for (int shift = 0; shift < 64; shift += 8) {
+			size_t counts[256] = { 0 };
+			for (size_t i = 0; i < entries.size(); i++)
+				counts[(entries[i].key >> shift) & 0xFF]++;
+			if (counts[(entries[0].key >> shift) & 0xFF] == entries.size())
+				continue;
+
+			size_t offset = 0;
+			for (int digit = 0; digit < 256; digit++) {
+				size_t count = counts[digit];
+				counts[digit] = offset;
+				offset += count;
+			}
+			for (size_t i = 0; i < entries.size(); i++)
+				scratch[counts[(entries[i].key >> shift) & 0xFF]++] = entries[i];
+			entries.swap(scratch);
+		}
+	}
+
+	void RenderQueue::clear()
+	{
+		for (int p = 0; p < RENDER_PASS_COUNT; p++) {
+			passes[p].begun = false;
+			passes[p].setup = std::function<void()>();
+		}
+		currentPass = RENDER_PASS_OPAQUE;
+		items.clear();
+		placements.clear();
+		visibility.clear();
+		callbacks.clear();
+		entries.clear();
+	}
+}
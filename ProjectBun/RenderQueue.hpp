@@ -0,0 +1,153 @@
+#ifndef RenderQueue_hpp
+#define RenderQueue_hpp
+
+#include <GL/glew.h>
+#include "glm/glm.hpp"
+
+#include "Model3D.hpp"
+#include "ModelInstances.hpp"
+#include "StaticBatch.hpp"
+#include "IndirectDrawList.hpp"
+#include "UniformRing.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+namespace gps {
+
+    // Passes in the order they run
+    enum RenderPass
+    {
+        RENDER_PASS_SHADOW,
+        RENDER_PASS_OPAQUE,
+        // after the opaque geometry, only shaded where nothing else was drawn
+        RENDER_PASS_BACKGROUND,
+        RENDER_PASS_COUNT
+    };
+
+    struct RenderQueueStats
+    {
+        size_t items;
+        // neighbouring items of a pass that differ in program, textures or vertex array
+        size_t stateChanges;
+    };
+
+    // The draws of a frame, for every pass, run in the order of a 64-bit key:
+    //   pass (4 bits) | program (8) | texture set (16) | vertex array (12) | depth (24)
+    // Draws sharing state end up next to each other and, within the same
+    // state, go front to back so early depth testing rejects hidden pixels.
+    // Items keep the matrices, levels of detail and visibility they were added
+    // with, so culling results may be overwritten before the queue runs. The
+    // `ObjectUniforms` blocks of all items go into the UniformRing at once when
+    // the queue runs, each item binds its own range. GL thread only.
+    class RenderQueue
+    {
+    public:
+        RenderQueue();
+
+        // The items added next belong to `pass`. Their depth is measured along
+        // `view`, which the normal matrix of the items is built from too. `setup`
+        // binds the target and per-pass uniforms right before the pass runs,
+        // even without items.
+        void beginPass(RenderPass pass, const glm::mat4& view, const std::function<void()>& setup);
+
+        // The meshes i of `model` with visibleMeshes[i] set (all when NULL), each
+        // at the level of detail `lodView` asks for; with `cullingView` the
+        // meshlets outside it are skipped as well
+        void add(Shader& shader, const Model3D& model, const glm::mat4& modelMatrix, const LodView& lodView,
+            const char* visibleMeshes = NULL, const CullingView* cullingView = NULL);
+
+        // Every copy of `model` in `instances`, placed relative to `modelMatrix`
+        void addInstances(Shader& shader, ModelInstances& instances, const Model3D& model, const glm::mat4& modelMatrix,
+            const LodView& lodView, const char* visibleInstances = NULL);
+
+        void addBatch(Shader& shader, StaticBatch& batch, const glm::mat4& modelMatrix);
+
+        // The draws carry their own model matrices, the normal matrix covers the view only
+        void addIndirect(Shader& shader, IndirectDrawList& draws);
+
+        // Anything else, run after the other items of the pass in the order added
+        void addCallback(const std::function<void()>& draw);
+
+        // Sorts and runs the items; they stay queued until clear(). The ring
+        // must have begun the frame.
+        void execute(RenderQueueStats* stats = NULL);
+        void clear();
+
+    private:
+        enum ItemKind {
+            ITEM_MESH,
+            ITEM_INSTANCES,
+            ITEM_BATCH,
+            ITEM_INDIRECT,
+            ITEM_CALLBACK
+        };
+
+        // Uniforms and views an item is drawn with, shared by the items of one add()
+        struct Placement {
+            glm::mat4 model;
+            glm::mat3 normal;
+            LodView lodView;
+            CullingView cullingView;
+            bool culled;
+        };
+
+        struct Item {
+            ItemKind kind;
+            Shader* shader;
+            size_t placement;
+            const Model3D* model;
+            const Mesh* mesh;
+            ModelInstances* instances;
+            StaticBatch* batch;
+            IndirectDrawList* draws;
+            // into visibility for instances, into callbacks for callbacks
+            size_t data;
+        };
+
+        struct SortEntry {
+            uint64_t key;
+            uint32_t item;
+        };
+
+        struct Pass {
+            glm::mat4 view;
+            std::function<void()> setup;
+            bool begun;
+        };
+
+        Pass passes[RENDER_PASS_COUNT];
+        RenderPass currentPass;
+
+        std::vector<Item> items;
+        std::vector<Placement> placements;
+        std::vector<char> visibility;
+        std::vector<std::function<void()> > callbacks;
+        std::vector<SortEntry> entries;
+        std::vector<SortEntry> scratch;
+
+        // ObjectUniforms of every placement, `objectStride` apart, as written to the ring
+        std::vector<unsigned char> objectBlocks;
+        size_t objectStride;
+        GLintptr objectOffset;
+
+        // Small ids for the key fields, kept from frame to frame
+        std::unordered_map<GLuint, uint32_t> programIds;
+        std::unordered_map<uint64_t, uint32_t> textureSetIds;
+        std::unordered_map<GLuint, uint32_t> vertexArrayIds;
+
+        size_t addPlacement(const glm::mat4& modelMatrix, const LodView& lodView, const CullingView* cullingView);
+        void push(const Item& item, const std::vector<Texture>& textures, GLuint vertexArray, float depth);
+        uint64_t makeKey(GLuint program, const std::vector<Texture>& textures, GLuint vertexArray, float depth);
+        void writeObjectBlocks();
+        void run(const Item& item);
+
+        // LSD radix sort on 8-bit digits, stable
+        static void radixSort(std::vector<SortEntry>& entries, std::vector<SortEntry>& scratch);
+    };
+}
+
+#endif /* RenderQueue_hpp */
@@ -0,0 +1,247 @@
+#include "SceneBvh.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define GPS_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace gps {
+
+	namespace {
+
+		enum PlaneSide { SIDE_OUTSIDE, SIDE_INTERSECTING, SIDE_INSIDE };
+
+		// Planes nothing is outside of, for the unused slots and the planes left open
+		const float OPEN_PLANE = 1e30f;
+
+		struct CenterLess {
+			const std::vector<BoundingBox>* bounds;
+			int axis;
+
+			bool operator()(size_t a, size_t b) const
+			{
+				return (*bounds)[a].min[axis] + (*bounds)[a].max[axis] < (*bounds)[b].min[axis] + (*bounds)[b].max[axis];
+			}
+		};
+	}
+
+	// Up to twelve planes as structure of arrays, with how far the objects
+	// reach past their boxes towards each (e.g. their shadows)
+	struct SceneBvh::CullingPlanes
+	{
+		static const int CAPACITY = 12;
+
+		float normalX[CAPACITY];
+		float normalY[CAPACITY];
+		float normalZ[CAPACITY];
+		float distance[CAPACITY];
+		float absX[CAPACITY];
+		float absY[CAPACITY];
+		float absZ[CAPACITY];
+		float reach[CAPACITY];
+
+		CullingPlanes()
+		{
+			for (int p = 0; p < CAPACITY; p++)
+				set(p, glm::vec4(0.0f, 0.0f, 0.0f, OPEN_PLANE), 0.0f);
+		}
+
+		void set(int p, const glm::vec4& plane, float planeReach)
+		{
+			normalX[p] = plane.x;
+			normalY[p] = plane.y;
+			normalZ[p] = plane.z;
+			distance[p] = plane.w;
+			absX[p] = std::fabs(plane.x);
+			absY[p] = std::fabs(plane.y);
+			absZ[p] = std::fabs(plane.z);
+			reach[p] = planeReach;
+		}
+
+		// Where a box lies against the planes: the signed distance of its center
+		// against the projection of its half extent on each normal. Inside means
+		// inside every plane, so nothing in the box can be culled.
+		PlaneSide classify(const BoundingBox& box) const
+		{
+			glm::vec3 center = (box.min + box.max) * 0.5f;
+			glm::vec3 extent = (box.max - box.min) * 0.5f;
+
+#ifdef GPS_USE_SSE2
+			__m128 cx = _mm_set1_ps(center.x), cy = _mm_set1_ps(center.y), cz = _mm_set1_ps(center.z);
+			__m128 ex = _mm_set1_ps(extent.x), ey = _mm_set1_ps(extent.y), ez = _mm_set1_ps(extent.z);
+			int outside = 0;
+			int intersecting = 0;
+			for (int p = 0; p < CAPACITY; p += 4) {
+				__m128 centerDistance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(normalX + p), cx),
+					_mm_mul_ps(_mm_loadu_ps(normalY + p), cy)),
+					_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(normalZ + p), cz), _mm_loadu_ps(distance + p)));
+				__m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(absX + p), ex),
+					_mm_mul_ps(_mm_loadu_ps(absY + p), ey)), _mm_mul_ps(_mm_loadu_ps(absZ + p), ez));
+				__m128 farthest = _mm_add_ps(_mm_add_ps(centerDistance, radius), _mm_loadu_ps(reach + p));
+				outside |= _mm_movemask_ps(_mm_cmplt_ps(farthest, _mm_setzero_ps()));
+				intersecting |= _mm_movemask_ps(_mm_cmplt_ps(centerDistance, radius));
+			}
+			if (outside)
+				return SIDE_OUTSIDE;
+			return intersecting ? SIDE_INTERSECTING : SIDE_INSIDE;
+#else
+			PlaneSide side = SIDE_INSIDE;
+			for (int p = 0; p < CAPACITY; p++) {
+				float centerDistance = normalX[p] * center.x + normalY[p] * center.y + normalZ[p] * center.z + distance[p];
+				float radius = absX[p] * extent.x + absY[p] * extent.y + absZ[p] * extent.z;
+				if (centerDistance + radius + reach[p] < 0.0f)
+					return SIDE_OUTSIDE;
+				if (centerDistance < radius)
+					side = SIDE_INTERSECTING;
+			}
+			return side;
+#endif
+		}
+	};
+
+	SceneBvh::SceneBvh()
+	{
+	}
+
+	size_t SceneBvh::add(const BoundingBox& bounds)
+	{
+		objectBounds.push_back(bounds);
+		return objectBounds.size() - 1;
+	}
+
+	void SceneBvh::setBounds(size_t object, const BoundingBox& bounds)
+	{
+		objectBounds[object] = bounds;
+	}
+
+	const BoundingBox& SceneBvh::getBounds(size_t object) const
+	{
+		return objectBounds[object];
+	}
+
+	size_t SceneBvh::getObjectCount() const
+	{
+		return objectBounds.size();
+	}
+
+	void SceneBvh::build()
+	{
+		nodes.clear();
+		objectOrder.resize(objectBounds.size());
+		for (size_t i = 0; i < objectOrder.size(); i++)
+			objectOrder[i] = i;
+		if (!objectOrder.empty())
+			buildNode(0, objectOrder.size());
+	}
+
+	size_t SceneBvh::buildNode(size_t firstObject, size_t objectCount)
+	{
+		size_t index = nodes.size();
+		Node node = { objectBounds[objectOrder[firstObject]], firstObject, objectCount, 0 };
+		glm::vec3 centerMin = (node.bounds.min + node.bounds.max) * 0.5f;
+		glm::vec3 centerMax = centerMin;
+		for (size_t i = firstObject; i < firstObject + objectCount; i++) {
+			const BoundingBox& bounds = objectBounds[objectOrder[i]];
+			node.bounds = mergeBoxes(node.bounds, bounds);
+			centerMin = glm::min(centerMin, (bounds.min + bounds.max) * 0.5f);
+			centerMax = glm::max(centerMax, (bounds.min + bounds.max) * 0.5f);
+		}
+		nodes.push_back(node);
+		if (objectCount <= LEAF_SIZE)
+			return index;
+
+		glm::vec3 spread = centerMax - centerMin;
+		CenterLess less = { &objectBounds, spread.x > spread.y ? (spread.x > spread.z ? 0 : 2) : (spread.y > spread.z ? 1 : 2) };
+		size_t half = objectCount / 2;
+		std::nth_element(objectOrder.begin() + firstObject, objectOrder.begin() + firstObject + half,
+			objectOrder.begin() + firstObject + objectCount, less);
+
+		buildNode(firstObject, half);
+		size_t rightChild = buildNode(firstObject + half, objectCount - half);
+		nodes[index].rightChild = rightChild;
+		return index;
+	}
+
+	void SceneBvh::refit()
+	{
+		// children come after their parents
+		for (size_t n = nodes.size(); n-- > 0;) {
+			Node& node = nodes[n];
+			if (node.rightChild == 0) {
+				node.bounds = objectBounds[objectOrder[node.firstObject]];
+				for (size_t i = node.firstObject + 1; i < node.firstObject + node.objectCount; i++)
+					node.bounds = mergeBoxes(node.bounds, objectBounds[objectOrder[i]]);
+			}
+			else
+				node.bounds = mergeBoxes(nodes[n + 1].bounds, nodes[node.rightChild].bounds);
+		}
+	}
+
+	void SceneBvh::cull(const CullingView& frustum, std::vector<char>& visible, BvhCullStats* stats) const
+	{
+		CullingPlanes planes;
+		for (int p = 0; p < 6; p++)
+			planes.set(p, frustum.planes[p], 0.0f);
+		cullPlanes(planes, visible, stats);
+	}
+
+	void SceneBvh::cullShadowCasters(const CullingView& lightVolume, const CullingView& cameraFrustum,
+		const glm::vec3& lightDirection, float shadowLength, std::vector<char>& visible, BvhCullStats* stats) const
+	{
+		CullingPlanes planes;
+		for (int p = 0; p < 6; p++) {
+			// no near plane: whatever lies between the light and the volume still casts into it
+			planes.set(p, lightVolume.planes[p], p == 4 ? OPEN_PLANE : 0.0f);
+
+			// a box swept along the light gets that much closer to the inside of each camera plane
+			float reach = std::max(glm::dot(glm::vec3(cameraFrustum.planes[p]), lightDirection) * shadowLength, 0.0f);
+			planes.set(6 + p, cameraFrustum.planes[p], reach);
+		}
+		cullPlanes(planes, visible, stats);
+	}
+
+	void SceneBvh::cullPlanes(const CullingPlanes& planes, std::vector<char>& visible, BvhCullStats* stats) const
+	{
+		visible.assign(objectBounds.size(), 0);
+		size_t testedNodes = 0;
+		size_t visibleObjects = 0;
+
+		if (!nodes.empty()) {
+			size_t stack[64];
+			size_t stackSize = 0;
+			stack[stackSize++] = 0;
+			while (stackSize > 0) {
+				const Node& node = nodes[stack[--stackSize]];
+				testedNodes++;
+				PlaneSide side = planes.classify(node.bounds);
+				if (side == SIDE_OUTSIDE)
+					continue;
+
+				if (side == SIDE_INSIDE || node.rightChild == 0) {
+					// leaves test their objects one by one unless the whole leaf is inside
+					for (size_t i = node.firstObject; i < node.firstObject + node.objectCount; i++) {
+						size_t object = objectOrder[i];
+						if (side == SIDE_INSIDE || node.objectCount == 1 || planes.classify(objectBounds[object]) != SIDE_OUTSIDE) {
+							visible[object] = 1;
+							visibleObjects++;
+						}
+					}
+					continue;
+				}
+
+				size_t index = &node - nodes.data();
+				stack[stackSize++] = node.rightChild;
+				stack[stackSize++] = index + 1;
+			}
+		}
+
+		if (stats) {
+			stats->objects += objectBounds.size();
+			stats->visibleObjects += visibleObjects;
+			stats->testedNodes += testedNodes;
+		}
+	}
+}
@@ -0,0 +1,77 @@
+#ifndef SceneBvh_hpp
+#define SceneBvh_hpp
+
+#include "glm/glm.hpp"
+
+#include "Meshlets.hpp"
+
+#include <cstddef>
+#include <vector>
+
+namespace gps {
+
+    struct BvhCullStats
+    {
+        size_t objects;
+        size_t visibleObjects;
+        // nodes whose box was tested against the planes
+        size_t testedNodes;
+    };
+
+    // Bounding volume hierarchy over the world space boxes of scene objects,
+    // for frustum culling them before drawing. Objects that move get new
+    // bounds and a refit, which keeps the tree shape; build() again when they
+    // have moved far from where the tree was built.
+    class SceneBvh
+    {
+    public:
+        SceneBvh();
+
+        // Ids count up from 0 in the order objects are added
+        size_t add(const BoundingBox& bounds);
+        void setBounds(size_t object, const BoundingBox& bounds);
+        const BoundingBox& getBounds(size_t object) const;
+        size_t getObjectCount() const;
+
+        // Top-down, splitting at the median of the longest axis of the box centers
+        void build();
+
+        // Grows and shrinks the node boxes to the current object bounds
+        void refit();
+
+        // visible[object] = 1 unless the box is entirely outside one of the planes.
+        // Subtrees entirely inside all planes are taken without further tests.
+        void cull(const CullingView& frustum, std::vector<char>& visible, BvhCullStats* stats = NULL) const;
+
+        // Shadow casters: objects inside the light's volume, left open past its
+        // near plane towards the light, whose shadow - the box swept `shadowLength` along
+        // `lightDirection` (the way the light travels) - can reach the camera frustum
+        void cullShadowCasters(const CullingView& lightVolume, const CullingView& cameraFrustum,
+            const glm::vec3& lightDirection, float shadowLength, std::vector<char>& visible, BvhCullStats* stats = NULL) const;
+
+    private:
+        static const size_t LEAF_SIZE = 4;
+
+        struct Node {
+            BoundingBox bounds;
+            // objects of the subtree, a range of objectOrder
+            size_t firstObject;
+            size_t objectCount;
+            // the left child follows its parent, 0 for leaves
+            size_t rightChild;
+        };
+
+        std::vector<BoundingBox> objectBounds;
+        // objects in tree order, every subtree a contiguous range
+        std::vector<size_t> objectOrder;
+        // parents before their children
+        std::vector<Node> nodes;
+
+        struct CullingPlanes;
+
+        size_t buildNode(size_t firstObject, size_t objectCount);
+        void cullPlanes(const CullingPlanes& planes, std::vector<char>& visible, BvhCullStats* stats) const;
+    };
+}
+
+#endif /* SceneBvh_hpp */
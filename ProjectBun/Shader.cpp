@@ -1,6 +1,60 @@
 #include "Shader.hpp"
+#include "GLStateCache.hpp"
+#include "UniformRing.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
 
 namespace gps {
+
+    namespace {
+
+        // uniform names by id, shared by all programs
+        struct UniformRegistry {
+            std::mutex mutex;
+            std::vector<std::string> names;
+            std::unordered_map<std::string, UniformId> ids;
+        };
+
+        UniformRegistry& uniformRegistry()
+        {
+            static UniformRegistry registry;
+            return registry;
+        }
+
+        UniformStats uniformStats = { 0, 0 };
+
+        // uniform blocks (see UniformRing.hpp) by name; GLSL 4.10 cannot give them a binding itself
+        const struct {
+            const char* name;
+            GLuint binding;
+        } UNIFORM_BLOCKS[] = {
+            { "FrameUniforms", FRAME_UNIFORM_BINDING },
+            { "PassUniforms", PASS_UNIFORM_BINDING },
+            { "ObjectUniforms", OBJECT_UNIFORM_BINDING }
+        };
+
+        bool isSampler(GLenum type)
+        {
+            switch (type) {
+            case GL_SAMPLER_1D: case GL_SAMPLER_2D: case GL_SAMPLER_3D: case GL_SAMPLER_CUBE:
+            case GL_SAMPLER_1D_SHADOW: case GL_SAMPLER_2D_SHADOW: case GL_SAMPLER_CUBE_SHADOW:
+            case GL_SAMPLER_1D_ARRAY: case GL_SAMPLER_2D_ARRAY:
+            case GL_SAMPLER_1D_ARRAY_SHADOW: case GL_SAMPLER_2D_ARRAY_SHADOW:
+            case GL_SAMPLER_2D_RECT: case GL_SAMPLER_2D_RECT_SHADOW: case GL_SAMPLER_BUFFER:
+            case GL_SAMPLER_2D_MULTISAMPLE: case GL_SAMPLER_2D_MULTISAMPLE_ARRAY:
+            case GL_INT_SAMPLER_2D: case GL_INT_SAMPLER_3D: case GL_INT_SAMPLER_CUBE:
+            case GL_INT_SAMPLER_2D_ARRAY: case GL_INT_SAMPLER_BUFFER:
+            case GL_UNSIGNED_INT_SAMPLER_2D: case GL_UNSIGNED_INT_SAMPLER_3D: case GL_UNSIGNED_INT_SAMPLER_CUBE:
+            case GL_UNSIGNED_INT_SAMPLER_2D_ARRAY: case GL_UNSIGNED_INT_SAMPLER_BUFFER:
+                return true;
+            default:
+                return false;
+            }
+        }
+    }
     std::string Shader::readShaderFile(std::string fileName)
     {
         std::ifstream shaderFile;
@@ -80,11 +134,191 @@ namespace gps {
         glDeleteShader(fragmentShader);
         //check linking info
         shaderLinkLog(this->shaderProgram);
+
+        reflectUniforms();
+        bindUniformBlocks();
     }
 
     void Shader::useShaderProgram()
     {
-        glUseProgram(this->shaderProgram);
+        GLStateCache::shared().useProgram(this->shaderProgram);
+    }
+
+    // Builds the table of the program's active uniforms and gives every
+    // sampler its own texture unit, in name order
+    void Shader::reflectUniforms()
+    {
+        uniformTable = std::make_shared<UniformTable>();
+
+        GLint count = 0;
+        GLint maxLength = 0;
+        glGetProgramiv(this->shaderProgram, GL_ACTIVE_UNIFORMS, &count);
+        glGetProgramiv(this->shaderProgram, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+        std::vector<GLchar> name(std::max(maxLength, 1) + 1);
+
+        std::vector<Uniform>& uniforms = uniformTable->uniforms;
+        for (GLint i = 0; i < count; i++) {
+            Uniform uniform;
+            GLsizei length = 0;
+            GLint size = 0;
+            glGetActiveUniform(this->shaderProgram, (GLuint)i, (GLsizei)name.size(), &length, &size,
+                &uniform.type, name.data());
+            uniform.name.assign(name.data(), length);
+            // arrays are listed as "name[0]"
+            if (uniform.name.size() > 3 && uniform.name.compare(uniform.name.size() - 3, 3, "[0]") == 0)
+                uniform.name.resize(uniform.name.size() - 3);
+            // members of uniform blocks have no location
+            uniform.location = glGetUniformLocation(this->shaderProgram, uniform.name.c_str());
+            if (uniform.location < 0)
+                continue;
+            uniform.samplerUnit = -1;
+            uniform.known = false;
+            uniforms.push_back(uniform);
+        }
+        std::sort(uniforms.begin(), uniforms.end(), [](const Uniform& a, const Uniform& b) {
+            return a.name < b.name;
+        });
+
+        GLStateCache& state = GLStateCache::shared();
+        GLuint previousProgram = state.getProgram();
+        state.useProgram(this->shaderProgram);
+        GLint unit = 0;
+        for (size_t i = 0; i < uniforms.size(); i++) {
+            if (!isSampler(uniforms[i].type))
+                continue;
+            uniforms[i].samplerUnit = unit;
+            uniforms[i].known = true;
+            memcpy(uniforms[i].value, &unit, sizeof(unit));
+            glUniform1i(uniforms[i].location, unit);
+            unit++;
+        }
+        state.useProgram(previousProgram);
+    }
+
+    void Shader::bindUniformBlocks()
+    {
+        for (size_t i = 0; i < sizeof(UNIFORM_BLOCKS) / sizeof(UNIFORM_BLOCKS[0]); i++) {
+            GLuint index = glGetUniformBlockIndex(this->shaderProgram, UNIFORM_BLOCKS[i].name);
+            if (index != GL_INVALID_INDEX)
+                glUniformBlockBinding(this->shaderProgram, index, UNIFORM_BLOCKS[i].binding);
+        }
+    }
+
+    UniformId Shader::getUniformId(const std::string& name)
+    {
+        UniformRegistry& registry = uniformRegistry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        std::unordered_map<std::string, UniformId>::iterator it = registry.ids.find(name);
+        if (it != registry.ids.end())
+            return it->second;
+        UniformId id = (UniformId)registry.names.size();
+        registry.names.push_back(name);
+        registry.ids[name] = id;
+        return id;
+    }
+
+    Shader::Uniform* Shader::findUniform(UniformId uniform)
+    {
+        if (!uniformTable || uniform < 0)
+            return NULL;
+        std::vector<int>& slots = uniformTable->slots;
+        if ((size_t)uniform >= slots.size()) {
+            // ids registered since the last lookup
+            UniformRegistry& registry = uniformRegistry();
+            std::lock_guard<std::mutex> lock(registry.mutex);
+            const std::vector<Uniform>& uniforms = uniformTable->uniforms;
+            for (size_t id = slots.size(); id < registry.names.size(); id++) {
+                int slot = -1;
+                for (size_t i = 0; i < uniforms.size() && slot < 0; i++) {
+                    if (uniforms[i].name == registry.names[id])
+                        slot = (int)i;
+                }
+                slots.push_back(slot);
+            }
+            if ((size_t)uniform >= slots.size())
+                return NULL;
+        }
+        int slot = slots[uniform];
+        return slot < 0 ? NULL : &uniformTable->uniforms[slot];
+    }
+
+    bool Shader::hasUniform(UniformId uniform)
+    {
+        return findUniform(uniform) != NULL;
+    }
+
+    GLint Shader::getSamplerUnit(UniformId uniform)
+    {
+        Uniform* found = findUniform(uniform);
+        return found ? found->samplerUnit : -1;
+    }
+
+    Shader::Uniform* Shader::changeUniform(UniformId uniform, const void* value, size_t size)
+    {
+        Uniform* found = findUniform(uniform);
+        if (!found)
+            return NULL;
+        if (found->known && memcmp(found->value, value, size) == 0) {
+            uniformStats.skipped++;
+            return NULL;
+        }
+        memcpy(found->value, value, size);
+        found->known = true;
+        uniformStats.calls++;
+        return found;
+    }
+
+    void Shader::setInt(UniformId uniform, GLint value)
+    {
+        Uniform* changed = changeUniform(uniform, &value, sizeof(value));
+        if (changed)
+            glUniform1i(changed->location, value);
+    }
+
+    void Shader::setFloat(UniformId uniform, GLfloat value)
+    {
+        Uniform* changed = changeUniform(uniform, &value, sizeof(value));
+        if (changed)
+            glUniform1f(changed->location, value);
+    }
+
+    void Shader::setVec2(UniformId uniform, const glm::vec2& value)
+    {
+        Uniform* changed = changeUniform(uniform, &value.x, sizeof(GLfloat) * 2);
+        if (changed)
+            glUniform2fv(changed->location, 1, &value.x);
+    }
+
+    void Shader::setVec3(UniformId uniform, const glm::vec3& value)
+    {
+        Uniform* changed = changeUniform(uniform, &value.x, sizeof(GLfloat) * 3);
+        if (changed)
+            glUniform3fv(changed->location, 1, &value.x);
+    }
+
+    void Shader::setMat3(UniformId uniform, const glm::mat3& value)
+    {
+        Uniform* changed = changeUniform(uniform, &value[0][0], sizeof(GLfloat) * 9);
+        if (changed)
+            glUniformMatrix3fv(changed->location, 1, GL_FALSE, &value[0][0]);
+    }
+
+    void Shader::setMat4(UniformId uniform, const glm::mat4& value)
+    {
+        Uniform* changed = changeUniform(uniform, &value[0][0], sizeof(GLfloat) * 16);
+        if (changed)
+            glUniformMatrix4fv(changed->location, 1, GL_FALSE, &value[0][0]);
+    }
+
+    UniformStats Shader::getUniformStats()
+    {
+        return uniformStats;
+    }
+
+    void Shader::resetUniformStats()
+    {
+        uniformStats.calls = 0;
+        uniformStats.skipped = 0;
     }
 
 }
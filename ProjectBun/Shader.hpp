@@ -2,15 +2,29 @@
 #define Shader_hpp
 
 #include <GL/glew.h>
+#include "glm/glm.hpp"
 
+#include <cstddef>
+#include <memory>
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 #include <string>
+#include <vector>
 
 namespace gps {
 
+// A uniform name, the same id in every program; look it up once and keep it
+typedef int UniformId;
+
+struct UniformStats
+{
+    // glUniform* calls made and skipped as repeating the value, over all programs
+    size_t calls;
+    size_t skipped;
+};
+
 class Shader
 {
 public:
@@ -18,10 +32,53 @@ public:
     void loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName);
     void useShaderProgram();
 
+    // Registers `name` the first time it is asked for
+    static UniformId getUniformId(const std::string& name);
+
+    bool hasUniform(UniformId uniform);
+    // Texture unit the sampler was given when the program was linked, -1 for other uniforms
+    GLint getSamplerUnit(UniformId uniform);
+
+    // Set a uniform of the program, which must be in use. Values equal to the
+    // one the program already holds are not sent again; uniforms the program
+    // does not have are ignored.
+    void setInt(UniformId uniform, GLint value);
+    void setFloat(UniformId uniform, GLfloat value);
+    void setVec2(UniformId uniform, const glm::vec2& value);
+    void setVec3(UniformId uniform, const glm::vec3& value);
+    void setMat3(UniformId uniform, const glm::mat3& value);
+    void setMat4(UniformId uniform, const glm::mat4& value);
+
+    static UniformStats getUniformStats();
+    static void resetUniformStats();
+
 private:
+    struct Uniform {
+        std::string name;
+        GLint location;
+        GLenum type;
+        GLint samplerUnit;
+        // last value sent, valid once `known`
+        bool known;
+        GLfloat value[16];
+    };
+    // shared by the copies of the shader, which are passed around by value
+    struct UniformTable {
+        std::vector<Uniform> uniforms;
+        // uniform id -> index in uniforms, -1 when the program lacks it
+        std::vector<int> slots;
+    };
+    std::shared_ptr<UniformTable> uniformTable;
+
     std::string readShaderFile(std::string fileName);
     void shaderCompileLog(GLuint shaderId);
     void shaderLinkLog(GLuint shaderProgramId);
+    void reflectUniforms();
+    // Points the program's uniform blocks at their binding points
+    void bindUniformBlocks();
+    Uniform* findUniform(UniformId uniform);
+    // The uniform when `value` differs from what it holds, which is recorded; NULL otherwise
+    Uniform* changeUniform(UniformId uniform, const void* value, size_t size);
 };
 
 }
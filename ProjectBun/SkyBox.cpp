@@ -1,4 +1,6 @@
 #include "SkyBox.hpp"
+#include "GLStateCache.hpp"
+#include "TextureLoader.hpp"
 
 namespace gps {
     
@@ -13,58 +15,27 @@ namespace gps {
         InitSkyBox();
     }
     
-    void SkyBox::Draw(gps::Shader shader, glm::mat4 viewMatrix, glm::mat4 projectionMatrix)
+    void SkyBox::Draw(gps::Shader shader)
     {
+        static const UniformId SKYBOX = Shader::getUniformId("skybox");
+
         shader.useShaderProgram();
         
-        //set the view and projection matrices
-        glm::mat4 transformedView = glm::mat4(glm::mat3(viewMatrix));
-        glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(transformedView));
-        glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projectionMatrix));
-        
-        glDepthFunc(GL_LEQUAL);
+        GLStateCache& state = GLStateCache::shared();
+        state.depthFunc(GL_LEQUAL);
         
-        glBindVertexArray(skyboxVAO);
-        glActiveTexture(GL_TEXTURE0);
-        glUniform1i(glGetUniformLocation(shader.shaderProgram, "skybox"), 0);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
+        state.bindVertexArray(skyboxVAO);
+        state.bindTexture((GLuint)shader.getSamplerUnit(SKYBOX), GL_TEXTURE_CUBE_MAP, cubemapTexture);
         glDrawArrays(GL_TRIANGLES, 0, 36);
-        glBindVertexArray(0);
         
-        glDepthFunc(GL_LESS);
+        state.depthFunc(GL_LESS);
     }
     
     GLuint SkyBox::LoadSkyBoxTextures(std::vector<const GLchar*> skyBoxFaces)
     {
-        GLuint textureID;
-        glGenTextures(1, &textureID);
-        glActiveTexture(GL_TEXTURE0);
-        
-        int width,height, n;
-        unsigned char* image;
-        int force_channels = 3;
-        
-        glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
-        for(GLuint i = 0; i < skyBoxFaces.size(); i++)
-        {
-            image = stbi_load(skyBoxFaces[i], &width, &height, &n, force_channels);
-            if (!image) {
-                fprintf(stderr, "ERROR: could not load %s\n", skyBoxFaces[i]);
-                return false;
-            }
-            glTexImage2D(
-                         GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0,
-                         GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image
-                         );
-        }
-        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
-        
-        return textureID;
+        // the faces are decoded in parallel, TextureLoader uploads them later
+        std::vector<std::string> faceFileNames(skyBoxFaces.begin(), skyBoxFaces.end());
+        return TextureLoader::shared().requestCubeMap(faceFileNames);
     }
     
     void SkyBox::InitSkyBox()
@@ -116,14 +87,14 @@ namespace gps {
         glGenVertexArrays(1, &(this->skyboxVAO));
         glGenBuffers(1, &skyboxVBO);
         
-        glBindVertexArray(skyboxVAO);
+        GLStateCache::shared().bindVertexArray(skyboxVAO);
         glBindBuffer(GL_ARRAY_BUFFER, skyboxVBO);
         glBufferData(GL_ARRAY_BUFFER, sizeof(skyboxVertices), &skyboxVertices, GL_STATIC_DRAW);
         
         glEnableVertexAttribArray(0);
         glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), (GLvoid*)0);
         
-        glBindVertexArray(0);
+        GLStateCache::shared().bindVertexArray(0);
     }
     
     GLuint SkyBox::GetTextureId()
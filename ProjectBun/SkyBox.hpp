@@ -14,7 +14,8 @@ namespace gps {
     public:
         SkyBox();
         void Load(std::vector<const GLchar*> cubeMapFaces);
-        void Draw(gps::Shader shader, glm::mat4 viewMatrix, glm::mat4 projectionMatrix);
+        // The view and projection come from the bound `PassUniforms` block
+        void Draw(gps::Shader shader);
         GLuint GetTextureId();
     private:
         GLuint skyboxVAO;
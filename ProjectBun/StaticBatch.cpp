@@ -0,0 +1,99 @@
+#include "StaticBatch.hpp"
+
+#include <iostream>
+
+namespace gps {
+
+	namespace {
+		bool sameTextures(const std::vector<Texture>& a, const std::vector<Texture>& b)
+		{
+			if (a.size() != b.size())
+				return false;
+			for (size_t i = 0; i < a.size(); i++) {
+				if (a[i].id != b[i].id || a[i].type != b[i].type)
+					return false;
+			}
+			return true;
+		}
+	}
+
+	StaticBatch::StaticBatch() : sourceMeshCount(0)
+	{
+	}
+
+	void StaticBatch::add(const Model3D& model, const glm::mat4& transform)
+	{
+		glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(transform)));
+
+		const std::vector<Mesh>& meshes = model.GetMeshes();
+		for (size_t m = 0; m < meshes.size(); m++) {
+			const Mesh& source = meshes[m];
+			if (!source.getVertices()) {
+				std::cerr << "WARNING: a streamed mesh has no geometry to batch" << std::endl;
+				continue;
+			}
+
+			Group* group = NULL;
+			for (size_t g = 0; g < groups.size() && !group; g++) {
+				if (sameTextures(groups[g].textures, source.textures))
+					group = &groups[g];
+			}
+			if (!group) {
+				groups.push_back(Group());
+				group = &groups.back();
+				group->textures = source.textures;
+			}
+
+			GLuint base = (GLuint)group->vertices.size();
+			for (size_t i = 0; i < source.getVertexCount(); i++) {
+				Vertex vertex = source.getVertices()[i];
+				vertex.Position = glm::vec3(transform * glm::vec4(vertex.Position, 1.0f));
+				if (vertex.Normal != glm::vec3(0.0f))
+					vertex.Normal = glm::normalize(normalMatrix * vertex.Normal);
+				group->vertices.push_back(vertex);
+			}
+			// only the full detail level, which starts the index buffer
+			const GLuint* indices = source.getIndices();
+			for (size_t i = 0; i < source.getLods()[0].indexCount; i++)
+				group->indices.push_back(base + indices[i]);
+			sourceMeshCount++;
+		}
+	}
+
+	void StaticBatch::build(VertexFormat format)
+	{
+		std::vector<Vertex> vertices;
+		std::vector<GLuint> indices;
+		parts.clear();
+		for (size_t g = 0; g < groups.size(); g++) {
+			GLuint base = (GLuint)vertices.size();
+			MeshPart part = { (GLuint)indices.size(), (GLuint)groups[g].indices.size(), groups[g].textures };
+			parts.push_back(part);
+
+			vertices.insert(vertices.end(), groups[g].vertices.begin(), groups[g].vertices.end());
+			for (size_t i = 0; i < groups[g].indices.size(); i++)
+				indices.push_back(base + groups[g].indices[i]);
+		}
+		groups.clear();
+
+		mesh = std::make_shared<Mesh>(std::move(vertices), std::move(indices), std::vector<Texture>(), format);
+		mesh->releaseGeometry();
+		std::cout << "Static batch   : " << sourceMeshCount << " meshes -> " << parts.size() << " draws" << std::endl;
+	}
+
+	void StaticBatch::Draw(gps::Shader shader)
+	{
+		if (mesh)
+			mesh->Draw(shader, parts);
+	}
+
+	size_t StaticBatch::getSourceMeshCount() const
+	{
+		return sourceMeshCount;
+	}
+
+	size_t StaticBatch::getDrawCount() const
+	{
+		return parts.size();
+	}
+}
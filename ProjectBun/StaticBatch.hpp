@@ -0,0 +1,49 @@
+#ifndef StaticBatch_hpp
+#define StaticBatch_hpp
+
+#include "Mesh.hpp"
+#include "Model3D.hpp"
+
+#include <memory>
+#include <vector>
+
+namespace gps {
+
+    // Geometry that never moves relative to each other, pre-transformed on load
+    // into one vertex and one index buffer. Triangles are grouped by texture set,
+    // so the batch draws with one VAO bind and one draw call per set, without
+    // per-mesh culling or levels of detail.
+    class StaticBatch
+    {
+    public:
+        StaticBatch();
+
+        // Adds the full detail level of every mesh of `model`, moved by `transform`.
+        // The textures stay owned by the model, which must outlive the batch.
+        // Streamed models keep no geometry on the CPU and can not be added.
+        void add(const Model3D& model, const glm::mat4& transform = glm::mat4(1.0f));
+
+        // Uploads everything added so far; the CPU copies are dropped
+        void build(VertexFormat format = VERTEX_FORMAT_FULL);
+
+        void Draw(gps::Shader shader);
+
+        // Meshes that went into the batch and the draw calls it takes instead
+        size_t getSourceMeshCount() const;
+        size_t getDrawCount() const;
+
+    private:
+        struct Group {
+            std::vector<Texture> textures;
+            std::vector<Vertex> vertices;
+            std::vector<GLuint> indices;
+        };
+
+        std::vector<Group> groups;
+        size_t sourceMeshCount;
+        std::shared_ptr<Mesh> mesh;
+        std::vector<MeshPart> parts;
+    };
+}
+
+#endif /* StaticBatch_hpp */
@@ -0,0 +1,91 @@
+#include "TextureCache.hpp"
+#include "FileUtils.hpp"
+#include "GLStateCache.hpp"
+#include "TextureLoader.hpp"
+
+namespace gps {
+
+	TextureCache::TextureCache() : hits(0), misses(0), releasedBytesSaved(0), contextAlive(true)
+	{
+	}
+
+	TextureCache& TextureCache::shared()
+	{
+		// never destroyed: models living in globals release into it at exit
+		static TextureCache* cache = new TextureCache();
+		return *cache;
+	}
+
+	GLuint TextureCache::acquire(const std::string& fileName)
+	{
+		uint64_t hash = hashFor(fileName);
+
+		std::unordered_map<uint64_t, Entry>::iterator it = entries.find(hash);
+		if (it != entries.end()) {
+			it->second.referenceCount++;
+			it->second.hits++;
+			hits++;
+			return it->second.textureId;
+		}
+
+		Entry entry;
+		entry.textureId = TextureLoader::shared().requestTexture2D(fileName);
+		entry.referenceCount = 1;
+		entry.hits = 0;
+		entries[hash] = entry;
+		textureHashes[entry.textureId] = hash;
+		misses++;
+		return entry.textureId;
+	}
+
+	void TextureCache::release(GLuint textureId)
+	{
+		std::unordered_map<GLuint, uint64_t>::iterator hashIt = textureHashes.find(textureId);
+		if (hashIt == textureHashes.end())
+			return;
+
+		std::unordered_map<uint64_t, Entry>::iterator it = entries.find(hashIt->second);
+		if (--it->second.referenceCount > 0)
+			return;
+
+		releasedBytesSaved += it->second.hits * TextureLoader::shared().getUploadedBytes(textureId);
+		if (contextAlive) {
+			glDeleteTextures(1, &textureId);
+			GLStateCache::shared().textureDeleted(textureId);
+		}
+		entries.erase(it);
+		textureHashes.erase(hashIt);
+	}
+
+	void TextureCache::contextDestroyed()
+	{
+		contextAlive = false;
+	}
+
+	TextureCacheStats TextureCache::getStats() const
+	{
+		TextureCacheStats stats;
+		stats.hits = hits;
+		stats.misses = misses;
+		// sizes are only known once the uploads happened, so sum them up lazily
+		stats.bytesSaved = releasedBytesSaved;
+		for (std::unordered_map<uint64_t, Entry>::const_iterator it = entries.begin(); it != entries.end(); ++it)
+			stats.bytesSaved += it->second.hits * TextureLoader::shared().getUploadedBytes(it->second.textureId);
+		return stats;
+	}
+
+	uint64_t TextureCache::hashFor(const std::string& fileName)
+	{
+		std::unordered_map<std::string, uint64_t>::iterator it = pathHashes.find(fileName);
+		if (it != pathHashes.end())
+			return it->second;
+
+		uint64_t hash;
+		if (!hashFile(fileName, &hash)) {
+			// unreadable files are keyed by name, the loader reports the error once
+			hash = hashBytes(fileName.data(), fileName.size(), 0x9e3779b97f4a7c15ull);
+		}
+		pathHashes[fileName] = hash;
+		return hash;
+	}
+}
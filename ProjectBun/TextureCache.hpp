@@ -0,0 +1,68 @@
+#ifndef TextureCache_hpp
+#define TextureCache_hpp
+
+#include <GL/glew.h>
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+namespace gps {
+
+    struct TextureCacheStats
+    {
+        // acquisitions served by an existing texture
+        size_t hits;
+        // acquisitions that had to decode and upload the image
+        size_t misses;
+        // video memory the hits would otherwise have taken
+        uint64_t bytesSaved;
+    };
+
+    // Process-wide set of 2D textures keyed by the content hash of the image
+    // file, so identical images - even under different paths - are decoded
+    // and stored in video memory once. Textures are reference counted.
+    // Used from the GL thread only.
+    class TextureCache
+    {
+    public:
+        static TextureCache& shared();
+
+        // Texture for an image file; takes a reference that must be released
+        GLuint acquire(const std::string& fileName);
+
+        // Drops a reference, the texture is deleted with the last one
+        void release(GLuint textureId);
+
+        // The GL context went away with the textures in it; later releases
+        // only drop their references
+        void contextDestroyed();
+
+        TextureCacheStats getStats() const;
+
+    private:
+        struct Entry {
+            GLuint textureId;
+            size_t referenceCount;
+            size_t hits;
+        };
+
+        // path -> content hash, so a known path is not read again
+        std::unordered_map<std::string, uint64_t> pathHashes;
+        std::unordered_map<uint64_t, Entry> entries;
+        std::unordered_map<GLuint, uint64_t> textureHashes;
+        size_t hits;
+        size_t misses;
+        // hits on textures that have been released since
+        uint64_t releasedBytesSaved;
+        bool contextAlive;
+
+        TextureCache();
+        TextureCache(const TextureCache&);
+        TextureCache& operator=(const TextureCache&);
+
+        uint64_t hashFor(const std::string& fileName);
+    };
+}
+
+#endif /* TextureCache_hpp */
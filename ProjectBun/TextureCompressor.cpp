@@ -0,0 +1,439 @@
+#include "TextureCompressor.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define GPS_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace gps {
+
+	namespace {
+
+		// A 4x4 block as one float array per channel, so four texels can be
+		// processed per SSE instruction
+		struct Block {
+			float channels[4][16];
+		};
+
+		void loadBlock(const unsigned char* rgba, Block* block)
+		{
+			for (int i = 0; i < 16; i++)
+				for (int c = 0; c < 4; c++)
+					block->channels[c][i] = rgba[i * 4 + c];
+		}
+
+		// Principal axis fit: returns the two extremes of the texels projected
+		// on the direction of largest variance
+		void fitEndpoints(const Block& block, int channelCount, float* low, float* high)
+		{
+			float mean[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+			for (int c = 0; c < channelCount; c++) {
+				for (int i = 0; i < 16; i++)
+					mean[c] += block.channels[c][i];
+				mean[c] /= 16.0f;
+			}
+
+			float covariance[4][4] = {};
+			for (int i = 0; i < 16; i++)
+				for (int a = 0; a < channelCount; a++)
+					for (int b = a; b < channelCount; b++)
+						covariance[a][b] += (block.channels[a][i] - mean[a]) * (block.channels[b][i] - mean[b]);
+			for (int a = 0; a < channelCount; a++)
+				for (int b = 0; b < a; b++)
+					covariance[a][b] = covariance[b][a];
+
+			// power iteration, started from the bounding box diagonal
+			float axis[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+			for (int c = 0; c < channelCount; c++) {
+				float minimum = 255.0f, maximum = 0.0f;
+				for (int i = 0; i < 16; i++) {
+					minimum = std::min(minimum, block.channels[c][i]);
+					maximum = std::max(maximum, block.channels[c][i]);
+				}
+				axis[c] = maximum - minimum;
+			}
+			for (int iteration = 0; iteration < 8; iteration++) {
+				float next[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+				float length = 0.0f;
+				for (int a = 0; a < channelCount; a++) {
+					for (int b = 0; b < channelCount; b++)
+						next[a] += covariance[a][b] * axis[b];
+					length = std::max(length, std::fabs(next[a]));
+				}
+				if (length < 1e-6f)
+					break;
+				for (int c = 0; c < channelCount; c++)
+					axis[c] = next[c] / length;
+			}
+
+			float axisLength = 0.0f;
+			for (int c = 0; c < channelCount; c++)
+				axisLength += axis[c] * axis[c];
+			if (axisLength < 1e-12f) {
+				// flat block
+				for (int c = 0; c < channelCount; c++)
+					low[c] = high[c] = mean[c];
+				return;
+			}
+
+			float minimum = 1e30f, maximum = -1e30f;
+			for (int i = 0; i < 16; i++) {
+				float t = 0.0f;
+				for (int c = 0; c < channelCount; c++)
+					t += (block.channels[c][i] - mean[c]) * axis[c];
+				minimum = std::min(minimum, t);
+				maximum = std::max(maximum, t);
+			}
+			for (int c = 0; c < channelCount; c++) {
+				low[c] = std::min(255.0f, std::max(0.0f, mean[c] + axis[c] * minimum / axisLength));
+				high[c] = std::min(255.0f, std::max(0.0f, mean[c] + axis[c] * maximum / axisLength));
+			}
+		}
+
+		// Position of every texel on the segment start -> end, as the nearest of
+		// `steps` + 1 evenly spaced points. Used for all index selection below.
+		void projectIndices(const Block& block, int firstChannel, int channelCount,
+			const float* start, const float* end, int steps, int* indices)
+		{
+			float direction[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+			float lengthSquared = 0.0f;
+			for (int c = 0; c < channelCount; c++) {
+				direction[c] = end[c] - start[c];
+				lengthSquared += direction[c] * direction[c];
+			}
+			if (lengthSquared < 1e-12f) {
+				for (int i = 0; i < 16; i++)
+					indices[i] = 0;
+				return;
+			}
+			float scale = (float)steps / lengthSquared;
+
+#ifdef GPS_USE_SSE2
+			for (int i = 0; i < 16; i += 4) {
+				__m128 t = _mm_setzero_ps();
+				for (int c = 0; c < channelCount; c++) {
+					__m128 value = _mm_loadu_ps(&block.channels[firstChannel + c][i]);
+					__m128 offset = _mm_sub_ps(value, _mm_set1_ps(start[c]));
+					t = _mm_add_ps(t, _mm_mul_ps(offset, _mm_set1_ps(direction[c])));
+				}
+				t = _mm_add_ps(_mm_mul_ps(t, _mm_set1_ps(scale)), _mm_set1_ps(0.5f));
+				t = _mm_min_ps(_mm_max_ps(t, _mm_setzero_ps()), _mm_set1_ps((float)steps));
+				_mm_storeu_si128((__m128i*)&indices[i], _mm_cvttps_epi32(t));
+			}
+#else
+			for (int i = 0; i < 16; i++) {
+				float t = 0.0f;
+				for (int c = 0; c < channelCount; c++)
+					t += (block.channels[firstChannel + c][i] - start[c]) * direction[c];
+				t = std::min(std::max(t * scale + 0.5f, 0.0f), (float)steps);
+				indices[i] = (int)t;
+			}
+#endif
+		}
+
+		uint16_t packRGB565(const float* color)
+		{
+			int r = (int)(color[0] * 31.0f / 255.0f + 0.5f);
+			int g = (int)(color[1] * 63.0f / 255.0f + 0.5f);
+			int b = (int)(color[2] * 31.0f / 255.0f + 0.5f);
+			return (uint16_t)((r << 11) | (g << 5) | b);
+		}
+
+		void unpackRGB565(uint16_t packed, float* color)
+		{
+			int r = (packed >> 11) & 31;
+			int g = (packed >> 5) & 63;
+			int b = packed & 31;
+			color[0] = (float)((r << 3) | (r >> 2));
+			color[1] = (float)((g << 2) | (g >> 4));
+			color[2] = (float)((b << 3) | (b >> 2));
+		}
+
+		void encodeColorBlock(const Block& block, unsigned char* out)
+		{
+			float low[4], high[4];
+			fitEndpoints(block, 3, low, high);
+
+			uint16_t color0 = packRGB565(high);
+			uint16_t color1 = packRGB565(low);
+			// color0 > color1 selects the four color mode
+			if (color0 < color1)
+				std::swap(color0, color1);
+
+			uint32_t indexBits = 0;
+			if (color0 != color1) {
+				float start[3], end[3];
+				unpackRGB565(color0, start);
+				unpackRGB565(color1, end);
+
+				// palette order is color0, color1, 2/3 color0 + 1/3 color1, 1/3 color0 + 2/3 color1
+				static const uint32_t order[4] = { 0, 2, 3, 1 };
+				int indices[16];
+				projectIndices(block, 0, 3, start, end, 3, indices);
+				for (int i = 0; i < 16; i++)
+					indexBits |= order[indices[i]] << (i * 2);
+			}
+
+			out[0] = (unsigned char)(color0 & 0xff);
+			out[1] = (unsigned char)(color0 >> 8);
+			out[2] = (unsigned char)(color1 & 0xff);
+			out[3] = (unsigned char)(color1 >> 8);
+			for (int i = 0; i < 4; i++)
+				out[4 + i] = (unsigned char)(indexBits >> (i * 8));
+		}
+
+		void encodeAlphaBlock(const Block& block, unsigned char* out)
+		{
+			float minimum = 255.0f, maximum = 0.0f;
+			for (int i = 0; i < 16; i++) {
+				minimum = std::min(minimum, block.channels[3][i]);
+				maximum = std::max(maximum, block.channels[3][i]);
+			}
+
+			// alpha0 > alpha1 selects eight interpolated values
+			unsigned char alpha0 = (unsigned char)maximum;
+			unsigned char alpha1 = (unsigned char)minimum;
+			uint64_t indexBits = 0;
+			if (alpha0 != alpha1) {
+				// palette order is alpha0, alpha1, then six steps from alpha0 to alpha1
+				static const uint64_t order[8] = { 0, 2, 3, 4, 5, 6, 7, 1 };
+				float start = alpha0, end = alpha1;
+				int indices[16];
+				projectIndices(block, 3, 1, &start, &end, 7, indices);
+				for (int i = 0; i < 16; i++)
+					indexBits |= order[indices[i]] << (i * 3);
+			}
+
+			out[0] = alpha0;
+			out[1] = alpha1;
+			for (int i = 0; i < 6; i++)
+				out[2 + i] = (unsigned char)(indexBits >> (i * 8));
+		}
+
+		class BitWriter {
+		public:
+			explicit BitWriter(unsigned char* out) : out(out), position(0) { memset(out, 0, 16); }
+
+			void put(uint32_t value, int bitCount)
+			{
+				for (int i = 0; i < bitCount; i++, position++)
+					out[position >> 3] |= (unsigned char)(((value >> i) & 1) << (position & 7));
+			}
+
+		private:
+			unsigned char* out;
+			int position;
+		};
+
+		// Quantizes an endpoint to 7 bits per channel plus a shared p-bit, keeping
+		// whichever p-bit lands closer
+		void quantizeEndpointBC7(const float* endpoint, int* quantized, int* pBit)
+		{
+			float bestError = 1e30f;
+			for (int p = 0; p < 2; p++) {
+				int candidate[4];
+				float error = 0.0f;
+				for (int c = 0; c < 4; c++) {
+					candidate[c] = std::min(127, std::max(0, (int)((endpoint[c] - p) * 0.5f + 0.5f)));
+					float difference = (float)(candidate[c] * 2 + p) - endpoint[c];
+					error += difference * difference;
+				}
+				if (error < bestError) {
+					bestError = error;
+					*pBit = p;
+					memcpy(quantized, candidate, sizeof(candidate));
+				}
+			}
+		}
+
+		// sRGB transfer curve lookups for mip generation
+		struct SRGBTables {
+			float toLinear[256];
+			unsigned char fromLinear[4096];
+
+			SRGBTables()
+			{
+				for (int i = 0; i < 256; i++) {
+					float value = i / 255.0f;
+					toLinear[i] = value <= 0.04045f ? value / 12.92f : std::pow((value + 0.055f) / 1.055f, 2.4f);
+				}
+				for (int i = 0; i < 4096; i++) {
+					float value = i / 4095.0f;
+					float encoded = value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+					fromLinear[i] = (unsigned char)(encoded * 255.0f + 0.5f);
+				}
+			}
+		};
+
+		const SRGBTables& srgbTables()
+		{
+			static SRGBTables tables;
+			return tables;
+		}
+
+		// 2x2 box filter, averaging color in linear space and alpha as is
+		void downsample(const std::vector<unsigned char>& source, int width, int height,
+			std::vector<unsigned char>& target, int targetWidth, int targetHeight)
+		{
+			const SRGBTables& tables = srgbTables();
+			target.resize((size_t)targetWidth * targetHeight * 4);
+
+			for (int y = 0; y < targetHeight; y++) {
+				int y0 = std::min(y * 2, height - 1);
+				int y1 = std::min(y * 2 + 1, height - 1);
+				for (int x = 0; x < targetWidth; x++) {
+					int x0 = std::min(x * 2, width - 1);
+					int x1 = std::min(x * 2 + 1, width - 1);
+					const unsigned char* texels[4] = {
+						&source[((size_t)y0 * width + x0) * 4], &source[((size_t)y0 * width + x1) * 4],
+						&source[((size_t)y1 * width + x0) * 4], &source[((size_t)y1 * width + x1) * 4]
+					};
+
+					unsigned char* result = &target[((size_t)y * targetWidth + x) * 4];
+					for (int c = 0; c < 3; c++) {
+						float sum = 0.0f;
+						for (int i = 0; i < 4; i++)
+							sum += tables.toLinear[texels[i][c]];
+						result[c] = tables.fromLinear[(int)(sum * 0.25f * 4095.0f + 0.5f)];
+					}
+					result[3] = (unsigned char)((texels[0][3] + texels[1][3] + texels[2][3] + texels[3][3] + 2) / 4);
+				}
+			}
+		}
+
+		void compressLevel(const std::vector<unsigned char>& rgba, int width, int height,
+			BlockFormat format, CompressedLevel* level)
+		{
+			int blocksWide = (width + 3) / 4;
+			int blocksHigh = (height + 3) / 4;
+			size_t bytesPerBlock = blockSize(format);
+
+			level->width = width;
+			level->height = height;
+			level->data.resize((size_t)blocksWide * blocksHigh * bytesPerBlock);
+
+			ThreadPool::shared().parallelFor((size_t)blocksHigh, [&](size_t blockY) {
+				unsigned char texels[64];
+				for (int blockX = 0; blockX < blocksWide; blockX++) {
+					// edge blocks repeat the last row / column
+					for (int y = 0; y < 4; y++) {
+						int sourceY = std::min((int)blockY * 4 + y, height - 1);
+						for (int x = 0; x < 4; x++) {
+							int sourceX = std::min(blockX * 4 + x, width - 1);
+							memcpy(&texels[(y * 4 + x) * 4], &rgba[((size_t)sourceY * width + sourceX) * 4], 4);
+						}
+					}
+
+					unsigned char* out = &level->data[(blockY * blocksWide + blockX) * bytesPerBlock];
+					switch (format) {
+					case BLOCK_FORMAT_BC1: encodeBlockBC1(texels, out); break;
+					case BLOCK_FORMAT_BC3: encodeBlockBC3(texels, out); break;
+					case BLOCK_FORMAT_BC7: encodeBlockBC7(texels, out); break;
+					}
+				}
+			});
+		}
+	}
+
+	size_t blockSize(BlockFormat format)
+	{
+		return format == BLOCK_FORMAT_BC1 ? 8 : 16;
+	}
+
+	void encodeBlockBC1(const unsigned char* rgba, unsigned char* out)
+	{
+		Block block;
+		loadBlock(rgba, &block);
+		encodeColorBlock(block, out);
+	}
+
+	void encodeBlockBC3(const unsigned char* rgba, unsigned char* out)
+	{
+		Block block;
+		loadBlock(rgba, &block);
+		encodeAlphaBlock(block, out);
+		encodeColorBlock(block, out + 8);
+	}
+
+	void encodeBlockBC7(const unsigned char* rgba, unsigned char* out)
+	{
+		Block block;
+		loadBlock(rgba, &block);
+
+		float low[4], high[4];
+		fitEndpoints(block, 4, low, high);
+
+		int quantized[2][4], pBits[2];
+		quantizeEndpointBC7(low, quantized[0], &pBits[0]);
+		quantizeEndpointBC7(high, quantized[1], &pBits[1]);
+
+		float endpoints[2][4];
+		for (int e = 0; e < 2; e++)
+			for (int c = 0; c < 4; c++)
+				endpoints[e][c] = (float)(quantized[e][c] * 2 + pBits[e]);
+
+		int indices[16];
+		projectIndices(block, 0, 4, endpoints[0], endpoints[1], 15, indices);
+
+		// the first index is stored with its top bit implied zero
+		if (indices[0] >= 8) {
+			std::swap(quantized[0], quantized[1]);
+			std::swap(pBits[0], pBits[1]);
+			for (int i = 0; i < 16; i++)
+				indices[i] = 15 - indices[i];
+		}
+
+		BitWriter writer(out);
+		writer.put(1 << 6, 7);
+		for (int c = 0; c < 4; c++) {
+			writer.put(quantized[0][c], 7);
+			writer.put(quantized[1][c], 7);
+		}
+		writer.put(pBits[0], 1);
+		writer.put(pBits[1], 1);
+		writer.put(indices[0], 3);
+		for (int i = 1; i < 16; i++)
+			writer.put(indices[i], 4);
+	}
+
+	void compressImage(const unsigned char* rgba, int width, int height,
+		TextureCompression compression, CompressedImage* image)
+	{
+		size_t texelCount = (size_t)width * height;
+		std::vector<unsigned char> level(rgba, rgba + texelCount * 4);
+
+		if (compression == TEXTURE_COMPRESSION_BC7) {
+			image->format = BLOCK_FORMAT_BC7;
+		}
+		else {
+			image->format = BLOCK_FORMAT_BC1;
+			for (size_t i = 0; i < texelCount; i++) {
+				if (rgba[i * 4 + 3] != 255) {
+					image->format = BLOCK_FORMAT_BC3;
+					break;
+				}
+			}
+		}
+
+		image->levels.clear();
+		for (;;) {
+			image->levels.push_back(CompressedLevel());
+			compressLevel(level, width, height, image->format, &image->levels.back());
+			if (width == 1 && height == 1)
+				break;
+
+			int nextWidth = std::max(1, width / 2);
+			int nextHeight = std::max(1, height / 2);
+			std::vector<unsigned char> next;
+			downsample(level, width, height, next, nextWidth, nextHeight);
+			level.swap(next);
+			width = nextWidth;
+			height = nextHeight;
+		}
+	}
+}
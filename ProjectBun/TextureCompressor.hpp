@@ -0,0 +1,54 @@
+#ifndef TextureCompressor_hpp
+#define TextureCompressor_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace gps {
+
+    enum TextureCompression
+    {
+        TEXTURE_COMPRESSION_NONE = 0,
+        // BC1 for opaque images, BC3 when they have transparency
+        TEXTURE_COMPRESSION_BC1_BC3 = 1,
+        TEXTURE_COMPRESSION_BC7 = 2
+    };
+
+    enum BlockFormat
+    {
+        BLOCK_FORMAT_BC1 = 1,
+        BLOCK_FORMAT_BC3 = 3,
+        BLOCK_FORMAT_BC7 = 7
+    };
+
+    struct CompressedLevel
+    {
+        int width;
+        int height;
+        std::vector<unsigned char> data;
+    };
+
+    // Block compressed image with its full mip chain, base level first
+    struct CompressedImage
+    {
+        BlockFormat format;
+        std::vector<CompressedLevel> levels;
+    };
+
+    // Bytes per 4x4 block
+    size_t blockSize(BlockFormat format);
+
+    // Encodes a single 4x4 block of RGBA8 texels (row major, 64 bytes)
+    void encodeBlockBC1(const unsigned char* rgba, unsigned char* out);
+    void encodeBlockBC3(const unsigned char* rgba, unsigned char* out);
+    // BC7 mode 6: one RGBA subset with 7.7.7.7+p endpoints and 4-bit indices
+    void encodeBlockBC7(const unsigned char* rgba, unsigned char* out);
+
+    // Builds the sRGB-correct mip chain of an RGBA8 image and block compresses
+    // every level, spreading the block rows over the shared thread pool
+    void compressImage(const unsigned char* rgba, int width, int height,
+        TextureCompression compression, CompressedImage* image);
+}
+
+#endif /* TextureCompressor_hpp */
@@ -0,0 +1,280 @@
+#include "TextureLoader.hpp"
+#include "GLStateCache.hpp"
+#include "ThreadPool.hpp"
+#include "CompressedTextureCache.hpp"
+
+#include "stb_image.h"
+
+#include <cstdio>
+
+namespace gps {
+
+	namespace {
+
+		// Flips the rows in place, stb_image returns the top row first
+		void flipRows(unsigned char* pixels, int width, int height, int channels)
+		{
+			int width_in_bytes = width * channels;
+			unsigned char *top = NULL;
+			unsigned char *bottom = NULL;
+			unsigned char temp = 0;
+			int half_height = height / 2;
+
+			for (int row = 0; row < half_height; row++) {
+				top = pixels + row * width_in_bytes;
+				bottom = pixels + (height - row - 1) * width_in_bytes;
+				for (int col = 0; col < width_in_bytes; col++) {
+					temp = *top;
+					*top = *bottom;
+					*bottom = temp;
+					top++;
+					bottom++;
+				}
+			}
+		}
+
+		GLenum compressedFormat(BlockFormat format)
+		{
+			switch (format) {
+			case BLOCK_FORMAT_BC1:
+				return GL_COMPRESSED_SRGB_S3TC_DXT1_EXT;
+			case BLOCK_FORMAT_BC3:
+				return GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT;
+			default:
+				return GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM;
+			}
+		}
+	}
+
+	TextureLoader::TextureLoader() : pendingCount(0), compression(TEXTURE_COMPRESSION_BC1_BC3)
+	{
+		// make sure the pool outlives this object, its jobs refer to it
+		ThreadPool::shared();
+	}
+
+	TextureLoader::~TextureLoader()
+	{
+		// no GL context is guaranteed here, just let the decodes drain
+		std::unique_lock<std::mutex> lock(decodedMutex);
+		decodedAvailable.wait(lock, [this]() { return pendingCount == 0; });
+		for (size_t i = 0; i < decoded.size(); i++)
+			stbi_image_free(decoded[i].pixels);
+	}
+
+	TextureLoader& TextureLoader::shared()
+	{
+		// never destroyed: models living in globals release their textures
+		// through TextureCache at exit, which asks for the uploaded sizes
+		static TextureLoader* loader = new TextureLoader();
+		return *loader;
+	}
+
+	void TextureLoader::setCompression(TextureCompression compression)
+	{
+		this->compression = compression;
+	}
+
+	GLuint TextureLoader::requestTexture2D(const std::string& fileName)
+	{
+		GLuint textureID;
+		glGenTextures(1, &textureID);
+		GLStateCache::shared().bindTexture(GL_TEXTURE_2D, textureID);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		GLStateCache::shared().bindTexture(GL_TEXTURE_2D, 0);
+
+		// names get recycled after glDeleteTextures
+		uploadedBytes.erase(textureID);
+		requestDecode(textureID, GL_TEXTURE_2D, fileName, getSupportedCompression());
+		return textureID;
+	}
+
+	GLuint TextureLoader::requestCubeMap(const std::vector<std::string>& faceFileNames)
+	{
+		GLuint textureID;
+		glGenTextures(1, &textureID);
+		GLStateCache::shared().bindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+		GLStateCache::shared().bindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+		uploadedBytes.erase(textureID);
+		for (GLuint i = 0; i < faceFileNames.size(); i++)
+			requestDecode(textureID, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, faceFileNames[i], TEXTURE_COMPRESSION_NONE);
+		return textureID;
+	}
+
+	void TextureLoader::uploadReady()
+	{
+		std::vector<DecodedImage> ready;
+		{
+			std::lock_guard<std::mutex> lock(decodedMutex);
+			ready.swap(decoded);
+		}
+		for (size_t i = 0; i < ready.size(); i++)
+			upload(ready[i]);
+	}
+
+	void TextureLoader::finish()
+	{
+		for (;;) {
+			std::vector<DecodedImage> ready;
+			{
+				std::unique_lock<std::mutex> lock(decodedMutex);
+				decodedAvailable.wait(lock, [this]() { return !decoded.empty() || pendingCount == 0; });
+				if (decoded.empty())
+					return;
+				ready.swap(decoded);
+			}
+			// upload this batch while the workers keep decoding the rest
+			for (size_t i = 0; i < ready.size(); i++)
+				upload(ready[i]);
+		}
+	}
+
+	uint64_t TextureLoader::getUploadedBytes(GLuint textureId) const
+	{
+		std::unordered_map<GLuint, uint64_t>::const_iterator it = uploadedBytes.find(textureId);
+		return it == uploadedBytes.end() ? 0 : it->second;
+	}
+
+	TextureCompression TextureLoader::getSupportedCompression() const
+	{
+		// the extension flags are only valid on the GL thread, after glewInit
+		TextureCompression supported = compression;
+		if (supported == TEXTURE_COMPRESSION_BC7 && !GLEW_ARB_texture_compression_bptc)
+			supported = TEXTURE_COMPRESSION_BC1_BC3;
+		if (supported == TEXTURE_COMPRESSION_BC1_BC3 && !(GLEW_EXT_texture_compression_s3tc && GLEW_EXT_texture_sRGB))
+			supported = TEXTURE_COMPRESSION_NONE;
+		return supported;
+	}
+
+	void TextureLoader::requestDecode(GLuint textureId, GLenum target, const std::string& fileName,
+		TextureCompression compression)
+	{
+		{
+			std::lock_guard<std::mutex> lock(decodedMutex);
+			pendingCount++;
+		}
+
+		ThreadPool::shared().submit([this, textureId, target, fileName, compression]() {
+			DecodedImage image;
+			image.textureId = textureId;
+			image.target = target;
+			image.fileName = fileName;
+			image.pixels = NULL;
+			image.width = 0;
+			image.height = 0;
+
+			std::string cacheFileName = CompressedTextureCache::pathFor(fileName);
+			if (compression != TEXTURE_COMPRESSION_NONE) {
+				std::shared_ptr<CompressedImage> compressed = std::make_shared<CompressedImage>();
+				if (CompressedTextureCache::read(cacheFileName, fileName, compression, compressed.get()))
+					image.compressed = compressed;
+			}
+
+			// cube faces are plain RGB, model textures are forced to RGBA
+			int n;
+			int force_channels = target == GL_TEXTURE_2D ? 4 : 3;
+			if (!image.compressed) {
+				image.pixels = stbi_load(fileName.c_str(), &image.width, &image.height, &n, force_channels);
+				if (image.pixels && target == GL_TEXTURE_2D)
+					flipRows(image.pixels, image.width, image.height, force_channels);
+			}
+
+			// first use: encode once and keep the result for the next runs
+			if (image.pixels && compression != TEXTURE_COMPRESSION_NONE) {
+				std::shared_ptr<CompressedImage> compressed = std::make_shared<CompressedImage>();
+				compressImage(image.pixels, image.width, image.height, compression, compressed.get());
+				if (!CompressedTextureCache::write(cacheFileName, fileName, compression, *compressed))
+					fprintf(stderr, "WARNING: could not write %s\n", cacheFileName.c_str());
+				stbi_image_free(image.pixels);
+				image.pixels = NULL;
+				image.compressed = compressed;
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(decodedMutex);
+				decoded.push_back(image);
+				pendingCount--;
+			}
+			decodedAvailable.notify_all();
+		});
+	}
+
+	void TextureLoader::upload(DecodedImage& image)
+	{
+		if (image.compressed) {
+			const CompressedImage& compressed = *image.compressed;
+			GLenum internalFormat = compressedFormat(compressed.format);
+			uint64_t bytes = 0;
+
+			// the whole chain comes from the cache, no glGenerateMipmap
+			GLStateCache::shared().bindTexture(GL_TEXTURE_2D, image.textureId);
+			for (size_t level = 0; level < compressed.levels.size(); level++) {
+				const CompressedLevel& data = compressed.levels[level];
+				glCompressedTexImage2D(
+					GL_TEXTURE_2D, (GLint)level, internalFormat,
+					data.width, data.height, 0, (GLsizei)data.data.size(), data.data.data()
+				);
+				bytes += data.data.size();
+			}
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)compressed.levels.size() - 1);
+			GLStateCache::shared().bindTexture(GL_TEXTURE_2D, 0);
+
+			uploadedBytes[image.textureId] = bytes;
+			image.compressed.reset();
+			return;
+		}
+
+		if (!image.pixels) {
+			fprintf(stderr, "ERROR: could not load %s\n", image.fileName.c_str());
+			return;
+		}
+
+		if (image.target == GL_TEXTURE_2D) {
+			// NPOT check
+			if ((image.width & (image.width - 1)) != 0 || (image.height & (image.height - 1)) != 0) {
+				fprintf(
+					stderr, "WARNING: texture %s is not power-of-2 dimensions\n", image.fileName.c_str()
+				);
+			}
+
+			GLStateCache::shared().bindTexture(GL_TEXTURE_2D, image.textureId);
+			glTexImage2D(
+				GL_TEXTURE_2D,
+				0,
+				GL_SRGB, //GL_SRGB,//GL_RGBA,
+				image.width,
+				image.height,
+				0,
+				GL_RGBA,
+				GL_UNSIGNED_BYTE,
+				image.pixels
+			);
+			glGenerateMipmap(GL_TEXTURE_2D);
+			GLStateCache::shared().bindTexture(GL_TEXTURE_2D, 0);
+
+			// a full mip chain adds about a third
+			uploadedBytes[image.textureId] = (uint64_t)image.width * image.height * 4 * 4 / 3;
+		}
+		else {
+			GLStateCache::shared().bindTexture(GL_TEXTURE_CUBE_MAP, image.textureId);
+			glTexImage2D(
+				image.target, 0,
+				GL_RGB, image.width, image.height, 0, GL_RGB, GL_UNSIGNED_BYTE, image.pixels
+			);
+			GLStateCache::shared().bindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+			uploadedBytes[image.textureId] += (uint64_t)image.width * image.height * 3;
+		}
+
+		stbi_image_free(image.pixels);
+		image.pixels = NULL;
+	}
+}
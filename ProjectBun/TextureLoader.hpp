@@ -0,0 +1,82 @@
+#ifndef TextureLoader_hpp
+#define TextureLoader_hpp
+
+#include <GL/glew.h>
+
+#include "TextureCompressor.hpp"
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace gps {
+
+    // Decodes image files on the shared thread pool. Texture names are created
+    // right away so meshes can refer to them; the pixel data is uploaded on the
+    // GL thread once decoding finished, from uploadReady() or finish().
+    class TextureLoader
+    {
+    public:
+        TextureLoader();
+        ~TextureLoader();
+
+        // Process-wide loader used by Model3D and SkyBox
+        static TextureLoader& shared();
+
+        // Block compression used for 2D textures requested from now on. Falls back
+        // to a mode the driver supports; compressed images are cached next to the source.
+        void setCompression(TextureCompression compression);
+
+        // sRGB 2D texture with mipmaps, rows flipped to OpenGL order
+        GLuint requestTexture2D(const std::string& fileName);
+
+        // Cube map from six faces in +X, -X, +Y, -Y, +Z, -Z order
+        GLuint requestCubeMap(const std::vector<std::string>& faceFileNames);
+
+        // Uploads every image decoded so far; never blocks. Must run on the GL thread.
+        void uploadReady();
+
+        // Waits for all requested images and uploads them. Must run on the GL thread.
+        void finish();
+
+        // Video memory taken by an uploaded texture, mip chain included (0 until uploaded)
+        uint64_t getUploadedBytes(GLuint textureId) const;
+
+    private:
+        struct DecodedImage {
+            GLuint textureId;
+            // GL_TEXTURE_2D or one of the GL_TEXTURE_CUBE_MAP_* faces
+            GLenum target;
+            std::string fileName;
+            unsigned char* pixels;
+            int width;
+            int height;
+            // set instead of pixels when the image was block compressed
+            std::shared_ptr<CompressedImage> compressed;
+        };
+
+        std::mutex decodedMutex;
+        std::condition_variable decodedAvailable;
+        std::vector<DecodedImage> decoded;
+        // decodes queued or running, touched under decodedMutex
+        size_t pendingCount;
+        // GL thread only
+        std::unordered_map<GLuint, uint64_t> uploadedBytes;
+        TextureCompression compression;
+
+        // Most compact mode at or below the requested one the driver can sample
+        TextureCompression getSupportedCompression() const;
+        void requestDecode(GLuint textureId, GLenum target, const std::string& fileName,
+            TextureCompression compression);
+        void upload(DecodedImage& image);
+
+        TextureLoader(const TextureLoader&);
+        TextureLoader& operator=(const TextureLoader&);
+    };
+}
+
+#endif /* TextureLoader_hpp */
@@ -0,0 +1,106 @@
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <atomic>
+
+namespace gps {
+
+	ThreadPool::ThreadPool(unsigned int threadCount) : stopping(false)
+	{
+		if (threadCount == 0)
+			threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+		for (unsigned int i = 0; i < threadCount; i++)
+			workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+	}
+
+	ThreadPool::~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(jobsMutex);
+			stopping = true;
+		}
+		jobsAvailable.notify_all();
+
+		for (size_t i = 0; i < workers.size(); i++)
+			workers[i].join();
+	}
+
+	ThreadPool& ThreadPool::shared()
+	{
+		static ThreadPool pool;
+		return pool;
+	}
+
+	unsigned int ThreadPool::size() const
+	{
+		return (unsigned int)workers.size();
+	}
+
+	void ThreadPool::enqueue(std::function<void()> job)
+	{
+		{
+			std::lock_guard<std::mutex> lock(jobsMutex);
+			jobs.push(job);
+		}
+		jobsAvailable.notify_one();
+	}
+
+	void ThreadPool::workerLoop()
+	{
+		for (;;) {
+			std::function<void()> job;
+			{
+				std::unique_lock<std::mutex> lock(jobsMutex);
+				jobsAvailable.wait(lock, [this]() { return stopping || !jobs.empty(); });
+				if (stopping && jobs.empty())
+					return;
+				job = jobs.front();
+				jobs.pop();
+			}
+			job();
+		}
+	}
+
+	// The calling thread takes part in the loop, so nested calls from a worker
+	// still make progress when every other worker is busy
+	void ThreadPool::parallelFor(size_t count, const std::function<void(size_t)>& job)
+	{
+		if (count == 0)
+			return;
+		if (count == 1) {
+			job(0);
+			return;
+		}
+
+		struct Loop {
+			std::atomic<size_t> next;
+			std::atomic<size_t> done;
+			std::mutex mutex;
+			std::condition_variable finished;
+		};
+		std::shared_ptr<Loop> loop = std::make_shared<Loop>();
+		loop->next = 0;
+		loop->done = 0;
+
+		const std::function<void(size_t)>* body = &job;
+		auto run = [loop, body, count]() {
+			size_t i;
+			while ((i = loop->next++) < count) {
+				(*body)(i);
+				if (++loop->done == count) {
+					std::lock_guard<std::mutex> lock(loop->mutex);
+					loop->finished.notify_all();
+				}
+			}
+		};
+
+		size_t helpers = std::min(count - 1, workers.size());
+		for (size_t i = 0; i < helpers; i++)
+			enqueue(run);
+		run();
+
+		std::unique_lock<std::mutex> lock(loop->mutex);
+		loop->finished.wait(lock, [&]() { return loop->done == count; });
+	}
+}
@@ -0,0 +1,56 @@
+#ifndef ThreadPool_hpp
+#define ThreadPool_hpp
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace gps {
+
+    class ThreadPool
+    {
+    public:
+        // Starts `threadCount` workers (0 = one per hardware thread)
+        explicit ThreadPool(unsigned int threadCount = 0);
+        ~ThreadPool();
+
+        // Process-wide pool used by the asset loaders
+        static ThreadPool& shared();
+
+        unsigned int size() const;
+
+        // Queues a job and returns a future for its result
+        template <typename F>
+        auto submit(F job) -> std::future<decltype(job())>;
+
+        // Runs job(i) for every i in [0, count) and waits for all of them
+        void parallelFor(size_t count, const std::function<void(size_t)>& job);
+
+    private:
+        std::vector<std::thread> workers;
+        std::queue<std::function<void()> > jobs;
+        std::mutex jobsMutex;
+        std::condition_variable jobsAvailable;
+        bool stopping;
+
+        void enqueue(std::function<void()> job);
+        void workerLoop();
+    };
+
+    template <typename F>
+    auto ThreadPool::submit(F job) -> std::future<decltype(job())>
+    {
+        typedef decltype(job()) Result;
+        std::shared_ptr<std::packaged_task<Result()> > task = std::make_shared<std::packaged_task<Result()> >(job);
+        std::future<Result> result = task->get_future();
+        enqueue([task]() { (*task)(); });
+        return result;
+    }
+}
+
+#endif /* ThreadPool_hpp */
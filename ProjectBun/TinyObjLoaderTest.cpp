@@ -0,0 +1,226 @@
+// Checks tinyobj::tryParseFloat against strtof in the "C" locale, bit for bit,
+// on every number of the v/vn/vt lines of the models, and counts the numbers
+// the loader's previous parser read differently. Not part of the application
+// build; run from this directory:
+//   g++ -std=c++14 -O2 TinyObjLoaderTest.cpp -o TinyObjLoaderTest && ./TinyObjLoaderTest [extra.obj ...]
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "tiny_obj_loader.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <clocale>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+	// Every OBJ file under models/
+	const char* MODEL_FILES[] = {
+		"models/Castle/Castle OBJ.obj",
+		"models/car/car.obj",
+		"models/cube/cube.obj",
+		"models/ground/ground.obj",
+		"models/sun/13913_Sun_v2_l3.obj",
+		"models/tank/uaz.obj",
+		"models/teapot/teapot20segUT.obj",
+		"models/tree/treeG.obj",
+		"models/tree/untitled.obj"
+	};
+
+	struct Results {
+		size_t numbers;
+		size_t mismatches;
+		// where the previous parser disagrees with strtof; reported, not a failure
+		size_t previousDifferences;
+	};
+
+	uint32_t floatBits(float value)
+	{
+		uint32_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+		return bits;
+	}
+
+	// The correctly rounded float; going through strtod would round twice
+	float referenceValue(const std::string& token)
+	{
+		return strtof(token.c_str(), NULL);
+	}
+
+	// tryParseDouble as the loader had it before tryParseFloat: the digits
+	// summed in a double with pow(), then narrowed to float
+	bool previousParseFloat(const char* s, const char* s_end, float* result)
+	{
+		if (s >= s_end)
+			return false;
+
+		double mantissa = 0.0;
+		int exponent = 0;
+		char sign = '+';
+		char exp_sign = '+';
+		const char* curr = s;
+		int read = 0;
+		bool end_not_reached = false;
+
+		if (*curr == '+' || *curr == '-') {
+			sign = *curr;
+			curr++;
+		}
+		else if (!(*curr >= '0' && *curr <= '9')) {
+			return false;
+		}
+
+		end_not_reached = (curr != s_end);
+		while (end_not_reached && *curr >= '0' && *curr <= '9') {
+			mantissa *= 10;
+			mantissa += static_cast<int>(*curr - 0x30);
+			curr++;
+			read++;
+			end_not_reached = (curr != s_end);
+		}
+		if (read == 0)
+			return false;
+
+		if (end_not_reached && *curr == '.') {
+			curr++;
+			read = 1;
+			end_not_reached = (curr != s_end);
+			while (end_not_reached && *curr >= '0' && *curr <= '9') {
+				static const double pow_lut[] = { 1.0, 0.1, 0.01, 0.001, 0.0001, 0.00001, 0.000001, 0.0000001 };
+				const int lut_entries = sizeof pow_lut / sizeof pow_lut[0];
+				mantissa += static_cast<int>(*curr - 0x30) * (read < lut_entries ? pow_lut[read] : pow(10.0, -read));
+				read++;
+				curr++;
+				end_not_reached = (curr != s_end);
+			}
+		}
+
+		if (end_not_reached && (*curr == 'e' || *curr == 'E')) {
+			curr++;
+			end_not_reached = (curr != s_end);
+			if (end_not_reached && (*curr == '+' || *curr == '-')) {
+				exp_sign = *curr;
+				curr++;
+			}
+			else if (!(end_not_reached && *curr >= '0' && *curr <= '9')) {
+				return false;
+			}
+
+			read = 0;
+			end_not_reached = (curr != s_end);
+			while (end_not_reached && *curr >= '0' && *curr <= '9') {
+				exponent *= 10;
+				exponent += static_cast<int>(*curr - 0x30);
+				curr++;
+				read++;
+				end_not_reached = (curr != s_end);
+			}
+			exponent *= (exp_sign == '+' ? 1 : -1);
+			if (read == 0)
+				return false;
+		}
+
+		double value = (sign == '+' ? 1 : -1) * (exponent ? ldexp(mantissa * pow(5.0, exponent), exponent) : mantissa);
+		*result = static_cast<float>(value);
+		return true;
+	}
+
+	void check(const std::string& token, const std::string& where, Results& results)
+	{
+		const char* begin = token.c_str();
+		const char* end = begin + token.size();
+		const char* parsed = NULL;
+		float value = 0.0f;
+		bool ok = tinyobj::tryParseFloat(begin, end, &value, &parsed);
+		float expected = referenceValue(token);
+
+		results.numbers++;
+		if (!ok || parsed != end || floatBits(value) != floatBits(expected)) {
+			if (results.mismatches < 20) {
+				printf("  %s: \"%s\" parsed as %.9g (0x%08x), strtof gives %.9g (0x%08x)\n", where.c_str(), token.c_str(),
+					value, floatBits(value), expected, floatBits(expected));
+			}
+			results.mismatches++;
+		}
+
+		float previous = 0.0f;
+		if (!previousParseFloat(begin, end, &previous) || floatBits(previous) != floatBits(expected))
+			results.previousDifferences++;
+	}
+
+	bool checkFile(const std::string& fileName, Results& results)
+	{
+		std::ifstream file(fileName.c_str());
+		if (!file) {
+			printf("  cannot open %s\n", fileName.c_str());
+			return false;
+		}
+
+		std::string line;
+		size_t lineNumber = 0;
+		while (std::getline(file, line)) {
+			lineNumber++;
+			if (line.compare(0, 2, "v ") != 0 && line.compare(0, 3, "vn ") != 0 && line.compare(0, 3, "vt ") != 0)
+				continue;
+
+			size_t position = line.find(' ');
+			while (position != std::string::npos) {
+				size_t begin = line.find_first_not_of(" \t\r", position);
+				if (begin == std::string::npos)
+					break;
+				position = line.find_first_of(" \t\r", begin);
+				std::string token = line.substr(begin, position == std::string::npos ? std::string::npos : position - begin);
+				check(token, fileName + ":" + std::to_string(lineNumber), results);
+			}
+		}
+		return true;
+	}
+
+	// Exactly representable values, the fast path limits, numbers only strtof can
+	// round, and float halfway points with their neighbours just above and below,
+	// which a detour through double rounds the wrong way
+	const char* EDGE_CASES[] = {
+		"0", "-0", "+0.0", "1", "-1", "0.5", "0.1", "0.2", "0.3", "1.0324", "-1.41", "11e2", "+3.1417e+2", "-0.0E-3",
+		"16777216", "16777217", "16777218", "9007199254740993", "1e10", "1e-10", "1e22", "1e23", "1e-22", "1e-23",
+		"3.4028234e38", "1.17549435e-38", "1.4e-45", "123456789012345678901234567890", "0.000000000000000000000001",
+		"0.1234567890123456789", "2.7182818284590452353602874713527", "6.02214076e23", "-9.999999e-5",
+		"1.000000059604644775390625", "1.0000000596046447753906250000000001", "1.0000000596046447753906249999999999",
+		"1.000000178813934326171875", "1.0000001788139343261718750000000001", "1.0000001788139343261718749999999999",
+		"3.00000011920928955078125", "3.0000001192092895507812500000000001", "-3.0000001192092895507812500000000001",
+		"16777217.000000000000000000000001", "16777219", "16777218.999999999999999999999999",
+		"7.00649232162408535461864791644958065640130970938257885878534141944895541342930300743319094181060791015625e-46",
+		"7.0064923216240853546186479164495807e-46", "7.0064923216240853546186479164495806e-46"
+	};
+}
+
+int main(int argc, char** argv)
+{
+	// strtof reads the decimal point of the locale
+	setlocale(LC_ALL, "C");
+
+	Results results = { 0, 0, 0 };
+	bool allRead = true;
+
+	for (size_t i = 0; i < sizeof(EDGE_CASES) / sizeof(EDGE_CASES[0]); i++)
+		check(EDGE_CASES[i], "edge case", results);
+
+	std::vector<std::string> files(MODEL_FILES, MODEL_FILES + sizeof(MODEL_FILES) / sizeof(MODEL_FILES[0]));
+	for (int i = 1; i < argc; i++)
+		files.push_back(argv[i]);
+	for (size_t i = 0; i < files.size(); i++)
+		allRead = checkFile(files[i], results) && allRead;
+
+	printf("%zu numbers, %zu mismatches\n", results.numbers, results.mismatches);
+	printf("the previous parser read %zu of them differently\n", results.previousDifferences);
+	if (!allRead || results.mismatches != 0) {
+		printf("FAILED\n");
+		return 1;
+	}
+	printf("OK\n");
+	return 0;
+}
@@ -0,0 +1,157 @@
+#include "UniformRing.hpp"
+#include "GLStateCache.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+namespace gps {
+
+	namespace {
+
+		// Room for the frame and pass blocks and about a thousand objects
+		const size_t INITIAL_REGION_SIZE = 256 * 1024;
+		// std140 aligns blocks to a vec4 anyway
+		const size_t MIN_ALIGNMENT = 16;
+		const GLuint64 FENCE_TIMEOUT = 1000000000;
+
+		size_t alignUp(size_t value, size_t alignment)
+		{
+			return (value + alignment - 1) / alignment * alignment;
+		}
+	}
+
+	UniformRing::UniformRing() : buffer(0), mapped(NULL), regionSize(0), alignment(MIN_ALIGNMENT), region(0), used(0),
+		requested(0)
+	{
+		for (int i = 0; i < FRAME_COUNT; i++)
+			fences[i] = 0;
+		resetStats();
+	}
+
+	UniformRing& UniformRing::shared()
+	{
+		static UniformRing ring;
+		return ring;
+	}
+
+	void UniformRing::create(size_t size)
+	{
+		for (int i = 0; i < FRAME_COUNT; i++) {
+			if (fences[i] != 0) {
+				glDeleteSync(fences[i]);
+				fences[i] = 0;
+			}
+		}
+		if (buffer != 0) {
+			if (mapped) {
+				glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+				glUnmapBuffer(GL_UNIFORM_BUFFER);
+			}
+			// GL keeps the storage for the draws still reading it
+			glDeleteBuffers(1, &buffer);
+			GLStateCache::shared().bufferDeleted(buffer);
+		}
+
+		GLint offsetAlignment = 0;
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &offsetAlignment);
+		alignment = std::max((size_t)offsetAlignment, MIN_ALIGNMENT);
+		regionSize = alignUp(size, alignment);
+		region = 0;
+		mapped = NULL;
+
+		GLsizeiptr bufferSize = (GLsizeiptr)(regionSize * FRAME_COUNT);
+		glGenBuffers(1, &buffer);
+		glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+		if (GLEW_ARB_buffer_storage) {
+			GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			glBufferStorage(GL_UNIFORM_BUFFER, bufferSize, NULL, flags);
+			mapped = (unsigned char*)glMapBufferRange(GL_UNIFORM_BUFFER, 0, bufferSize, flags);
+		}
+		else {
+			glBufferData(GL_UNIFORM_BUFFER, bufferSize, NULL, GL_STREAM_DRAW);
+		}
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+
+	void UniformRing::waitForRegion()
+	{
+		if (fences[region] == 0)
+			return;
+		GLenum result = glClientWaitSync(fences[region], 0, 0);
+		while (result == GL_TIMEOUT_EXPIRED)
+			result = glClientWaitSync(fences[region], GL_SYNC_FLUSH_COMMANDS_BIT, FENCE_TIMEOUT);
+		glDeleteSync(fences[region]);
+		fences[region] = 0;
+	}
+
+	void UniformRing::beginFrame()
+	{
+		if (buffer == 0 || requested > regionSize) {
+			if (buffer != 0)
+				std::cout << "Uniform ring: a frame needed " << requested / 1024 << " KB, growing" << std::endl;
+			create(std::max(requested * 2, INITIAL_REGION_SIZE));
+		}
+		else if (mapped) {
+			fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			region = (region + 1) % FRAME_COUNT;
+			waitForRegion();
+		}
+		else {
+			region = (region + 1) % FRAME_COUNT;
+			if (region == 0) {
+				// fresh storage; the draws of the last frames keep reading the old one
+				glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+				glBufferData(GL_UNIFORM_BUFFER, (GLsizeiptr)(regionSize * FRAME_COUNT), NULL, GL_STREAM_DRAW);
+				glBindBuffer(GL_UNIFORM_BUFFER, 0);
+			}
+		}
+		used = 0;
+		requested = 0;
+	}
+
+	GLintptr UniformRing::write(const void* data, size_t size)
+	{
+		requested = alignUp(requested, alignment) + size;
+		size_t offset = alignUp(used, alignment);
+		if (offset + size > regionSize)
+			offset = 0;
+		// never past the region, whatever it costs the frame
+		size = std::min(size, regionSize);
+		used = offset + size;
+
+		size_t bufferOffset = region * regionSize + offset;
+		if (mapped) {
+			memcpy(mapped + bufferOffset, data, size);
+		}
+		else {
+			glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+			glBufferSubData(GL_UNIFORM_BUFFER, (GLintptr)bufferOffset, (GLsizeiptr)size, data);
+			glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		}
+		stats.writes++;
+		stats.bytes += size;
+		return (GLintptr)bufferOffset;
+	}
+
+	void UniformRing::bind(GLuint binding, GLintptr offset, size_t size)
+	{
+		GLStateCache::shared().bindUniformBuffer(binding, buffer, offset, (GLsizeiptr)size);
+	}
+
+	size_t UniformRing::getAlignment() const
+	{
+		return alignment;
+	}
+
+	UniformRingStats UniformRing::getStats() const
+	{
+		return stats;
+	}
+
+	void UniformRing::resetStats()
+	{
+		stats.writes = 0;
+		stats.bytes = 0;
+	}
+}
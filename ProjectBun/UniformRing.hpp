@@ -0,0 +1,123 @@
+#ifndef UniformRing_hpp
+#define UniformRing_hpp
+
+#include <GL/glew.h>
+#include "glm/glm.hpp"
+
+#include <cstddef>
+
+namespace gps {
+
+    // Binding points of the uniform blocks, given to every program when it is linked
+    const GLuint FRAME_UNIFORM_BINDING = 0;
+    const GLuint PASS_UNIFORM_BINDING = 1;
+    const GLuint OBJECT_UNIFORM_BINDING = 2;
+
+    // The uniform blocks of the shaders, laid out by std140: a vec3 takes 16
+    // bytes unless a float follows it, and mat3s go as mat4s so no column needs
+    // padding. Blocks are sized in whole vec4s.
+
+    // `FrameUniforms`, the same in every pass
+    struct FrameUniforms
+    {
+        glm::mat4 lightSpaceTrMatrix;
+        // towards the light, world space
+        glm::vec3 lightDir;
+        float padding0;
+        glm::vec3 lightColor;
+        float padding1;
+        // point light, world space
+        glm::vec3 lightPos1;
+        float fogDensity;
+        GLint pointinit;
+        GLint padding2[3];
+    };
+
+    // `PassUniforms`, the view a pass renders from
+    struct PassUniforms
+    {
+        glm::mat4 view;
+        glm::mat4 projection;
+        // mat3 in the upper left
+        glm::mat4 lightDirMatrix;
+    };
+
+    // `ObjectUniforms`, one per model drawn
+    struct ObjectUniforms
+    {
+        glm::mat4 model;
+        // mat3 in the upper left
+        glm::mat4 normalMatrix;
+    };
+
+    static_assert(sizeof(FrameUniforms) == 128, "FrameUniforms must match its std140 block");
+    static_assert(sizeof(PassUniforms) == 192, "PassUniforms must match its std140 block");
+    static_assert(sizeof(ObjectUniforms) == 128, "ObjectUniforms must match its std140 block");
+
+    struct UniformRingStats
+    {
+        size_t writes;
+        size_t bytes;
+    };
+
+    // Uniform block data streamed through one buffer, split in FRAME_COUNT
+    // regions used round robin: a frame writes only its own region and binds
+    // ranges of it, so the blocks of frames still on the GPU are never
+    // overwritten. With ARB_buffer_storage the buffer stays mapped and each
+    // region waits on the fence of the frame that last used it; otherwise it is
+    // orphaned whenever the ring wraps around. A frame that runs out of room
+    // writes over its own first blocks and the ring grows at the next frame.
+    // Created by the first beginFrame(), GL thread only.
+    class UniformRing
+    {
+    public:
+        static const int FRAME_COUNT = 3;
+
+        static UniformRing& shared();
+
+        // Moves on to the region of the next frame
+        void beginFrame();
+
+        // Copies `size` bytes into the frame's region and returns their offset in the buffer
+        GLintptr write(const void* data, size_t size);
+        // Binds the range at `offset` to the uniform block binding point `binding`
+        void bind(GLuint binding, GLintptr offset, size_t size);
+
+        // write() and bind() of one block
+        template <typename T>
+        void push(GLuint binding, const T& block)
+        {
+            bind(binding, write(&block, sizeof(T)), sizeof(T));
+        }
+
+        // Offsets returned by write() are multiples of it
+        size_t getAlignment() const;
+
+        UniformRingStats getStats() const;
+        void resetStats();
+
+    private:
+        GLuint buffer;
+        // non-NULL when persistently mapped
+        unsigned char* mapped;
+        GLsync fences[FRAME_COUNT];
+        size_t regionSize;
+        size_t alignment;
+        int region;
+        // bytes of the region written this frame
+        size_t used;
+        // bytes the frame asked for, including what did not fit
+        size_t requested;
+        UniformRingStats stats;
+
+        UniformRing();
+        UniformRing(const UniformRing&);
+        UniformRing& operator=(const UniformRing&);
+
+        // Replaces the buffer with one of FRAME_COUNT regions of `size` bytes
+        void create(size_t size);
+        void waitForRegion();
+    };
+}
+
+#endif /* UniformRing_hpp */
@@ -0,0 +1,128 @@
+#include "VertexFormat.hpp"
+
+#include "glm/gtc/packing.hpp"
+
+#include <cmath>
+
+namespace gps {
+
+	namespace {
+
+		int16_t toSnorm16(float value)
+		{
+			value = value < -1.0f ? -1.0f : (value > 1.0f ? 1.0f : value);
+			return (int16_t)std::floor(value * 32767.0f + 0.5f);
+		}
+
+		// Inverse of value * scale + offset; a flat range keeps only the offset
+		float toQuantized(float value, float offset, float scale)
+		{
+			return scale <= 0.0f ? 0.0f : (value - offset) / scale;
+		}
+
+		uint16_t toUnorm16(float value, float offset, float scale)
+		{
+			float t = toQuantized(value, offset, scale);
+			t = t < 0.0f ? 0.0f : (t > 1.0f ? 1.0f : t);
+			return (uint16_t)std::floor(t * 65535.0f + 0.5f);
+		}
+
+		float signNotZero(float value)
+		{
+			return value >= 0.0f ? 1.0f : -1.0f;
+		}
+	}
+
+	size_t vertexStride(VertexFormat format)
+	{
+		switch (format) {
+		case VERTEX_FORMAT_COMPACT:
+			return sizeof(CompactVertex);
+		case VERTEX_FORMAT_QUANTIZED:
+			return sizeof(QuantizedVertex);
+		default:
+			return sizeof(Vertex);
+		}
+	}
+
+	bool hasOctahedralNormals(VertexFormat format)
+	{
+		return format != VERTEX_FORMAT_FULL;
+	}
+
+	VertexQuantization computeQuantization(const Vertex* vertices, size_t count, VertexFormat format)
+	{
+		VertexQuantization quantization;
+		quantization.positionScale = glm::vec3(1.0f);
+		quantization.positionOffset = glm::vec3(0.0f);
+		quantization.texCoordScale = glm::vec2(1.0f);
+		quantization.texCoordOffset = glm::vec2(0.0f);
+		if (format != VERTEX_FORMAT_QUANTIZED || count == 0)
+			return quantization;
+
+		glm::vec3 minPosition = vertices[0].Position;
+		glm::vec3 maxPosition = vertices[0].Position;
+		glm::vec2 minTexCoords = vertices[0].TexCoords;
+		glm::vec2 maxTexCoords = vertices[0].TexCoords;
+		for (size_t i = 1; i < count; i++) {
+			for (int c = 0; c < 3; c++) {
+				minPosition[c] = std::min(minPosition[c], vertices[i].Position[c]);
+				maxPosition[c] = std::max(maxPosition[c], vertices[i].Position[c]);
+			}
+			for (int c = 0; c < 2; c++) {
+				minTexCoords[c] = std::min(minTexCoords[c], vertices[i].TexCoords[c]);
+				maxTexCoords[c] = std::max(maxTexCoords[c], vertices[i].TexCoords[c]);
+			}
+		}
+
+		quantization.positionScale = maxPosition - minPosition;
+		quantization.positionOffset = minPosition;
+		quantization.texCoordScale = maxTexCoords - minTexCoords;
+		quantization.texCoordOffset = minTexCoords;
+		return quantization;
+	}
+
+	void encodeOctahedral(const glm::vec3& normal, int16_t* encoded)
+	{
+		float length = std::fabs(normal.x) + std::fabs(normal.y) + std::fabs(normal.z);
+		if (length == 0.0f) {
+			encoded[0] = 0;
+			encoded[1] = 0;
+			return;
+		}
+
+		float x = normal.x / length;
+		float y = normal.y / length;
+		// the lower hemisphere folds over the diagonals
+		if (normal.z < 0.0f) {
+			float foldedX = (1.0f - std::fabs(y)) * signNotZero(x);
+			float foldedY = (1.0f - std::fabs(x)) * signNotZero(y);
+			x = foldedX;
+			y = foldedY;
+		}
+		encoded[0] = toSnorm16(x);
+		encoded[1] = toSnorm16(y);
+	}
+
+	void encodeVertex(const Vertex& vertex, const VertexQuantization& quantization, CompactVertex* encoded)
+	{
+		// exact for the identity quantization computeQuantization() gives this format
+		for (int c = 0; c < 3; c++)
+			encoded->Position[c] = toQuantized(vertex.Position[c], quantization.positionOffset[c], quantization.positionScale[c]);
+		encodeOctahedral(vertex.Normal, encoded->Normal);
+		for (int c = 0; c < 2; c++) {
+			float texCoord = toQuantized(vertex.TexCoords[c], quantization.texCoordOffset[c], quantization.texCoordScale[c]);
+			encoded->TexCoords[c] = (uint16_t)glm::packHalf1x16(texCoord);
+		}
+	}
+
+	void encodeVertex(const Vertex& vertex, const VertexQuantization& quantization, QuantizedVertex* encoded)
+	{
+		for (int c = 0; c < 3; c++)
+			encoded->Position[c] = toUnorm16(vertex.Position[c], quantization.positionOffset[c], quantization.positionScale[c]);
+		encoded->Position[3] = 0;
+		encodeOctahedral(vertex.Normal, encoded->Normal);
+		for (int c = 0; c < 2; c++)
+			encoded->TexCoords[c] = toUnorm16(vertex.TexCoords[c], quantization.texCoordOffset[c], quantization.texCoordScale[c]);
+	}
+}
@@ -0,0 +1,125 @@
+#ifndef VertexFormat_hpp
+#define VertexFormat_hpp
+
+#include <GL/glew.h>
+#include "glm/glm.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace gps {
+
+struct Vertex
+{
+    glm::vec3 Position;
+    glm::vec3 Normal;
+    glm::vec2 TexCoords;
+};
+
+    // Layout of the vertex data on the GPU. Meshes keep full gps::Vertex data
+    // on the CPU and are packed on upload.
+    enum VertexFormat
+    {
+        // gps::Vertex as is, 32 bytes
+        VERTEX_FORMAT_FULL = 0,
+        // float position, octahedral 2x16-bit normal, half-float texcoords, 20 bytes
+        VERTEX_FORMAT_COMPACT = 1,
+        // 16-bit position and texcoords relative to the mesh bounds, octahedral normal, 16 bytes
+        VERTEX_FORMAT_QUANTIZED = 2
+    };
+
+    struct CompactVertex
+    {
+        glm::vec3 Position;
+        int16_t Normal[2];
+        uint16_t TexCoords[2];
+    };
+
+    struct QuantizedVertex
+    {
+        // the fourth component only pads to 8 bytes
+        uint16_t Position[4];
+        int16_t Normal[2];
+        uint16_t TexCoords[2];
+    };
+
+    // Maps stored positions/texcoords back to model space: value * scale + offset
+    struct VertexQuantization
+    {
+        glm::vec3 positionScale;
+        glm::vec3 positionOffset;
+        glm::vec2 texCoordScale;
+        glm::vec2 texCoordOffset;
+    };
+
+    struct VertexAttribute
+    {
+        GLuint location;
+        GLint size;
+        GLenum type;
+        GLboolean normalized;
+        size_t offset;
+    };
+
+    // Attribute pointers of a vertex type: position at 0, normal at 1, texcoords at 2
+    template <typename V> struct VertexLayout;
+
+    template <> struct VertexLayout<Vertex>
+    {
+        static const size_t attributeCount = 3;
+        static const VertexAttribute* getAttributes()
+        {
+            static const VertexAttribute attributes[attributeCount] = {
+                { 0, 3, GL_FLOAT, GL_FALSE, offsetof(Vertex, Position) },
+                { 1, 3, GL_FLOAT, GL_FALSE, offsetof(Vertex, Normal) },
+                { 2, 2, GL_FLOAT, GL_FALSE, offsetof(Vertex, TexCoords) }
+            };
+            return attributes;
+        }
+    };
+
+    template <> struct VertexLayout<CompactVertex>
+    {
+        static const size_t attributeCount = 3;
+        static const VertexAttribute* getAttributes()
+        {
+            static const VertexAttribute attributes[attributeCount] = {
+                { 0, 3, GL_FLOAT, GL_FALSE, offsetof(CompactVertex, Position) },
+                { 1, 2, GL_SHORT, GL_TRUE, offsetof(CompactVertex, Normal) },
+                { 2, 2, GL_HALF_FLOAT, GL_FALSE, offsetof(CompactVertex, TexCoords) }
+            };
+            return attributes;
+        }
+    };
+
+    template <> struct VertexLayout<QuantizedVertex>
+    {
+        static const size_t attributeCount = 3;
+        static const VertexAttribute* getAttributes()
+        {
+            static const VertexAttribute attributes[attributeCount] = {
+                { 0, 3, GL_UNSIGNED_SHORT, GL_TRUE, offsetof(QuantizedVertex, Position) },
+                { 1, 2, GL_SHORT, GL_TRUE, offsetof(QuantizedVertex, Normal) },
+                { 2, 2, GL_UNSIGNED_SHORT, GL_TRUE, offsetof(QuantizedVertex, TexCoords) }
+            };
+            return attributes;
+        }
+    };
+
+    // Size of one vertex on the GPU
+    size_t vertexStride(VertexFormat format);
+
+    // True when the normals reach the shader octahedral-encoded
+    bool hasOctahedralNormals(VertexFormat format);
+
+    // Scale/offset for a mesh; identity unless the format quantizes against the bounds
+    VertexQuantization computeQuantization(const Vertex* vertices, size_t count, VertexFormat format);
+
+    // Unit vector to two snorm16 components on the octahedron (zero maps to +Z)
+    void encodeOctahedral(const glm::vec3& normal, int16_t* encoded);
+
+    void encodeVertex(const Vertex& vertex, const VertexQuantization& quantization, CompactVertex* encoded);
+    void encodeVertex(const Vertex& vertex, const VertexQuantization& quantization, QuantizedVertex* encoded);
+}
+
+#endif /* VertexFormat_hpp */
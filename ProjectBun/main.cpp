@@ -11,9 +11,21 @@
 #include "Shader.hpp"
 #include "Camera.hpp"
 #include "Model3D.hpp"
+#include "StaticBatch.hpp"
+#include "GpuBufferArena.hpp"
+#include "ModelInstances.hpp"
+#include "IndirectDrawList.hpp"
+#include "GLStateCache.hpp"
+#include "SceneBvh.hpp"
+#include "OcclusionCuller.hpp"
+#include "RenderQueue.hpp"
 #include "SkyBox.hpp"
+#include "TextureCache.hpp"
+#include "TextureLoader.hpp"
+#include "UniformRing.hpp"
 
 #include <iostream>
+#include <random>
 
 // window
 gps::Window myWindow;
@@ -29,13 +41,13 @@ glm::vec3 lightDir;
 glm::vec3 lightColor;
 GLfloat lightAngle;
 
-// shader uniform locations
-GLuint modelLoc;
-GLuint viewLoc;
-GLuint projectionLoc;
-GLuint normalMatrixLoc;
-GLuint lightDirLoc;
-GLuint lightColorLoc;
+// shader uniforms, the same ids in every program; the matrices and lights
+// are in the uniform blocks of gps::UniformRing
+const gps::UniformId shadowMapUniform = gps::Shader::getUniformId("shadowMap");
+// uniform updates, uniform block writes and GL state changes of the last frame; C prints them
+gps::UniformStats frameUniformStats;
+gps::UniformRingStats frameRingStats;
+gps::GLStateStats frameStateStats;
 
 // camera
 gps::Camera myCamera(
@@ -58,9 +70,46 @@ gps::Model3D tank;
 gps::Model3D tree;
 gps::Model3D leaves;
 gps::Model3D bird;
+// the castle merged by texture; B switches between it and the culled, LOD-selected meshes
+gps::StaticBatch castleBatch;
+bool staticBatching = false;
+// copies of the tree scattered around the castle, drawn instanced; F toggles them
+const size_t FOREST_SIZE = 1000;
+gps::ModelInstances forest;
+bool showForest = true;
+// the other models of a pass as one indirect submission per material; I toggles it
+gps::IndirectDrawList shadowDraws;
+gps::IndirectDrawList sceneDraws;
+gps::IndirectDrawList* passDraws = &sceneDraws;
+bool indirectDraws = false;
+// the draws of both passes, sorted by state and depth before any of them runs
+gps::RenderQueue renderQueue;
+gps::RenderQueueStats renderQueueStats;
 float angle;
 glm::mat4 birdMatrix;
 GLfloat birdRotation = 0.0f;
+// placement of the other models, computed once per frame
+glm::mat4 tankMatrix;
+glm::mat4 treeMatrix;
+glm::mat4 leavesMatrix;
+glm::mat4 castleMatrix;
+
+// frustum culling: one BVH object per mesh of the models, then one per forest
+// tree; C prints what the last frame drew and culled
+gps::SceneBvh sceneBvh;
+std::vector<char> visibleObjects;
+size_t castleObjects, tankObjects, treeObjects, leavesObjects, birdObjects, forestObjects;
+gps::BvhCullStats shadowCullStats;
+gps::BvhCullStats cameraCullStats;
+
+// occlusion culling of the camera pass: the large castle meshes, rasterized on
+// the CPU, hide what is behind them; O toggles it
+const float OCCLUDER_MIN_SIZE = 10.0f;
+const float OCCLUDER_PROXY_ERROR = 0.15f;
+gps::OcclusionCuller occlusionCuller;
+size_t castleOccluders;
+bool occlusionCulling = true;
+gps::OcclusionStats occlusionStats;
 
 
 //skybox 
@@ -86,6 +135,12 @@ bool mouse = true;
 //shadow
 const unsigned int SHADOW_WIDTH = 4096;
 const unsigned int SHADOW_HEIGHT = 2048;
+const GLfloat LIGHT_NEAR_PLANE = 35.0f, LIGHT_FAR_PLANE = 200.0f;
+
+//level of detail - largest error in pixels, shadow casters get away with coarser meshes
+const float CAMERA_LOD_ERROR = 1.0f;
+const float SHADOW_LOD_ERROR = 4.0f;
+float lodError = CAMERA_LOD_ERROR;
 
 //fog
 int foginit = 0;
@@ -95,11 +150,9 @@ GLfloat fogDensity = 0.000f;
 //pont light
 int pointinit = 0;
 glm::vec3 lightPos1; 
-GLuint lightPos1Loc;
 
 GLuint shadowMapFBO;
 GLuint depthMapTexture;
-GLuint lightDirMatrixLoc;
 glm::mat3 lightDirMatrix;
 float var;
 
@@ -146,20 +199,11 @@ void windowResizeCallback(GLFWwindow* window, int width, int height) {
     retina_height = myWindow.getWindowDimensions().height;
     glfwGetFramebufferSize(myWindow.getWindow(), &retina_width, &retina_height);
 
-    myCustomShader.useShaderProgram();
-
-    // set projection matrix
-    glm::mat4 projection = glm::perspective(glm::radians(45.0f), (float)retina_width / (float)retina_height, 0.1f, 1000.0f);
-    //send matrix data to shader
-    GLint projLoc = glGetUniformLocation(myCustomShader.shaderProgram, "projection");
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
-
-    lightShader.useShaderProgram();
-
-    glUniformMatrix4fv(glGetUniformLocation(lightShader.shaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+    // set projection matrix, the next frame sends it
+    projection = glm::perspective(glm::radians(45.0f), (float)retina_width / (float)retina_height, 0.1f, 1000.0f);
 
     // set Viewport transform
-    glViewport(0, 0, retina_width, retina_height);
+    gps::GLStateCache::shared().viewport(0, 0, retina_width, retina_height);
 }
 
 void keyboardCallback(GLFWwindow* window, int key, int scancode, int action, int mode) {
@@ -167,6 +211,44 @@ void keyboardCallback(GLFWwindow* window, int key, int scancode, int action, int
         glfwSetWindowShouldClose(window, GL_TRUE);
     }
 
+    if (key == GLFW_KEY_B && action == GLFW_PRESS) {
+        staticBatching = !staticBatching;
+        std::cout << "Castle draw calls per pass: " << (staticBatching ? castleBatch.getDrawCount() : castleBatch.getSourceMeshCount()) << std::endl;
+    }
+
+    if (key == GLFW_KEY_F && action == GLFW_PRESS) {
+        showForest = !showForest;
+    }
+
+    if (key == GLFW_KEY_C && action == GLFW_PRESS) {
+        std::cout << "Shadow pass: " << shadowCullStats.visibleObjects << " objects drawn, "
+            << shadowCullStats.objects - shadowCullStats.visibleObjects << " culled (" << shadowCullStats.testedNodes
+            << " BVH nodes tested)" << std::endl;
+        std::cout << "Camera pass: " << cameraCullStats.visibleObjects << " objects drawn, "
+            << cameraCullStats.objects - cameraCullStats.visibleObjects << " culled (" << cameraCullStats.testedNodes
+            << " BVH nodes tested)" << std::endl;
+        std::cout << "Occlusion: " << occlusionStats.occludedObjects << " of " << occlusionStats.testedObjects
+            << " objects hidden by " << occlusionStats.occluders << " occluders (" << occlusionStats.occluderTriangles
+            << " triangles, " << occlusionStats.reprojectedSamples << " samples reprojected)" << std::endl;
+        std::cout << "Uniforms: " << frameUniformStats.calls << " set, " << frameUniformStats.skipped
+            << " skipped as unchanged; " << frameRingStats.writes << " block writes, " << frameRingStats.bytes
+            << " bytes" << std::endl;
+        std::cout << "GL state: " << frameStateStats.issued << " changes issued, " << frameStateStats.elided
+            << " elided" << std::endl;
+        std::cout << "Render queue: " << renderQueueStats.items << " items, " << renderQueueStats.stateChanges
+            << " state changes between them" << std::endl;
+    }
+
+    if (key == GLFW_KEY_O && action == GLFW_PRESS) {
+        occlusionCulling = !occlusionCulling;
+    }
+
+    if (key == GLFW_KEY_I && action == GLFW_PRESS) {
+        indirectDraws = !indirectDraws;
+        std::cout << "Indirect draws: " << (indirectDraws ? "on" : "off")
+            << (gps::IndirectDrawList::isMultiDrawIndirectSupported() ? "" : " (draw loop, no ARB_multi_draw_indirect)") << std::endl;
+    }
+
     if (key >= 0 && key < 1024) {
         if (action == GLFW_PRESS) {
             pressedKeys[key] = true;
@@ -257,9 +339,6 @@ void processMovement() {
         lightAngle += 0.5f;
         if (lightAngle > 360.0f)
             lightAngle -= 360.0f;
-        glm::vec3 lightDirTr = glm::vec3(glm::rotate(glm::mat4(1.0f), glm::radians(lightAngle), glm::vec3(0.0f, 1.0f, 0.0f)) * glm::vec4(lightDir, 1.0f));
-        myCustomShader.useShaderProgram();
-        glUniform3fv(lightDirLoc, 1, glm::value_ptr(lightDirTr));
     }
 
     // move light
@@ -267,9 +346,6 @@ void processMovement() {
         lightAngle -= 0.5f;
         if (lightAngle < 0.0f)
             lightAngle += 360.0f;
-        glm::vec3 lightDirTr = glm::vec3(glm::rotate(glm::mat4(1.0f), glm::radians(lightAngle), glm::vec3(0.0f, 1.0f, 0.0f)) * glm::vec4(lightDir, 1.0f));
-        myCustomShader.useShaderProgram();
-        glUniform3fv(lightDirLoc, 1, glm::value_ptr(lightDirTr));
     }
 
     // INCREASE fog
@@ -310,31 +386,27 @@ void processMovement() {
 
     // start pointlight
     if (pressedKeys[GLFW_KEY_3]) {
-        myCustomShader.useShaderProgram();
         pointinit = 1;
-        glUniform1i(glGetUniformLocation(myCustomShader.shaderProgram, "pointinit"), pointinit);
     }
 
     // stop pointlight
     if (pressedKeys[GLFW_KEY_4]) {
-        myCustomShader.useShaderProgram();
         pointinit = 0;
-        glUniform1i(glGetUniformLocation(myCustomShader.shaderProgram, "pointinit"), pointinit);
     }
 
     // line view
     if (pressedKeys[GLFW_KEY_7]) {
-        glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+        gps::GLStateCache::shared().polygonMode(GL_LINE);
     }
 
     // point view
     if (pressedKeys[GLFW_KEY_8]) {
-        glPolygonMode(GL_FRONT_AND_BACK, GL_POINT);
+        gps::GLStateCache::shared().polygonMode(GL_POINT);
     }
 
     // normal view
     if (pressedKeys[GLFW_KEY_9]) {
-        glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+        gps::GLStateCache::shared().polygonMode(GL_FILL);
     }
 }
 
@@ -350,9 +422,9 @@ void setWindowCallbacks() {
 
 void initOpenGLState() {
     glClearColor(0.7f, 0.7f, 0.7f, 1.0f);
-    glViewport(0, 0, myWindow.getWindowDimensions().width, myWindow.getWindowDimensions().height);
+    gps::GLStateCache::shared().viewport(0, 0, myWindow.getWindowDimensions().width, myWindow.getWindowDimensions().height);
     glEnable(GL_DEPTH_TEST); // enable depth-testing
-    glDepthFunc(GL_LESS); // depth-testing interprets a smaller value as "closer"
+    gps::GLStateCache::shared().depthFunc(GL_LESS); // depth-testing interprets a smaller value as "closer"
     //glEnable(GL_CULL_FACE); // cull face
     glCullFace(GL_BACK); // cull back face
     glFrontFace(GL_CCW); // GL_CCW for counter clock-wise
@@ -365,7 +437,7 @@ void initFBO()
 
     //create depth texture for FBO
     glGenTextures(1, &depthMapTexture);
-    glBindTexture(GL_TEXTURE_2D, depthMapTexture);
+    gps::GLStateCache::shared().bindTexture(GL_TEXTURE_2D, depthMapTexture);
     glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT,
         SHADOW_WIDTH, SHADOW_HEIGHT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
@@ -374,31 +446,146 @@ void initFBO()
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
     //attach texture to FBO
-    glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO);
+    gps::GLStateCache::shared().bindFramebuffer(shadowMapFBO);
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthMapTexture, 0);
     glDrawBuffer(GL_NONE);
     glReadBuffer(GL_NONE);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    gps::GLStateCache::shared().bindFramebuffer(0);
 }
 
-glm::mat4 computeLightSpaceTrMatrix()
+// Where the shadow map is rendered from, looking at the camera target
+glm::vec3 computeLightPosition()
 {
-    const GLfloat near_plane = 35.0f, far_plane = 200.0f;
-    glm::mat4 lightProjection = glm::ortho(-100.0f, 100.0f, -100.0f, 100.0f, near_plane, far_plane);
+    return glm::vec3(glm::rotate(glm::mat4(1.0f), glm::radians(lightAngle), glm::vec3(0.0f, 1.0f, 0.0f)) * glm::vec4(lightDir, 1.0f));
+}
+
+glm::mat4 computeLightViewMatrix()
+{
+    return glm::lookAt(computeLightPosition(), myCamera.getCameraTarget(), glm::vec3(0.0f, 1.0f, 0.0f));
+}
+
+glm::mat4 computeLightProjectionMatrix()
+{
+    return glm::ortho(-100.0f, 100.0f, -100.0f, 100.0f, LIGHT_NEAR_PLANE, LIGHT_FAR_PLANE);
+}
+
+// Registers the meshes of `object` with the BVH, returns the first of their ids
+size_t addSceneObjects(const gps::Model3D& object) {
+    size_t firstObject = sceneBvh.getObjectCount();
+    const std::vector<gps::Mesh>& meshes = object.GetMeshes();
+    for (size_t i = 0; i < meshes.size(); i++) {
+        sceneBvh.add(meshes[i].getBoundingBox());
+    }
+    return firstObject;
+}
+
+void setSceneBounds(size_t firstObject, const gps::Model3D& object, const glm::mat4& modelMatrix) {
+    const std::vector<gps::Mesh>& meshes = object.GetMeshes();
+    for (size_t i = 0; i < meshes.size(); i++) {
+        sceneBvh.setBounds(firstObject + i, gps::transformBox(meshes[i].getBoundingBox(), modelMatrix));
+    }
+}
+
+// Box around all the meshes of `object`, false when it has none
+bool getModelBounds(const gps::Model3D& object, gps::BoundingBox* bounds) {
+    const std::vector<gps::Mesh>& meshes = object.GetMeshes();
+    for (size_t i = 0; i < meshes.size(); i++) {
+        *bounds = i == 0 ? meshes[i].getBoundingBox() : gps::mergeBoxes(*bounds, meshes[i].getBoundingBox());
+    }
+    return !meshes.empty();
+}
+
+void updateSceneMatrices() {
+    birdMatrix = glm::mat4(0.5f);
+    birdMatrix = glm::rotate(birdMatrix, glm::radians(angle), glm::vec3(0, 1, 0));
+    birdMatrix = glm::rotate(birdMatrix, glm::radians(birdRotation), glm::vec3(0, 1, 0));
+
+    tankMatrix = glm::rotate(glm::mat4(1.0f), glm::radians(angle), glm::vec3(0, 1, 0));
+    tankMatrix = glm::translate(tankMatrix, glm::vec3(move2, move1, -move3));
+
+    treeMatrix = glm::rotate(glm::mat4(1.0f), glm::radians(angle), glm::vec3(0, 1, 0));
+
+    leavesMatrix = glm::rotate(glm::mat4(1.0f), glm::radians(angle), glm::vec3(0, 1, 0));
+    leavesMatrix = glm::translate(leavesMatrix, glm::vec3(var, 0.0f, 0.0f));
+
+    // the castle has always been turned on top of the leaves' matrix
+    castleMatrix = glm::rotate(leavesMatrix, glm::radians(angle), glm::vec3(0, 1, 0));
+}
 
-    glm::vec3 lightDirTr = glm::vec3(glm::rotate(glm::mat4(1.0f), glm::radians(lightAngle), glm::vec3(0.0f, 1.0f, 0.0f)) * glm::vec4(lightDir, 1.0f));
-    glm::mat4 lightView = glm::lookAt(lightDirTr, myCamera.getCameraTarget(), glm::vec3(0.0f, 1.0f, 0.0f));
+// Moves the BVH objects to where the models are drawn this frame
+void updateSceneBounds() {
+    setSceneBounds(castleObjects, fullScene, castleMatrix);
+    occlusionCuller.setTransform(castleOccluders, castleMatrix);
+    setSceneBounds(tankObjects, tank, tankMatrix);
+    setSceneBounds(treeObjects, tree, treeMatrix);
+    setSceneBounds(leavesObjects, leaves, leavesMatrix);
+    setSceneBounds(birdObjects, bird, birdMatrix);
+
+    // a forest tree covers its trunk and its leaves
+    gps::BoundingBox treeBounds;
+    gps::BoundingBox leavesBounds;
+    bool hasTree = getModelBounds(tree, &treeBounds);
+    bool hasLeaves = getModelBounds(leaves, &leavesBounds);
+    const std::vector<gps::ModelInstance>& trees = forest.getInstances();
+    for (size_t i = 0; i < trees.size(); i++) {
+        gps::BoundingBox bounds = gps::transformBox(hasTree ? treeBounds : leavesBounds, treeMatrix * trees[i].transform);
+        if (hasTree && hasLeaves) {
+            bounds = gps::mergeBoxes(bounds, gps::transformBox(leavesBounds, leavesMatrix * trees[i].transform));
+        }
+        sceneBvh.setBounds(forestObjects + i, bounds);
+    }
 
-    return lightProjection * lightView;
+    sceneBvh.refit();
 }
 
 void initModels() {
+    // the castle and the trees keep float positions, so their meshes line up exactly
+    fullScene.SetVertexFormat(gps::VERTEX_FORMAT_COMPACT);
+    tree.SetVertexFormat(gps::VERTEX_FORMAT_COMPACT);
+    leaves.SetVertexFormat(gps::VERTEX_FORMAT_COMPACT);
+    sun.SetVertexFormat(gps::VERTEX_FORMAT_QUANTIZED);
+    tank.SetVertexFormat(gps::VERTEX_FORMAT_QUANTIZED);
+    bird.SetVertexFormat(gps::VERTEX_FORMAT_QUANTIZED);
+
     sun.LoadModel("models/sun/13913_Sun_v2_l3.obj", "models/sun/");
     fullScene.LoadModel("models/Castle/Castle OBJ.obj", "models/Castle/");
     tank.LoadModel("models/tank/uaz.obj", "models/tank/");
     bird.LoadModel("models/bird/13625_Pterodactylus_v1_L1.obj", "models/bird/");
     tree.LoadModel("models/tree/treeG.obj", "models/tree/");
     leaves.LoadModel("models/leaves/treeG.obj", "models/leaves/");
+
+    castleBatch.add(fullScene);
+    castleBatch.build(gps::VERTEX_FORMAT_COMPACT);
+
+    // a ring of trees around the castle, the same every run
+    std::mt19937 random(7);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    for (size_t i = 0; i < FOREST_SIZE; i++) {
+        float direction = glm::radians(360.0f * unit(random));
+        float distance = glm::mix(150.0f, 450.0f, std::sqrt(unit(random)));
+        glm::mat4 transform = glm::translate(glm::mat4(1.0f), glm::vec3(std::cos(direction), 0.0f, std::sin(direction)) * distance);
+        transform = glm::rotate(transform, glm::radians(360.0f * unit(random)), glm::vec3(0, 1, 0));
+        transform = glm::scale(transform, glm::vec3(glm::mix(0.7f, 1.3f, unit(random))));
+        float shade = glm::mix(0.75f, 1.1f, unit(random));
+        forest.add(transform, glm::vec4(shade, glm::mix(0.9f, 1.1f, unit(random)) * shade, shade, 1.0f));
+    }
+
+    castleObjects = addSceneObjects(fullScene);
+    castleOccluders = occlusionCuller.addOccluders(fullScene, OCCLUDER_MIN_SIZE, OCCLUDER_PROXY_ERROR);
+    occlusionCuller.setReprojection(true);
+    tankObjects = addSceneObjects(tank);
+    treeObjects = addSceneObjects(tree);
+    leavesObjects = addSceneObjects(leaves);
+    birdObjects = addSceneObjects(bird);
+    forestObjects = sceneBvh.getObjectCount();
+    for (size_t i = 0; i < forest.size(); i++) {
+        sceneBvh.add(gps::BoundingBox());
+    }
+    updateSceneMatrices();
+    updateSceneBounds();
+    sceneBvh.build();
+
+    gps::GpuBufferArena::shared().printStats();
 }
 
 void initShaders() {
@@ -407,130 +594,119 @@ void initShaders() {
     depthMapShader.loadShader("shaders/simpleDepthMap.vert", "shaders/simpleDepthMap.frag");
 }
 
+// The uniform blocks are sent every frame from these
 void initUniforms() {
 
-
-    myCustomShader.useShaderProgram();
-
-    modelLoc = glGetUniformLocation(myCustomShader.shaderProgram, "model");
-
-    viewLoc = glGetUniformLocation(myCustomShader.shaderProgram, "view");
-
-    normalMatrixLoc = glGetUniformLocation(myCustomShader.shaderProgram, "normalMatrix");
-
-    lightDirMatrixLoc = glGetUniformLocation(myCustomShader.shaderProgram, "lightDirMatrix");
-
     projection = glm::perspective(glm::radians(45.0f), (float)myWindow.getWindowDimensions().width / (float)myWindow.getWindowDimensions().height, 0.1f, 1000.0f);
-    projectionLoc = glGetUniformLocation(myCustomShader.shaderProgram, "projection");
-    glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(projection));
 
     // set the light direction (direction towards the light)
     lightDir = glm::vec3(0.0f, 2.5f, 0.5f) * 20.0f;
-    lightDirLoc = glGetUniformLocation(myCustomShader.shaderProgram, "lightDir");
-    glUniform3fv(lightDirLoc, 1, glm::value_ptr(lightDir));
 
     // set light color
     lightColor = glm::vec3(1.0f, 1.0f, 1.0f); //white light
-    lightColorLoc = glGetUniformLocation(myCustomShader.shaderProgram, "lightColor");
-    glUniform3fv(lightColorLoc, 1, glm::value_ptr(lightColor));
-
-    // pointlight
-    lightPos1Loc = glGetUniformLocation(myCustomShader.shaderProgram, "lightPos1");
-    glUniform3fv(lightPos1Loc, 1, glm::value_ptr(lightPos1));
-
-    lightShader.useShaderProgram();
-    glUniformMatrix4fv(glGetUniformLocation(lightShader.shaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
 }
 
-void renderTeapot(gps::Shader shader) {
-    // select active shader program
-    shader.useShaderProgram();
-
-    //send teapot model matrix data to shader
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
+// Levels of detail of a model drawn with `modelMatrix`, picked from the camera in every pass
+gps::LodView computeLodView(const glm::mat4& modelMatrix) {
+    return gps::makeLodView(projection, (float)myWindow.getWindowDimensions().height, myCamera.getCameraPosition(), modelMatrix, lodError);
+}
 
-    //send teapot normal matrix data to shader
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
+// Queues the meshes of a model that passed culling, for the render queue or
+// the indirect submission of the pass
+void drawModel(gps::Model3D& object, gps::Shader& shader, const glm::mat4& modelMatrix, size_t firstObject) {
+    const char* visibleMeshes = visibleObjects.data() + firstObject;
+    if (indirectDraws) {
+        passDraws->add(object, modelMatrix, computeLodView(modelMatrix), visibleMeshes);
+    }
+    else {
+        renderQueue.add(shader, object, modelMatrix, computeLodView(modelMatrix), visibleMeshes);
+    }
+}
 
+void renderTeapot(gps::Shader& shader) {
     // draw teapot
-    teapot.Draw(shader);
+    renderQueue.add(shader, teapot, model, computeLodView(model));
 }
 
 void initSkyBoxShader()
 {
     mySkyBox.Load(faces);
     skyboxShader.loadShader("shaders/skyboxShader.vert", "shaders/skyboxShader.frag");
-    skyboxShader.useShaderProgram();
-    view = myCamera.getViewMatrix();
-    glUniformMatrix4fv(glGetUniformLocation(skyboxShader.shaderProgram, "view"), 1, GL_FALSE,
-        glm::value_ptr(view));
-
-    projection = glm::perspective(glm::radians(45.0f), (float)myWindow.getWindowDimensions().width / (float)myWindow.getWindowDimensions().height, 0.1f, 1000.0f);
-    glUniformMatrix4fv(glGetUniformLocation(skyboxShader.shaderProgram, "projection"), 1, GL_FALSE,
-        glm::value_ptr(projection));
 }
 
-void renderBird(gps::Shader shader) {
-
-    shader.useShaderProgram();
-    birdMatrix = glm::mat4(0.5f);
-    birdMatrix = glm::rotate(birdMatrix, glm::radians(angle), glm::vec3(0, 1, 0));
-    birdMatrix = glm::rotate(birdMatrix, glm::radians(birdRotation), glm::vec3(0, 1, 0));
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(birdMatrix));
-   
-    bird.Draw(myCustomShader);
+void renderBird(gps::Shader& shader) {
 
-    
-    if (birdRotation < 360.0f) {
-        birdRotation += 0.3f;
-    }
-    else {
-        birdRotation = 0;
-    }
-    
+    drawModel(bird, shader, birdMatrix, birdObjects);
 }
 
-void renderTank(gps::Shader shader) {
+void renderTank(gps::Shader& shader) {
 
-    shader.useShaderProgram();
-    model = glm::rotate(glm::mat4(1.0f), glm::radians(angle), glm::vec3(0, 1, 0));
-    model = glm::translate(model, glm::vec3(move2, move1, -move3));
-    glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
-  
-    tank.Draw(shader);
+    drawModel(tank, shader, tankMatrix, tankObjects);
 }
 
-void renderTree(gps::Shader shader) {
+void renderTree(gps::Shader& shader) {
+
+    drawModel(tree, shader, treeMatrix, treeObjects);
 
-    shader.useShaderProgram();
-    model = glm::rotate(glm::mat4(1.0f), glm::radians(angle), glm::vec3(0, 1, 0));
-    glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
-   
-    tree.Draw(shader);
+    if (showForest) {
+        renderQueue.addInstances(shader, forest, tree, treeMatrix, computeLodView(treeMatrix),
+            visibleObjects.data() + forestObjects);
+    }
 }
 
-void renderLeaves(gps::Shader shader) {
+void renderLeaves(gps::Shader& shader) {
 
-    shader.useShaderProgram();
-    model = glm::rotate(glm::mat4(1.0f), glm::radians(angle), glm::vec3(0, 1, 0));
-    model = glm::translate(model, glm::vec3(var, 0.0f, 0.0f));
-    glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
- 
+    drawModel(leaves, shader, leavesMatrix, leavesObjects);
 
-    leaves.Draw(shader);
+    if (showForest) {
+        renderQueue.addInstances(shader, forest, leaves, leavesMatrix, computeLodView(leavesMatrix),
+            visibleObjects.data() + forestObjects);
+    }
 }
 
-void renderBackgroundScene(gps::Shader shader) {
+void renderBackgroundScene(gps::Shader& shader, bool cameraPass) {
 
-    shader.useShaderProgram();
-    model = glm::rotate(model, glm::radians(angle), glm::vec3(0, 1, 0));
-    glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
-  
-    fullScene.Draw(shader);
+    if (staticBatching) {
+        renderQueue.addBatch(shader, castleBatch, castleMatrix);
+    }
+    else if (cameraPass) {
+        // skip the parts of the castle outside the view; faces are drawn double-sided,
+        // so meshlets facing away from the camera stay
+        gps::CullingView cullingView = gps::makeCullingView(projection * view, myCamera.getCameraPosition(), castleMatrix);
+        const char* visibleMeshes = visibleObjects.data() + castleObjects;
+        if (indirectDraws) {
+            passDraws->add(fullScene, castleMatrix, cullingView, computeLodView(castleMatrix), visibleMeshes);
+        }
+        else {
+            renderQueue.add(shader, fullScene, castleMatrix, computeLodView(castleMatrix), visibleMeshes, &cullingView);
+        }
+    }
+    else {
+        drawModel(fullScene, shader, castleMatrix, castleObjects);
+    }
 }
 
+// Binds the shadow map as the target of the depth pass, which sees the scene from the light
+void beginShadowPass(const gps::PassUniforms& lightPass) {
+    gps::UniformRing::shared().push(gps::PASS_UNIFORM_BINDING, lightPass);
 
+    gps::GLStateCache& state = gps::GLStateCache::shared();
+    state.viewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
+    state.bindFramebuffer(shadowMapFBO);
+    glClear(GL_DEPTH_BUFFER_BIT);
+}
 
+// Back to the window, with the view of the camera
+void beginCameraPass(const gps::PassUniforms& cameraPass) {
+    gps::UniformRing::shared().push(gps::PASS_UNIFORM_BINDING, cameraPass);
+
+    gps::GLStateCache& state = gps::GLStateCache::shared();
+    state.bindFramebuffer(0);
+    state.viewport(0, 0, myWindow.getWindowDimensions().width, myWindow.getWindowDimensions().height);
+
+    // bind the depth map
+    state.bindTexture((GLuint)myCustomShader.getSamplerUnit(shadowMapUniform), GL_TEXTURE_2D, depthMapTexture);
+}
 
 void renderScene() {
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -538,111 +714,131 @@ void renderScene() {
     // wind effect
     var = sin(glfwGetTime()) * 0.1f;
 
-    // 1st step: render the scene to the depth buffer 
+    // the bird turns once per frame, at the speed it had when both passes turned it
+    if (birdRotation < 360.0f) {
+        birdRotation += 0.6f;
+    }
+    else {
+        birdRotation = 0;
+    }
 
-    depthMapShader.useShaderProgram();
+    updateSceneMatrices();
+    updateSceneBounds();
+
+    // both passes are only queued here, the queue runs them sorted at the end
+    renderQueue.clear();
+
+    gps::PassUniforms lightPass;
+    lightPass.view = computeLightViewMatrix();
+    lightPass.projection = computeLightProjectionMatrix();
+    lightPass.lightDirMatrix = glm::mat4(1.0f);
+    glm::mat4 lightSpaceTrMatrix = lightPass.projection * lightPass.view;
+
+    // the blocks every pass reads, sent once per frame
+    gps::UniformRing& uniformRing = gps::UniformRing::shared();
+    uniformRing.beginFrame();
+    gps::FrameUniforms frameUniforms = gps::FrameUniforms();
+    frameUniforms.lightSpaceTrMatrix = lightSpaceTrMatrix;
+    frameUniforms.lightDir = computeLightPosition();
+    frameUniforms.lightColor = lightColor;
+    frameUniforms.lightPos1 = lightPos1;
+    frameUniforms.fogDensity = fogDensity;
+    frameUniforms.pointinit = pointinit;
+    uniformRing.push(gps::FRAME_UNIFORM_BINDING, frameUniforms);
 
-    glUniformMatrix4fv(glGetUniformLocation(depthMapShader.shaderProgram, "lightSpaceTrMatrix"),
-        1,
-        GL_FALSE,
-        glm::value_ptr(computeLightSpaceTrMatrix()));
+    // 1st step: render the scene to the depth buffer 
 
-    glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-    glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO);
-    glClear(GL_DEPTH_BUFFER_BIT);
+    renderQueue.beginPass(gps::RENDER_PASS_SHADOW, lightPass.view, [lightPass]() {
+        beginShadowPass(lightPass);
+    });
+    lodError = SHADOW_LOD_ERROR;
+    shadowDraws.clear();
+    passDraws = &shadowDraws;
+
+    // casters are kept when their shadow, as long as the shadow map is deep,
+    // can fall inside the camera frustum
+    gps::CullingView cameraFrustum = myCamera.getFrustum(projection);
+    glm::vec3 lightPosition = computeLightPosition();
+    shadowCullStats = gps::BvhCullStats();
+    sceneBvh.cullShadowCasters(gps::makeCullingView(lightSpaceTrMatrix, lightPosition, glm::mat4(1.0f)),
+        cameraFrustum, glm::normalize(myCamera.getCameraTarget() - lightPosition), LIGHT_FAR_PLANE - LIGHT_NEAR_PLANE,
+        visibleObjects, &shadowCullStats);
 
-    // render the bird
     renderBird(depthMapShader);
-   
-    // render the tank
     renderTank(depthMapShader);
-
-    // render trees
     renderTree(depthMapShader);
-
-    // render leaves
     renderLeaves(depthMapShader);
+    renderBackgroundScene(depthMapShader, false);
 
-    // render the scene
-    renderBackgroundScene(depthMapShader);
-   
-
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (indirectDraws) {
+        renderQueue.addIndirect(depthMapShader, shadowDraws);
+    }
 
     // 2nd step: render the scene
 
-    myCustomShader.useShaderProgram();
-
-    // send lightSpace matrix to shader
-    glUniformMatrix4fv(glGetUniformLocation(myCustomShader.shaderProgram, "lightSpaceTrMatrix"), 1, GL_FALSE, glm::value_ptr(computeLightSpaceTrMatrix()));
-
-    // send view matrix to shader
     view = myCamera.getViewMatrix();
-    glUniformMatrix4fv(glGetUniformLocation(myCustomShader.shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
 
     // compute light direction transformation matrix
     lightDirMatrix = glm::mat3(glm::inverseTranspose(view));
 
-    // send lightDir matrix data to shader
-    glUniformMatrix3fv(lightDirMatrixLoc, 1, GL_FALSE, glm::value_ptr(lightDirMatrix));
-
-    glViewport(0, 0,myWindow.getWindowDimensions().width , myWindow.getWindowDimensions().height);
-    myCustomShader.useShaderProgram();
-
-    // bind the depth map
-    glActiveTexture(GL_TEXTURE3);
-    glBindTexture(GL_TEXTURE_2D, depthMapTexture);
-    glUniform1i(glGetUniformLocation(myCustomShader.shaderProgram, "shadowMap"), 3);
-
-    // bind the fog map
-    glUniform1f(glGetUniformLocation(myCustomShader.shaderProgram, "fogDensity"), fogDensity);
-
-    // draw the bird
-    normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
+    gps::PassUniforms cameraPass;
+    cameraPass.view = view;
+    cameraPass.projection = projection;
+    cameraPass.lightDirMatrix = glm::mat4(lightDirMatrix);
+    renderQueue.beginPass(gps::RENDER_PASS_OPAQUE, view, [cameraPass]() {
+        beginCameraPass(cameraPass);
+    });
+    lodError = CAMERA_LOD_ERROR;
+    sceneDraws.clear();
+    passDraws = &sceneDraws;
+
+    cameraCullStats = gps::BvhCullStats();
+    sceneBvh.cull(cameraFrustum, visibleObjects, &cameraCullStats);
+
+    occlusionStats = gps::OcclusionStats();
+    if (occlusionCulling) {
+        occlusionCuller.render(projection * view, myCamera.getCameraPosition(), &occlusionStats);
+        occlusionCuller.cull(sceneBvh, visibleObjects, &occlusionStats);
+    }
 
+    // each model gets the normal matrix of its own model matrix from the queue
     renderBird(myCustomShader);
-
-
-    // draw the tank
-    normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-
     renderTank(myCustomShader);
-
-    // draw the tree
-    normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-
     renderTree(myCustomShader);
-
-    // draw the leaves
-    normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-
     renderLeaves(myCustomShader);
+    renderBackgroundScene(myCustomShader, true);
 
-    // draw the scene
-    normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-
-    renderBackgroundScene(myCustomShader);
-
+    if (indirectDraws) {
+        // the indirect path hands the shader world space normals
+        renderQueue.addIndirect(myCustomShader, sceneDraws);
+    }
 
     // draw a white circle
-    lightShader.useShaderProgram();
-    glUniformMatrix4fv(glGetUniformLocation(lightShader.shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
     model = glm::rotate(glm::mat4(1.0f), glm::radians(lightAngle), glm::vec3(0.0f, 1.0f, 0.0f));
     model = glm::translate(model, lightDir);
-    glUniformMatrix4fv(glGetUniformLocation(lightShader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
-
-    sun.Draw(lightShader);
-
-    mySkyBox.Draw(skyboxShader, view, projection);
-
+    renderQueue.add(lightShader, sun, model, computeLodView(model));
+
+    // keeps the blocks of the camera pass
+    renderQueue.beginPass(gps::RENDER_PASS_BACKGROUND, view, std::function<void()>());
+    renderQueue.addCallback([]() {
+        mySkyBox.Draw(skyboxShader);
+    });
+
+    renderQueueStats = gps::RenderQueueStats();
+    renderQueue.execute(&renderQueueStats);
+
+    gps::GLStateCache& state = gps::GLStateCache::shared();
+    frameUniformStats = gps::Shader::getUniformStats();
+    gps::Shader::resetUniformStats();
+    frameRingStats = uniformRing.getStats();
+    uniformRing.resetStats();
+    frameStateStats = state.getStats();
+    state.resetStats();
 }
 
 void cleanup() {
+    // the global models release their textures after this
+    gps::TextureCache::shared().contextDestroyed();
     myWindow.Delete();
     //cleanup code for your own data
 }
@@ -666,6 +862,13 @@ int main(int argc, const char* argv[]) {
     initFaces();
     initSkyBoxShader();
 
+    // model and skybox images were decoded in the background meanwhile
+    gps::TextureLoader::shared().finish();
+
+    gps::TextureCacheStats textureStats = gps::TextureCache::shared().getStats();
+    std::cout << "Texture cache : " << textureStats.hits << " hits, " << textureStats.misses << " misses, "
+        << textureStats.bytesSaved / (1024 * 1024) << " MB of video memory saved" << std::endl;
+
     glCheckError();
     // application loop
     while (!glfwWindowShouldClose(myWindow.getWindow())) {
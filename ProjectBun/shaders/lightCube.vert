@@ -4,11 +4,26 @@ layout(location=0) in vec3 vPosition;
 layout(location=1) in vec3 vNormal;
 layout(location=2) in vec2 vTexCoords;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// uniform blocks (see gps::UniformRing), the same in every shader
+layout(std140) uniform PassUniforms {
+	mat4 view;
+	mat4 projection;
+	// mat3 in the upper left
+	mat4 lightDirMatrix;
+};
+
+layout(std140) uniform ObjectUniforms {
+	mat4 model;
+	// mat3 in the upper left
+	mat4 normalMatrix;
+};
+
+// vertex packing (see gps::VertexFormat)
+uniform vec3 positionScale;
+uniform vec3 positionOffset;
 
 void main() 
 {
-	gl_Position = projection * view * model * vec4(vPosition, 1.0f);
+	vec3 position = vPosition * positionScale + positionOffset;
+	gl_Position = projection * view * model * vec4(position, 1.0f);
 }
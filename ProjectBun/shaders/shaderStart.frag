@@ -4,20 +4,39 @@ in vec3 normal;
 in vec4 fragPosEye;
 in vec4 fragPosLightSpace;
 in vec2 fragTexCoords;
+in vec4 fragTint;
 
 in vec3 fragPos;
 
 out vec4 fColor;
 
+// uniform blocks (see gps::UniformRing), the same in every shader
+layout(std140) uniform FrameUniforms {
+	mat4 lightSpaceTrMatrix;
+	vec3 lightDir;
+	vec3 lightColor;
+	vec3 lightPos1;
+	float fogDensity;
+	int pointinit;
+};
+
+layout(std140) uniform PassUniforms {
+	mat4 view;
+	mat4 projection;
+	// mat3 in the upper left
+	mat4 lightDirMatrix;
+};
+
+layout(std140) uniform ObjectUniforms {
+	mat4 model;
+	// mat3 in the upper left
+	mat4 normalMatrix;
+};
+
 // fog
 uniform int foginit;
-uniform float fogDensity;
 
 // light
-uniform	mat3 normalMatrix;
-uniform mat3 lightDirMatrix;
-uniform	vec3 lightColor;
-uniform	vec3 lightDir;
 uniform sampler2D diffuseTexture;
 uniform sampler2D specularTexture;
 uniform sampler2D shadowMap;
@@ -30,11 +49,6 @@ float specularStrength = 0.5f;
 float shininess = 64.0f;
 
 // point light
-uniform int pointinit;
-
-uniform vec3 lightPos1;
-
-
 float constant = 1.0f;
 float linear = 0.00225f;
 float quadratic = 0.00375;
@@ -43,18 +57,16 @@ float ambientPoint = 0.5f;
 float specularStrengthPoint = 0.5f;
 float shininessPoint = 32.0f;
 
-uniform mat4 view;
-
 
 vec3 computeLightComponents()
 {		
 	vec3 cameraPosEye = vec3(0.0f);//in eye coordinates, the viewer is situated at the origin
 	
 	//transform normal
-	vec3 normalEye = normalize(normalMatrix * normal);	
+	vec3 normalEye = normalize(mat3(normalMatrix) * normal);	
 	
 	//compute light direction
-	vec3 lightDirN = normalize(lightDirMatrix * lightDir);	
+	vec3 lightDirN = normalize(mat3(lightDirMatrix) * lightDir);	
 
 	//compute view direction 
 	vec3 viewDirN = normalize(cameraPosEye - fragPosEye.xyz);
@@ -80,7 +92,7 @@ vec3 computeLightComponents()
 vec3 computePointLight(vec4 lightPosEye)
 {
 	vec3 cameraPosEye = vec3(0.0f);
-	vec3 normalEye = normalize(normalMatrix * normal);
+	vec3 normalEye = normalize(mat3(normalMatrix) * normal);
 	vec3 lightDirN = normalize(lightPosEye.xyz - fragPosEye.xyz);
 	vec3 viewDirN = normalize(cameraPosEye - fragPosEye.xyz);
 	vec3 ambient = ambientPoint * lightColor;
@@ -135,8 +147,8 @@ void main()
 	float shadow = computeShadow();
 	
 	// modulate with diffuse map
-	ambient *= vec3(texture(diffuseTexture, fragTexCoords)) * 1.2f;
-	diffuse *= vec3(texture(diffuseTexture, fragTexCoords)) ;//* 1.2f;
+	ambient *= vec3(texture(diffuseTexture, fragTexCoords)) * fragTint.rgb * 1.2f;
+	diffuse *= vec3(texture(diffuseTexture, fragTexCoords)) * fragTint.rgb;//* 1.2f;
 	// modulate with specular map
 	specular *= vec3(texture(specularTexture, fragTexCoords)) ;//* 1.2f;
 	
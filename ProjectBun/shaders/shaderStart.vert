@@ -3,26 +3,94 @@
 layout(location=0) in vec3 vPosition;
 layout(location=1) in vec3 vNormal;
 layout(location=2) in vec2 vTexCoords;
+// per instance (see gps::ModelInstance), read only when `instanced` is set
+layout(location=3) in mat4 instanceTransform;
+layout(location=7) in vec4 instanceTint;
+// per draw (see gps::IndirectDrawList), read only when `indirect` is set
+layout(location=8) in uint drawId;
 
 out vec3 normal;
 out vec4 fragPosEye;
 out vec4 fragPosLightSpace;
 out vec2 fragTexCoords;
+out vec4 fragTint;
 
 out vec3 fragPos;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
-uniform mat4 lightSpaceTrMatrix;
+// uniform blocks (see gps::UniformRing), the same in every shader
+layout(std140) uniform FrameUniforms {
+	mat4 lightSpaceTrMatrix;
+	vec3 lightDir;
+	vec3 lightColor;
+	vec3 lightPos1;
+	float fogDensity;
+	int pointinit;
+};
+
+layout(std140) uniform PassUniforms {
+	mat4 view;
+	mat4 projection;
+	// mat3 in the upper left
+	mat4 lightDirMatrix;
+};
+
+layout(std140) uniform ObjectUniforms {
+	mat4 model;
+	// mat3 in the upper left
+	mat4 normalMatrix;
+};
+
+uniform bool instanced;
+uniform bool indirect;
+uniform samplerBuffer drawRecords;
+
+// vertex packing (see gps::VertexFormat), identity for full float vertices
+uniform vec3 positionScale;
+uniform vec3 positionOffset;
+uniform vec2 texCoordScale;
+uniform vec2 texCoordOffset;
+uniform bool octahedralNormals;
+
+vec3 decodeNormal(vec3 n, bool octahedral)
+{
+	if (!octahedral)
+		return n;
+	vec3 v = vec3(n.xy, 1.0f - abs(n.x) - abs(n.y));
+	float t = max(-v.z, 0.0f);
+	v.xy += vec2(v.x >= 0.0f ? -t : t, v.y >= 0.0f ? -t : t);
+	return normalize(v);
+}
 
 void main() 
 {
+	mat4 modelMatrix = model;
+	vec3 position = vPosition * positionScale + positionOffset;
+	vec3 objectNormal = decodeNormal(vNormal, octahedralNormals);
+	fragTexCoords = vTexCoords * texCoordScale + texCoordOffset;
+	fragTint = vec4(1.0f);
+	if (indirect) {
+		// model matrix and vertex decoding of the draw; normals end up in world
+		// space, normalMatrix covers only the view
+		int record = int(drawId) * 7;
+		modelMatrix = mat4(texelFetch(drawRecords, record), texelFetch(drawRecords, record + 1),
+			texelFetch(drawRecords, record + 2), texelFetch(drawRecords, record + 3));
+		vec4 scale = texelFetch(drawRecords, record + 4);
+		vec4 texCoordDecode = texelFetch(drawRecords, record + 6);
+		position = vPosition * scale.xyz + texelFetch(drawRecords, record + 5).xyz;
+		objectNormal = mat3(modelMatrix) * decodeNormal(vNormal, scale.w > 0.5f);
+		fragTexCoords = vTexCoords * texCoordDecode.xy + texCoordDecode.zw;
+	}
+	else if (instanced) {
+		// normalMatrix covers `model`, the instance only rotates and scales uniformly
+		modelMatrix = model * instanceTransform;
+		objectNormal = mat3(instanceTransform) * objectNormal;
+		fragTint = instanceTint;
+	}
+	normal = objectNormal;
+
 	//compute eye space coordinates
-	fragPosEye = view * model * vec4(vPosition, 1.0f);
-	normal = vNormal;
-	fragPos = vec3(model* vec4(vPosition,1.0f));
-	fragTexCoords = vTexCoords;
-	fragPosLightSpace = lightSpaceTrMatrix * model * vec4(vPosition, 1.0f);
-	gl_Position = projection * view * model * vec4(vPosition, 1.0f);
+	fragPosEye = view * modelMatrix * vec4(position, 1.0f);
+	fragPos = vec3(modelMatrix * vec4(position,1.0f));
+	fragPosLightSpace = lightSpaceTrMatrix * modelMatrix * vec4(position, 1.0f);
+	gl_Position = projection * view * modelMatrix * vec4(position, 1.0f);
 }
@@ -1,11 +1,43 @@
 #version 410 core
 
 layout(location=0) in vec3 vPosition;
+// per instance (see gps::ModelInstance), read only when `instanced` is set
+layout(location=3) in mat4 instanceTransform;
+// per draw (see gps::IndirectDrawList), read only when `indirect` is set
+layout(location=8) in uint drawId;
 
-uniform mat4 lightSpaceTrMatrix;
-uniform mat4 model;
+// uniform blocks (see gps::UniformRing), the same in every shader; the
+// pass renders from the light
+layout(std140) uniform PassUniforms {
+    mat4 view;
+    mat4 projection;
+    // mat3 in the upper left
+    mat4 lightDirMatrix;
+};
+
+layout(std140) uniform ObjectUniforms {
+    mat4 model;
+    // mat3 in the upper left
+    mat4 normalMatrix;
+};
+
+uniform bool instanced;
+uniform bool indirect;
+uniform samplerBuffer drawRecords;
+
+// vertex packing (see gps::VertexFormat)
+uniform vec3 positionScale;
+uniform vec3 positionOffset;
 
 void main()
 {
-    gl_Position = lightSpaceTrMatrix * model * vec4(vPosition, 1.0f);
+    vec3 position = vPosition * positionScale + positionOffset;
+    mat4 modelMatrix = instanced ? model * instanceTransform : model;
+    if (indirect) {
+        int record = int(drawId) * 7;
+        modelMatrix = mat4(texelFetch(drawRecords, record), texelFetch(drawRecords, record + 1),
+            texelFetch(drawRecords, record + 2), texelFetch(drawRecords, record + 3));
+        position = vPosition * texelFetch(drawRecords, record + 4).xyz + texelFetch(drawRecords, record + 5).xyz;
+    }
+    gl_Position = projection * view * modelMatrix * vec4(position, 1.0f);
 }
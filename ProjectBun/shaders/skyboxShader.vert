@@ -3,13 +3,18 @@
 layout (location = 0) in vec3 vertexPosition;
 out vec3 textureCoordinates;
 
-uniform mat4 projection;
-uniform mat4 view;
-uniform mat4 model;
+// uniform blocks (see gps::UniformRing), the same in every shader
+layout(std140) uniform PassUniforms {
+    mat4 view;
+    mat4 projection;
+    // mat3 in the upper left
+    mat4 lightDirMatrix;
+};
 
 void main()
 {
-    vec4 tempPos = projection * view * vec4(vertexPosition, 1.0);
+    // the sky stays around the camera, only the rotation of the view applies
+    vec4 tempPos = projection * mat4(mat3(view)) * vec4(vertexPosition, 1.0);
     gl_Position = tempPos.xyww;
     textureCoordinates = vertexPosition;
 }
@@ -23,6 +23,8 @@
  */
 
 //
+// local : SIMD line/token scanning and exact fast float parsing
+// local : LoadObjParallel() - multi-threaded parsing of an in-memory .obj
 // version 1.0.2 : Improve parsing speed by about a factor of 2 for large files(#105)
 // version 1.0.1 : Fixes a shape is lost if obj ends with a 'usemtl'(#104)
 // version 1.0.0 : Change data structure. Change license from BSD to MIT.
@@ -208,6 +210,18 @@ namespace tinyobj {
                  const char *filename, const char *mtl_basepath = NULL,
                  bool triangulate = true);
     
+    /// Loads .obj from an in-memory buffer (e.g. a memory-mapped file) using
+    /// `num_threads` threads (0 = one per hardware thread).
+    /// The buffer is split into chunks at line boundaries, `v`/`vn`/`vt`/`f`
+    /// lines are tokenized concurrently and the per-chunk results are stitched
+    /// together with prefix-summed index offsets, so the output is identical to
+    /// the `std::istream` based LoadObj().
+    bool LoadObjParallel(attrib_t *attrib, std::vector<shape_t> *shapes,
+                         std::vector<material_t> *materials, std::string *err,
+                         const char *buf, size_t len,
+                         MaterialReader *readMatFn = NULL,
+                         bool triangulate = true, unsigned int num_threads = 0);
+    
     /// Loads .obj from a file with custom user callback.
     /// .mtl is loaded as usual and parsed material_t data will be passed to
     /// `callback.mtllib_cb`.
@@ -235,6 +249,8 @@ namespace tinyobj {
 }  // namespace tinyobj
 
 #ifdef TINYOBJLOADER_IMPLEMENTATION
+#include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cctype>
 #include <cmath>
@@ -245,6 +261,20 @@ namespace tinyobj {
 
 #include <fstream>
 #include <sstream>
+#include <thread>
+
+#if defined(__AVX2__)
+#define TINYOBJ_USE_AVX2
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TINYOBJ_USE_SSE2
+#endif
+#if defined(TINYOBJ_USE_AVX2) || defined(TINYOBJ_USE_SSE2)
+#include <immintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 namespace tinyobj {
     
@@ -310,6 +340,53 @@ namespace tinyobj {
 (static_cast<unsigned int>((x) - '0') < static_cast<unsigned int>(10))
 #define IS_NEW_LINE(x) (((x) == '\r') || ((x) == '\n') || ((x) == '\0'))
     
+    static inline unsigned int countTrailingZeros(unsigned int mask) {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanForward(&index, mask);
+        return static_cast<unsigned int>(index);
+#else
+        return static_cast<unsigned int>(__builtin_ctz(mask));
+#endif
+    }
+    
+    // Vectorized search for the first of three characters, used to find line
+    // and token ends. SSE2 is part of every x64 target; AVX2 is used when the
+    // compiler is allowed to emit it (/arch:AVX2, -mavx2).
+    static inline const char *findFirstOf(const char *p, const char *end, char c0,
+                                          char c1, char c2) {
+#if defined(TINYOBJ_USE_AVX2)
+        const __m256i v0 = _mm256_set1_epi8(c0);
+        const __m256i v1 = _mm256_set1_epi8(c1);
+        const __m256i v2 = _mm256_set1_epi8(c2);
+        while (end - p >= 32) {
+            __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+            __m256i hit = _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(chunk, v0), _mm256_cmpeq_epi8(chunk, v1)),
+                _mm256_cmpeq_epi8(chunk, v2));
+            unsigned int mask = static_cast<unsigned int>(_mm256_movemask_epi8(hit));
+            if (mask) return p + countTrailingZeros(mask);
+            p += 32;
+        }
+#endif
+#if defined(TINYOBJ_USE_SSE2)
+        const __m128i w0 = _mm_set1_epi8(c0);
+        const __m128i w1 = _mm_set1_epi8(c1);
+        const __m128i w2 = _mm_set1_epi8(c2);
+        while (end - p >= 16) {
+            __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+            __m128i hit = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(chunk, w0), _mm_cmpeq_epi8(chunk, w1)),
+                _mm_cmpeq_epi8(chunk, w2));
+            unsigned int mask = static_cast<unsigned int>(_mm_movemask_epi8(hit));
+            if (mask) return p + countTrailingZeros(mask);
+            p += 16;
+        }
+#endif
+        while (p < end && *p != c0 && *p != c1 && *p != c2) p++;
+        return p;
+    }
+    
     // Make index zero-base, and also support relative index.
     static inline int fixIndex(int idx, int n) {
         if (idx > 0) return idx - 1;
@@ -349,144 +426,142 @@ namespace tinyobj {
     //  Valid strings are for example:
     //   -0  +3.1417e+2  -0.0E-3  1.0324  -1.41   11e2
     //
-    // If the parsing is a success, result is set to the parsed value and true
-    // is returned.
+    // If the parsing is a success, result is set to the correctly rounded
+    // float and true is returned; *s_parsed (optional) receives the first
+    // character that was not consumed.
     //
-    // The function is greedy and will parse until any of the following happens:
-    //  - a non-conforming character is encountered.
-    //  - s_end is reached.
+    // The decimal digits are collected into a 64-bit integer mantissa and a
+    // power of ten. When both are small enough the value is produced by a
+    // single IEEE multiplication or division of exactly representable
+    // operands (Clinger's fast path), which is exact. Anything else - long
+    // mantissas, large exponents, or a double result that falls on a float
+    // rounding midpoint - is handed to strtof.
     //
     // The following situations triggers a failure:
     //  - s >= s_end.
     //  - parse failure.
     //
-    static bool tryParseDouble(const char *s, const char *s_end, double *result) {
+    static bool tryParseFloat(const char *s, const char *s_end, float *result,
+                              const char **s_parsed = NULL) {
+        static const float float_pow10[] = {1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f,
+                                            1e6f, 1e7f, 1e8f, 1e9f, 1e10f};
+        static const double double_pow10[] = {
+            1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+            1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+        
+        const char *curr = s;
+        bool negative = false;
+        unsigned long long mantissa = 0;
+        int significant = 0;     // digits that went into `mantissa`
+        int exponent = 0;        // decimal exponent applied to `mantissa`
+        bool truncated = false;  // more than 19 significant digits
+        
         if (s >= s_end) {
             return false;
         }
         
-        double mantissa = 0.0;
-        // This exponent is base 2 rather than 10.
-        // However the exponent we parse is supposed to be one of ten,
-        // thus we must take care to convert the exponent/and or the
-        // mantissa to a * 2^E, where a is the mantissa and E is the
-        // exponent.
-        // To get the final double we will use ldexp, it requires the
-        // exponent to be in base 2.
-        int exponent = 0;
-        
-        // NOTE: THESE MUST BE DECLARED HERE SINCE WE ARE NOT ALLOWED
-        // TO JUMP OVER DEFINITIONS.
-        char sign = '+';
-        char exp_sign = '+';
-        char const *curr = s;
-        
-        // How many characters were read in a loop.
-        int read = 0;
-        // Tells whether a loop terminated due to reaching s_end.
-        bool end_not_reached = false;
-        
-        /*
-         BEGIN PARSING.
-         */
-        
-        // Find out what sign we've got.
         if (*curr == '+' || *curr == '-') {
-            sign = *curr;
+            negative = (*curr == '-');
             curr++;
-        } else if (IS_DIGIT(*curr)) { /* Pass through. */
-        } else {
-            goto fail;
         }
         
-        // Read the integer part.
-        end_not_reached = (curr != s_end);
-        while (end_not_reached && IS_DIGIT(*curr)) {
-            mantissa *= 10;
-            mantissa += static_cast<int>(*curr - 0x30);
+        // Read the integer part; at least one digit is required.
+        const char *int_begin = curr;
+        while (curr != s_end && IS_DIGIT(*curr)) {
+            if (significant < 19) {
+                mantissa = mantissa * 10 + static_cast<unsigned int>(*curr - '0');
+                if (mantissa) significant++;
+            } else {
+                exponent++;
+                truncated = true;
+            }
             curr++;
-            read++;
-            end_not_reached = (curr != s_end);
         }
-        
-        // We must make sure we actually got something.
-        if (read == 0) goto fail;
-        // We allow numbers of form "#", "###" etc.
-        if (!end_not_reached) goto assemble;
+        if (curr == int_begin) return false;
         
         // Read the decimal part.
-        if (*curr == '.') {
+        if (curr != s_end && *curr == '.') {
             curr++;
-            read = 1;
-            end_not_reached = (curr != s_end);
-            while (end_not_reached && IS_DIGIT(*curr)) {
-                static const double pow_lut[] = {
-                    1.0,
-                    0.1,
-                    0.01,
-                    0.001,
-                    0.0001,
-                    0.00001,
-                    0.000001,
-                    0.0000001,
-                };
-                const int lut_entries = sizeof pow_lut / sizeof pow_lut[0];
-                
-                // NOTE: Don't use powf here, it will absolutely murder precision.
-                mantissa += static_cast<int>(*curr - 0x30) *
-                (read < lut_entries ? pow_lut[read] : pow(10.0, -read));
-                read++;
+            while (curr != s_end && IS_DIGIT(*curr)) {
+                if (significant < 19) {
+                    mantissa = mantissa * 10 + static_cast<unsigned int>(*curr - '0');
+                    if (mantissa) significant++;
+                    exponent--;
+                } else {
+                    truncated = true;
+                }
                 curr++;
-                end_not_reached = (curr != s_end);
             }
-        } else if (*curr == 'e' || *curr == 'E') {
-        } else {
-            goto assemble;
         }
         
-        if (!end_not_reached) goto assemble;
-        
         // Read the exponent part.
-        if (*curr == 'e' || *curr == 'E') {
+        if (curr != s_end && (*curr == 'e' || *curr == 'E')) {
             curr++;
-            // Figure out if a sign is present and if it is.
-            end_not_reached = (curr != s_end);
-            if (end_not_reached && (*curr == '+' || *curr == '-')) {
-                exp_sign = *curr;
+            bool exp_negative = false;
+            if (curr != s_end && (*curr == '+' || *curr == '-')) {
+                exp_negative = (*curr == '-');
                 curr++;
-            } else if (IS_DIGIT(*curr)) { /* Pass through. */
-            } else {
-                // Empty E is not allowed.
-                goto fail;
             }
-            
-            read = 0;
-            end_not_reached = (curr != s_end);
-            while (end_not_reached && IS_DIGIT(*curr)) {
-                exponent *= 10;
-                exponent += static_cast<int>(*curr - 0x30);
+            const char *exp_begin = curr;
+            int exp_value = 0;
+            while (curr != s_end && IS_DIGIT(*curr)) {
+                if (exp_value < 100000) {
+                    exp_value = exp_value * 10 + (*curr - '0');
+                }
                 curr++;
-                read++;
-                end_not_reached = (curr != s_end);
             }
-            exponent *= (exp_sign == '+' ? 1 : -1);
-            if (read == 0) goto fail;
+            // Empty E is not allowed.
+            if (curr == exp_begin) return false;
+            exponent += exp_negative ? -exp_value : exp_value;
         }
         
-    assemble:
-        *result = (sign == '+' ? 1 : -1) *
-        (exponent ? ldexp(mantissa * pow(5.0, exponent), exponent) : mantissa);
+        if (s_parsed) (*s_parsed) = curr;
+        
+        float value;
+        if (mantissa == 0 && !truncated) {
+            value = 0.0f;
+        } else if (!truncated && mantissa <= (1ull << 24) && exponent >= -10 &&
+                   exponent <= 10) {
+            value = static_cast<float>(mantissa);
+            value = exponent < 0 ? value / float_pow10[-exponent]
+                                 : value * float_pow10[exponent];
+        } else {
+            bool done = false;
+            if (!truncated && mantissa <= (1ull << 53) && exponent >= -22 &&
+                exponent <= 22) {
+                double d = static_cast<double>(mantissa);
+                d = exponent < 0 ? d / double_pow10[-exponent]
+                                 : d * double_pow10[exponent];
+                // Narrowing a correctly rounded double is only exact when the
+                // double does not sit on a midpoint between two floats.
+                unsigned long long bits;
+                memcpy(&bits, &d, sizeof(bits));
+                if ((bits & 0x1fffffffull) != 0x10000000ull) {
+                    value = static_cast<float>(d);
+                    done = true;
+                }
+            }
+            if (!done) {
+                char buf[TINYOBJ_SSCANF_BUFFER_SIZE];
+                size_t n = static_cast<size_t>(curr - s);
+                if (n >= sizeof(buf)) n = sizeof(buf) - 1;
+                memcpy(buf, s, n);
+                buf[n] = '\0';
+                value = strtof(buf, NULL);
+                *result = value;
+                return true;
+            }
+        }
+        
+        *result = negative ? -value : value;
         return true;
-    fail:
-        return false;
     }
     
     static inline float parseFloat(const char **token, double default_value = 0.0) {
         (*token) += strspn((*token), " \t");
         const char *end = (*token) + strcspn((*token), " \t\r");
-        double val = default_value;
-        tryParseDouble((*token), end, &val);
-        float f = static_cast<float>(val);
+        float f = static_cast<float>(default_value);
+        tryParseFloat((*token), end, &f);
         (*token) = end;
         return f;
     }
@@ -1377,6 +1452,568 @@ namespace tinyobj {
         return true;
     }
     
+    // Parallel loader: per-chunk tokenizer output.
+    // Face corner indices are resolved to absolute values where possible; a
+    // negative (relative) OBJ index is stored relative to the start of the
+    // chunk and flagged, since the element counts of earlier chunks are only
+    // known once every chunk has been tokenized.
+    enum {
+        CHUNK_REL_V = 1,
+        CHUNK_REL_VT = 2,
+        CHUNK_REL_VN = 4
+    };
+    
+    struct chunk_directive {
+        size_t face_pos;   // number of faces of the chunk preceding this line
+        std::string line;  // usemtl, mtllib, g, o and t lines are replayed in order
+    };
+    
+    struct obj_chunk {
+        const char *begin;
+        const char *end;
+        std::vector<float> v;
+        std::vector<float> vn;
+        std::vector<float> vt;
+        std::vector<vertex_index> corners;
+        std::vector<unsigned char> corner_flags;
+        std::vector<int> face_sizes;
+        std::vector<chunk_directive> directives;
+        size_t v_base, vn_base, vt_base;
+    };
+    
+    static inline int fixChunkIndex(int idx, int local_count, unsigned char *flags,
+                                    unsigned char rel_flag) {
+        if (idx > 0) return idx - 1;
+        if (idx == 0) return 0;
+        (*flags) |= rel_flag;
+        return local_count + idx;
+    }
+    
+    // Bounded scanning helpers for the chunk tokenizer: they work directly on
+    // the mapped buffer, so lines are neither copied nor NUL-terminated.
+    static inline const char *skipSpaces(const char *p, const char *end) {
+        while (p < end && IS_SPACE(*p)) p++;
+        return p;
+    }
+    
+    // First ' ', '\t' or '\r' in [p, end) - same set as strcspn(" \t\r").
+    static inline const char *findTokenEnd(const char *p, const char *end) {
+        return findFirstOf(p, end, ' ', '\t', '\r');
+    }
+    
+    // First '/', ' ', '\t' or '\r' in [p, end).
+    static inline const char *findTripleEnd(const char *p, const char *end) {
+        while (p < end && *p != '/' && !IS_SPACE(*p) && *p != '\r') p++;
+        return p;
+    }
+    
+    // atoi() on a bounded range.
+    static inline int parseIntBounded(const char *p, const char *end) {
+        bool negative = false;
+        if (p < end && (*p == '+' || *p == '-')) {
+            negative = (*p == '-');
+            p++;
+        }
+        int value = 0;
+        while (p < end && IS_DIGIT(*p)) {
+            value = value * 10 + (*p - '0');
+            p++;
+        }
+        return negative ? -value : value;
+    }
+    
+    static inline float parseFloatBounded(const char **token, const char *end,
+                                          float default_value = 0.0f) {
+        (*token) = skipSpaces((*token), end);
+        const char *token_end = findTokenEnd((*token), end);
+        float f = default_value;
+        tryParseFloat((*token), token_end, &f);
+        (*token) = token_end;
+        return f;
+    }
+    
+    // parseTriple() counterpart that records which indices are chunk relative.
+    static vertex_index parseChunkTriple(const char **token, const char *end,
+                                         int vsize, int vnsize, int vtsize,
+                                         unsigned char *flags) {
+        vertex_index vi(-1);
+        
+        const char *e = findTripleEnd((*token), end);
+        vi.v_idx = fixChunkIndex(parseIntBounded((*token), e), vsize, flags, CHUNK_REL_V);
+        (*token) = e;
+        if ((*token) == end || (*token)[0] != '/') {
+            return vi;
+        }
+        (*token)++;
+        
+        // i//k
+        if ((*token) < end && (*token)[0] == '/') {
+            (*token)++;
+            e = findTripleEnd((*token), end);
+            vi.vn_idx = fixChunkIndex(parseIntBounded((*token), e), vnsize, flags, CHUNK_REL_VN);
+            (*token) = e;
+            return vi;
+        }
+        
+        // i/j/k or i/j
+        e = findTripleEnd((*token), end);
+        vi.vt_idx = fixChunkIndex(parseIntBounded((*token), e), vtsize, flags, CHUNK_REL_VT);
+        (*token) = e;
+        if ((*token) == end || (*token)[0] != '/') {
+            return vi;
+        }
+        
+        // i/j/k
+        (*token)++;  // skip '/'
+        e = findTripleEnd((*token), end);
+        vi.vn_idx = fixChunkIndex(parseIntBounded((*token), e), vnsize, flags, CHUNK_REL_VN);
+        (*token) = e;
+        return vi;
+    }
+    
+    static void tokenizeChunk(obj_chunk *chunk) {
+        const char *p = chunk->begin;
+        
+        while (p < chunk->end) {
+            const char *line_end = findFirstOf(p, chunk->end, '\n', '\r', '\n');
+            const char *token = skipSpaces(p, line_end);
+            p = line_end + 1;
+            
+            if (token == line_end) continue;  // empty line
+            
+            if (token[0] == '#') continue;  // comment line
+            
+            size_t avail = static_cast<size_t>(line_end - token);
+            
+            // vertex
+            if (token[0] == 'v' && avail > 1 && IS_SPACE((token[1]))) {
+                token += 2;
+                float x = parseFloatBounded(&token, line_end);
+                float y = parseFloatBounded(&token, line_end);
+                float z = parseFloatBounded(&token, line_end);
+                chunk->v.push_back(x);
+                chunk->v.push_back(y);
+                chunk->v.push_back(z);
+                continue;
+            }
+            
+            // normal
+            if (token[0] == 'v' && avail > 2 && token[1] == 'n' && IS_SPACE((token[2]))) {
+                token += 3;
+                float x = parseFloatBounded(&token, line_end);
+                float y = parseFloatBounded(&token, line_end);
+                float z = parseFloatBounded(&token, line_end);
+                chunk->vn.push_back(x);
+                chunk->vn.push_back(y);
+                chunk->vn.push_back(z);
+                continue;
+            }
+            
+            // texcoord
+            if (token[0] == 'v' && avail > 2 && token[1] == 't' && IS_SPACE((token[2]))) {
+                token += 3;
+                float x = parseFloatBounded(&token, line_end);
+                float y = parseFloatBounded(&token, line_end);
+                chunk->vt.push_back(x);
+                chunk->vt.push_back(y);
+                continue;
+            }
+            
+            // face
+            if (token[0] == 'f' && avail > 1 && IS_SPACE((token[1]))) {
+                token += 2;
+                token = skipSpaces(token, line_end);
+                
+                int v_count = static_cast<int>(chunk->v.size() / 3);
+                int vn_count = static_cast<int>(chunk->vn.size() / 3);
+                int vt_count = static_cast<int>(chunk->vt.size() / 2);
+                
+                int num_corners = 0;
+                while (token < line_end) {
+                    unsigned char flags = 0;
+                    vertex_index vi = parseChunkTriple(&token, line_end, v_count,
+                                                       vn_count, vt_count, &flags);
+                    
+                    chunk->corners.push_back(vi);
+                    chunk->corner_flags.push_back(flags);
+                    num_corners++;
+                    token = skipSpaces(token, line_end);
+                }
+                
+                if (num_corners > 0) {
+                    chunk->face_sizes.push_back(num_corners);
+                }
+                continue;
+            }
+            
+            std::string linebuf(token, line_end);
+            const char *line = linebuf.c_str();
+            if (((0 == strncmp(line, "usemtl", 6)) && IS_SPACE((line[6]))) ||
+                ((0 == strncmp(line, "mtllib", 6)) && IS_SPACE((line[6]))) ||
+                (line[0] == 'g' && IS_SPACE((line[1]))) ||
+                (line[0] == 'o' && IS_SPACE((line[1]))) ||
+                (line[0] == 't' && IS_SPACE((line[1])))) {
+                chunk_directive directive;
+                directive.face_pos = chunk->face_sizes.size();
+                directive.line.swap(linebuf);
+                chunk->directives.push_back(directive);
+            }
+            
+            // Ignore unknown command.
+        }
+    }
+    
+    static void resolveChunkIndices(obj_chunk *chunk) {
+        const int v_base = static_cast<int>(chunk->v_base);
+        const int vn_base = static_cast<int>(chunk->vn_base);
+        const int vt_base = static_cast<int>(chunk->vt_base);
+        
+        for (size_t i = 0; i < chunk->corners.size(); i++) {
+            unsigned char flags = chunk->corner_flags[i];
+            if (!flags) continue;
+            vertex_index &vi = chunk->corners[i];
+            if (flags & CHUNK_REL_V) vi.v_idx += v_base;
+            if (flags & CHUNK_REL_VT) vi.vt_idx += vt_base;
+            if (flags & CHUNK_REL_VN) vi.vn_idx += vn_base;
+        }
+    }
+    
+    // Same as exportFaceGroupToShape(), for faces stored back to back in `corners`.
+    static bool exportFlatFaceGroupToShape(
+                                           shape_t *shape, const std::vector<vertex_index> &corners,
+                                           const std::vector<int> &face_sizes,
+                                           const std::vector<tag_t> &tags, const int material_id,
+                                           const std::string &name, bool triangulate) {
+        if (face_sizes.empty()) {
+            return false;
+        }
+        
+        size_t offset = 0;
+        for (size_t i = 0; i < face_sizes.size(); i++) {
+            const vertex_index *face = &corners[offset];
+            size_t npolys = static_cast<size_t>(face_sizes[i]);
+            offset += npolys;
+            
+            if (triangulate) {
+                // Polygon -> triangle fan conversion
+                for (size_t k = 2; k < npolys; k++) {
+                    const vertex_index &i0 = face[0];
+                    const vertex_index &i1 = face[k - 1];
+                    const vertex_index &i2 = face[k];
+                    
+                    index_t idx0, idx1, idx2;
+                    idx0.vertex_index = i0.v_idx;
+                    idx0.normal_index = i0.vn_idx;
+                    idx0.texcoord_index = i0.vt_idx;
+                    idx1.vertex_index = i1.v_idx;
+                    idx1.normal_index = i1.vn_idx;
+                    idx1.texcoord_index = i1.vt_idx;
+                    idx2.vertex_index = i2.v_idx;
+                    idx2.normal_index = i2.vn_idx;
+                    idx2.texcoord_index = i2.vt_idx;
+                    
+                    shape->mesh.indices.push_back(idx0);
+                    shape->mesh.indices.push_back(idx1);
+                    shape->mesh.indices.push_back(idx2);
+                    
+                    shape->mesh.num_face_vertices.push_back(3);
+                    shape->mesh.material_ids.push_back(material_id);
+                }
+            } else {
+                for (size_t k = 0; k < npolys; k++) {
+                    index_t idx;
+                    idx.vertex_index = face[k].v_idx;
+                    idx.normal_index = face[k].vn_idx;
+                    idx.texcoord_index = face[k].vt_idx;
+                    shape->mesh.indices.push_back(idx);
+                }
+                
+                shape->mesh.num_face_vertices.push_back(
+                                                        static_cast<unsigned char>(npolys));
+                shape->mesh.material_ids.push_back(material_id);  // per face
+            }
+        }
+        
+        shape->name = name;
+        shape->mesh.tags = tags;
+        
+        return true;
+    }
+    
+    // Sequential state of the stitching pass, mirrors the locals of LoadObj().
+    struct stitch_state {
+        std::vector<vertex_index> corners;
+        std::vector<int> face_sizes;
+        std::vector<tag_t> tags;
+        std::string name;
+        std::map<std::string, int> material_map;
+        int material;
+        shape_t shape;
+        
+        stitch_state() : material(-1) {}
+        
+        bool flush(bool triangulate) {
+            bool ret = exportFlatFaceGroupToShape(&shape, corners, face_sizes, tags,
+                                                  material, name, triangulate);
+            corners.clear();
+            face_sizes.clear();
+            return ret;
+        }
+    };
+    
+    static bool replayDirective(const char *token, stitch_state *state,
+                                std::vector<shape_t> *shapes,
+                                std::vector<material_t> *materials,
+                                MaterialReader *readMatFn, std::string *err,
+                                bool triangulate) {
+        // use mtl
+        if ((0 == strncmp(token, "usemtl", 6)) && IS_SPACE((token[6]))) {
+            char namebuf[TINYOBJ_SSCANF_BUFFER_SIZE];
+            token += 7;
+#ifdef _MSC_VER
+            sscanf_s(token, "%s", namebuf, (unsigned)_countof(namebuf));
+#else
+            sscanf(token, "%s", namebuf);
+#endif
+            
+            int newMaterialId = -1;
+            if (state->material_map.find(namebuf) != state->material_map.end()) {
+                newMaterialId = state->material_map[namebuf];
+            }
+            
+            if (newMaterialId != state->material) {
+                state->flush(triangulate);
+                state->material = newMaterialId;
+            }
+            return true;
+        }
+        
+        // load mtl
+        if ((0 == strncmp(token, "mtllib", 6)) && IS_SPACE((token[6]))) {
+            if (readMatFn) {
+                char namebuf[TINYOBJ_SSCANF_BUFFER_SIZE];
+                token += 7;
+#ifdef _MSC_VER
+                sscanf_s(token, "%s", namebuf, (unsigned)_countof(namebuf));
+#else
+                sscanf(token, "%s", namebuf);
+#endif
+                
+                std::string err_mtl;
+                bool ok = (*readMatFn)(namebuf, materials, &state->material_map, &err_mtl);
+                if (err) {
+                    (*err) += err_mtl;
+                }
+                
+                if (!ok) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        
+        // group name
+        if (token[0] == 'g' && IS_SPACE((token[1]))) {
+            if (state->flush(triangulate)) {
+                shapes->push_back(state->shape);
+            }
+            state->shape = shape_t();
+            
+            std::vector<std::string> names;
+            names.reserve(2);
+            
+            while (!IS_NEW_LINE(token[0])) {
+                std::string str = parseString(&token);
+                names.push_back(str);
+                token += strspn(token, " \t\r");  // skip tag
+            }
+            
+            // names[0] must be 'g', so skip the 0th element.
+            if (names.size() > 1) {
+                state->name = names[1];
+            } else {
+                state->name = "";
+            }
+            return true;
+        }
+        
+        // object name
+        if (token[0] == 'o' && IS_SPACE((token[1]))) {
+            if (state->flush(triangulate)) {
+                shapes->push_back(state->shape);
+            }
+            state->shape = shape_t();
+            
+            char namebuf[TINYOBJ_SSCANF_BUFFER_SIZE];
+            token += 2;
+#ifdef _MSC_VER
+            sscanf_s(token, "%s", namebuf, (unsigned)_countof(namebuf));
+#else
+            sscanf(token, "%s", namebuf);
+#endif
+            state->name = std::string(namebuf);
+            return true;
+        }
+        
+        if (token[0] == 't' && IS_SPACE(token[1])) {
+            tag_t tag;
+            
+            char namebuf[4096];
+            token += 2;
+#ifdef _MSC_VER
+            sscanf_s(token, "%s", namebuf, (unsigned)_countof(namebuf));
+#else
+            sscanf(token, "%s", namebuf);
+#endif
+            tag.name = std::string(namebuf);
+            
+            token += tag.name.size() + 1;
+            
+            tag_sizes ts = parseTagTriple(&token);
+            
+            tag.intValues.resize(static_cast<size_t>(ts.num_ints));
+            for (size_t i = 0; i < static_cast<size_t>(ts.num_ints); ++i) {
+                tag.intValues[i] = atoi(token);
+                token += strcspn(token, "/ \t\r") + 1;
+            }
+            
+            tag.floatValues.resize(static_cast<size_t>(ts.num_floats));
+            for (size_t i = 0; i < static_cast<size_t>(ts.num_floats); ++i) {
+                tag.floatValues[i] = parseFloat(&token);
+                token += strcspn(token, "/ \t\r") + 1;
+            }
+            
+            tag.stringValues.resize(static_cast<size_t>(ts.num_strings));
+            for (size_t i = 0; i < static_cast<size_t>(ts.num_strings); ++i) {
+                char stringValueBuffer[4096];
+                
+#ifdef _MSC_VER
+                sscanf_s(token, "%s", stringValueBuffer,
+                         (unsigned)_countof(stringValueBuffer));
+#else
+                sscanf(token, "%s", stringValueBuffer);
+#endif
+                tag.stringValues[i] = stringValueBuffer;
+                token += tag.stringValues[i].size() + 1;
+            }
+            
+            state->tags.push_back(tag);
+        }
+        return true;
+    }
+    
+    static void appendChunkFaces(stitch_state *state, const obj_chunk &chunk,
+                                 size_t *face, size_t *corner, size_t face_end) {
+        for (; *face < face_end; (*face)++) {
+            int n = chunk.face_sizes[*face];
+            state->corners.insert(state->corners.end(), chunk.corners.begin() + *corner,
+                                  chunk.corners.begin() + *corner + n);
+            state->face_sizes.push_back(n);
+            (*corner) += static_cast<size_t>(n);
+        }
+    }
+    
+    bool LoadObjParallel(attrib_t *attrib, std::vector<shape_t> *shapes,
+                         std::vector<material_t> *materials, std::string *err,
+                         const char *buf, size_t len,
+                         MaterialReader *readMatFn /*= NULL*/,
+                         bool triangulate, unsigned int num_threads) {
+        attrib->vertices.clear();
+        attrib->normals.clear();
+        attrib->texcoords.clear();
+        shapes->clear();
+        
+        if (num_threads == 0) {
+            num_threads = std::thread::hardware_concurrency();
+        }
+        if (num_threads == 0) {
+            num_threads = 1;
+        }
+        
+        // Split at line boundaries; small files are not worth a thread each.
+        const size_t min_chunk_size = 64 * 1024;
+        size_t num_chunks = std::min(static_cast<size_t>(num_threads) * 4,
+                                     len / min_chunk_size + 1);
+        
+        std::vector<obj_chunk> chunks(num_chunks);
+        const char *data_end = buf + len;
+        const char *p = buf;
+        for (size_t i = 0; i < num_chunks; i++) {
+            const char *e = (i + 1 == num_chunks) ? data_end : buf + (len * (i + 1)) / num_chunks;
+            if (e < p) e = p;
+            while (e < data_end && *e != '\n') e++;
+            if (e < data_end) e++;
+            chunks[i].begin = p;
+            chunks[i].end = e;
+            p = e;
+        }
+        
+        // Tokenize chunks concurrently; workers pull the next chunk index.
+        std::atomic<size_t> next_chunk(0);
+        std::vector<std::thread> workers;
+        size_t num_workers = std::min(static_cast<size_t>(num_threads), num_chunks);
+        for (size_t t = 1; t < num_workers; t++) {
+            workers.push_back(std::thread([&chunks, &next_chunk]() {
+                size_t i;
+                while ((i = next_chunk++) < chunks.size()) tokenizeChunk(&chunks[i]);
+            }));
+        }
+        {
+            size_t i;
+            while ((i = next_chunk++) < chunks.size()) tokenizeChunk(&chunks[i]);
+        }
+        for (size_t t = 0; t < workers.size(); t++) workers[t].join();
+        workers.clear();
+        
+        // Prefix sums of the element counts give every chunk its global base.
+        size_t v_total = 0, vn_total = 0, vt_total = 0;
+        for (size_t i = 0; i < num_chunks; i++) {
+            chunks[i].v_base = v_total / 3;
+            chunks[i].vn_base = vn_total / 3;
+            chunks[i].vt_base = vt_total / 2;
+            v_total += chunks[i].v.size();
+            vn_total += chunks[i].vn.size();
+            vt_total += chunks[i].vt.size();
+        }
+        
+        attrib->vertices.reserve(v_total);
+        attrib->normals.reserve(vn_total);
+        attrib->texcoords.reserve(vt_total);
+        for (size_t i = 0; i < num_chunks; i++) {
+            resolveChunkIndices(&chunks[i]);
+            attrib->vertices.insert(attrib->vertices.end(), chunks[i].v.begin(), chunks[i].v.end());
+            attrib->normals.insert(attrib->normals.end(), chunks[i].vn.begin(), chunks[i].vn.end());
+            attrib->texcoords.insert(attrib->texcoords.end(), chunks[i].vt.begin(), chunks[i].vt.end());
+            std::vector<float>().swap(chunks[i].v);
+            std::vector<float>().swap(chunks[i].vn);
+            std::vector<float>().swap(chunks[i].vt);
+        }
+        
+        // Replay faces and state changing lines in file order.
+        stitch_state state;
+        for (size_t i = 0; i < num_chunks; i++) {
+            const obj_chunk &chunk = chunks[i];
+            size_t face = 0, corner = 0;
+            for (size_t d = 0; d < chunk.directives.size(); d++) {
+                appendChunkFaces(&state, chunk, &face, &corner, chunk.directives[d].face_pos);
+                if (!replayDirective(chunk.directives[d].line.c_str(), &state, shapes,
+                                     materials, readMatFn, err, triangulate)) {
+                    return false;
+                }
+            }
+            appendChunkFaces(&state, chunk, &face, &corner, chunk.face_sizes.size());
+        }
+        
+        bool ret = state.flush(triangulate);
+        // we also add `shape` to `shapes` when `shape.mesh` has already some
+        // faces(indices)
+        if (ret || state.shape.mesh.indices.size()) {
+            shapes->push_back(state.shape);
+        }
+        
+        return true;
+    }
+    
     bool LoadObjWithCallback(std::istream &inStream, const callback_t &callback,
                              void *user_data /*= NULL*/,
                              MaterialReader *readMatFn /*= NULL*/,